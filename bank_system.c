@@ -3,22 +3,60 @@
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
 
 #include <math.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_X86_DISPATCH 1
+#include <cpuid.h>
+#else
+#define SHA256_X86_DISPATCH 0
+#endif
+
+#if defined(__AVX2__) || defined(__SSE4_1__) || defined(__SSE2__) || SHA256_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 
 #ifdef _WIN32
 #include <conio.h>
 #include <direct.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/locking.h>
 #define CLEAR "cls"
 #define MKDIR(path) _mkdir(path)
+#define CHDIR(path) _chdir(path)
+#define NULL_DEVICE "NUL"
 #else
 #include <termios.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
 #define CLEAR "clear"
 #define MKDIR(path) mkdir(path, 0777)
+#define CHDIR(path) chdir(path)
+#define NULL_DEVICE "/dev/null"
 #endif
 
 #define RED    "\x1b[31m"
@@ -36,12 +74,189 @@
 #define ACCOUNTS_FILE "accounts.dat"
 #define TRANSACTIONS_FILE "transactions.dat"
 #define LOANS_FILE "loans.dat"
+#define EXCHANGE_RATES_FILE "exchange_rates.dat"
+#define BACKUP_DIR "backups"
+
+// Pending loan applications in arrival order (see loanIndexBuild); rewritten
+// once at least LOAN_QUEUE_COMPACT_MIN entries, and half the file, are decided
+#define LOAN_QUEUE_FILE "loans.queue"
+#define LOAN_QUEUE_MAGIC "LNQ1v1"
+#define LOAN_QUEUE_MAGIC_LEN 6
+#define LOAN_QUEUE_COMPACT_MIN 1024
+
+// Terms of new loans: a fixed annual rate in basis points (12%) and a
+// repayment term chosen by the applicant, repaid in equal monthly instalments
+#define LOAN_ANNUAL_RATE_BP 1200
+#define LOAN_DEFAULT_TERM_MONTHS 12
+#define LOAN_MAX_TERM_MONTHS 360
 
 #define INTEREST_LOG_FILE "interest_log.dat"
 
 // Interest rate (5% annual)
 #define ANNUAL_INTEREST_RATE 0.05
 
+// Money is kept in minor units; DATA_FORMAT_FILE records the on-disk layout
+// version (1 = float amounts, 2 = integer minor units, 3 = packed
+// transaction records, 4 = loan amortization terms, 5 = postings in WAL
+// entries)
+#define MONEY_SCALE 100
+#define DATA_FORMAT_FILE "format.dat"
+#define DATA_FORMAT_VERSION 5
+#define DATA_MIGRATE_SUFFIX ".migrate"
+#define BANK_TOTALS_MAX_CURRENCIES 32
+
+// In-memory hash indexes keyed by acc_no
+#define RECORD_INDEX_MIN_CAPACITY 1024
+#define RECORD_INDEX_EMPTY   (-1L)
+#define RECORD_INDEX_DELETED (-2L)
+
+// Per-account transaction chains: TRANSACTIONS_INDEX_FILE holds, for every
+// record in TRANSACTIONS_FILE, the record number of the previous transaction
+// of the same account. TRANSACTIONS_HEADS_FILE checkpoints the newest record
+// of each account.
+#define TRANSACTIONS_INDEX_FILE "transactions.idx"
+#define TRANSACTIONS_HEADS_FILE "transactions.head"
+#define TRANSACTIONS_HEADS_MAGIC "TXH1v1"
+#define TRANSACTIONS_HEADS_MAGIC_LEN 6
+
+// Time-partitioned log segments (see archiveTransactionLog).
+// TRANSACTIONS_ARCHIVE_FILE is the single archive of earlier versions.
+#define TRANSACTIONS_MANIFEST_FILE "transactions.manifest"
+#define TRANSACTIONS_ARCHIVE_FILE "transactions.arc"
+#define TX_MANIFEST_MAGIC "TXM1"
+#define TX_SEGMENT_PREFIX "transactions-"
+#define TX_SEGMENT_NAME_MAX 64
+#define TX_ARCHIVE_MAGIC "TXA1v1"
+#define TX_ARCHIVE_MAGIC_LEN 6
+#define TX_ARCHIVE_BLOCK_MAGIC 0x4B4C4254U // "TBLK"
+#define TX_ARCHIVE_BLOCK_RECORDS 4096
+#define TX_ARCHIVE_RUN_RECORDS (1 << 20) // records sorted by account at a time
+#define TX_ARCHIVE_MAX_RECORD_BYTES 40   // encoded size of one record, worst case
+
+// Columns of an archive query (TxArchiveQuery.columns)
+#define TX_COL_ACC      0x01
+#define TX_COL_TYPE     0x02
+#define TX_COL_CURRENCY 0x04
+#define TX_COL_AMOUNT   0x08
+#define TX_COL_TIME     0x10
+#define TX_COL_RECEIVER 0x20
+#define TX_COL_ALL      0x3F
+
+// Statement records are spooled to a temporary file and replayed this many
+// at a time (see writeAccountStatement)
+#define STATEMENT_SPOOL_RECORDS 4096
+
+// Month-end statement run: accounts are hashed into partitions of about
+// STATEMENT_RUN_PARTITION_BYTES of spilled data each, and worker threads
+// (--statement-workers, default one per core) write one partition's
+// statements at a time into STATEMENTS_DIR/YYYY-MM
+#define STATEMENTS_DIR "statements"
+#define STATEMENT_RUN_PARTITION_BYTES (16L * 1024 * 1024)
+#define STATEMENT_RUN_MAX_PARTITIONS 256
+#define STATEMENT_RUN_MAX_WORKERS 64
+#define STATEMENT_RUN_SPILL_BUFFER 65536
+
+// Group commit for the transaction log: buffered records are written and
+// fsync'ed together once this many are pending or the oldest is this old
+#define TRANSACTION_LOG_GROUP_RECORDS 256
+#define TRANSACTION_LOG_GROUP_MS 200
+
+// Write-ahead log for operations that update several records at once
+#define WAL_FILE "wal.dat"
+#define WAL_MAGIC 0x314C4157U // "WAL1"
+#define WAL_MAX_UPDATES 4
+#define WAL_MAX_POSTINGS 2 // transaction log records carried by one entry
+#define WAL_CHECKPOINT_ENTRIES 64 // fsync data files and truncate the WAL after this many entries
+
+// Batch mode commits the WAL entries of this many lines with one write and
+// one fsync (see struct WalGroup)
+#define BATCH_GROUP_LINES 256
+
+// Memory-mapped account store (enabled with --mmap)
+#define ACCOUNT_MAP_MIN_RECORDS 1024
+#define ACCOUNT_STORE_SYNC_EVERY 1 // msync after this many operations (0 = only on exit)
+
+// Deleted accounts stay in ACCOUNTS_FILE as tombstones (locked ==
+// ACCOUNT_TOMBSTONE) and their slots are reused by new accounts. The file is
+// compacted in the background once this share of its records is dead.
+#define ACCOUNT_TOMBSTONE 2
+#define ACCOUNTS_COMPACT_FILE "accounts.dat.compact"
+#define COMPACT_DEAD_RATIO 0.25
+#define COMPACT_MIN_DEAD 16
+
+// Scheduled interest run: worker threads (--interest-workers, default one per
+// core) each take a contiguous range of at least INTEREST_MIN_WORKER_RECORDS
+// records and read it INTEREST_CHUNK_RECORDS at a time
+#define INTEREST_CHUNK_RECORDS 4096
+#define INTEREST_MIN_WORKER_RECORDS 16384
+#define INTEREST_MAX_WORKERS 64
+
+// Marker of a scheduled interest run whose postings may be in the log while
+// its balances are not all written yet (see interestRecover)
+#define INTEREST_RUN_FILE "interest_run.dat"
+#define INTEREST_RUN_MAGIC "IRN1v1"
+#define INTEREST_RUN_MAGIC_LEN 6
+
+// Currency ids stored in transaction records (see currencyId)
+#define CURRENCY_ID_NONE 0
+#define CURRENCY_ID_PACKED_BASE 1000
+#define CURRENCY_ID_LIMIT (CURRENCY_ID_PACKED_BASE + 26 * 26 * 26)
+#define ACCOUNT_MIRROR_DEAD CURRENCY_ID_LIMIT // currency of a tombstone in the account mirror
+#define TRANSACTION_RECORD_VERSION 1
+
+// Exchange rate table: currency ids index a dense rate matrix; the file is
+// checked for changes at most this often
+#define EXCHANGE_MAX_CURRENCIES 64
+#define EXCHANGE_RATES_CHECK_MS 1000
+
+// Incremental backups in BACKUP_DIR (see createAutomatedBackup)
+#define BACKUP_MANIFEST_FILE "backup.manifest"
+#define BACKUP_MANIFEST_MAGIC "BKM2"
+#define BACKUP_MANIFEST_MAGIC_V1 "BKM1" // lines without checksums
+#define BACKUP_PIECE_MAGIC "BKP1v1"
+#define BACKUP_PIECE_MAGIC_LEN 6
+#define BACKUP_BLOCKMAP_MAGIC "BKB1"
+#define BACKUP_BLOCKMAP_SUFFIX ".blocks"
+#define BACKUP_BLOCK_SIZE 4096 // one page, the unit the mmap store writes back
+#define BACKUP_FINGERPRINT_BYTES 4096
+#define BACKUP_MAX_INCREMENTS 32 // pieces after a full copy before the next full copy
+#define BACKUP_EXTENT_SIZE (256 * 1024) // unit of compression, checksums and parallel work
+#define BACKUP_EXTENT_RAW 1            // BackupExtent.flags: stored uncompressed
+#define BACKUP_MAX_WORKERS 64
+#define BACKUP_JOBS_PER_WORKER 4
+#define BACKUP_LZ_MIN_MATCH 4
+#define BACKUP_LZ_HASH_BITS 14
+#define BACKUP_COPY_BUFFER (1 << 20)
+#define BACKUP_PIECE_NAME_MAX 128
+#define BACKUP_PATH_MAX 256
+
+// Only one process may use the data files at a time
+#define DATA_LOCK_FILE "bank.lock"
+
+// Customer sessions: a PIN check is reused by later operations on the same
+// account until it expires or the customer leaves the user menu
+#define SESSION_TTL_SECONDS 300
+#define SESSION_MAX 64
+
+// Server mode (--server): per-account locks are striped over this many mutexes
+#define ACCOUNT_LOCK_STRIPES 256
+#define SERVER_DEFAULT_PORT 7070
+#define SERVER_MAX_WORKERS 64
+#define SERVER_LINE_MAX 512
+
+// Benchmark (--bench): accounts[:transactions] per scale, timed calls per operation
+#define BENCH_DEFAULT_SCALES "10000,1000000,10000000"
+#define BENCH_DEFAULT_OPS 1000
+#define BENCH_DEFAULT_DIR "bench_data"
+#define BENCH_RESTORE_DIR "restored"
+#define BENCH_ACCOUNTS_PER_LOAN 10 // generated loans
+#define BENCH_LOOKUPS_PER_OP 100 // accountExists is cheap enough to run this many times more
+#define BENCH_STATEMENTS_DIR "statements"
+#define BENCH_MAX_STATEMENT_ACCOUNTS 1000000 // the month-end run writes a file per account
+
+// Self-test (--self-test): known-answer and crash-recovery checks
+#define SELF_TEST_DEFAULT_DIR "selftest_data"
+
 
 typedef unsigned char BYTE;
 typedef unsigned int  WORD;
@@ -63,10 +278,27 @@ typedef struct {
     WORD state[8];
 } SHA256_CTX;
 
+// Compression engines; sha256_engine picks one (--sha256-engine), AUTO takes
+// the fastest this CPU supports. The x86 engines are compiled with per-function
+// target attributes and chosen at run time, so a generic build still uses them.
+enum Sha256Engine { SHA256_ENGINE_AUTO, SHA256_ENGINE_SCALAR, SHA256_ENGINE_SSE2, SHA256_ENGINE_AVX2, SHA256_ENGINE_SHANI };
+#define SHA256_MAX_LANES 8
+int sha256_engine = SHA256_ENGINE_AUTO;
+
+// One hashPinBatch entry: hash = SHA-256(salt || pin)
+struct PinHashJob {
+    const char *pin;
+    const unsigned char *salt;
+    unsigned char *hash;
+};
+
 // =========================================================================
 // NEW ENUMS AND STRUCTS
 // =========================================================================
 
+// Amounts are stored as integer minor units (paise/cents), MONEY_SCALE per unit
+typedef long long Money;
+
 typedef enum {
     PENDING,
     APPROVED,
@@ -77,10 +309,35 @@ typedef enum {
 struct Loan {
     int loan_id;
     int acc_no;
-    float amount;
+    Money amount;
     long timestamp;
     LoanStatus status;
-    float amount_paid;
+    Money amount_paid;
+    // Amortization terms; loans from before format version 4 have none and
+    // carry no interest
+    int32_t rate_bp;       // annual interest rate in basis points
+    int32_t term_months;   // 0 = no instalment schedule
+    Money emi;             // monthly instalment, fixed when approved
+    Money interest;        // interest accrued so far, owed on top of amount
+    int64_t approved_at;   // the schedule starts here
+    int64_t accrued_until; // interest is accrued up to this time
+};
+
+// One row of a planned repayment schedule (see loanSchedule)
+struct LoanInstallment {
+    int number;
+    time_t due;
+    Money payment;
+    Money interest;
+    Money principal;
+    Money balance; // principal left after this payment
+};
+
+// Totals of an accrueLoanBook run
+struct LoanAccrualResult {
+    long scanned;
+    long charged;
+    Money interest;
 };
 
 typedef enum {
@@ -90,23 +347,30 @@ typedef enum {
     TRANSFER_IN,
 
     LOAN_REPAYMENT, // New transaction type
-    INTEREST_CREDIT // New transaction type for interest
+    INTEREST_CREDIT, // New transaction type for interest
+    LOAN_APPROVED,   // loan amount credited to the borrower
+    LOAN_REJECTED    // decision only, amount 0
 
 } TransactionType;
 
+// Transaction log record, 32 bytes with fixed-width fields so the layout is
+// the same on every platform
 struct Transaction {
-    int acc_no;
-    TransactionType type;
-    float amount;
-    long timestamp;
-    int receiver_acc_no;
-    char currency[4]; // New field
+    Money amount;
+    int64_t timestamp;
+    int32_t acc_no;
+    int32_t receiver_acc_no;
+    uint16_t currency; // see currencyId
+    uint8_t type;      // TransactionType
+    uint8_t version;   // TRANSACTION_RECORD_VERSION
+    uint32_t reserved;
 };
 
 struct Account {
     int acc_no;
     char name[100];
-    float balance;
+    Money balance;
+    char currency[4];
     unsigned char pin_hash[HASH_SIZE];
     unsigned char salt[SALT_SIZE];
     int failed_attempts;
@@ -129,6 +393,293 @@ struct ExchangeRate {
     float rate;
 };
 
+// Hot fields of a chunk of account records, one array per field, for the
+// vectorized interest pass (see accrueInterestColumns)
+struct AccountColumns {
+    Money *balance;
+    int64_t *last_interest_date;
+    double *daily_rate; // the same for every account
+    int *locked;
+    Money *interest; // kernel output
+    int *days;       // kernel output
+};
+
+// Balance and currency id of every record in ACCOUNTS_FILE by record number,
+// kept in memory for whole-bank scans (see accountMirrorSet)
+struct AccountMirror {
+    Money *balance;     // 0 for a tombstone
+    uint16_t *currency; // ACCOUNT_MIRROR_DEAD for a tombstone
+    size_t count, capacity;
+    int valid; // 0 until the next accountIndexBuild
+};
+
+// Per-currency balance totals (see computeBankTotals). Accounts in a
+// currency that no longer fits in the table, or whose code is not a currency
+// code, are totalled in other_* instead, mixed currencies and all.
+struct BankTotals {
+    long accounts;
+    int currency_count;
+    uint16_t currency_id[BANK_TOTALS_MAX_CURRENCIES];
+    char currency[BANK_TOTALS_MAX_CURRENCIES][4];
+    Money balance[BANK_TOTALS_MAX_CURRENCIES];
+    long other_accounts;
+    Money other_balance;
+};
+
+// Slot of an open-addressing record index
+struct RecordIndexSlot {
+    int acc_no;
+    long recno; // record number, or RECORD_INDEX_EMPTY / RECORD_INDEX_DELETED
+};
+
+struct RecordIndex {
+    struct RecordIndexSlot *slots;
+    size_t capacity; // always a power of two
+    size_t used;     // live + deleted slots
+};
+
+// Filter for txArchiveScan. Records outside [from, to] or of another account
+// are skipped; 0 means no filter.
+struct TxArchiveQuery {
+    int acc_no;
+    long from;
+    long to;
+    unsigned columns; // TX_COL_* columns to decode; the rest are left zero
+};
+
+// Figures of a statement written by writeAccountStatement
+struct StatementTotals {
+    Money opening;
+    Money closing;
+    Money credits;
+    Money debits;
+    long count;
+    int segments_read;
+};
+
+// Outcome of a month-end statement run (see runMonthEndStatements)
+struct StatementRunResult {
+    long accounts;     // statements written
+    long transactions; // rows in them
+    long failed;       // accounts whose statement could not be written
+    int partitions;
+    int workers;
+    int segments_read;
+};
+
+// One sealed part of the transaction log, as listed in the manifest
+struct TxSegment {
+    char file[TX_SEGMENT_NAME_MAX];
+    long min_time;
+    long max_time;
+    long records;
+    int pending; // written, but the log records it holds are not yet removed
+    struct TxBlockRef *blocks; // block headers, loaded by the first scan
+    size_t block_count;
+};
+
+// Header of TRANSACTIONS_HEADS_FILE, followed by `count` RecordIndexSlot entries
+struct TransactionHeadsHeader {
+    char magic[8];
+    long covered; // transaction records reflected in the checkpoint
+    long count;
+};
+
+// Contents of INTEREST_RUN_FILE
+struct InterestRunRecord {
+    char magic[8];
+    int64_t now;       // time of the run, the timestamp of its postings
+    int64_t log_start; // TRANSACTIONS_FILE record of its first posting
+    int64_t postings;
+};
+
+// Header of LOAN_QUEUE_FILE, followed by LOANS_FILE record numbers (long)
+struct LoanQueueHeader {
+    char magic[8];
+    long head; // first entry that may still be pending
+};
+
+// One entry of a bulk loan decision list
+struct LoanDecision {
+    int loan_id;
+    char action; // 'A' approve, 'R' reject
+};
+
+// Bulk approval rule: pending loans of at most max_amount whose borrower
+// has a balance of at least min_balance
+struct LoanRule {
+    Money max_amount;
+    Money min_balance;
+};
+
+struct LoanBatchResult {
+    long approved;
+    long rejected;
+    long skipped;
+    Money credited;
+};
+
+// Result of a non-interactive account operation
+typedef enum {
+    OP_OK,
+    OP_NOT_FOUND,
+    OP_RECEIVER_NOT_FOUND,
+    OP_EXISTS,
+    OP_INVALID_AMOUNT,
+    OP_INVALID_PIN,
+    OP_INVALID_NAME,
+    OP_INVALID_CURRENCY,
+    OP_SAME_ACCOUNT,
+    OP_INSUFFICIENT_FUNDS,
+    OP_IO_ERROR
+} OpStatus;
+
+// One parsed batch/server command (see parseCommand)
+struct Command {
+    char op; // 'C', 'D', 'W' or 'T'
+    int acc_no;
+    int to_acc;
+    Money amount; // amount, or initial balance for 'C'
+    char pin[32];
+    char currency[10];
+    const char *name; // points into the parsed line
+};
+
+typedef enum {
+    WAL_TARGET_ACCOUNT,
+    WAL_TARGET_LOAN
+} WalTarget;
+
+// After-image of one record touched by a WAL entry
+struct WalUpdate {
+    WalTarget target;
+    long offset; // byte offset of the record in ACCOUNTS_FILE or LOANS_FILE
+    union {
+        struct Account account;
+        struct Loan loan;
+    } image;
+};
+
+// One multi-record operation. An entry is valid only if magic and checksum
+// match, so a torn write at the tail of WAL_FILE is detected and discarded.
+// The operation's transaction log records travel with it; log_recno is the
+// TRANSACTIONS_FILE record number reserved for the first of them.
+struct WalEntry {
+    unsigned int magic;
+    unsigned int seq;
+    int count;
+    struct WalUpdate updates[WAL_MAX_UPDATES];
+    int posting_count;
+    int64_t log_recno;
+    struct Transaction postings[WAL_MAX_POSTINGS];
+    unsigned int checksum; // FNV-1a over all preceding bytes
+};
+
+// WAL entries queued by walCommit while the group is in use (walGroupUse),
+// committed together by walGroupCommit. images maps an account record number
+// to its newest queued after-image (entry * WAL_MAX_UPDATES + update), which
+// loadAccount returns in place of the record.
+struct WalGroup {
+    struct WalEntry *entries;
+    size_t count, capacity;
+    struct RecordIndex images;
+};
+
+// Data format version 1 (float amounts). Only read by
+// migrateDataFiles.
+struct AccountV1 {
+    int acc_no;
+    char name[100];
+    float balance;
+    char currency[4];
+    unsigned char pin_hash[HASH_SIZE];
+    unsigned char salt[SALT_SIZE];
+    int failed_attempts;
+    int locked;
+    long last_interest_date;
+};
+
+struct TransactionV1 {
+    int acc_no;
+    TransactionType type;
+    float amount;
+    long timestamp;
+    int receiver_acc_no;
+    char currency[4];
+};
+
+// Data format version 2 transaction record (TRANSACTION_RECORD_VERSION 0)
+struct TransactionV2 {
+    int acc_no;
+    TransactionType type;
+    Money amount;
+    long timestamp;
+    int receiver_acc_no;
+    char currency[4];
+};
+
+struct LoanV1 {
+    int loan_id;
+    int acc_no;
+    float amount;
+    long timestamp;
+    LoanStatus status;
+    float amount_paid;
+};
+
+// Data format version 2 and 3 loan record
+struct LoanV3 {
+    int loan_id;
+    int acc_no;
+    Money amount;
+    long timestamp;
+    LoanStatus status;
+    Money amount_paid;
+};
+
+// Data format version 4 WAL entry: the same updates, no postings
+struct WalEntryV4 {
+    unsigned int magic;
+    unsigned int seq;
+    int count;
+    struct WalUpdate updates[WAL_MAX_UPDATES];
+    unsigned int checksum;
+};
+
+struct WalUpdateV3 {
+    WalTarget target;
+    long offset;
+    union {
+        struct Account account;
+        struct LoanV3 loan;
+    } image;
+};
+
+struct WalEntryV3 {
+    unsigned int magic;
+    unsigned int seq;
+    int count;
+    struct WalUpdateV3 updates[WAL_MAX_UPDATES];
+    unsigned int checksum;
+};
+
+struct WalUpdateV1 {
+    WalTarget target;
+    long offset;
+    union {
+        struct AccountV1 account;
+        struct LoanV1 loan;
+    } image;
+};
+
+struct WalEntryV1 {
+    unsigned int magic;
+    unsigned int seq;
+    int count;
+    struct WalUpdateV1 updates[WAL_MAX_UPDATES];
+    unsigned int checksum;
+};
+
 // =========================================================================
 // FUNCTION PROTOTYPES
 // =========================================================================
@@ -137,19 +688,27 @@ void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len);
 void sha256_final(SHA256_CTX *ctx, BYTE hash[]);
 void sha256(const BYTE *data, size_t len, BYTE *out_hash);
+void sha256_multi(const BYTE *const data[], const size_t len[], size_t count, BYTE *const out[]);
+int sha256EngineFromName(const char *name);
 void flush_stdin(void);
 void getMaskedInput(char *buffer, size_t size);
 void printHex(const unsigned char *data, size_t len);
 void generateSalt(unsigned char *salt, size_t length);
 void hashPin(const char *pin, const unsigned char *salt, size_t salt_len, unsigned char *out_hash);
+void hashPinBatch(const struct PinHashJob *jobs, size_t count, size_t salt_len);
 int accountExists(int acc_no);
 int authenticate(int acc_no, const char *pin_input);
+unsigned long long sessionOpen(int acc_no);
+int sessionCheck(unsigned long long token, int acc_no);
+void sessionClose(unsigned long long token);
+int authenticateCustomer(int acc_no, const char *prompt);
 void createAccount();
 void deposit();
 void withdraw();
 void transferMoney();
 void viewAccounts();
 void viewTransactionHistory();
+void printTransactionHistory(int acc_no);
 void applyForLoan();
 int isLoanPending(int acc_no);
 void loanRepayment();
@@ -158,26 +717,196 @@ void updateAccountName();
 void deleteAccount();
 void userMenu();
 void adminMenu();
-void logTransaction(int acc_no, TransactionType type, float amount, int receiver_acc, const char* currency);
+void logTransaction(int acc_no, TransactionType type, Money amount, int receiver_acc, const char* currency);
 int loadAdminCredentials(unsigned char *salt, unsigned char *hash);
 int saveAdminCredentials(const unsigned char *salt, const unsigned char *hash);
 int setAdminPinInteractive(void);
 int adminInitIfNeeded(void);
 int authenticateAdmin(const char *pin_input);
 void generateAccountStatement();
+Money transactionEffect(const struct Transaction *t);
+int writeAccountStatement(FILE *out, int acc_no, long from, long to, struct StatementTotals *totals);
+int runMonthEndStatements(const char *dir, long from, long to, struct StatementRunResult *result);
+int monthEndStatements(const char *month);
+void monthEndStatementsMenu(void);
 void unlockAccount();
-void createAutomatedBackup();
+int createAutomatedBackup();
+int restoreBackup(const char *dir);
+void backupReset(void);
 void manageLoanApplications();
+int decideLoans(const struct LoanDecision *decisions, size_t n, const struct LoanRule *rule,
+                struct LoanBatchResult *result);
+void bulkLoanDecisions();
 float getExchangeRate(const char* from, const char* to); // New function prototype
 void initializeExchangeRates(); // New function prototype
+void exchangeRatesClose(void);
+uint16_t currencyId(const char *code);
+const char *currencyCode(uint16_t id, char code[4]);
+float getExchangeRateById(uint16_t from, uint16_t to);
 
 // New function prototypes for interest calculation
+void accrueInterestColumns(const Money *amount, const int64_t *from, const double *daily_rate, size_t n,
+                           int64_t now, int unset_is_one_day, Money *interest, int *days);
+int accrueInterest(struct Account *account, time_t now, Money *interest);
 void calculateInterestForAccount(struct Account *account);
 void processScheduledInterest();
+int interestRecover(void);
 void viewInterestLog();
 void initializeLastInterestDate();
 int daysSinceLastInterest(long last_date);
 
+// Record index prototypes
+void recordIndexClear(struct RecordIndex *ix);
+int recordIndexReserve(struct RecordIndex *ix, size_t expected);
+long recordIndexLookup(const struct RecordIndex *ix, int acc_no);
+int recordIndexPut(struct RecordIndex *ix, int acc_no, long recno, int replace);
+void recordIndexRemove(struct RecordIndex *ix, int acc_no);
+
+// Account index prototypes
+int accountIndexBuild(void);
+long accountIndexLookup(int acc_no);
+int accountIndexInsert(int acc_no, long recno);
+void accountIndexRemove(int acc_no);
+int accountIsTombstone(const struct Account *a);
+int findAccount(FILE *fp, int acc_no, struct Account *out, long *pos);
+
+// Account store prototypes
+int accountStoreOpen(void);
+void accountStoreClose(void);
+int accountStoreCommit(int force);
+int loadAccount(int acc_no, struct Account *out, long *pos);
+int saveAccount(long pos, const struct Account *a);
+int appendAccount(const struct Account *a);
+void accountStoreChanged(void);
+
+// Compaction prototypes
+int compactAccountsFile(void);
+void compactionMaybeStart(void);
+void compactionPoll(int wait);
+
+// Transaction index prototypes
+long fileRecordCount(const char *path, size_t record_size);
+int transactionIndexOpen(void);
+void transactionIndexCheckpoint(void);
+long transactionIndexLink(int acc_no, long recno);
+long *transactionIndexChain(int acc_no, size_t *count);
+long transactionIndexHead(int acc_no);
+long transactionIndexPrev(FILE *idx_fp, long recno);
+
+// Transaction log writer prototypes
+long long monotonicMillis(void);
+int transactionLogOpen(void);
+int transactionLogAppend(const struct Transaction *t);
+int transactionLogAppendBatch(const struct Transaction *t, size_t n);
+long transactionLogReserve(size_t n);
+void transactionLogRelease(size_t n);
+void transactionLogPost(const struct Transaction *t, size_t n, long recno);
+int transactionLogFlush(void);
+int transactionLogFlushExpired(void);
+void transactionLogClose(void);
+int syncFile(FILE *fp);
+int syncDescriptor(int fd);
+
+long transactionLogFirstTime(void);
+
+// Transaction archive prototypes
+int txArchiveRecover(void);
+long archiveTransactionLog(void);
+void transactionLogRollPoll(void);
+void transactionSegmentsRemove(void);
+void printTransactionSegments(void);
+long txArchiveScan(const char *path, const struct TxArchiveQuery *q,
+                   int (*visit)(const struct Transaction *t, void *ctx), void *ctx);
+long transactionSegmentsScan(const struct TxArchiveQuery *q, int (*visit)(const struct Transaction *t, void *ctx),
+                             void *ctx, int *segments_read);
+void archiveTransactionsMenu(void);
+
+// Write-ahead log prototypes
+void walBegin(struct WalEntry *entry);
+int walAddAccount(struct WalEntry *entry, long pos, const struct Account *a);
+int walAddLoan(struct WalEntry *entry, long pos, const struct Loan *loan);
+int walAddPosting(struct WalEntry *entry, int acc_no, TransactionType type, Money amount, int receiver_acc,
+                  const char *currency);
+int loanIndexBuild(void);
+void loanIndexClose(void);
+const struct Loan *loanIndexGet(long recno);
+long loanIndexFindId(int loan_id);
+long loanIndexFindAccount(int acc_no, LoanStatus status);
+long loanIndexAppend(struct Loan *loan);
+void loanIndexUpdate(long recno, const struct Loan *loan);
+long loanQueueNext(long *cursor);
+void loanIndexUpdateBatch(const long *recnos, const struct Loan *loans, size_t n);
+int walCommit(struct WalEntry *entry);
+int walCommitBatch(struct WalEntry *entries, size_t n);
+int walCheckpoint(void);
+int walRecover(void);
+int walPendingEntries(void);
+int walGroupInit(struct WalGroup *g, size_t capacity);
+void walGroupFree(struct WalGroup *g);
+void walGroupUse(struct WalGroup *g);
+int walGroupCommit(struct WalGroup *g);
+
+// Loan amortization prototypes
+void loanEmiColumns(const Money *principal, const int32_t *rate_bp, const int32_t *term, size_t n, Money *emi);
+Money loanOutstanding(const struct Loan *loan);
+void loanStartSchedule(struct Loan *loan, time_t now);
+void loanStartSchedules(struct Loan *loans, size_t n, time_t now);
+int accrueLoan(struct Loan *loan, time_t now, Money *interest);
+time_t loanDueDate(const struct Loan *loan, int k);
+int loanSchedule(const struct Loan *loan, struct LoanInstallment *rows, int max);
+int loanInstallmentsDue(const struct Loan *loan, time_t now, Money *arrears);
+int accrueLoanBook(time_t now, struct LoanAccrualResult *result);
+void processLoanInterest();
+void printLoanSchedule(const struct Loan *loan);
+void viewLoanSchedule();
+
+// Account operation prototypes (shared by the menus and batch mode)
+const char *opStatusMessage(OpStatus status);
+OpStatus openAccount(int acc_no, const char *name, const char *pin, Money balance, const char *currency);
+OpStatus depositFunds(int acc_no, Money amount, struct Account *result);
+OpStatus withdrawFunds(int acc_no, Money amount, struct Account *result);
+OpStatus removeAccount(int acc_no, struct Account *result);
+OpStatus transferFunds(int from_acc, int to_acc, Money amount, struct Account *sender_result,
+                       struct Account *receiver_result, Money *converted_amount);
+int openDataFiles(void);
+void closeDataFiles(void);
+
+// Money prototypes
+double moneyToDouble(Money amount);
+Money moneyRound(double value);
+int parseMoney(const char *text, Money *out);
+int readMoney(Money *out);
+Money sumMoney(const Money *values, size_t n);
+Money sumMoneyWhere(const Money *values, const uint16_t *keys, uint16_t key, size_t n);
+int computeBankTotals(struct BankTotals *totals);
+int migrateDataFiles(void);
+int writeDataFormatVersion(void);
+void viewBankTotals();
+
+// Locking prototypes
+int acquireDataLock(void);
+void releaseDataLock(void);
+void accountLock(int acc_no);
+void accountUnlock(int acc_no);
+void accountLockPair(int acc_a, int acc_b);
+void accountUnlockPair(int acc_a, int acc_b);
+void accountLockAll(void);
+void accountUnlockAll(void);
+
+// Batch mode prototypes
+int parseCommand(char *line, struct Command *cmd);
+OpStatus executeCommand(const struct Command *cmd, struct Account *result);
+int runBatch(const char *path);
+
+// Server mode prototypes
+int runServer(int port, int workers);
+
+// Benchmark prototypes
+int runBenchmark(const char *scales, int ops, const char *dir);
+
+// Self-test prototypes
+int runSelfTests(const char *dir);
+
 // =========================================================================
 // NEW FUNCTION IMPLEMENTATION
 // =========================================================================
@@ -200,109 +929,525 @@ void initializeExchangeRates() {
     fclose(fp);
 }
 
-float getExchangeRate(const char* from, const char* to) {
-    if (strcmp(from, to) == 0) return 1.0f;
+// =========================================================================
+// NEW FUNCTIONS FOR INTEREST CALCULATION
+// =========================================================================
 
-    FILE* fp = fopen(EXCHANGE_RATES_FILE, "rb");
-    if (!fp) {
-        printf(RED "Exchange rates file not found. Using default rate of 1.0.\n" RESET);
-        return 1.0f;
+// Interest kernel over column buffers, shared by the account and loan interest
+// runs. For each entry, days[i] is the whole days from from[i] to now and
+// interest[i] is amount[i] times daily_rate[i] times days, rounded like
+// moneyRound; both are 0 when the amount is not positive or no full day has
+// passed. With unset_is_one_day, from[i] == 0 (an account never credited)
+// counts as one day. The vector paths do the same double operations in the
+// same order as the scalar loop, so every build gives identical amounts.
+// Values outside +-2^51, which the vector int64 <-> double conversions cannot
+// carry exactly, go through the scalar loop.
+static void accrueInterestScalar(const Money *amount, const int64_t *from, const double *daily_rate, size_t n,
+                                 int64_t now, int unset_is_one_day, Money *interest, int *days) {
+    for (size_t i = 0; i < n; i++) {
+        int d = 1;
+        if (!unset_is_one_day || from[i] != 0) d = (int)(difftime((time_t)now, (time_t)from[i]) / (60 * 60 * 24));
+        if (amount[i] <= 0 || d <= 0) {
+            interest[i] = 0;
+            days[i] = 0;
+        } else {
+            interest[i] = moneyRound((double)amount[i] * daily_rate[i] * d);
+            days[i] = d;
+        }
     }
+}
 
-    struct ExchangeRate rate;
-    while(fread(&rate, sizeof(struct ExchangeRate), 1, fp)) {
-        if (strcmp(rate.from_currency, from) == 0 && strcmp(rate.to_currency, to) == 0) {
-            fclose(fp);
-            return rate.rate;
+void accrueInterestColumns(const Money *amount, const int64_t *from, const double *daily_rate, size_t n,
+                           int64_t now, int unset_is_one_day, Money *interest, int *days) {
+    size_t i = 0;
+#if defined(__AVX2__) || defined(__SSE4_1__)
+    const double exact_limit = 2251799813685248.0; // 2^51
+    const long long bias_bits = 0x4338000000000000LL; // bits of 1.5 * 2^52
+    const double bias = 6755399441055744.0;
+    const long long unset_bits = unset_is_one_day ? -1LL : 0;
+#if defined(__AVX2__)
+    const __m256i range_i = _mm256_set1_epi64x(1LL << 51);
+    const __m256i bias_i = _mm256_set1_epi64x(bias_bits);
+    const __m256d bias_d = _mm256_set1_pd(bias), limit_d = _mm256_set1_pd(exact_limit);
+    const __m256d now_d = _mm256_set1_pd((double)now), day_d = _mm256_set1_pd(60 * 60 * 24);
+    const __m256d unset = _mm256_castsi256_pd(_mm256_set1_epi64x(unset_bits));
+    const __m256d zero = _mm256_setzero_pd(), half = _mm256_set1_pd(0.5), one = _mm256_set1_pd(1.0);
+    for (; i + 4 <= n; i += 4) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)(amount + i));
+        __m256i l = _mm256_loadu_si256((const __m256i *)(from + i));
+        __m256i outside = _mm256_or_si256(_mm256_srli_epi64(_mm256_add_epi64(b, range_i), 52),
+                                          _mm256_srli_epi64(_mm256_add_epi64(l, range_i), 52));
+        if (!_mm256_testz_si256(outside, outside)) {
+            accrueInterestScalar(amount + i, from + i, daily_rate + i, 4, now, unset_is_one_day, interest + i, days + i);
+            continue;
         }
+        __m256d bd = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(b, bias_i)), bias_d);
+        __m256d ld = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(l, bias_i)), bias_d);
+        __m256d d = _mm256_round_pd(_mm256_div_pd(_mm256_sub_pd(now_d, ld), day_d),
+                                    _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        d = _mm256_blendv_pd(d, one, _mm256_and_pd(_mm256_cmp_pd(ld, zero, _CMP_EQ_OQ), unset));
+        __m256d due = _mm256_and_pd(_mm256_cmp_pd(bd, zero, _CMP_GT_OQ), _mm256_cmp_pd(d, zero, _CMP_GT_OQ));
+        __m256d x = _mm256_mul_pd(_mm256_mul_pd(bd, _mm256_loadu_pd(daily_rate + i)), d);
+        __m256d t = _mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m256d r = _mm256_add_pd(t, _mm256_and_pd(_mm256_cmp_pd(_mm256_sub_pd(x, t), half, _CMP_GE_OQ), one));
+        r = _mm256_and_pd(r, due);
+        d = _mm256_and_pd(d, due);
+        if (_mm256_movemask_pd(_mm256_cmp_pd(r, limit_d, _CMP_GE_OQ))) {
+            accrueInterestScalar(amount + i, from + i, daily_rate + i, 4, now, unset_is_one_day, interest + i, days + i);
+            continue;
+        }
+        _mm256_storeu_si256((__m256i *)(interest + i),
+                            _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(r, bias_d)), bias_i));
+        _mm_storeu_si128((__m128i *)(days + i), _mm256_cvttpd_epi32(d));
     }
-    fclose(fp);
-    printf(RED "No exchange rate found for %s to %s. Using default rate of 1.0.\n" RESET, from, to);
-    return 1.0f;
+#else
+    const __m128i range_i = _mm_set1_epi64x(1LL << 51);
+    const __m128i bias_i = _mm_set1_epi64x(bias_bits);
+    const __m128d bias_d = _mm_set1_pd(bias), limit_d = _mm_set1_pd(exact_limit);
+    const __m128d now_d = _mm_set1_pd((double)now), day_d = _mm_set1_pd(60 * 60 * 24);
+    const __m128d unset = _mm_castsi128_pd(_mm_set1_epi64x(unset_bits));
+    const __m128d zero = _mm_setzero_pd(), half = _mm_set1_pd(0.5), one = _mm_set1_pd(1.0);
+    for (; i + 2 <= n; i += 2) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(amount + i));
+        __m128i l = _mm_loadu_si128((const __m128i *)(from + i));
+        __m128i outside = _mm_or_si128(_mm_srli_epi64(_mm_add_epi64(b, range_i), 52),
+                                       _mm_srli_epi64(_mm_add_epi64(l, range_i), 52));
+        if (!_mm_testz_si128(outside, outside)) {
+            accrueInterestScalar(amount + i, from + i, daily_rate + i, 2, now, unset_is_one_day, interest + i, days + i);
+            continue;
+        }
+        __m128d bd = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(b, bias_i)), bias_d);
+        __m128d ld = _mm_sub_pd(_mm_castsi128_pd(_mm_add_epi64(l, bias_i)), bias_d);
+        __m128d d = _mm_round_pd(_mm_div_pd(_mm_sub_pd(now_d, ld), day_d), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        d = _mm_blendv_pd(d, one, _mm_and_pd(_mm_cmpeq_pd(ld, zero), unset));
+        __m128d due = _mm_and_pd(_mm_cmpgt_pd(bd, zero), _mm_cmpgt_pd(d, zero));
+        __m128d x = _mm_mul_pd(_mm_mul_pd(bd, _mm_loadu_pd(daily_rate + i)), d);
+        __m128d t = _mm_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        __m128d r = _mm_add_pd(t, _mm_and_pd(_mm_cmpge_pd(_mm_sub_pd(x, t), half), one));
+        r = _mm_and_pd(r, due);
+        d = _mm_and_pd(d, due);
+        if (_mm_movemask_pd(_mm_cmpge_pd(r, limit_d))) {
+            accrueInterestScalar(amount + i, from + i, daily_rate + i, 2, now, unset_is_one_day, interest + i, days + i);
+            continue;
+        }
+        _mm_storeu_si128((__m128i *)(interest + i), _mm_sub_epi64(_mm_castpd_si128(_mm_add_pd(r, bias_d)), bias_i));
+        _mm_storel_epi64((__m128i *)(days + i), _mm_cvttpd_epi32(d));
+    }
+#endif
+#endif
+    accrueInterestScalar(amount + i, from + i, daily_rate + i, n - i, now, unset_is_one_day, interest + i, days + i);
 }
 
-// =========================================================================
-// NEW FUNCTIONS FOR INTEREST CALCULATION
-// =========================================================================
+// Credits interest for the whole days since last_interest_date and moves the
+// date to now. Returns the number of days credited (0 if nothing was due);
+// *interest receives the amount.
+int accrueInterest(struct Account *account, time_t now, Money *interest) {
+    int days;
+    int64_t from = account->last_interest_date;
+    double daily_rate = ANNUAL_INTEREST_RATE / 365.0;
+    accrueInterestColumns(&account->balance, &from, &daily_rate, 1, (int64_t)now, 1, interest, &days);
+    if (days == 0) return 0;
+    account->balance += *interest;
+    account->last_interest_date = (long)now;
+    return days;
+}
 
 // Function to calculate interest for a single account
 void calculateInterestForAccount(struct Account *account) {
-    if (account->balance <= 0) return; // No interest for zero or negative balances
-    
-    // Calculate days since last interest calculation
-    int days = daysSinceLastInterest(account->last_interest_date);
-    if (days <= 0) return; // No need to calculate if already done today
-    
-    // Calculate daily interest rate (assuming 365 days in a year)
-    double daily_rate = ANNUAL_INTEREST_RATE / 365.0;
-    
-    // Calculate interest for the period
-    double interest = account->balance * daily_rate * days;
-    
-    // Update account balance
-    account->balance += (float)interest;
-    
-    // Update last interest date
-    account->last_interest_date = time(NULL);
-    
+    Money interest;
+    int days = accrueInterest(account, time(NULL), &interest);
+    if (days == 0) return;
+
     // Log the interest transaction
-    logTransaction(account->acc_no, INTEREST_CREDIT, (float)interest, 0);
+    logTransaction(account->acc_no, INTEREST_CREDIT, interest, 0, account->currency);
     
     // Log interest calculation in separate file
     FILE *log_fp = fopen(INTEREST_LOG_FILE, "a");
     if (log_fp) {
         fprintf(log_fp, "Account: %d, Date: %ld, Days: %d, Interest: %.2f, New Balance: %.2f\n",
-                account->acc_no, time(NULL), days, interest, account->balance);
+                account->acc_no, time(NULL), days, moneyToDouble(interest), moneyToDouble(account->balance));
         fclose(log_fp);
     }
     
     printf(GREEN "Interest of Rs. %.2f credited to account %d (for %d days)\n" RESET, 
-           (float)interest, account->acc_no, days);
+           moneyToDouble(interest), account->acc_no, days);
+}
+
+// The scheduled interest run splits ACCOUNTS_FILE into one contiguous range
+// per worker thread. Each worker reads its range in chunks through its own
+// FILE and computes a chunk's interest with accrueInterestColumns over column
+// copies of the hot fields. The run makes two passes:
+//
+//   1. Workers only read, collecting their INTEREST_CREDIT transactions and
+//      interest log lines in memory. Ranges are in file order, so
+//      concatenating the workers' buffers gives one append per log.
+//   2. Once the postings are durable in the transaction log, workers read
+//      their ranges again and write the changed records back in runs,
+//      followed by a single fsync of the account file.
+//
+// The second pass recomputes the same amounts from the same records and
+// time, so a balance is never credited without its posting. INTEREST_RUN_FILE
+// is synced before the postings are appended and removed after the account
+// file is synced; interestRecover uses it to finish or undo a run that a
+// crash interrupted between the two.
+struct InterestWorker {
+    long first, end; // records [first, end)
+    time_t now;
+    int apply;       // 0: collect the postings, 1: write the balances
+    struct Transaction *postings;
+    size_t posting_count, posting_capacity;
+    char *log_text;
+    size_t log_len, log_capacity;
+    long scanned, credited;
+    int ok;
+};
+
+int interest_workers = 0; // 0 = one per CPU core
+
+static int interestWorkerPost(struct InterestWorker *w, const struct Account *a, Money interest, int days) {
+    if (w->posting_count == w->posting_capacity) {
+        size_t capacity = w->posting_capacity ? w->posting_capacity * 2 : 1024;
+        struct Transaction *postings = realloc(w->postings, capacity * sizeof(struct Transaction));
+        if (!postings) return 0;
+        w->postings = postings;
+        w->posting_capacity = capacity;
+    }
+    struct Transaction *t = &w->postings[w->posting_count++];
+    memset(t, 0, sizeof(*t));
+    t->acc_no = a->acc_no;
+    t->type = INTEREST_CREDIT;
+    t->amount = interest;
+    t->timestamp = (int64_t)w->now;
+    t->currency = currencyId(a->currency);
+    t->version = TRANSACTION_RECORD_VERSION;
+
+    char line[160];
+    int len = snprintf(line, sizeof(line), "Account: %d, Date: %ld, Days: %d, Interest: %.2f, New Balance: %.2f\n",
+                       a->acc_no, (long)w->now, days, moneyToDouble(interest), moneyToDouble(a->balance));
+    if (w->log_len + (size_t)len > w->log_capacity) {
+        size_t capacity = w->log_capacity ? w->log_capacity * 2 : 64 * 1024;
+        while (capacity < w->log_len + (size_t)len) capacity *= 2;
+        char *text = realloc(w->log_text, capacity);
+        if (!text) return 0;
+        w->log_text = text;
+        w->log_capacity = capacity;
+    }
+    memcpy(w->log_text + w->log_len, line, (size_t)len);
+    w->log_len += (size_t)len;
+    return 1;
+}
+
+static void *interestWorkerRun(void *arg) {
+    struct InterestWorker *w = arg;
+    FILE *fp = fopen(ACCOUNTS_FILE, w->apply ? "rb+" : "rb");
+    struct Account *chunk = malloc(INTEREST_CHUNK_RECORDS * sizeof(struct Account));
+    struct AccountColumns cols;
+    cols.balance = malloc(INTEREST_CHUNK_RECORDS * sizeof(Money));
+    cols.last_interest_date = malloc(INTEREST_CHUNK_RECORDS * sizeof(int64_t));
+    cols.daily_rate = malloc(INTEREST_CHUNK_RECORDS * sizeof(double));
+    cols.locked = malloc(INTEREST_CHUNK_RECORDS * sizeof(int));
+    cols.interest = malloc(INTEREST_CHUNK_RECORDS * sizeof(Money));
+    cols.days = malloc(INTEREST_CHUNK_RECORDS * sizeof(int));
+    w->ok = fp && chunk && cols.balance && cols.last_interest_date && cols.daily_rate && cols.locked &&
+            cols.interest && cols.days;
+    for (int i = 0; w->ok && i < INTEREST_CHUNK_RECORDS; i++) cols.daily_rate[i] = ANNUAL_INTEREST_RATE / 365.0;
+
+    for (long base = w->first; w->ok && base < w->end; base += INTEREST_CHUNK_RECORDS) {
+        size_t n = (size_t)(w->end - base < INTEREST_CHUNK_RECORDS ? w->end - base : INTEREST_CHUNK_RECORDS);
+        if (fseek(fp, base * (long)sizeof(struct Account), SEEK_SET) != 0 ||
+            fread(chunk, sizeof(struct Account), n, fp) != n) {
+            w->ok = 0;
+            break;
+        }
+
+        // Interest for the whole chunk in one pass over the columns; only the
+        // records that change are touched afterwards
+        for (size_t i = 0; i < n; i++) {
+            cols.balance[i] = chunk[i].balance;
+            cols.last_interest_date[i] = chunk[i].last_interest_date;
+            cols.locked[i] = chunk[i].locked;
+        }
+        accrueInterestColumns(cols.balance, cols.last_interest_date, cols.daily_rate, n, (int64_t)w->now, 1,
+                              cols.interest, cols.days);
+
+        size_t run_start = n; // first record of the current run of changed records
+        for (size_t i = 0; i <= n && w->ok; i++) {
+            int changed = 0;
+            if (i < n && !cols.locked[i]) { // Skips locked accounts and tombstones
+                struct Account *a = &chunk[i];
+                if (cols.last_interest_date[i] == 0) {
+                    a->last_interest_date = (long)w->now; // New account: start the period today
+                    changed = 1;
+                } else if (cols.days[i] > 0) {
+                    a->balance += cols.interest[i];
+                    a->last_interest_date = (long)w->now;
+                    changed = 1;
+                    if (!w->apply) {
+                        w->credited++;
+                        w->ok = interestWorkerPost(w, a, cols.interest[i], cols.days[i]);
+                    }
+                }
+            }
+            if (!w->apply) continue;
+            if (changed && run_start == n) run_start = i;
+            if (!changed && run_start < n) {
+                w->ok = w->ok && fseek(fp, (base + (long)run_start) * (long)sizeof(struct Account), SEEK_SET) == 0 &&
+                        fwrite(&chunk[run_start], sizeof(struct Account), i - run_start, fp) == i - run_start;
+                run_start = n;
+            }
+        }
+        if (w->apply && fflush(fp) != 0) w->ok = 0;
+        if (w->ok) w->scanned += (long)n;
+    }
+
+    free(chunk);
+    free(cols.balance);
+    free(cols.last_interest_date);
+    free(cols.daily_rate);
+    free(cols.locked);
+    free(cols.interest);
+    free(cols.days);
+    if (fp && fclose(fp) != 0) w->ok = 0;
+    return NULL;
+}
+
+// Workers for a run over `records` accounts, at most `limit`
+static int interestWorkerCount(long records, int limit) {
+    int workers = limit;
+#ifdef _WIN32
+    workers = 1;
+#else
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (workers > INTEREST_MAX_WORKERS) workers = INTEREST_MAX_WORKERS;
+    if ((long)workers * INTEREST_MIN_WORKER_RECORDS > records)
+        workers = (int)(records / INTEREST_MIN_WORKER_RECORDS);
+    if (workers < 1) workers = 1;
+    return workers;
+}
+
+// Runs one pass of the workers (see struct InterestWorker), this thread
+// taking the first range; returns 0 if any of them failed
+static int interestPass(struct InterestWorker *w, int workers, int apply) {
+    for (int i = 0; i < workers; i++) {
+        w[i].apply = apply;
+        w[i].scanned = 0;
+    }
+#ifndef _WIN32
+    pthread_t threads[INTEREST_MAX_WORKERS];
+    int started_threads[INTEREST_MAX_WORKERS];
+    for (int i = 1; i < workers; i++)
+        started_threads[i] = pthread_create(&threads[i], NULL, interestWorkerRun, &w[i]) == 0;
+    interestWorkerRun(&w[0]);
+    for (int i = 1; i < workers; i++) {
+        if (started_threads[i])
+            pthread_join(threads[i], NULL);
+        else
+            interestWorkerRun(&w[i]);
+    }
+#else
+    interestWorkerRun(&w[0]);
+#endif
+    int ok = 1;
+    for (int i = 0; i < workers; i++)
+        if (!w[i].ok) ok = 0;
+    return ok;
+}
+
+// Writes the balances of a run whose postings are all logged and syncs
+// ACCOUNTS_FILE. Records already written are left as they are: their
+// last_interest_date is the run's time, so no days are due on them.
+// Needs every account lock.
+static int interestApply(time_t now, long records, int workers, long *scanned) {
+    struct InterestWorker *w = calloc((size_t)workers, sizeof(struct InterestWorker));
+    if (!w) return 0;
+    for (int i = 0; i < workers; i++) {
+        w[i].first = records * i / workers;
+        w[i].end = records * (i + 1) / workers;
+        w[i].now = now;
+    }
+    int ok = interestPass(w, workers, 1);
+    if (scanned) {
+        *scanned = 0;
+        for (int i = 0; i < workers; i++) *scanned += w[i].scanned;
+    }
+    free(w);
+    accountStoreChanged();
+
+    FILE *fp = fopen(ACCOUNTS_FILE, "rb+");
+    if (!fp || !syncFile(fp)) ok = 0;
+    if (fp) fclose(fp);
+    return ok;
+}
+
+static int truncateFile(FILE *fp, long size);
+
+// Finishes or undoes a scheduled interest run that INTEREST_RUN_FILE shows
+// was interrupted. If all its postings reached TRANSACTIONS_FILE, the
+// balances are written; if only part of them did, that tail is cut off and
+// no balance changes. A marker whose postings are not at log_start belongs
+// to a run whose append failed and was rolled back; it is just removed.
+// Runs at startup before the transaction log is opened, and again before
+// each interest run and archive. Returns 0 if the run could not be settled.
+int interestRecover(void) {
+    FILE *fp = fopen(INTEREST_RUN_FILE, "rb");
+    if (!fp) return 1;
+    struct InterestRunRecord run;
+    int valid = fread(&run, sizeof(run), 1, fp) == 1 &&
+                memcmp(run.magic, INTEREST_RUN_MAGIC, INTEREST_RUN_MAGIC_LEN) == 0 && run.log_start >= 0 &&
+                run.postings >= 0;
+    fclose(fp);
+    if (!valid) return remove(INTEREST_RUN_FILE) == 0; // Torn: written before any posting
+
+    accountLockAll();
+    // Leading records from log_start that are postings of this run
+    long logged = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+    long ours = 0;
+    FILE *tx_fp = logged > run.log_start ? fopen(TRANSACTIONS_FILE, "rb") : NULL;
+    if (tx_fp && fseek(tx_fp, (long)run.log_start * (long)sizeof(struct Transaction), SEEK_SET) == 0) {
+        struct Transaction t;
+        while (ours < run.postings && fread(&t, sizeof(t), 1, tx_fp) == 1 && t.type == INTEREST_CREDIT &&
+               t.timestamp == run.now)
+            ours++;
+    }
+    if (tx_fp) fclose(tx_fp);
+
+    int ok = 1;
+    if (ours == run.postings) {
+        long records = fileRecordCount(ACCOUNTS_FILE, sizeof(struct Account));
+        ok = interestApply((time_t)run.now, records, interestWorkerCount(records, interest_workers), NULL);
+        if (ok) printf(YELLOW "Finished an interrupted interest run.\n" RESET);
+    } else if (ours > 0 && run.log_start + ours == logged) {
+        // The crash came while the postings were written: drop them.
+        // transactionIndexOpen re-indexes the log once it is shorter.
+        FILE *tx_cut = fopen(TRANSACTIONS_FILE, "rb+");
+        FILE *idx_cut = fopen(TRANSACTIONS_INDEX_FILE, "rb+");
+        long idx_records = fileRecordCount(TRANSACTIONS_INDEX_FILE, sizeof(long));
+        ok = tx_cut && truncateFile(tx_cut, (long)run.log_start * (long)sizeof(struct Transaction)) && syncFile(tx_cut);
+        if (ok && idx_cut && idx_records > run.log_start)
+            ok = truncateFile(idx_cut, (long)run.log_start * (long)sizeof(long));
+        if (tx_cut) fclose(tx_cut);
+        if (idx_cut) fclose(idx_cut);
+        if (ok) printf(YELLOW "Rolled back an interrupted interest run; run it again.\n" RESET);
+    }
+    if (ok) ok = remove(INTEREST_RUN_FILE) == 0;
+    accountUnlockAll();
+    return ok;
 }
 
 // Function to process scheduled interest for all eligible accounts
 void processScheduledInterest() {
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb+");
-    if (!fp) {
+    // Records are rewritten below without going through the WAL or the store,
+    // so no other operation may run meanwhile
+    if (!walCheckpoint()) {
+        printf(RED "Error: the interest run needs the data files synced first.\n" RESET);
+        return;
+    }
+    if (!interestRecover()) {
+        printf(RED "Error: an earlier interest run could not be finished.\n" RESET);
+        return;
+    }
+    accountLockAll();
+    accountStoreChanged();
+
+    long records = fileRecordCount(ACCOUNTS_FILE, sizeof(struct Account));
+    if (records == 0) {
+        accountUnlockAll();
         printf(RED "Error opening accounts file.\n" RESET);
         return;
     }
-    
-    struct Account a;
-    long pos;
-    int processed_count = 0;
-    
+
+    int workers = interestWorkerCount(records, interest_workers);
+    struct InterestWorker *w = calloc((size_t)workers, sizeof(struct InterestWorker));
+    if (!w) {
+        accountUnlockAll();
+        printf(RED "Not enough memory for the interest run.\n" RESET);
+        return;
+    }
+
     printf(BLUE "\n--- Processing Scheduled Interest ---\n" RESET);
-    
-    while (fread(&a, sizeof(struct Account), 1, fp)) {
-        pos = ftell(fp) - sizeof(struct Account);
-        
-        // Skip locked accounts
-        if (a.locked) continue;
-        
-        // Initialize last_interest_date if it's 0 (new account)
-        if (a.last_interest_date == 0) {
-            a.last_interest_date = time(NULL);
-            fseek(fp, pos, SEEK_SET);
-            fwrite(&a, sizeof(struct Account), 1, fp);
-            continue;
+    long long started = monotonicMillis();
+    time_t now = time(NULL);
+    for (int i = 0; i < workers; i++) {
+        w[i].first = records * i / workers;
+        w[i].end = records * (i + 1) / workers;
+        w[i].now = now;
+    }
+    int ok = interestPass(w, workers, 0);
+
+    // Merge the workers' postings in file order
+    size_t total = 0, log_total = 0;
+    long scanned = 0, credited = 0;
+    for (int i = 0; i < workers; i++) {
+        total += w[i].posting_count;
+        log_total += w[i].log_len;
+        scanned += w[i].scanned;
+        credited += w[i].credited;
+    }
+    struct Transaction *postings = ok && total ? malloc(total * sizeof(struct Transaction)) : NULL;
+    char *log_text = ok && log_total ? malloc(log_total) : NULL;
+    if ((total && !postings) || (log_total && !log_text)) ok = 0;
+    if (ok) {
+        size_t at = 0, log_at = 0;
+        for (int i = 0; i < workers; i++) {
+            if (w[i].posting_count) memcpy(postings + at, w[i].postings, w[i].posting_count * sizeof(struct Transaction));
+            if (w[i].log_len) memcpy(log_text + log_at, w[i].log_text, w[i].log_len);
+            at += w[i].posting_count;
+            log_at += w[i].log_len;
         }
-        
-        // Calculate interest if needed
-        if (daysSinceLastInterest(a.last_interest_date) > 0 && a.balance > 0) {
-            calculateInterestForAccount(&a);
-            
-            // Write updated account back to file
-            fseek(fp, pos, SEEK_SET);
-            fwrite(&a, sizeof(struct Account), 1, fp);
-            fflush(fp);
-            
-            processed_count++;
+    }
+    for (int i = 0; i < workers; i++) {
+        free(w[i].postings);
+        free(w[i].log_text);
+    }
+    free(w);
+
+    // Nothing has been written so far. The marker goes first, then the
+    // postings; only then are the balances written.
+    int logged = 0;
+    if (ok) {
+        struct InterestRunRecord run;
+        memset(&run, 0, sizeof(run));
+        memcpy(run.magic, INTEREST_RUN_MAGIC, INTEREST_RUN_MAGIC_LEN);
+        run.now = (int64_t)now;
+        run.postings = (int64_t)total;
+        ok = transactionLogFlush();
+        run.log_start = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+        FILE *run_fp = ok ? fopen(INTEREST_RUN_FILE, "wb") : NULL;
+        ok = run_fp && fwrite(&run, sizeof(run), 1, run_fp) == 1 && syncFile(run_fp);
+        if (run_fp && fclose(run_fp) != 0) ok = 0;
+        if (ok) {
+            logged = transactionLogAppendBatch(postings, total);
+            if (!logged) ok = 0;
         }
+        if (!logged) remove(INTEREST_RUN_FILE); // The append rolled back: no posting, no balance
     }
-    
-    fclose(fp);
-    printf(GREEN "Processed interest for %d accounts.\n" RESET, processed_count);
+    if (logged) {
+        FILE *log_fp = log_total ? fopen(INTEREST_LOG_FILE, "a") : NULL;
+        if (log_total && !log_fp) ok = 0;
+        if (log_fp) {
+            if (fwrite(log_text, 1, log_total, log_fp) != log_total) ok = 0;
+            if (fclose(log_fp) != 0) ok = 0;
+        }
+        long applied = 0;
+        if (interestApply(now, records, workers, &applied) && remove(INTEREST_RUN_FILE) == 0) {
+            scanned = applied;
+        } else {
+            ok = 0;
+            printf(RED "Error: not every balance was credited; the next interest run finishes it.\n" RESET);
+        }
+    } else {
+        credited = 0;
+    }
+    free(postings);
+    free(log_text);
+    accountUnlockAll();
+
+    double seconds = (double)(monotonicMillis() - started) / 1000.0;
+    if (!ok) printf(RED "Error: the interest run did not complete; run it again to finish.\n" RESET);
+    printf(GREEN "Processed interest for %ld accounts.\n" RESET, credited);
+    printf(GREEN "Scanned %ld accounts in %.2f s (%.0f accounts/sec, %d worker(s)).\n" RESET,
+           scanned, seconds, seconds > 0 ? scanned / seconds : (double)scanned, workers);
 }
 
 // Function to view interest calculation log
@@ -348,7 +1493,7 @@ void initializeLastInterestDate() {
         pos = ftell(fp) - sizeof(struct Account);
         
         // If last_interest_date is 0, initialize it to current date
-        if (a.last_interest_date == 0) {
+        if (a.last_interest_date == 0 && !accountIsTombstone(&a)) {
             a.last_interest_date = time(NULL);
             fseek(fp, pos, SEEK_SET);
             fwrite(&a, sizeof(struct Account), 1, fp);
@@ -359,1408 +1504,9263 @@ void initializeLastInterestDate() {
 }
 
 // =========================================================================
-// EXISTING FUNCTION IMPLEMENTATIONS
+// LOCKING
 // =========================================================================
 
-void sha256_transform(SHA256_CTX *ctx, const BYTE data[])
-{
-    WORD a,b,c,d,e,f,g,h,i,j,t1,t2,m[64];
+// DATA_LOCK_FILE holds an exclusive lock for as long as the data files are
+// open, so a second instance refuses to start instead of corrupting them.
+//
+// Within the process, shared state has its own locks so that server workers
+// can run operations concurrently:
+//   store_lock          - account store and account index. Record reads and
+//                         writes share it when the store is memory-mapped;
+//                         the stdio backend seeks, so they take it exclusively.
+//   store_commit_mutex  - the mmap store's operations-since-msync counter
+//   wal_mutex/wal_cond  - WAL file, counters and commits in flight; a
+//                         checkpoint waits until no commit is between its
+//                         write and its apply
+//   tx_log_mutex/tx_log_cond - the transaction log group buffer, chain
+//                         heads and the record numbers reserved by WAL
+//                         commits; direct appends wait until none are
+//                         outstanding
+//   account stripes     - serialize operations on the same account; all of
+//                         them are held while compaction swaps the file
+//   compaction_mutex    - background compaction state
+//   exchange_mutex      - reloading the exchange rate table and freeing the
+//                         ones it replaced (lookups do not lock)
+//   session_mutex       - the customer session table
+// On Windows the program is single-threaded and these are no-ops.
 
-    static const WORD k[64] = {
-        0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,
-        0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
-        0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,
-        0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
-        0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,
-        0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
-        0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,
-        0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
-        0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,
-        0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
-        0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,
-        0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
-        0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,
-        0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
-        0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,
-        0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
-    };
-
-    for (i=0,j=0; i < 16; ++i, j += 4)
-        m[i] = (data[j] << 24) | (data[j+1] << 16) | (data[j+2] << 8) | (data[j+3]);
-    for ( ; i < 64; ++i)
-        m[i] = SIG1(m[i-2]) + m[i-7] + SIG0(m[i-15]) + m[i-16];
-
-    a = ctx->state[0];
-    b = ctx->state[1];
-    c = ctx->state[2];
-    d = ctx->state[3];
-    e = ctx->state[4];
-    f = ctx->state[5];
-    g = ctx->state[6];
-    h = ctx->state[7];
-
-    for (i=0; i < 64; ++i) {
-        t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
-        t2 = EP0(a) + MAJ(a,b,c);
-        h = g;
-        g = f;
-        f = e;
-        e = d + t1;
-        d = c;
-        c = b;
-        b = a;
-        a = t1 + t2;
-    }
-
-    ctx->state[0] += a;
-    ctx->state[1] += b;
-    ctx->state[2] += c;
-    ctx->state[3] += d;
-    ctx->state[4] += e;
-    ctx->state[5] += f;
-    ctx->state[6] += g;
-    ctx->state[7] += h;
+#ifdef _WIN32
+#define MUTEX_LOCK(m)
+#define MUTEX_UNLOCK(m)
+#define COND_WAIT(c, m)
+#define COND_BROADCAST(c)
+#define ATOMIC_INC(p) (++*(p))
+#define ATOMIC_LOAD(p) (*(p))
+#define ATOMIC_LOAD_ACQUIRE(p) (*(p))
+#define ATOMIC_STORE_RELEASE(p, v) (*(p) = (v))
+#define ATOMIC_ADD_SEQ_CST(p, v) (*(p) += (v))
+#define ATOMIC_LOAD_SEQ_CST(p) (*(p))
+#define ATOMIC_STORE_SEQ_CST(p, v) (*(p) = (v))
+#else
+#define MUTEX_LOCK(m) pthread_mutex_lock(m)
+#define MUTEX_UNLOCK(m) pthread_mutex_unlock(m)
+#define COND_WAIT(c, m) pthread_cond_wait(c, m)
+#define COND_BROADCAST(c) pthread_cond_broadcast(c)
+#define ATOMIC_INC(p) __atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define ATOMIC_ADD_SEQ_CST(p, v) __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_SEQ_CST(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE_SEQ_CST(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#endif
+
+#ifdef _WIN32
+static int data_lock_fd = -1;
+
+int acquireDataLock(void) {
+    data_lock_fd = _open(DATA_LOCK_FILE, _O_RDWR | _O_CREAT, 0600);
+    if (data_lock_fd < 0) return 0;
+    if (_locking(data_lock_fd, _LK_NBLCK, 1) != 0) {
+        _close(data_lock_fd);
+        data_lock_fd = -1;
+        return 0;
+    }
+    return 1;
 }
 
-void sha256_init(SHA256_CTX *ctx)
-{
-    ctx->datalen = 0;
-    ctx->bitlen = 0;
-    ctx->state[0] = 0x6a09e667;
-    ctx->state[1] = 0xbb67ae85;
-    ctx->state[2] = 0x3c6ef372;
-    ctx->state[3] = 0xa54ff53a;
-    ctx->state[4] = 0x510e527f;
-    ctx->state[5] = 0x9b05688c;
-    ctx->state[6] = 0x1f83d9ab;
-    ctx->state[7] = 0x5be0cd19;
+void releaseDataLock(void) {
+    if (data_lock_fd < 0) return;
+    _lseek(data_lock_fd, 0, SEEK_SET);
+    _locking(data_lock_fd, _LK_UNLCK, 1);
+    _close(data_lock_fd);
+    data_lock_fd = -1;
 }
 
-void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len)
-{
-    WORD i;
-
-    for (i=0; i < len; ++i) {
-        ctx->data[ctx->datalen] = data[i];
-        ctx->datalen++;
-        if (ctx->datalen == 64) {
-            sha256_transform(ctx, ctx->data);
-            ctx->bitlen += 512;
-            ctx->datalen = 0;
-        }
+static void storeLockRead(void) {}
+static void storeLockAccess(void) {}
+static void storeLockWrite(void) {}
+static void storeUnlock(void) {}
+void accountLock(int acc_no) { (void)acc_no; }
+void accountUnlock(int acc_no) { (void)acc_no; }
+void accountLockAll(void) {}
+void accountUnlockAll(void) {}
+#else
+static int data_lock_fd = -1;
+
+int acquireDataLock(void) {
+    data_lock_fd = open(DATA_LOCK_FILE, O_RDWR | O_CREAT, 0600);
+    if (data_lock_fd < 0) return 0;
+    if (flock(data_lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        close(data_lock_fd);
+        data_lock_fd = -1;
+        return 0;
     }
+    return 1;
 }
 
-void sha256_final(SHA256_CTX *ctx, BYTE hash[])
-{
-    WORD i;
+void releaseDataLock(void) {
+    if (data_lock_fd < 0) return;
+    flock(data_lock_fd, LOCK_UN);
+    close(data_lock_fd);
+    data_lock_fd = -1;
+}
 
-    i = ctx->datalen;
+static pthread_rwlock_t store_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t store_commit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wal_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t tx_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tx_log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t compaction_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t exchange_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t account_stripes[ACCOUNT_LOCK_STRIPES];
+static pthread_once_t account_stripes_once = PTHREAD_ONCE_INIT;
+
+extern int account_store_use_mmap;
+
+// Index lookups only
+static void storeLockRead(void) {
+    pthread_rwlock_rdlock(&store_lock);
+}
 
-    if (ctx->datalen < 56) {
-        ctx->data[i++] = 0x80;
-        while (i < 56)
-            ctx->data[i++] = 0x00;
-    }
-    else {
-        ctx->data[i++] = 0x80;
-        while (i < 64)
-            ctx->data[i++] = 0x00;
-        sha256_transform(ctx, ctx->data);
-        memset(ctx->data, 0, 56);
-    }
+// Reading or writing one record
+static void storeLockAccess(void) {
+    if (account_store_use_mmap)
+        pthread_rwlock_rdlock(&store_lock);
+    else
+        pthread_rwlock_wrlock(&store_lock);
+}
 
-    ctx->bitlen += ctx->datalen * 8;
-    ctx->data[63] = ctx->bitlen;
-    ctx->data[62] = ctx->bitlen >> 8;
-    ctx->data[61] = ctx->bitlen >> 16;
-    ctx->data[60] = ctx->bitlen >> 24;
-    ctx->data[59] = ctx->bitlen >> 32;
-    ctx->data[58] = ctx->bitlen >> 40;
-    ctx->data[57] = ctx->bitlen >> 48;
-    ctx->data[56] = ctx->bitlen >> 56;
-    sha256_transform(ctx, ctx->data);
+// Appending or remapping
+static void storeLockWrite(void) {
+    pthread_rwlock_wrlock(&store_lock);
+}
 
-    for (i=0; i < 4; ++i) {
-        hash[i]      = (ctx->state[0] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 4]  = (ctx->state[1] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 8]  = (ctx->state[2] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 12] = (ctx->state[3] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 16] = (ctx->state[4] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 20] = (ctx->state[5] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 24] = (ctx->state[6] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 28] = (ctx->state[7] >> (24 - i * 8)) & 0x000000ff;
-    }
+static void storeUnlock(void) {
+    pthread_rwlock_unlock(&store_lock);
 }
 
-void sha256(const BYTE *data, size_t len, BYTE *out_hash)
-{
-    SHA256_CTX ctx;
-    sha256_init(&ctx);
-    sha256_update(&ctx, data, len);
-    sha256_final(&ctx, out_hash);
+static void accountStripesInit(void) {
+    for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) pthread_mutex_init(&account_stripes[i], NULL);
 }
 
-void flush_stdin(void)
-{
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF);
+static unsigned int accountStripe(int acc_no) {
+    unsigned int h = (unsigned int)acc_no * 2654435761U;
+    return (h >> 16) % ACCOUNT_LOCK_STRIPES;
 }
 
-void getMaskedInput(char *buffer, size_t size)
-{
-    if (size == 0) return;
-    size_t idx = 0;
-#ifdef _WIN32
-    int ch;
-    while ((ch = _getch()) != '\r' && ch != EOF) {
-        if (ch == '\b' || ch == 127) {
-            if (idx > 0) {
-                idx--;
-                printf("\b \b");
-            }
-        } else if (ch >= ' ' && ch <= '~' && idx + 1 < size) {
-            buffer[idx++] = (char)ch;
-            printf("*");
-        }
-    }
-    buffer[idx] = '\0';
-    printf("\n");
-#else
-    struct termios oldt, newt;
-    tcgetattr(STDIN_FILENO, &oldt);
-    newt = oldt;
-    newt.c_lflag &= ~(ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+void accountLock(int acc_no) {
+    pthread_once(&account_stripes_once, accountStripesInit);
+    pthread_mutex_lock(&account_stripes[accountStripe(acc_no)]);
+}
 
-    int ch;
-    while ((ch = getchar()) != '\n' && ch != EOF) {
-        if (ch == 127 || ch == '\b') {
-            if (idx > 0) {
-                idx--;
-                printf("\b \b");
-            }
-        } else if (ch >= ' ' && ch <= '~' && idx + 1 < size) {
-            buffer[idx++] = (char)ch;
-            printf("*");
-        }
+void accountUnlock(int acc_no) {
+    pthread_mutex_unlock(&account_stripes[accountStripe(acc_no)]);
+}
+
+// Waits for every operation in progress and holds off new ones. Stripes are
+// taken in index order, the same order accountLockPair uses.
+void accountLockAll(void) {
+    pthread_once(&account_stripes_once, accountStripesInit);
+    for (int i = 0; i < ACCOUNT_LOCK_STRIPES; i++) pthread_mutex_lock(&account_stripes[i]);
+}
+
+void accountUnlockAll(void) {
+    for (int i = ACCOUNT_LOCK_STRIPES - 1; i >= 0; i--) pthread_mutex_unlock(&account_stripes[i]);
+}
+#endif
+
+// Locks both accounts of a transfer. Several accounts share a stripe, so the
+// locks are taken in stripe order (acc_no order within a stripe is implied,
+// since the stripe is locked once); any fixed order rules out deadlock.
+void accountLockPair(int acc_a, int acc_b) {
+#ifndef _WIN32
+    unsigned int sa = accountStripe(acc_a), sb = accountStripe(acc_b);
+    if (sa == sb) {
+        accountLock(acc_a);
+    } else if (sa < sb) {
+        accountLock(acc_a);
+        accountLock(acc_b);
+    } else {
+        accountLock(acc_b);
+        accountLock(acc_a);
     }
-    buffer[idx] = '\0';
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    printf("\n");
+#else
+    (void)acc_a;
+    (void)acc_b;
 #endif
 }
 
-void printHex(const unsigned char *data, size_t len)
-{
-    for (size_t i = 0; i < len; ++i)
-        printf("%02x", data[i]);
-    printf("\n");
+void accountUnlockPair(int acc_a, int acc_b) {
+#ifndef _WIN32
+    accountUnlock(acc_a);
+    if (accountStripe(acc_a) != accountStripe(acc_b)) accountUnlock(acc_b);
+#else
+    (void)acc_a;
+    (void)acc_b;
+#endif
 }
 
-void generateSalt(unsigned char *salt, size_t length) {
-    for (size_t i = 0; i < length; i++) {
-        salt[i] = (unsigned char)(rand() % 256);
+// =========================================================================
+// CURRENCIES
+// =========================================================================
+
+// Transaction records store a currency as a 16-bit id instead of its code.
+// Registered currencies use their ISO 4217 numeric code (INR = 356); any
+// other three-letter code gets CURRENCY_ID_PACKED_BASE + its letters in base
+// 26. Both are fixed by the code alone, so ids never need a lookup file.
+struct CurrencyInfo {
+    char code[4];
+    uint16_t id;
+};
+
+static const struct CurrencyInfo currency_registry[] = {
+    {"AED", 784}, {"AUD", 36},  {"BDT", 50},  {"BRL", 986}, {"CAD", 124}, {"CHF", 756},
+    {"CNY", 156}, {"DKK", 208}, {"EUR", 978}, {"GBP", 826}, {"HKD", 344}, {"IDR", 360},
+    {"INR", 356}, {"JPY", 392}, {"KRW", 410}, {"LKR", 144}, {"MXN", 484}, {"NOK", 578},
+    {"NPR", 524}, {"NZD", 554}, {"PKR", 586}, {"RUB", 643}, {"SAR", 682}, {"SEK", 752},
+    {"SGD", 702}, {"THB", 764}, {"TRY", 949}, {"USD", 840}, {"ZAR", 710},
+};
+#define CURRENCY_REGISTRY_COUNT (sizeof(currency_registry) / sizeof(currency_registry[0]))
+
+// "USD" -> 0..26^3-1, -1 for anything but three capital letters
+static int currencyLetters(const char *code) {
+    int letters = 0;
+    for (int i = 0; i < 3; i++) {
+        if (code[i] < 'A' || code[i] > 'Z') return -1;
+        letters = letters * 26 + (code[i] - 'A');
     }
+    return code[3] == '\0' ? letters : -1;
 }
 
-void hashPin(const char *pin, const unsigned char *salt, size_t salt_len, unsigned char *out_hash) {
-    SHA256_CTX ctx;
-    sha256_init(&ctx);
-    sha256_update(&ctx, salt, salt_len);
-    sha256_update(&ctx, (const BYTE *)pin, strlen(pin));
-    sha256_final(&ctx, out_hash);
+// Returns the id of code, or CURRENCY_ID_NONE if it is not a currency code
+uint16_t currencyId(const char *code) {
+    int letters = currencyLetters(code);
+    if (letters < 0) return CURRENCY_ID_NONE;
+    for (size_t i = 0; i < CURRENCY_REGISTRY_COUNT; i++) {
+        if (currencyLetters(currency_registry[i].code) == letters) return currency_registry[i].id;
+    }
+    return (uint16_t)(CURRENCY_ID_PACKED_BASE + letters);
 }
 
-int loadAdminCredentials(unsigned char *salt, unsigned char *hash) {
-    FILE *fp = fopen(ADMIN_FILE, "rb");
-    if (!fp) return 0;
-    AdminRecord rec;
-    size_t r = fread(&rec, sizeof(AdminRecord), 1, fp);
-    fclose(fp);
-    if (r != 1) return 0;
-    if (memcmp(rec.magic, ADMIN_MAGIC, ADMIN_MAGIC_LEN) != 0) return 0;
-    memcpy(salt, rec.salt, SALT_SIZE);
-    memcpy(hash, rec.pin_hash, HASH_SIZE);
-    return 1;
+// Writes the code for id into code (empty for an unknown id) and returns it
+const char *currencyCode(uint16_t id, char code[4]) {
+    code[0] = '\0';
+    if (id >= CURRENCY_ID_PACKED_BASE && id < CURRENCY_ID_LIMIT) {
+        int letters = id - CURRENCY_ID_PACKED_BASE;
+        code[0] = (char)('A' + letters / (26 * 26));
+        code[1] = (char)('A' + letters / 26 % 26);
+        code[2] = (char)('A' + letters % 26);
+        code[3] = '\0';
+        return code;
+    }
+    for (size_t i = 0; i < CURRENCY_REGISTRY_COUNT; i++) {
+        if (currency_registry[i].id == id && id != CURRENCY_ID_NONE) {
+            memcpy(code, currency_registry[i].code, 4);
+            break;
+        }
+    }
+    return code;
 }
 
-int saveAdminCredentials(const unsigned char *salt, const unsigned char *hash) {
-    FILE *fp = fopen(ADMIN_FILE, "wb");
-    if (!fp) return 0;
-    AdminRecord rec;
-    memset(&rec, 0, sizeof(rec));
-    memcpy(rec.magic, ADMIN_MAGIC, ADMIN_MAGIC_LEN);
-    memcpy(rec.salt, salt, SALT_SIZE);
-    memcpy(rec.pin_hash, hash, HASH_SIZE);
-    size_t w = fwrite(&rec, sizeof(AdminRecord), 1, fp);
-    fclose(fp);
-#ifndef _WIN32
-    chmod(ADMIN_FILE, S_IRUSR | S_IWUSR);
-#endif
-    return w == 1;
+// =========================================================================
+// EXCHANGE RATES
+// =========================================================================
+
+// EXCHANGE_RATES_FILE is loaded into an immutable table: each currency id maps
+// to a row of a dense rate matrix, so a lookup is two array reads. Codes that
+// have no currency id fall back to a scan of the cached records. The file's mtime and size
+// are checked at most every EXCHANGE_RATES_CHECK_MS; a changed file is loaded
+// into a new table that replaces the old one with a single pointer store.
+// Readers never lock; they count themselves in exchange_readers while they
+// use a table. A replaced table is kept until a check finds no other lookup
+// in progress, which cannot be reading it then, and is freed there.
+struct ExchangeRateTable {
+    int missing; // EXCHANGE_RATES_FILE could not be read
+    time_t mtime;
+    off_t size;
+    int currency_count;
+    unsigned char row[CURRENCY_ID_LIMIT]; // currency id -> matrix row + 1, 0 = no rates
+    unsigned char has[EXCHANGE_MAX_CURRENCIES][EXCHANGE_MAX_CURRENCIES];
+    float rate[EXCHANGE_MAX_CURRENCIES][EXCHANGE_MAX_CURRENCIES];
+    struct ExchangeRate *records;
+    size_t record_count;
+    int missing_warned, pair_warned; // each warning is printed once per table
+    struct ExchangeRateTable *replaced; // older tables, freed together
+};
+
+static struct ExchangeRateTable *exchange_table = NULL;
+static struct ExchangeRateTable *exchange_retired = NULL; // replaced tables not yet freed
+static int exchange_readers = 0; // lookups using a table
+static long long exchange_checked_ms = 0;
+
+static void exchangeRatesFree(struct ExchangeRateTable *t) {
+    while (t) {
+        struct ExchangeRateTable *older = t->replaced;
+        free(t->records);
+        free(t);
+        t = older;
+    }
 }
 
-int setAdminPinInteractive(void) {
-    char pin1[64], pin2[64];
+static struct ExchangeRateTable *exchangeRatesLoad(void) {
+    struct ExchangeRateTable *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
 
-    while (1) {
-        printf(YELLOW "\nNo admin PIN configured.\n" RESET);
-        printf(GREEN "Set admin PIN (4-12 digits): " RESET);
-        getMaskedInput(pin1, sizeof(pin1));
-        size_t n = strlen(pin1);
-        if (n < 4 || n > 12 || strspn(pin1, "0123456789") != n) {
-            printf(RED "Invalid PIN. Must be 4-12 digits.\n" RESET);
-            continue;
+    FILE *fp = fopen(EXCHANGE_RATES_FILE, "rb");
+    struct stat st;
+    if (!fp || fstat(fileno(fp), &st) != 0) {
+        if (fp) fclose(fp);
+        t->missing = 1;
+        return t;
+    }
+    t->mtime = st.st_mtime;
+    t->size = st.st_size;
+
+    size_t capacity = (size_t)st.st_size / sizeof(struct ExchangeRate);
+    t->records = malloc((capacity ? capacity : 1) * sizeof(struct ExchangeRate));
+    if (!t->records) {
+        fclose(fp);
+        free(t);
+        return NULL;
+    }
+    t->record_count = fread(t->records, sizeof(struct ExchangeRate), capacity, fp);
+    fclose(fp);
+
+    for (size_t i = 0; i < t->record_count; i++) {
+        struct ExchangeRate *r = &t->records[i];
+        r->from_currency[3] = '\0';
+        r->to_currency[3] = '\0';
+        uint16_t from = currencyId(r->from_currency), to = currencyId(r->to_currency);
+        if (from == CURRENCY_ID_NONE || to == CURRENCY_ID_NONE) continue; // Found by the scan only
+        if (!t->row[from] && t->currency_count < EXCHANGE_MAX_CURRENCIES) t->row[from] = (unsigned char)++t->currency_count;
+        if (!t->row[to] && t->currency_count < EXCHANGE_MAX_CURRENCIES) t->row[to] = (unsigned char)++t->currency_count;
+        if (!t->row[from] || !t->row[to]) continue;
+        int a = t->row[from] - 1, b = t->row[to] - 1;
+        if (!t->has[a][b]) { // The first record for a pair wins, as with the old scan
+            t->has[a][b] = 1;
+            t->rate[a][b] = r->rate;
         }
+    }
+    return t;
+}
 
-        printf(GREEN "Confirm admin PIN: " RESET);
-        getMaskedInput(pin2, sizeof(pin2));
-        if (strcmp(pin1, pin2) != 0) {
-            printf(RED "PINs do not match. Try again.\n" RESET);
-            continue;
+// The current table, which stays valid until exchangeRatesRelease. The
+// reader is counted before the table pointer is read, and a reload publishes
+// the new table before it reads the count (all sequentially consistent), so a
+// count of one, the caller itself, means no lookup holds a replaced table.
+static struct ExchangeRateTable *exchangeRatesAcquire(void) {
+    ATOMIC_ADD_SEQ_CST(&exchange_readers, 1);
+    struct ExchangeRateTable *t = ATOMIC_LOAD_SEQ_CST(&exchange_table);
+    long long now = monotonicMillis();
+    if (t && now - ATOMIC_LOAD(&exchange_checked_ms) < EXCHANGE_RATES_CHECK_MS) return t;
+
+    MUTEX_LOCK(&exchange_mutex);
+    t = exchange_table;
+    if (!t || now - exchange_checked_ms >= EXCHANGE_RATES_CHECK_MS) {
+        struct stat st;
+        int exists = stat(EXCHANGE_RATES_FILE, &st) == 0;
+        if (!t || exists == t->missing || (exists && (st.st_mtime != t->mtime || st.st_size != t->size))) {
+            struct ExchangeRateTable *fresh = exchangeRatesLoad();
+            if (fresh) {
+                if (t) {
+                    t->replaced = exchange_retired;
+                    exchange_retired = t;
+                }
+                ATOMIC_STORE_SEQ_CST(&exchange_table, fresh);
+                t = fresh;
+            }
+        }
+        if (exchange_retired && ATOMIC_LOAD_SEQ_CST(&exchange_readers) == 1) {
+            exchangeRatesFree(exchange_retired);
+            exchange_retired = NULL;
         }
+        ATOMIC_STORE_RELEASE(&exchange_checked_ms, now);
+    }
+    MUTEX_UNLOCK(&exchange_mutex);
+    return t;
+}
 
-        unsigned char salt[SALT_SIZE];
-        unsigned char hash[HASH_SIZE];
-        generateSalt(salt, SALT_SIZE);
-        hashPin(pin1, salt, SALT_SIZE, hash);
+static void exchangeRatesRelease(void) {
+    ATOMIC_ADD_SEQ_CST(&exchange_readers, -1);
+}
 
-        memset(pin1, 0, sizeof(pin1));
-        memset(pin2, 0, sizeof(pin2));
+// Frees every table; the next lookup loads the file again. No lookup may be
+// in progress.
+void exchangeRatesClose(void) {
+    MUTEX_LOCK(&exchange_mutex);
+    exchangeRatesFree(exchange_table);
+    exchangeRatesFree(exchange_retired);
+    exchange_table = NULL;
+    exchange_retired = NULL;
+    MUTEX_UNLOCK(&exchange_mutex);
+}
 
-        if (!saveAdminCredentials(salt, hash)) {
-            printf(RED "Failed to save admin PIN. Please try again.\n" RESET);
-            return 0;
-        }
+// The missing-file warning, once per table. t is NULL if no table could be
+// allocated.
+static void exchangeRatesWarnMissing(struct ExchangeRateTable *t) {
+    if (t && (ATOMIC_LOAD(&t->missing_warned) || ATOMIC_INC(&t->missing_warned) != 1)) return;
+    printf(RED "Exchange rates file not found. Using default rate of 1.0.\n" RESET);
+}
 
-        printf(GREEN "Admin PIN set successfully.\n" RESET);
-        return 1;
-    }
+// The missing-pair warning, once per table for the first pair looked up
+// without a rate
+static void exchangeRatesWarnPair(struct ExchangeRateTable *t, const char *from, const char *to) {
+    if (ATOMIC_LOAD(&t->pair_warned) || ATOMIC_INC(&t->pair_warned) != 1) return;
+    printf(RED "No exchange rate found for %s to %s. Using default rate of 1.0 for it and any other pair "
+               "without a rate.\n" RESET, from, to);
 }
 
-int adminInitIfNeeded(void) {
-    unsigned char salt[SALT_SIZE], hash[HASH_SIZE];
-    if (loadAdminCredentials(salt, hash)) return 1;
-    return setAdminPinInteractive();
+// Rate for a pair of currency ids; 0 if the pair has no rate
+static float exchangeRateLookup(const struct ExchangeRateTable *t, uint16_t from, uint16_t to) {
+    if (from >= CURRENCY_ID_LIMIT || to >= CURRENCY_ID_LIMIT) return 0.0f;
+    int a = t->row[from], b = t->row[to];
+    return a && b && t->has[a - 1][b - 1] ? t->rate[a - 1][b - 1] : 0.0f;
 }
 
-int authenticateAdmin(const char *pin_input) {
-    unsigned char salt[SALT_SIZE], stored_hash[HASH_SIZE], input_hash[HASH_SIZE];
-    if (!loadAdminCredentials(salt, stored_hash)) {
-        return 0;
+float getExchangeRateById(uint16_t from, uint16_t to) {
+    if (from == to) return 1.0f;
+
+    struct ExchangeRateTable *t = exchangeRatesAcquire();
+    float rate = 1.0f;
+    if (!t || t->missing) {
+        exchangeRatesWarnMissing(t);
+    } else if ((rate = exchangeRateLookup(t, from, to)) == 0.0f) {
+        char from_code[4], to_code[4];
+        exchangeRatesWarnPair(t, currencyCode(from, from_code), currencyCode(to, to_code));
+        rate = 1.0f;
     }
-    hashPin(pin_input, salt, SALT_SIZE, input_hash);
-    return memcmp(input_hash, stored_hash, HASH_SIZE) == 0;
+    exchangeRatesRelease();
+    return rate;
 }
 
-int accountExists(int acc_no)
-{
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb");
-    if (!fp) return 0;
-    struct Account a;
-    while (fread(&a, sizeof(struct Account), 1, fp)) {
-        if (a.acc_no == acc_no) {
-            fclose(fp);
-            return 1;
-        }
+float getExchangeRate(const char* from, const char* to) {
+    uint16_t from_id = currencyId(from), to_id = currencyId(to);
+    if (from_id != CURRENCY_ID_NONE && to_id != CURRENCY_ID_NONE) return getExchangeRateById(from_id, to_id);
+    if (strcmp(from, to) == 0) return 1.0f;
+
+    struct ExchangeRateTable *t = exchangeRatesAcquire();
+    float rate = 1.0f;
+    if (!t || t->missing) {
+        exchangeRatesWarnMissing(t);
+    } else {
+        size_t i = 0;
+        while (i < t->record_count &&
+               (strcmp(t->records[i].from_currency, from) != 0 || strcmp(t->records[i].to_currency, to) != 0))
+            i++;
+        if (i < t->record_count)
+            rate = t->records[i].rate;
+        else
+            exchangeRatesWarnPair(t, from, to);
     }
-    fclose(fp);
-    return 0;
+    exchangeRatesRelease();
+    return rate;
 }
 
-int authenticate(int acc_no, const char *pin_input) {
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb+");
-    if (!fp) {
-        return 0;
-    }
+// =========================================================================
+// MONEY
+// =========================================================================
 
-    struct Account a;
-    int found = 0;
-    long pos = 0;
+// Balances and amounts are exact integers in minor units. Doubles appear only
+// for display and for rate multiplications, which are rounded back with
+// moneyRound.
 
-    while (fread(&a, sizeof(struct Account), 1, fp) == 1) {
-        if (a.acc_no == acc_no) {
-            found = 1;
-            pos = ftell(fp) - sizeof(struct Account);
-            break;
-        }
+double moneyToDouble(Money amount) {
+    return (double)amount / MONEY_SCALE;
+}
+
+// Rounds a value in minor units to the nearest unit (half away from zero)
+Money moneyRound(double minor_units) {
+    return (Money)llround(minor_units);
+}
+
+// Parses "123", "123.4" or "123.45" exactly. More than two decimals, or
+// amounts beyond 15 integer digits, are rejected.
+int parseMoney(const char *text, Money *out) {
+    const char *p = text;
+    int negative = 0;
+    if (*p == '+' || *p == '-') negative = (*p++ == '-');
+
+    Money units = 0;
+    int digits = 0;
+    while (isdigit((unsigned char)*p)) {
+        if (++digits > 15) return 0;
+        units = units * 10 + (*p++ - '0');
+    }
+
+    Money fraction = 0;
+    int decimals = 0;
+    if (*p == '.') {
+        p++;
+        while (isdigit((unsigned char)*p)) {
+            if (++decimals > 2) return 0;
+            fraction = fraction * 10 + (*p++ - '0');
+        }
+    }
+    if (*p != '\0' || digits + decimals == 0) return 0;
+    if (decimals == 1) fraction *= 10;
+
+    Money value = units * MONEY_SCALE + fraction;
+    *out = negative ? -value : value;
+    return 1;
+}
+
+// Reads one amount token from stdin
+int readMoney(Money *out) {
+    char buf[32];
+    if (scanf("%31s", buf) != 1) return 0;
+    return parseMoney(buf, out);
+}
+
+// Aggregate kernels over a contiguous balance column. The vector paths are
+// chosen at compile time (e.g. -mavx2 or -march=native); every build keeps
+// the scalar loop for the tail and for targets without SSE2.
+Money sumMoney(const Money *values, size_t n) {
+    size_t i = 0;
+    Money total = 0;
+#if defined(__AVX2__)
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_epi64(acc0, _mm256_loadu_si256((const __m256i *)(values + i)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_loadu_si256((const __m256i *)(values + i + 4)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+    total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE2__)
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_epi64(acc0, _mm_loadu_si128((const __m128i *)(values + i)));
+        acc1 = _mm_add_epi64(acc1, _mm_loadu_si128((const __m128i *)(values + i + 2)));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) total += values[i];
+    return total;
+}
+
+// Sum of values[i] for which keys[i] == key
+Money sumMoneyWhere(const Money *values, const uint16_t *keys, uint16_t key, size_t n) {
+    size_t i = 0;
+    Money total = 0;
+#if defined(__AVX2__)
+    __m256i target = _mm256_set1_epi64x(key);
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 4 <= n; i += 4) {
+        __m256i k = _mm256_cvtepu16_epi64(_mm_loadl_epi64((const __m128i *)(keys + i)));
+        __m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+        acc = _mm256_add_epi64(acc, _mm256_and_si256(_mm256_cmpeq_epi64(k, target), v));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__SSE4_1__)
+    __m128i target = _mm_set1_epi64x(key);
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) {
+        int packed;
+        memcpy(&packed, keys + i, sizeof(packed));
+        __m128i k = _mm_cvtepu16_epi64(_mm_cvtsi32_si128(packed));
+        __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+        acc = _mm_add_epi64(acc, _mm_and_si128(_mm_cmpeq_epi64(k, target), v));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    total = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++)
+        if (keys[i] == key) total += values[i];
+    return total;
+}
+
+// =========================================================================
+// RECORD INDEX
+// =========================================================================
+
+// In-memory open-addressing hash table keyed by acc_no. Used for the account
+// index (acc_no -> record in ACCOUNTS_FILE) and the transaction chain heads
+// (acc_no -> newest record in TRANSACTIONS_FILE).
+static size_t recordIndexHash(int acc_no) {
+    unsigned int h = (unsigned int)acc_no;
+    h ^= h >> 16;
+    h *= 0x7feb352dU;
+    h ^= h >> 15;
+    h *= 0x846ca68bU;
+    h ^= h >> 16;
+    return (size_t)h;
+}
+
+static int recordIndexResize(struct RecordIndex *ix, size_t new_capacity) {
+    struct RecordIndexSlot *slots = malloc(new_capacity * sizeof(struct RecordIndexSlot));
+    if (!slots) return 0;
+    for (size_t i = 0; i < new_capacity; i++) {
+        slots[i].acc_no = 0;
+        slots[i].recno = RECORD_INDEX_EMPTY;
+    }
+
+    size_t used = 0;
+    for (size_t i = 0; i < ix->capacity; i++) {
+        if (ix->slots[i].recno < 0) continue;
+        size_t j = recordIndexHash(ix->slots[i].acc_no) & (new_capacity - 1);
+        while (slots[j].recno != RECORD_INDEX_EMPTY)
+            j = (j + 1) & (new_capacity - 1);
+        slots[j] = ix->slots[i];
+        used++;
+    }
+
+    free(ix->slots);
+    ix->slots = slots;
+    ix->capacity = new_capacity;
+    ix->used = used;
+    return 1;
+}
+
+void recordIndexClear(struct RecordIndex *ix) {
+    free(ix->slots);
+    ix->slots = NULL;
+    ix->capacity = 0;
+    ix->used = 0;
+}
+
+// Pre-sizes an empty index for the expected number of keys
+int recordIndexReserve(struct RecordIndex *ix, size_t expected) {
+    size_t capacity = RECORD_INDEX_MIN_CAPACITY;
+    while (expected * 10 >= capacity * 7) capacity *= 2;
+    if (capacity <= ix->capacity) return 1;
+    return recordIndexResize(ix, capacity);
+}
+
+long recordIndexLookup(const struct RecordIndex *ix, int acc_no) {
+    if (ix->capacity == 0) return -1;
+    size_t mask = ix->capacity - 1;
+    size_t i = recordIndexHash(acc_no) & mask;
+    while (ix->slots[i].recno != RECORD_INDEX_EMPTY) {
+        if (ix->slots[i].recno >= 0 && ix->slots[i].acc_no == acc_no)
+            return ix->slots[i].recno;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+// Maps acc_no -> recno. When replace is 0 an existing entry is left untouched.
+int recordIndexPut(struct RecordIndex *ix, int acc_no, long recno, int replace) {
+    // Keep the load factor (including deleted slots) below 0.7
+    if ((ix->used + 1) * 10 >= ix->capacity * 7) {
+        size_t new_capacity = ix->capacity ? ix->capacity * 2 : RECORD_INDEX_MIN_CAPACITY;
+        if (!recordIndexResize(ix, new_capacity)) return 0;
+    }
+
+    size_t mask = ix->capacity - 1;
+    size_t i = recordIndexHash(acc_no) & mask;
+    long reuse = -1;
+    while (ix->slots[i].recno != RECORD_INDEX_EMPTY) {
+        if (ix->slots[i].recno >= 0 && ix->slots[i].acc_no == acc_no) {
+            if (replace) ix->slots[i].recno = recno;
+            return 1;
+        }
+        if (ix->slots[i].recno == RECORD_INDEX_DELETED && reuse < 0)
+            reuse = (long)i;
+        i = (i + 1) & mask;
+    }
+    if (reuse >= 0) {
+        i = (size_t)reuse;
+    } else {
+        ix->used++;
+    }
+    ix->slots[i].acc_no = acc_no;
+    ix->slots[i].recno = recno;
+    return 1;
+}
+
+void recordIndexRemove(struct RecordIndex *ix, int acc_no) {
+    if (ix->capacity == 0) return;
+    size_t mask = ix->capacity - 1;
+    size_t i = recordIndexHash(acc_no) & mask;
+    while (ix->slots[i].recno != RECORD_INDEX_EMPTY) {
+        if (ix->slots[i].recno >= 0 && ix->slots[i].acc_no == acc_no) {
+            ix->slots[i].recno = RECORD_INDEX_DELETED;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+// =========================================================================
+// ACCOUNT INDEX
+// =========================================================================
+
+// acc_no -> record number in ACCOUNTS_FILE. Built once at startup and kept in
+// sync by createAccount and deleteAccount, so lookups seek straight to the
+// record. The same pass collects the tombstone slots that appendAccount
+// reuses; account_free_count is also the dead-record count compaction checks.
+static struct RecordIndex account_index = {NULL, 0, 0};
+static long *account_free_slots = NULL;
+static size_t account_free_count = 0;
+static size_t account_free_capacity = 0;
+static long account_records = 0; // records in ACCOUNTS_FILE, live or dead
+
+// The account mirror is filled by the same pass as the index and updated by
+// the account store with every record it writes, under the store lock. Code
+// that rewrites ACCOUNTS_FILE behind the store calls accountStoreChanged,
+// which marks the mirror stale until the next accountIndexBuild.
+static struct AccountMirror account_mirror = {NULL, NULL, 0, 0, 0};
+
+int accountIsTombstone(const struct Account *a) {
+    return a->locked == ACCOUNT_TOMBSTONE;
+}
+
+static int accountFreeSlotPush(long recno) {
+    if (account_free_count == account_free_capacity) {
+        size_t capacity = account_free_capacity ? account_free_capacity * 2 : 64;
+        long *slots = realloc(account_free_slots, capacity * sizeof(long));
+        if (!slots) return 0;
+        account_free_slots = slots;
+        account_free_capacity = capacity;
+    }
+    account_free_slots[account_free_count++] = recno;
+    return 1;
+}
+
+long accountIndexLookup(int acc_no) {
+    return recordIndexLookup(&account_index, acc_no);
+}
+
+// The first record in the file wins, as it did with the old linear scans
+int accountIndexInsert(int acc_no, long recno) {
+    return recordIndexPut(&account_index, acc_no, recno, 0);
+}
+
+void accountIndexRemove(int acc_no) {
+    recordIndexRemove(&account_index, acc_no);
+}
+
+static int accountMirrorReserve(size_t records) {
+    if (records <= account_mirror.capacity) return 1;
+    size_t capacity = account_mirror.capacity ? account_mirror.capacity : 1024;
+    while (capacity < records) capacity *= 2;
+    Money *balance = realloc(account_mirror.balance, capacity * sizeof(Money));
+    if (!balance) return 0;
+    account_mirror.balance = balance;
+    uint16_t *currency = realloc(account_mirror.currency, capacity * sizeof(uint16_t));
+    if (!currency) return 0;
+    account_mirror.currency = currency;
+    account_mirror.capacity = capacity;
+    return 1;
+}
+
+static void accountMirrorSet(long recno, const struct Account *a) {
+    if (!account_mirror.valid || recno < 0 || (size_t)recno >= account_mirror.count) return;
+    int dead = accountIsTombstone(a);
+    account_mirror.balance[recno] = dead ? 0 : a->balance;
+    account_mirror.currency[recno] = dead ? ACCOUNT_MIRROR_DEAD : currencyId(a->currency);
+}
+
+// recno is the record just appended to ACCOUNTS_FILE
+static void accountMirrorAppend(long recno, const struct Account *a) {
+    if (!account_mirror.valid) return;
+    if ((size_t)recno != account_mirror.count || !accountMirrorReserve(account_mirror.count + 1)) {
+        account_mirror.valid = 0;
+        return;
+    }
+    account_mirror.count++;
+    accountMirrorSet(recno, a);
+}
+
+// Rebuilds the index and the account mirror with one sequential pass over
+// ACCOUNTS_FILE
+int accountIndexBuild(void) {
+    recordIndexClear(&account_index);
+    account_free_count = 0;
+    account_records = 0;
+    account_mirror.count = 0;
+    account_mirror.valid = 1;
+
+    FILE *fp = fopen(ACCOUNTS_FILE, "rb");
+    if (!fp) return 1; // No accounts yet, empty index
+
+    long records = 0;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        records = ftell(fp) / (long)sizeof(struct Account);
+        rewind(fp);
+    }
+    if (!recordIndexReserve(&account_index, (size_t)records)) {
+        fclose(fp);
+        return 0;
+    }
+    account_mirror.valid = accountMirrorReserve((size_t)records);
+
+    struct Account a;
+    long recno = 0;
+    while (fread(&a, sizeof(struct Account), 1, fp) == 1) {
+        accountMirrorAppend(recno, &a);
+        int ok = accountIsTombstone(&a) ? accountFreeSlotPush(recno) : accountIndexInsert(a.acc_no, recno);
+        if (!ok) {
+            fclose(fp);
+            return 0;
+        }
+        recno++;
+    }
+    account_records = recno;
+    fclose(fp);
+    return 1;
+}
+
+// Reads the record for acc_no from an open ACCOUNTS_FILE using the index.
+// On success the file is positioned just past the record and *pos (if given)
+// holds the record's byte offset. A stale index is rebuilt once.
+int findAccount(FILE *fp, int acc_no, struct Account *out, long *pos) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        long recno = accountIndexLookup(acc_no);
+        if (recno >= 0) {
+            long offset = recno * (long)sizeof(struct Account);
+            if (fseek(fp, offset, SEEK_SET) == 0 &&
+                fread(out, sizeof(struct Account), 1, fp) == 1 &&
+                out->acc_no == acc_no) {
+                if (pos) *pos = offset;
+                return 1;
+            }
+        } else if (account_index.slots != NULL) {
+            return 0;
+        }
+        if (attempt == 0 && !accountIndexBuild()) return 0;
+    }
+    return 0;
+}
+
+// Totals every account balance per currency from the account mirror. One
+// pass over the currency column counts the accounts of each currency and
+// gives the table slots in order of first appearance; the kernels in MONEY
+// then sum the balance column once in all and once per currency. Accounts
+// without a slot are the difference. The store lock is held throughout, so
+// the totals are those of one moment.
+int computeBankTotals(struct BankTotals *totals) {
+    memset(totals, 0, sizeof(*totals));
+    long *count = calloc(ACCOUNT_MIRROR_DEAD + 1, sizeof(long)); // by currency id
+    if (!count) return 0;
+
+    storeLockWrite();
+    int ok = account_mirror.valid || (accountIndexBuild() && account_mirror.valid);
+    if (ok) {
+        const uint16_t *currency = account_mirror.currency;
+        const Money *balance = account_mirror.balance;
+        size_t n = account_mirror.count;
+        for (size_t i = 0; i < n; i++) {
+            uint16_t id = currency[i];
+            if (count[id]++ == 0 && id != CURRENCY_ID_NONE && id != ACCOUNT_MIRROR_DEAD &&
+                totals->currency_count < BANK_TOTALS_MAX_CURRENCIES) {
+                int k = totals->currency_count++;
+                totals->currency_id[k] = id;
+                currencyCode(id, totals->currency[k]);
+            }
+        }
+        totals->accounts = (long)n - count[ACCOUNT_MIRROR_DEAD];
+        Money all = sumMoney(balance, n); // Tombstones hold 0
+        totals->other_accounts = totals->accounts;
+        totals->other_balance = all;
+        for (int k = 0; k < totals->currency_count; k++) {
+            uint16_t id = totals->currency_id[k];
+            totals->other_accounts -= count[id];
+            if (totals->currency_count == 1 && count[id] == totals->accounts)
+                totals->balance[k] = all;
+            else
+                totals->balance[k] = sumMoneyWhere(balance, currency, id, n);
+            totals->other_balance -= totals->balance[k];
+        }
+    }
+    storeUnlock();
+    free(count);
+    return ok;
+}
+
+// =========================================================================
+// ACCOUNT STORE
+// =========================================================================
+
+// Single-account reads and writes go through loadAccount/saveAccount.
+// The default backend keeps ACCOUNTS_FILE open unbuffered, so each write is
+// immediately visible to the functions that still scan the file with stdio.
+// With --mmap the file is mapped MAP_SHARED instead: records are updated in
+// place with plain memory stores and made durable by msync at commit points
+// (every account_store_sync_every operations, and on close).
+int account_store_use_mmap = 0;
+int account_store_sync_every = ACCOUNT_STORE_SYNC_EVERY;
+
+static FILE *account_store_fp = NULL;
+static long account_store_generation = 0; // bumped by every record write, see compaction
+#ifndef _WIN32
+static int account_map_fd = -1;
+static struct Account *account_map = NULL;
+static size_t account_map_records = 0;  // records in the file
+static size_t account_map_capacity = 0; // records covered by the mapping
+static int account_map_pending = 0;     // operations since the last msync
+static int account_map_dirty = 0;
+
+// Makes sure the mapping covers at least min_records records. The mapping may
+// extend past EOF; only the first account_map_records entries are touched.
+static int accountMapReserve(size_t min_records) {
+    size_t capacity = account_map_capacity ? account_map_capacity : ACCOUNT_MAP_MIN_RECORDS;
+    while (capacity < min_records) capacity *= 2;
+    if (account_map && capacity == account_map_capacity) return 1;
+
+    if (account_map) munmap(account_map, account_map_capacity * sizeof(struct Account));
+    void *p = mmap(NULL, capacity * sizeof(struct Account), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, account_map_fd, 0);
+    if (p == MAP_FAILED) {
+        account_map = NULL;
+        account_map_capacity = 0;
+        return 0;
+    }
+    account_map = p;
+    account_map_capacity = capacity;
+    return 1;
+}
+#endif
+
+int accountStoreOpen(void) {
+    accountStoreClose();
+#ifndef _WIN32
+    if (account_store_use_mmap) {
+        account_map_fd = open(ACCOUNTS_FILE, O_RDWR | O_CREAT, 0644);
+        if (account_map_fd < 0) return 0;
+        struct stat st;
+        if (fstat(account_map_fd, &st) != 0) {
+            close(account_map_fd);
+            account_map_fd = -1;
+            return 0;
+        }
+        account_map_records = (size_t)st.st_size / sizeof(struct Account);
+        return accountMapReserve(account_map_records);
+    }
+#else
+    if (account_store_use_mmap) {
+        printf(YELLOW "Memory-mapped store is not available on this platform. Using file I/O.\n" RESET);
+        account_store_use_mmap = 0;
+    }
+#endif
+    // A missing file is created lazily by appendAccount
+    account_store_fp = fopen(ACCOUNTS_FILE, "rb+");
+    if (account_store_fp) setvbuf(account_store_fp, NULL, _IONBF, 0);
+    return 1;
+}
+
+void accountStoreClose(void) {
+#ifndef _WIN32
+    if (account_map) {
+        accountStoreCommit(1);
+        munmap(account_map, account_map_capacity * sizeof(struct Account));
+        account_map = NULL;
+        account_map_capacity = 0;
+        account_map_records = 0;
+    }
+    if (account_map_fd >= 0) {
+        close(account_map_fd);
+        account_map_fd = -1;
+    }
+#endif
+    if (account_store_fp) {
+        fclose(account_store_fp);
+        account_store_fp = NULL;
+    }
+}
+
+// Marks the end of one logical operation. With the mmap backend, dirty pages
+// are msync'ed once every account_store_sync_every operations. When force is
+// set the file is made durable right away with either backend. Returns 0 if a
+// sync failed; the mapping then stays dirty so the next commit retries it.
+int accountStoreCommit(int force) {
+#ifndef _WIN32
+    if (!force) {
+        if (!account_store_use_mmap || account_store_sync_every <= 0) return 1;
+        MUTEX_LOCK(&store_commit_mutex);
+        int due = ++account_map_pending >= account_store_sync_every;
+        if (due) account_map_pending = 0;
+        MUTEX_UNLOCK(&store_commit_mutex);
+        if (!due) return 1;
+    }
+#else
+    if (!force) return 1;
+#endif
+    // Syncing only has to keep the mapping from being replaced
+    storeLockAccess();
+    int ok = !account_store_fp || syncFile(account_store_fp);
+#ifndef _WIN32
+    if (account_map && __atomic_exchange_n(&account_map_dirty, 0, __ATOMIC_RELAXED) && account_map_records > 0 &&
+        msync(account_map, account_map_records * sizeof(struct Account), MS_SYNC) != 0) {
+        __atomic_store_n(&account_map_dirty, 1, __ATOMIC_RELAXED);
+        ok = 0;
+    }
+#endif
+    storeUnlock();
+    return ok;
+}
+
+// Batch mode's WAL group while it is in use (see struct WalGroup)
+static struct WalGroup *wal_group = NULL;
+
+// The newest image of acc_no's record queued in wal_group, if there is one
+static int walGroupLookup(int acc_no, struct Account *out, long *pos) {
+    storeLockRead();
+    long recno = accountIndexLookup(acc_no);
+    storeUnlock();
+    long at = recno >= 0 ? recordIndexLookup(&wal_group->images, (int)recno) : -1;
+    if (at < 0) return 0;
+    const struct Account *a = &wal_group->entries[at / WAL_MAX_UPDATES].updates[at % WAL_MAX_UPDATES].image.account;
+    if (a->acc_no != acc_no) return 0;
+    *out = *a;
+    if (pos) *pos = recno * (long)sizeof(struct Account);
+    return 1;
+}
+
+// Copies the record for acc_no into *out; *pos (if given) receives its byte
+// offset for a later saveAccount.
+int loadAccount(int acc_no, struct Account *out, long *pos) {
+    if (wal_group && walGroupLookup(acc_no, out, pos)) return 1;
+    int found = 0;
+    storeLockAccess();
+#ifndef _WIN32
+    if (account_map) {
+        for (int attempt = 0; attempt < 2; attempt++) {
+            long recno = accountIndexLookup(acc_no);
+            if (recno >= 0 && (size_t)recno < account_map_records &&
+                account_map[recno].acc_no == acc_no) {
+                *out = account_map[recno];
+                if (pos) *pos = recno * (long)sizeof(struct Account);
+                found = 1;
+                break;
+            }
+            if (recno < 0 || attempt > 0 || !accountIndexBuild()) break;
+        }
+        storeUnlock();
+        return found;
+    }
+#endif
+    if (account_store_fp) found = findAccount(account_store_fp, acc_no, out, pos);
+    storeUnlock();
+    return found;
+}
+
+static int storeAccountRecord(long pos, const struct Account *a);
+
+// Writes a single record. While un-checkpointed WAL entries exist, recovery
+// could redo an older image of this record over the new one, so the write is
+// appended to the WAL as well to keep the redo order intact. With a WAL group
+// in use it is queued in the group like every other write.
+int saveAccount(long pos, const struct Account *a) {
+    if (wal_group || walPendingEntries() > 0) {
+        struct WalEntry entry;
+        walBegin(&entry);
+        walAddAccount(&entry, pos, a);
+        return walCommit(&entry);
+    }
+    return storeAccountRecord(pos, a);
+}
+
+static int storeAccountRecord(long pos, const struct Account *a) {
+    int ok = 0;
+    storeLockAccess();
+    ATOMIC_INC(&account_store_generation);
+#ifndef _WIN32
+    if (account_map) {
+        size_t recno = (size_t)pos / sizeof(struct Account);
+        if (recno < account_map_records) {
+            account_map[recno] = *a;
+            __atomic_store_n(&account_map_dirty, 1, __ATOMIC_RELAXED); // Many writers may share the read lock
+            accountMirrorSet((long)recno, a); // Each writer holds its account's stripe
+            ok = 1;
+        }
+        storeUnlock();
+        return ok;
+    }
+#endif
+    if (account_store_fp && fseek(account_store_fp, pos, SEEK_SET) == 0)
+        ok = fwrite(a, sizeof(struct Account), 1, account_store_fp) == 1;
+    if (ok) accountMirrorSet(pos / (long)sizeof(struct Account), a);
+    storeUnlock();
+    return ok;
+}
+
+static int appendAccountRecord(const struct Account *a);
+
+// Adds a new record to the account index, reusing a tombstone slot when one
+// is free. A reused slot is written through saveAccount so that the write is
+// ordered after a WAL entry that may still hold the tombstone.
+int appendAccount(const struct Account *a) {
+    long recno = -1;
+    storeLockWrite();
+    if (account_free_count > 0) {
+        recno = account_free_slots[--account_free_count];
+    } else {
+        int ok = appendAccountRecord(a);
+        storeUnlock();
+        return ok;
+    }
+    storeUnlock();
+
+    int ok = saveAccount(recno * (long)sizeof(struct Account), a);
+    storeLockWrite();
+    if (ok)
+        ok = accountIndexInsert(a->acc_no, recno);
+    else
+        accountFreeSlotPush(recno); // The slot still holds the tombstone
+    storeUnlock();
+    return ok;
+}
+
+// For code that writes ACCOUNTS_FILE through its own FILE, so that a
+// background compaction copy taken meanwhile is redone and the account
+// mirror is rebuilt before it is read again
+void accountStoreChanged(void) {
+    ATOMIC_INC(&account_store_generation);
+    storeLockWrite();
+    account_mirror.valid = 0;
+    storeUnlock();
+}
+
+static int appendAccountRecord(const struct Account *a) {
+    long recno;
+    ATOMIC_INC(&account_store_generation);
+#ifndef _WIN32
+    if (account_map) {
+        recno = (long)account_map_records;
+        if (ftruncate(account_map_fd, (off_t)(account_map_records + 1) * sizeof(struct Account)) != 0)
+            return 0;
+        if (!accountMapReserve(account_map_records + 1)) return 0;
+        account_map[recno] = *a;
+        account_map_records++;
+        account_map_dirty = 1;
+        account_records++;
+        accountMirrorAppend(recno, a);
+        return accountIndexInsert(a->acc_no, recno);
+    }
+#endif
+    if (!account_store_fp) {
+        FILE *create_fp = fopen(ACCOUNTS_FILE, "ab");
+        if (!create_fp) return 0;
+        fclose(create_fp);
+        account_store_fp = fopen(ACCOUNTS_FILE, "rb+");
+        if (!account_store_fp) return 0;
+        setvbuf(account_store_fp, NULL, _IONBF, 0);
+    }
+    if (fseek(account_store_fp, 0, SEEK_END) != 0) return 0;
+    recno = ftell(account_store_fp) / (long)sizeof(struct Account);
+    if (fwrite(a, sizeof(struct Account), 1, account_store_fp) != 1) return 0;
+    account_records++;
+    accountMirrorAppend(recno, a);
+    return accountIndexInsert(a->acc_no, recno);
+}
+
+// =========================================================================
+// ACCOUNT COMPACTION
+// =========================================================================
+
+// Deleting an account only writes a tombstone over its record. Once
+// compaction_dead_ratio of the records are dead, a background thread copies
+// the live records into ACCOUNTS_COMPACT_FILE and syncs it while operations
+// carry on. The copy replaces ACCOUNTS_FILE at the next compactionPoll on the
+// main thread (the menus and the batch and server loops call it):
+//   1. every account stripe is locked, so no operation holds a record offset,
+//   2. the WAL is checkpointed, since its entries address records by offset,
+//   3. if any record was written after the copy started, the copy is redone,
+//   4. the copy is renamed over ACCOUNTS_FILE and the index is rebuilt.
+// A crash leaves either the old file or the new one in place; a leftover
+// copy is removed at startup.
+double compaction_dead_ratio = COMPACT_DEAD_RATIO;
+
+enum { COMPACT_IDLE, COMPACT_RUNNING, COMPACT_DONE };
+static int compaction_state = COMPACT_IDLE;
+static int compaction_ok = 0;
+static long compaction_generation = 0; // account_store_generation when the copy started
+#ifndef _WIN32
+static pthread_t compaction_thread;
+#endif
+
+// Copies the live records of ACCOUNTS_FILE into ACCOUNTS_COMPACT_FILE and
+// syncs it
+int compactAccountsFile(void) {
+    enum { CHUNK = 4096 };
+    FILE *in = fopen(ACCOUNTS_FILE, "rb");
+    if (!in) return 0;
+    FILE *out = fopen(ACCOUNTS_COMPACT_FILE, "wb");
+    struct Account *records = malloc(CHUNK * sizeof(struct Account));
+    if (!out || !records) {
+        if (out) fclose(out);
+        free(records);
+        fclose(in);
+        remove(ACCOUNTS_COMPACT_FILE);
+        return 0;
+    }
+
+    int ok = 1;
+    size_t n;
+    while (ok && (n = fread(records, sizeof(struct Account), CHUNK, in)) > 0) {
+        size_t kept = 0;
+        for (size_t i = 0; i < n; i++)
+            if (!accountIsTombstone(&records[i])) records[kept++] = records[i];
+        ok = fwrite(records, sizeof(struct Account), kept, out) == kept;
+    }
+    if (ferror(in)) ok = 0;
+    if (ok) ok = syncFile(out);
+    if (fclose(out) != 0) ok = 0;
+    fclose(in);
+    free(records);
+    if (!ok) remove(ACCOUNTS_COMPACT_FILE);
+    return ok;
+}
+
+#ifndef _WIN32
+static void *compactionThread(void *arg) {
+    (void)arg;
+    int ok = compactAccountsFile();
+    MUTEX_LOCK(&compaction_mutex);
+    compaction_ok = ok;
+    compaction_state = COMPACT_DONE;
+    MUTEX_UNLOCK(&compaction_mutex);
+    return NULL;
+}
+#endif
+
+// Called after a delete: starts the copy once enough records are dead
+void compactionMaybeStart(void) {
+    if (compaction_dead_ratio <= 0) return;
+    MUTEX_LOCK(&compaction_mutex);
+    if (compaction_state == COMPACT_IDLE) {
+        // The write lock waits for record writes in progress, so any write the
+        // copy could see half-done bumps the generation after this snapshot
+        storeLockWrite();
+        int due = account_free_count >= COMPACT_MIN_DEAD &&
+                  (double)account_free_count >= compaction_dead_ratio * (double)account_records;
+        compaction_generation = account_store_generation;
+        storeUnlock();
+        if (due) {
+#ifndef _WIN32
+            compaction_state = COMPACT_RUNNING;
+            if (pthread_create(&compaction_thread, NULL, compactionThread, NULL) != 0)
+                compaction_state = COMPACT_IDLE;
+#else
+            // No threads: copy now, install at the next poll
+            compaction_ok = compactAccountsFile();
+            compaction_state = COMPACT_DONE;
+#endif
+        }
+    }
+    MUTEX_UNLOCK(&compaction_mutex);
+}
+
+static void compactionInstall(void) {
+    accountLockAll();
+    // WAL entries address records by offset, so they must not outlive the
+    // old file
+    if (!walCheckpoint()) {
+        accountUnlockAll();
+        remove(ACCOUNTS_COMPACT_FILE);
+        printf(RED "Compaction of %s failed; deleted records stay in place.\n" RESET, ACCOUNTS_FILE);
+        return;
+    }
+    accountStoreClose();
+
+    long records_before = account_records;
+    int ok = 1;
+    if (ATOMIC_LOAD(&account_store_generation) != compaction_generation)
+        ok = compactAccountsFile(); // Records changed during the copy
+#ifdef _WIN32
+    if (ok) remove(ACCOUNTS_FILE);
+#endif
+    if (ok && rename(ACCOUNTS_COMPACT_FILE, ACCOUNTS_FILE) != 0) {
+        remove(ACCOUNTS_COMPACT_FILE);
+        ok = 0;
+    }
+    if (!accountIndexBuild() || !accountStoreOpen())
+        printf(RED "Error reopening accounts after compaction.\n" RESET);
+    long removed = records_before - account_records;
+    accountUnlockAll();
+
+    if (ok)
+        printf(GREEN "Compacted %s: removed %ld deleted record(s).\n" RESET, ACCOUNTS_FILE, removed);
+    else
+        printf(RED "Compaction of %s failed; deleted records stay in place.\n" RESET, ACCOUNTS_FILE);
+}
+
+// Installs a finished copy; with wait set, a copy still running is waited for.
+// Only the main thread calls this.
+void compactionPoll(int wait) {
+    MUTEX_LOCK(&compaction_mutex);
+    int state = compaction_state;
+    MUTEX_UNLOCK(&compaction_mutex);
+    if (state == COMPACT_IDLE || (state == COMPACT_RUNNING && !wait)) return;
+
+#ifndef _WIN32
+    pthread_join(compaction_thread, NULL);
+#endif
+    if (compaction_ok) {
+        compactionInstall();
+    } else {
+        printf(RED "Compaction of %s failed; deleted records stay in place.\n" RESET, ACCOUNTS_FILE);
+    }
+    MUTEX_LOCK(&compaction_mutex);
+    compaction_state = COMPACT_IDLE;
+    MUTEX_UNLOCK(&compaction_mutex);
+}
+
+// =========================================================================
+// TRANSACTION INDEX
+// =========================================================================
+
+// acc_no -> newest record number in TRANSACTIONS_FILE. Older records are
+// reached through the prev links stored in TRANSACTIONS_INDEX_FILE, so an
+// account's history is read without touching anybody else's records.
+static struct RecordIndex transaction_heads = {NULL, 0, 0};
+
+long fileRecordCount(const char *path, size_t record_size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    long records = 0;
+    if (fseek(fp, 0, SEEK_END) == 0)
+        records = ftell(fp) / (long)record_size;
+    fclose(fp);
+    return records;
+}
+
+// Loads the heads checkpoint and indexes any transactions logged after it.
+// An index that does not match the log is rebuilt from scratch.
+int transactionIndexOpen(void) {
+    recordIndexClear(&transaction_heads);
+
+    long covered = 0;
+    FILE *hp = fopen(TRANSACTIONS_HEADS_FILE, "rb");
+    if (hp) {
+        struct TransactionHeadsHeader hdr;
+        if (fread(&hdr, sizeof(hdr), 1, hp) == 1 &&
+            memcmp(hdr.magic, TRANSACTIONS_HEADS_MAGIC, TRANSACTIONS_HEADS_MAGIC_LEN) == 0 &&
+            recordIndexReserve(&transaction_heads, (size_t)hdr.count)) {
+            struct RecordIndexSlot slot;
+            long loaded = 0;
+            while (loaded < hdr.count && fread(&slot, sizeof(slot), 1, hp) == 1) {
+                recordIndexPut(&transaction_heads, slot.acc_no, slot.recno, 1);
+                loaded++;
+            }
+            if (loaded == hdr.count) {
+                covered = hdr.covered;
+            } else {
+                recordIndexClear(&transaction_heads);
+            }
+        }
+        fclose(hp);
+    }
+
+    long n_tx = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+    long n_idx = fileRecordCount(TRANSACTIONS_INDEX_FILE, sizeof(long));
+    if (covered > n_idx || n_idx > n_tx) {
+        // Out of step with the log (e.g. after a crash): start over
+        recordIndexClear(&transaction_heads);
+        FILE *reset_fp = fopen(TRANSACTIONS_INDEX_FILE, "wb");
+        if (!reset_fp) return 0;
+        fclose(reset_fp);
+        covered = 0;
+        n_idx = 0;
+    }
+    if (covered == n_tx) return 1;
+
+    FILE *tx_fp = fopen(TRANSACTIONS_FILE, "rb");
+    FILE *idx_fp = fopen(TRANSACTIONS_INDEX_FILE, "ab");
+    if (!tx_fp || !idx_fp) {
+        if (tx_fp) fclose(tx_fp);
+        if (idx_fp) fclose(idx_fp);
+        return 0;
+    }
+    fseek(tx_fp, covered * (long)sizeof(struct Transaction), SEEK_SET);
+
+    struct Transaction t;
+    for (long k = covered; k < n_tx && fread(&t, sizeof(t), 1, tx_fp) == 1; k++) {
+        if (k >= n_idx) {
+            long prev = recordIndexLookup(&transaction_heads, t.acc_no);
+            fwrite(&prev, sizeof(prev), 1, idx_fp);
+        }
+        if (!recordIndexPut(&transaction_heads, t.acc_no, k, 1)) {
+            fclose(tx_fp);
+            fclose(idx_fp);
+            return 0;
+        }
+    }
+    fclose(tx_fp);
+    fclose(idx_fp);
+
+    transactionIndexCheckpoint();
+    return 1;
+}
+
+// Writes the in-memory heads to TRANSACTIONS_HEADS_FILE (temp file + rename)
+void transactionIndexCheckpoint(void) {
+    const char *tmp_path = TRANSACTIONS_HEADS_FILE ".tmp";
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) return;
+
+    struct TransactionHeadsHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRANSACTIONS_HEADS_MAGIC, TRANSACTIONS_HEADS_MAGIC_LEN);
+    hdr.covered = fileRecordCount(TRANSACTIONS_INDEX_FILE, sizeof(long));
+    hdr.count = 0;
+    for (size_t i = 0; i < transaction_heads.capacity; i++)
+        if (transaction_heads.slots[i].recno >= 0) hdr.count++;
+
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    for (size_t i = 0; ok && i < transaction_heads.capacity; i++) {
+        if (transaction_heads.slots[i].recno < 0) continue;
+        ok = fwrite(&transaction_heads.slots[i], sizeof(struct RecordIndexSlot), 1, fp) == 1;
+    }
+    if (fclose(fp) != 0) ok = 0;
+
+    if (ok) {
+        remove(TRANSACTIONS_HEADS_FILE);
+        rename(tmp_path, TRANSACTIONS_HEADS_FILE);
+    } else {
+        remove(tmp_path);
+    }
+}
+
+// Makes transaction record `recno` the head of acc_no's chain and returns the
+// previous head (-1 if none), which is the record's TRANSACTIONS_INDEX_FILE
+// entry
+long transactionIndexLink(int acc_no, long recno) {
+    long prev = recordIndexLookup(&transaction_heads, acc_no);
+    recordIndexPut(&transaction_heads, acc_no, recno, 1);
+    return prev;
+}
+
+// Newest record of acc_no in TRANSACTIONS_FILE, -1 if none
+long transactionIndexHead(int acc_no) {
+    return recordIndexLookup(&transaction_heads, acc_no);
+}
+
+// The record before recno in its account's chain, read from idx_fp (open on
+// TRANSACTIONS_INDEX_FILE); -1 at the start of the chain or on a bad link
+long transactionIndexPrev(FILE *idx_fp, long recno) {
+    long prev;
+    if (fseek(idx_fp, recno * (long)sizeof(long), SEEK_SET) != 0 || fread(&prev, sizeof(prev), 1, idx_fp) != 1 ||
+        prev >= recno)
+        return -1; // Links always point backwards
+    return prev;
+}
+
+// Returns the record numbers of acc_no's transactions, oldest first, in a
+// malloc'ed array (NULL when there are none). The caller frees it.
+long *transactionIndexChain(int acc_no, size_t *count) {
+    *count = 0;
+    long cur = recordIndexLookup(&transaction_heads, acc_no);
+    if (cur < 0) return NULL;
+
+    FILE *fp = fopen(TRANSACTIONS_INDEX_FILE, "rb");
+    if (!fp) return NULL;
+
+    size_t n = 0, cap = 64;
+    long *chain = malloc(cap * sizeof(long));
+    while (chain && cur >= 0) {
+        if (n == cap) {
+            long *grown = realloc(chain, cap * 2 * sizeof(long));
+            if (!grown) {
+                free(chain);
+                chain = NULL;
+                break;
+            }
+            chain = grown;
+            cap *= 2;
+        }
+        chain[n++] = cur;
+
+        long prev;
+        if (fseek(fp, cur * (long)sizeof(long), SEEK_SET) != 0 ||
+            fread(&prev, sizeof(prev), 1, fp) != 1 || prev >= cur)
+            break; // Links always point backwards; stop on anything else
+        cur = prev;
+    }
+    fclose(fp);
+    if (!chain) return NULL;
+
+    for (size_t i = 0; i < n / 2; i++) {
+        long tmp = chain[i];
+        chain[i] = chain[n - 1 - i];
+        chain[n - 1 - i] = tmp;
+    }
+    *count = n;
+    return chain;
+}
+
+// =========================================================================
+// TRANSACTION LOG WRITER
+// =========================================================================
+
+// TRANSACTIONS_FILE and TRANSACTIONS_INDEX_FILE stay open for the whole run.
+// logTransaction only appends to an in-memory group; a group is written with
+// one fwrite per file and made durable with a single fsync when it reaches
+// transaction_log_group_records records or its oldest record is
+// transaction_log_group_ms old. The menus flush after every action, and any
+// reader of the log flushes first.
+//
+// Postings of account operations come from their WAL entries: walCommitBatch
+// reserves their record numbers when it writes the entries and posts them
+// here, in the same order, once the entries are durable. Until the log is
+// flushed the WAL is their durable copy, so a WAL checkpoint flushes the log
+// first and walRecover appends whatever a crash kept from reaching it.
+int transaction_log_group_records = TRANSACTION_LOG_GROUP_RECORDS;
+int transaction_log_group_ms = TRANSACTION_LOG_GROUP_MS;
+
+static FILE *tx_log_fp = NULL;
+static FILE *tx_index_fp = NULL;
+static struct Transaction *tx_log_group = NULL;
+static long *tx_index_group = NULL;
+static size_t tx_log_group_capacity = 0;
+static size_t tx_log_pending = 0;
+static long tx_log_next_recno = 0; // record number of the next appended record
+static long tx_log_reserved = 0;   // records after it numbered for WAL commits in flight
+static int tx_log_group_posted = 0; // the group holds postings of committed WAL entries
+static long tx_log_first_time = -1; // timestamp of record 0, -1 while the log is empty
+static long long tx_log_group_started = 0;
+
+long long monotonicMillis(void) {
+#ifdef _WIN32
+    return (long long)clock() * 1000 / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+int syncFile(FILE *fp) {
+    if (fflush(fp) != 0) return 0;
+#ifdef _WIN32
+    return syncDescriptor(_fileno(fp));
+#else
+    return syncDescriptor(fileno(fp));
+#endif
+}
+
+int syncDescriptor(int fd) {
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+// Must run after transactionIndexOpen so the heads cover the whole log
+int transactionLogOpen(void) {
+    transactionLogClose();
+    if (transaction_log_group_records < 1) transaction_log_group_records = 1;
+
+    tx_log_group_capacity = (size_t)transaction_log_group_records;
+    tx_log_group = malloc(tx_log_group_capacity * sizeof(struct Transaction));
+    tx_index_group = malloc(tx_log_group_capacity * sizeof(long));
+    tx_log_fp = fopen(TRANSACTIONS_FILE, "ab");
+    tx_index_fp = fopen(TRANSACTIONS_INDEX_FILE, "ab");
+    if (!tx_log_group || !tx_index_group || !tx_log_fp || !tx_index_fp) {
+        transactionLogClose();
+        return 0;
+    }
+    tx_log_next_recno = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+    tx_log_pending = 0;
+    tx_log_first_time = -1;
+    if (tx_log_next_recno > 0) {
+        FILE *fp = fopen(TRANSACTIONS_FILE, "rb");
+        struct Transaction first;
+        if (fp && fread(&first, sizeof(first), 1, fp) == 1) tx_log_first_time = (long)first.timestamp;
+        if (fp) fclose(fp);
+    }
+    return 1;
+}
+
+// Timestamp of the oldest record in the log, -1 if the log is empty
+long transactionLogFirstTime(void) {
+    MUTEX_LOCK(&tx_log_mutex);
+    long first = tx_log_first_time;
+    MUTEX_UNLOCK(&tx_log_mutex);
+    return first;
+}
+
+static int transactionLogFlushLocked(void);
+static int truncateFile(FILE *fp, long size);
+
+// A committed operation's postings could not be written. Rolling them back
+// would hand their record numbers to later WAL commits, so the process stops
+// instead; walRecover appends them from the WAL on the next start.
+static void transactionLogLost(void) {
+    printf(RED "Fatal: transactions of committed operations could not be logged. Stopping; they are "
+               "restored from the write-ahead log on the next start.\n" RESET);
+    fflush(stdout);
+    exit(EXIT_FAILURE);
+}
+
+// Undoes records first_recno.. that could not be written: each account's
+// head goes back to the link its record replaced (newest first), and both
+// files are cut back to first_recno records and reopened, dropping whatever
+// part of the group reached them or is still buffered. The next record is
+// then numbered first_recno again.
+static void transactionLogRollback(long first_recno, const struct Transaction *t, const long *links, size_t n) {
+    for (size_t i = n; i-- > 0; ) {
+        if (links[i] >= 0)
+            recordIndexPut(&transaction_heads, t[i].acc_no, links[i], 1);
+        else
+            recordIndexRemove(&transaction_heads, t[i].acc_no);
+    }
+    tx_log_next_recno = first_recno;
+    if (first_recno == 0) tx_log_first_time = -1;
+
+    fclose(tx_log_fp);
+    fclose(tx_index_fp);
+    tx_log_fp = fopen(TRANSACTIONS_FILE, "rb+");
+    tx_index_fp = fopen(TRANSACTIONS_INDEX_FILE, "rb+");
+    int ok = tx_log_fp && tx_index_fp && truncateFile(tx_log_fp, first_recno * (long)sizeof(struct Transaction)) &&
+             truncateFile(tx_index_fp, first_recno * (long)sizeof(long));
+    if (tx_log_fp) fclose(tx_log_fp);
+    if (tx_index_fp) fclose(tx_index_fp);
+    tx_log_fp = ok ? fopen(TRANSACTIONS_FILE, "ab") : NULL;
+    tx_index_fp = ok ? fopen(TRANSACTIONS_INDEX_FILE, "ab") : NULL;
+    if (!tx_log_fp || !tx_index_fp) {
+        // Appends fail from here on; the next start re-indexes the log
+        if (tx_log_fp) fclose(tx_log_fp);
+        if (tx_index_fp) fclose(tx_index_fp);
+        tx_log_fp = NULL;
+        tx_index_fp = NULL;
+    }
+}
+
+int transactionLogAppend(const struct Transaction *t) {
+    int ok = 1;
+    MUTEX_LOCK(&tx_log_mutex);
+    while (tx_log_reserved > 0) COND_WAIT(&tx_log_cond, &tx_log_mutex);
+    if (!tx_log_fp) {
+        ok = 0;
+    } else {
+        if (tx_log_pending == 0) tx_log_group_started = monotonicMillis();
+
+        long recno = tx_log_next_recno++;
+        if (recno == 0) tx_log_first_time = (long)t->timestamp;
+        tx_log_group[tx_log_pending] = *t;
+        tx_index_group[tx_log_pending] = transactionIndexLink(t->acc_no, recno);
+        tx_log_pending++;
+
+        if (tx_log_pending >= tx_log_group_capacity ||
+            monotonicMillis() - tx_log_group_started >= transaction_log_group_ms)
+            ok = transactionLogFlushLocked();
+    }
+    MUTEX_UNLOCK(&tx_log_mutex);
+    return ok;
+}
+
+int transactionLogFlush(void) {
+    MUTEX_LOCK(&tx_log_mutex);
+    int ok = transactionLogFlushLocked();
+    MUTEX_UNLOCK(&tx_log_mutex);
+    return ok;
+}
+
+// Commits the pending group once its oldest record has waited
+// transaction_log_group_ms; called periodically while idle (server mode)
+int transactionLogFlushExpired(void) {
+    int ok = 1;
+    MUTEX_LOCK(&tx_log_mutex);
+    if (tx_log_pending > 0 && monotonicMillis() - tx_log_group_started >= transaction_log_group_ms)
+        ok = transactionLogFlushLocked();
+    MUTEX_UNLOCK(&tx_log_mutex);
+    return ok;
+}
+
+// Writes the pending group: log records first (fsync'ed), then their index
+// entries. transactionIndexOpen repairs an index that got ahead of the log.
+static int transactionLogFlushLocked(void) {
+    if (!tx_log_fp || tx_log_pending == 0) return 1;
+
+    int ok = fwrite(tx_log_group, sizeof(struct Transaction), tx_log_pending, tx_log_fp) == tx_log_pending &&
+             syncFile(tx_log_fp);
+    if (ok) {
+        ok = fwrite(tx_index_group, sizeof(long), tx_log_pending, tx_index_fp) == tx_log_pending &&
+             fflush(tx_index_fp) == 0;
+    }
+    if (!ok) {
+        printf(RED "Error: Could not write to the transactions file.\n" RESET);
+        if (tx_log_group_posted) transactionLogLost();
+        transactionLogRollback(tx_log_next_recno - (long)tx_log_pending, tx_log_group, tx_index_group, tx_log_pending);
+    }
+    tx_log_pending = 0;
+    tx_log_group_posted = 0;
+    return ok;
+}
+
+// Writes n records after the committed ones with one write and one fsync,
+// bypassing the group (which must be empty). Rolls them back on failure.
+static int transactionLogWriteLocked(const struct Transaction *t, size_t n) {
+    long *links = malloc(n * sizeof(long));
+    if (!links) return 0;
+    if (tx_log_next_recno == 0) tx_log_first_time = (long)t[0].timestamp;
+    for (size_t i = 0; i < n; i++) links[i] = transactionIndexLink(t[i].acc_no, tx_log_next_recno++);
+    int ok = fwrite(t, sizeof(struct Transaction), n, tx_log_fp) == n && syncFile(tx_log_fp) &&
+             fwrite(links, sizeof(long), n, tx_index_fp) == n && fflush(tx_index_fp) == 0;
+    if (!ok) {
+        printf(RED "Error: Could not write to the transactions file.\n" RESET);
+        transactionLogRollback(tx_log_next_recno - (long)n, t, links, n);
+    }
+    free(links);
+    return ok;
+}
+
+// Appends n records with one write and one fsync. Records already pending are
+// committed first so the log stays in order.
+int transactionLogAppendBatch(const struct Transaction *t, size_t n) {
+    if (n == 0) return 1;
+    MUTEX_LOCK(&tx_log_mutex);
+    while (tx_log_reserved > 0) COND_WAIT(&tx_log_cond, &tx_log_mutex);
+    int ok = tx_log_fp != NULL && transactionLogFlushLocked() && transactionLogWriteLocked(t, n);
+    MUTEX_UNLOCK(&tx_log_mutex);
+    return ok;
+}
+
+// Numbers the next n records for a WAL commit. It later either posts them
+// with transactionLogPost or, if its entries could not be made durable,
+// gives them back with transactionLogRelease. Called under wal_mutex, so
+// reservations are posted in the order they were made. Returns the first
+// record number, or -1 if the log is not open.
+long transactionLogReserve(size_t n) {
+    MUTEX_LOCK(&tx_log_mutex);
+    long recno = -1;
+    if (tx_log_fp) {
+        recno = tx_log_next_recno + tx_log_reserved;
+        tx_log_reserved += (long)n;
+    }
+    MUTEX_UNLOCK(&tx_log_mutex);
+    return recno;
+}
+
+// Gives back the newest reservation
+void transactionLogRelease(size_t n) {
+    MUTEX_LOCK(&tx_log_mutex);
+    tx_log_reserved -= (long)n;
+    if (tx_log_reserved == 0) COND_BROADCAST(&tx_log_cond);
+    MUTEX_UNLOCK(&tx_log_mutex);
+}
+
+// Adds the n postings of durable WAL entries as records recno.. (their
+// reservation), to be committed with the group. Postings that do not fit in
+// the group are written right away after it.
+void transactionLogPost(const struct Transaction *t, size_t n, long recno) {
+    if (n == 0) return;
+    MUTEX_LOCK(&tx_log_mutex);
+    if (!tx_log_fp || recno != tx_log_next_recno) transactionLogLost();
+    tx_log_reserved -= (long)n;
+    if (tx_log_pending + n > tx_log_group_capacity) {
+        if (!transactionLogFlushLocked() || !transactionLogWriteLocked(t, n)) transactionLogLost();
+    } else {
+        if (tx_log_pending == 0) tx_log_group_started = monotonicMillis();
+        if (tx_log_next_recno == 0) tx_log_first_time = (long)t[0].timestamp;
+        for (size_t i = 0; i < n; i++) {
+            tx_log_group[tx_log_pending] = t[i];
+            tx_index_group[tx_log_pending] = transactionIndexLink(t[i].acc_no, tx_log_next_recno++);
+            tx_log_pending++;
+        }
+        tx_log_group_posted = 1;
+        if (tx_log_pending >= tx_log_group_capacity ||
+            monotonicMillis() - tx_log_group_started >= transaction_log_group_ms)
+            transactionLogFlushLocked();
+    }
+    if (tx_log_reserved == 0) COND_BROADCAST(&tx_log_cond);
+    MUTEX_UNLOCK(&tx_log_mutex);
+}
+
+void transactionLogClose(void) {
+    transactionLogFlush();
+    if (tx_log_fp) fclose(tx_log_fp);
+    if (tx_index_fp) fclose(tx_index_fp);
+    free(tx_log_group);
+    free(tx_index_group);
+    tx_log_fp = NULL;
+    tx_index_fp = NULL;
+    tx_log_group = NULL;
+    tx_index_group = NULL;
+    tx_log_group_capacity = 0;
+    tx_log_pending = 0;
+}
+
+// =========================================================================
+// TRANSACTION ARCHIVE
+// =========================================================================
+
+// The transaction log is split into time-partitioned segments. When the
+// calendar month of the oldest record in TRANSACTIONS_FILE has ended,
+// archiveTransactionLog seals the log: its records are written to one
+// columnar segment file per month ("transactions-YYYY-MM.arc"), listed in
+// TRANSACTIONS_MANIFEST_FILE with their time range, and the log starts
+// afresh. Queries open only the segments whose range overlaps theirs, and a
+// segment file moved elsewhere only hides its own records.
+//
+// A segment is a header followed by blocks of up to TX_ARCHIVE_BLOCK_RECORDS
+// records. Each block stores acc_no, type, currency, amount, timestamp and
+// receiver as separate columns and starts with the account and time range it
+// covers, so txArchiveScan skips blocks that cannot match and decodes only
+// the columns a query needs. Records are sorted by account (oldest first
+// within an account) in runs of TX_ARCHIVE_RUN_RECORDS before they are cut
+// into blocks, which keeps each account's records in a few blocks.
+//
+// Column encodings: type is one byte per record; the others are LEB128
+// varints. acc_no and timestamp are stored as zigzag deltas from the
+// previous record, amount and receiver as zigzag values.
+//
+// Crash safety: segments are written to temporary files and synced. The
+// manifest then lists them as pending together with the number of log
+// records they hold (drop). After that the files are renamed, the log is
+// emptied and the manifest marks them sealed. txArchiveRecover finishes
+// whatever a crash interrupted. TRANSACTIONS_ARCHIVE_FILE, the single archive
+// written by earlier versions, has the same layout and is listed in the
+// manifest as an ordinary segment.
+
+// Column order in a block; TX_COL_* bit i selects column i
+enum {
+    TX_COLUMN_ACC,
+    TX_COLUMN_TYPE,
+    TX_COLUMN_CURRENCY,
+    TX_COLUMN_AMOUNT,
+    TX_COLUMN_TIME,
+    TX_COLUMN_RECEIVER,
+    TX_COLUMN_COUNT
+};
+
+struct TxArchiveHeader {
+    char magic[8];
+    int64_t committed; // file bytes covered by complete blocks
+    int64_t log_drop;  // leading TRANSACTIONS_FILE records already archived
+};
+
+struct TxArchiveBlock {
+    uint32_t magic;
+    uint32_t count;
+    int32_t min_acc;
+    int32_t max_acc;
+    int64_t min_time;
+    int64_t max_time;
+    uint32_t column_bytes[TX_COLUMN_COUNT];
+};
+
+static size_t varintPut(unsigned char *out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (unsigned char)v;
+    return n;
+}
+
+// Returns 0 on a truncated or overlong varint
+static int varintGet(const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        unsigned char byte = *(*p)++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *v = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t zigzagEncode(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t zigzagDecode(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int truncateFile(FILE *fp, long size) {
+    if (fflush(fp) != 0) return 0;
+#ifdef _WIN32
+    return _chsize(_fileno(fp), size) == 0;
+#else
+    return ftruncate(fileno(fp), (off_t)size) == 0;
+#endif
+}
+
+static int txArchiveWriteHeader(FILE *fp, const struct TxArchiveHeader *hdr) {
+    return fseek(fp, 0, SEEK_SET) == 0 && fwrite(hdr, sizeof(*hdr), 1, fp) == 1 && syncFile(fp);
+}
+
+// Encodes records [0, n) as one block at the current position of fp
+static int txArchiveWriteBlock(FILE *fp, const struct Transaction *t, size_t n, unsigned char *buf) {
+    struct TxArchiveBlock block;
+    memset(&block, 0, sizeof(block));
+    block.magic = TX_ARCHIVE_BLOCK_MAGIC;
+    block.count = (uint32_t)n;
+    block.min_acc = block.max_acc = t[0].acc_no;
+    block.min_time = block.max_time = t[0].timestamp;
+    for (size_t i = 1; i < n; i++) {
+        if (t[i].acc_no < block.min_acc) block.min_acc = t[i].acc_no;
+        if (t[i].acc_no > block.max_acc) block.max_acc = t[i].acc_no;
+        if (t[i].timestamp < block.min_time) block.min_time = t[i].timestamp;
+        if (t[i].timestamp > block.max_time) block.max_time = t[i].timestamp;
+    }
+
+    // buf holds n * TX_ARCHIVE_MAX_RECORD_BYTES, enough for every column
+    unsigned char *p = buf;
+    unsigned char *start = p;
+    int64_t prev = 0;
+    for (size_t i = 0; i < n; prev = t[i].acc_no, i++) p += varintPut(p, zigzagEncode(t[i].acc_no - prev));
+    block.column_bytes[TX_COLUMN_ACC] = (uint32_t)(p - start);
+
+    start = p;
+    for (size_t i = 0; i < n; i++) *p++ = t[i].type;
+    block.column_bytes[TX_COLUMN_TYPE] = (uint32_t)(p - start);
+
+    start = p;
+    for (size_t i = 0; i < n; i++) p += varintPut(p, t[i].currency);
+    block.column_bytes[TX_COLUMN_CURRENCY] = (uint32_t)(p - start);
+
+    start = p;
+    for (size_t i = 0; i < n; i++) p += varintPut(p, zigzagEncode(t[i].amount));
+    block.column_bytes[TX_COLUMN_AMOUNT] = (uint32_t)(p - start);
+
+    start = p;
+    prev = block.min_time;
+    for (size_t i = 0; i < n; prev = t[i].timestamp, i++) p += varintPut(p, zigzagEncode(t[i].timestamp - prev));
+    block.column_bytes[TX_COLUMN_TIME] = (uint32_t)(p - start);
+
+    start = p;
+    for (size_t i = 0; i < n; i++) p += varintPut(p, zigzagEncode(t[i].receiver_acc_no));
+    block.column_bytes[TX_COLUMN_RECEIVER] = (uint32_t)(p - start);
+
+    size_t bytes = (size_t)(p - buf);
+    return fwrite(&block, sizeof(block), 1, fp) == 1 && fwrite(buf, 1, bytes, fp) == bytes;
+}
+
+// A block header and where it starts in its segment file
+struct TxBlockRef {
+    long offset;
+    struct TxArchiveBlock block;
+};
+
+struct TxArchiveSortKey {
+    int32_t month; // index into the month list of the roll
+    int32_t acc_no;
+    uint32_t pos;
+};
+
+static int txArchiveSortCompare(const void *a, const void *b) {
+    const struct TxArchiveSortKey *x = a, *y = b;
+    if (x->month != y->month) return x->month < y->month ? -1 : 1;
+    if (x->acc_no != y->acc_no) return x->acc_no < y->acc_no ? -1 : 1;
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+// Removes the first `records` records of TRANSACTIONS_FILE and resets the
+// transaction index; the log writer must be closed
+static int txArchiveDropLog(long records) {
+    long total = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+    int ok = 1;
+    if (records < total) {
+        // Keep the current month's records
+        const char *tmp_path = TRANSACTIONS_FILE ".tmp";
+        FILE *in = fopen(TRANSACTIONS_FILE, "rb");
+        FILE *out = fopen(tmp_path, "wb");
+        struct Transaction t;
+        ok = in && out && fseek(in, records * (long)sizeof(struct Transaction), SEEK_SET) == 0;
+        while (ok && fread(&t, sizeof(t), 1, in) == 1) ok = fwrite(&t, sizeof(t), 1, out) == 1;
+        if (out) {
+            if (ok) ok = syncFile(out);
+            if (fclose(out) != 0) ok = 0;
+        }
+        if (in) fclose(in);
+        if (ok) {
+            remove(TRANSACTIONS_FILE);
+            ok = rename(tmp_path, TRANSACTIONS_FILE) == 0;
+        }
+    } else {
+        FILE *fp = fopen(TRANSACTIONS_FILE, "wb");
+        ok = fp && syncFile(fp);
+        if (fp && fclose(fp) != 0) ok = 0;
+    }
+    if (!ok) return 0;
+
+    // The chains refer to record numbers that no longer exist
+    FILE *idx = fopen(TRANSACTIONS_INDEX_FILE, "wb");
+    if (!idx) return 0;
+    fclose(idx);
+    remove(TRANSACTIONS_HEADS_FILE);
+    return 1;
+}
+
+static struct TxSegment *tx_segments = NULL;
+static size_t tx_segment_count = 0;
+static size_t tx_segment_capacity = 0;
+static long tx_manifest_drop = 0; // log records held by pending segments
+
+// Start of the calendar month (local time) containing t, and of the next one
+static void txMonthBounds(long t, long *start, long *end) {
+    time_t when = (time_t)t;
+    struct tm tm = *localtime(&when);
+    tm.tm_mday = 1;
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    *start = (long)mktime(&tm);
+    tm.tm_mon++;
+    tm.tm_isdst = -1;
+    *end = (long)mktime(&tm);
+}
+
+static int txSegmentAdd(const struct TxSegment *seg) {
+    if (tx_segment_count == tx_segment_capacity) {
+        size_t capacity = tx_segment_capacity ? tx_segment_capacity * 2 : 16;
+        struct TxSegment *grown = realloc(tx_segments, capacity * sizeof(struct TxSegment));
+        if (!grown) return 0;
+        tx_segments = grown;
+        tx_segment_capacity = capacity;
+    }
+    tx_segments[tx_segment_count++] = *seg;
+    return 1;
+}
+
+static int txSegmentListed(const char *file) {
+    for (size_t i = 0; i < tx_segment_count; i++)
+        if (strcmp(tx_segments[i].file, file) == 0) return 1;
+    return 0;
+}
+
+static void txSegmentsClear(void) {
+    for (size_t i = 0; i < tx_segment_count; i++) free(tx_segments[i].blocks);
+    tx_segment_count = 0;
+}
+
+static int txManifestLoad(void) {
+    txSegmentsClear();
+    tx_manifest_drop = 0;
+    FILE *fp = fopen(TRANSACTIONS_MANIFEST_FILE, "r");
+    if (!fp) return 1;
+
+    char line[256], magic[8] = "", state[16];
+    int ok = fgets(line, sizeof(line), fp) && sscanf(line, "%7s", magic) == 1 &&
+             strcmp(magic, TX_MANIFEST_MAGIC) == 0;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        struct TxSegment seg;
+        memset(&seg, 0, sizeof(seg));
+        if (sscanf(line, "drop %ld", &tx_manifest_drop) == 1) continue;
+        if (sscanf(line, "segment %63s %ld %ld %ld %15s", seg.file, &seg.min_time, &seg.max_time, &seg.records,
+                   state) != 5) {
+            ok = 0;
+            break;
+        }
+        seg.pending = strcmp(state, "pending") == 0;
+        ok = txSegmentAdd(&seg);
+    }
+    fclose(fp);
+    if (!ok) printf(RED "Error: %s is damaged.\n" RESET, TRANSACTIONS_MANIFEST_FILE);
+    return ok;
+}
+
+// Replaces the manifest (temp file + rename)
+static int txManifestSave(void) {
+    const char *tmp_path = TRANSACTIONS_MANIFEST_FILE ".tmp";
+    FILE *fp = fopen(tmp_path, "w");
+    if (!fp) return 0;
+    fprintf(fp, "%s\n", TX_MANIFEST_MAGIC);
+    fprintf(fp, "drop %ld\n", tx_manifest_drop);
+    for (size_t i = 0; i < tx_segment_count; i++) {
+        const struct TxSegment *seg = &tx_segments[i];
+        fprintf(fp, "segment %s %ld %ld %ld %s\n", seg->file, seg->min_time, seg->max_time, seg->records,
+                seg->pending ? "pending" : "sealed");
+    }
+    int ok = syncFile(fp);
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) {
+        remove(tmp_path);
+        return 0;
+    }
+    remove(TRANSACTIONS_MANIFEST_FILE);
+    return rename(tmp_path, TRANSACTIONS_MANIFEST_FILE) == 0;
+}
+
+// Reads the header of every block in a segment file into a malloc'ed array
+static int txArchiveLoadBlocks(const char *path, struct TxBlockRef **blocks, size_t *count) {
+    *blocks = NULL;
+    *count = 0;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    struct TxArchiveHeader hdr;
+    int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 && memcmp(hdr.magic, TX_ARCHIVE_MAGIC, TX_ARCHIVE_MAGIC_LEN) == 0;
+    size_t capacity = 0;
+    long pos = (long)sizeof(hdr);
+    while (ok && pos < (long)hdr.committed) {
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct TxBlockRef *grown = realloc(*blocks, capacity * sizeof(struct TxBlockRef));
+            if (!grown) {
+                ok = 0;
+                break;
+            }
+            *blocks = grown;
+        }
+        struct TxBlockRef *ref = &(*blocks)[*count];
+        ref->offset = pos;
+        ok = fseek(fp, pos, SEEK_SET) == 0 && fread(&ref->block, sizeof(ref->block), 1, fp) == 1 &&
+             ref->block.magic == TX_ARCHIVE_BLOCK_MAGIC && ref->block.count > 0 &&
+             ref->block.count <= TX_ARCHIVE_BLOCK_RECORDS;
+        if (!ok) break;
+        size_t bytes = 0;
+        for (int c = 0; c < TX_COLUMN_COUNT; c++) bytes += ref->block.column_bytes[c];
+        ok = bytes <= (size_t)TX_ARCHIVE_BLOCK_RECORDS * TX_ARCHIVE_MAX_RECORD_BYTES;
+        pos += (long)(sizeof(ref->block) + bytes);
+        (*count)++;
+    }
+    fclose(fp);
+    if (!ok) {
+        free(*blocks);
+        *blocks = NULL;
+        *count = 0;
+    }
+    return ok;
+}
+
+// Time range and record count of a segment file, from its block headers
+static int txArchiveRange(const char *path, struct TxSegment *seg) {
+    struct TxBlockRef *blocks;
+    size_t count;
+    if (!txArchiveLoadBlocks(path, &blocks, &count)) return 0;
+    seg->records = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct TxArchiveBlock *block = &blocks[i].block;
+        if (seg->records == 0 || block->min_time < seg->min_time) seg->min_time = (long)block->min_time;
+        if (seg->records == 0 || block->max_time > seg->max_time) seg->max_time = (long)block->max_time;
+        seg->records += block->count;
+    }
+    free(blocks);
+    return 1;
+}
+
+// Brings the segments and the log back in step after a crash and lists a
+// TRANSACTIONS_ARCHIVE_FILE from earlier versions. Runs at startup before
+// transactionIndexOpen.
+int txArchiveRecover(void) {
+    if (!txManifestLoad()) return 0;
+
+    // Earlier versions appended to TRANSACTIONS_ARCHIVE_FILE and recorded the
+    // archived log records in its header
+    FILE *fp = fopen(TRANSACTIONS_ARCHIVE_FILE, "rb+");
+    if (fp) {
+        struct TxArchiveHeader hdr;
+        int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+                 memcmp(hdr.magic, TX_ARCHIVE_MAGIC, TX_ARCHIVE_MAGIC_LEN) == 0;
+        if (ok && fseek(fp, 0, SEEK_END) == 0 && ftell(fp) > (long)hdr.committed)
+            ok = truncateFile(fp, (long)hdr.committed) && syncFile(fp);
+        if (ok && hdr.log_drop > 0) {
+            ok = txArchiveDropLog((long)hdr.log_drop);
+            hdr.log_drop = 0;
+            if (ok) ok = txArchiveWriteHeader(fp, &hdr);
+        }
+        fclose(fp);
+        if (!ok) return 0;
+        if (!txSegmentListed(TRANSACTIONS_ARCHIVE_FILE)) {
+            struct TxSegment seg;
+            memset(&seg, 0, sizeof(seg));
+            snprintf(seg.file, sizeof(seg.file), "%s", TRANSACTIONS_ARCHIVE_FILE);
+            if (!txArchiveRange(TRANSACTIONS_ARCHIVE_FILE, &seg) || !txSegmentAdd(&seg) || !txManifestSave())
+                return 0;
+        }
+    }
+
+    // Pending segments: their files are complete, so finish the roll
+    int pending = 0;
+    for (size_t i = 0; i < tx_segment_count; i++) {
+        struct TxSegment *seg = &tx_segments[i];
+        if (!seg->pending) continue;
+        char tmp_path[TX_SEGMENT_NAME_MAX + 8];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", seg->file);
+        if ((fp = fopen(tmp_path, "rb")) != NULL) {
+            fclose(fp);
+            remove(seg->file);
+            if (rename(tmp_path, seg->file) != 0) return 0;
+        }
+        seg->pending = 0;
+        pending = 1;
+    }
+    if (pending || tx_manifest_drop > 0) {
+        if (tx_manifest_drop > 0 && !txArchiveDropLog(tx_manifest_drop)) return 0;
+        tx_manifest_drop = 0;
+        if (!txManifestSave()) return 0;
+    }
+    return 1;
+}
+
+// Picks an unused segment file name for the month starting at month_start
+static void txSegmentName(long month_start, char *name, size_t len) {
+    time_t when = (time_t)month_start;
+    char month[16];
+    strftime(month, sizeof(month), "%Y-%m", localtime(&when));
+    snprintf(name, len, "%s%s.arc", TX_SEGMENT_PREFIX, month);
+    for (int n = 2; txSegmentListed(name); n++) snprintf(name, len, "%s%s-%d.arc", TX_SEGMENT_PREFIX, month, n);
+}
+
+// Encodes the first `total` records of in as one segment per month. months
+// holds the first instant of each month present, ascending.
+static int txArchiveWriteSegments(FILE *in, long total, const long *months, int month_count,
+                                  struct TxSegment *segs) {
+    FILE **out = calloc((size_t)month_count, sizeof(FILE *));
+    size_t run_cap = total < TX_ARCHIVE_RUN_RECORDS ? (size_t)total : TX_ARCHIVE_RUN_RECORDS;
+    struct Transaction *run = malloc(run_cap * sizeof(struct Transaction));
+    struct Transaction *sorted = malloc(run_cap * sizeof(struct Transaction));
+    struct TxArchiveSortKey *keys = malloc(run_cap * sizeof(struct TxArchiveSortKey));
+    unsigned char *buf = malloc((size_t)TX_ARCHIVE_BLOCK_RECORDS * TX_ARCHIVE_MAX_RECORD_BYTES);
+    int ok = out && run && sorted && keys && buf && fseek(in, 0, SEEK_SET) == 0;
+
+    struct TxArchiveHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TX_ARCHIVE_MAGIC, TX_ARCHIVE_MAGIC_LEN);
+    for (int m = 0; ok && m < month_count; m++) {
+        char tmp_path[TX_SEGMENT_NAME_MAX + 8];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", segs[m].file);
+        out[m] = fopen(tmp_path, "wb");
+        ok = out[m] && fwrite(&hdr, sizeof(hdr), 1, out[m]) == 1;
+    }
+
+    for (long done = 0; ok && done < total; ) {
+        size_t want = total - done < (long)run_cap ? (size_t)(total - done) : run_cap;
+        size_t n = fread(run, sizeof(struct Transaction), want, in);
+        if (n == 0) {
+            ok = 0;
+            break;
+        }
+        int m = 0;
+        for (size_t i = 0; i < n; i++) {
+            // Records are nearly in time order; check the previous month first
+            if (run[i].timestamp < months[m] || (m + 1 < month_count && run[i].timestamp >= months[m + 1])) {
+                m = 0;
+                while (m + 1 < month_count && run[i].timestamp >= months[m + 1]) m++;
+            }
+            keys[i].month = m;
+            keys[i].acc_no = run[i].acc_no;
+            keys[i].pos = (uint32_t)i;
+        }
+        qsort(keys, n, sizeof(keys[0]), txArchiveSortCompare);
+        for (size_t i = 0; i < n; i++) sorted[i] = run[keys[i].pos];
+
+        for (size_t i = 0; ok && i < n; ) {
+            m = keys[i].month;
+            size_t count = 1;
+            while (i + count < n && count < TX_ARCHIVE_BLOCK_RECORDS && keys[i + count].month == m) count++;
+            ok = txArchiveWriteBlock(out[m], sorted + i, count, buf);
+            for (size_t k = i; k < i + count; k++) {
+                struct TxSegment *seg = &segs[m];
+                if (seg->records == 0 || sorted[k].timestamp < seg->min_time) seg->min_time = (long)sorted[k].timestamp;
+                if (seg->records == 0 || sorted[k].timestamp > seg->max_time) seg->max_time = (long)sorted[k].timestamp;
+                seg->records++;
+            }
+            i += count;
+        }
+        done += (long)n;
+    }
+
+    for (int m = 0; out && m < month_count; m++) {
+        if (!out[m]) continue;
+        if (ok) {
+            hdr.committed = (int64_t)ftell(out[m]);
+            ok = txArchiveWriteHeader(out[m], &hdr);
+        }
+        if (fclose(out[m]) != 0) ok = 0;
+    }
+    free(out);
+    free(run);
+    free(sorted);
+    free(keys);
+    free(buf);
+    return ok;
+}
+
+// Seals the records of past months into segments: the leading run of the
+// log's records that are older than the first day of the current month.
+// Everything from the first current-month record on stays in the log, so
+// each month is sealed once, into one segment, after it is over. Returns the
+// number of records archived, or -1 on failure (the log is then left as it
+// was). Takes every account lock, so no operation runs meanwhile.
+long archiveTransactionLog(void) {
+    // Postings of an unfinished interest run must not be sealed before its
+    // balances are written
+    if (!interestRecover()) return -1;
+    accountLockAll();
+    // WAL entries refer to log records by number, which sealing changes
+    if (!walCheckpoint()) {
+        accountUnlockAll();
+        return -1;
+    }
+    transactionLogClose();
+    long logged = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+    long current_month, next_month;
+    txMonthBounds((long)time(NULL), &current_month, &next_month);
+    long total = 0; // records to seal
+    size_t listed = tx_segment_count;
+    long *months = NULL;
+    int month_count = 0;
+    struct TxSegment *segs = NULL;
+    FILE *in = logged > 0 ? fopen(TRANSACTIONS_FILE, "rb") : NULL;
+    int ok = logged == 0 || in != NULL;
+
+    // Months present in the records to seal, ascending
+    if (ok && logged > 0) {
+        struct Transaction t;
+        int month_cap = 0;
+        long start = 0, end = 0;
+        while (ok && fread(&t, sizeof(t), 1, in) == 1) {
+            if (t.timestamp >= current_month) break;
+            total++;
+            if (month_count > 0 && t.timestamp >= start && t.timestamp < end) continue;
+            txMonthBounds((long)t.timestamp, &start, &end);
+            int m = 0;
+            while (m < month_count && months[m] < start) m++;
+            if (m < month_count && months[m] == start) continue;
+            if (month_count == month_cap) {
+                month_cap = month_cap ? month_cap * 2 : 4;
+                long *grown = realloc(months, (size_t)month_cap * sizeof(long));
+                if (!grown) {
+                    ok = 0;
+                    break;
+                }
+                months = grown;
+            }
+            memmove(months + m + 1, months + m, (size_t)(month_count - m) * sizeof(long));
+            months[m] = start;
+            month_count++;
+        }
+        if (ok && total > 0) {
+            segs = calloc((size_t)month_count, sizeof(struct TxSegment));
+            ok = segs != NULL;
+            for (int m = 0; ok && m < month_count; m++) {
+                txSegmentName(months[m], segs[m].file, sizeof(segs[m].file));
+                segs[m].pending = 1;
+            }
+            ok = ok && txArchiveWriteSegments(in, total, months, month_count, segs);
+        }
+    }
+    if (in) fclose(in);
+    long archived = total;
+
+    int committed = 0;
+    if (ok && total > 0) {
+        // Once the manifest is saved the records belong to the segments
+        for (int m = 0; ok && m < month_count; m++) ok = txSegmentAdd(&segs[m]);
+        tx_manifest_drop = total;
+        committed = ok && txManifestSave();
+        if (committed) {
+            ok = txArchiveRecover(); // Renames the files, drops the records from the log, marks them sealed
+            if (!ok) printf(RED "Error: Could not finish archiving; it completes on the next start.\n" RESET);
+        } else {
+            ok = 0;
+            tx_segment_count = listed;
+            tx_manifest_drop = 0;
+        }
+    }
+    for (int m = 0; !committed && segs && m < month_count; m++) {
+        char tmp_path[TX_SEGMENT_NAME_MAX + 8];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", segs[m].file);
+        remove(tmp_path);
+    }
+    free(months);
+    free(segs);
+
+    if (!ok) archived = -1;
+    if (!transactionIndexOpen() || !transactionLogOpen()) {
+        printf(RED "Error: Could not reopen the transaction log.\n" RESET);
+        archived = -1;
+    }
+    accountUnlockAll();
+    return archived;
+}
+
+// Seals the log once the month of its oldest record is over. Called from the
+// main thread between operations.
+void transactionLogRollPoll(void) {
+    static long cached_first = -1, roll_at = 0;
+    long first = transactionLogFirstTime();
+    if (first < 0) return;
+    if (first != cached_first) {
+        long start;
+        txMonthBounds(first, &start, &roll_at);
+        cached_first = first;
+    }
+    if ((long)time(NULL) < roll_at) return;
+
+    long archived = archiveTransactionLog();
+    if (archived > 0)
+        printf(YELLOW "Sealed %ld transaction(s) from before this month into log segments.\n" RESET, archived);
+}
+
+void printTransactionSegments(void) {
+    if (tx_segment_count == 0) return;
+    printf(BLUE "\n| %-28s | %-10s | %-10s | %-10s | %-10s |\n" RESET, "Segment", "From", "To", "Records", "Bytes");
+    for (size_t i = 0; i < tx_segment_count; i++) {
+        const struct TxSegment *seg = &tx_segments[i];
+        char from[16], to[16];
+        time_t when = (time_t)seg->min_time;
+        strftime(from, sizeof(from), "%Y-%m-%d", localtime(&when));
+        when = (time_t)seg->max_time;
+        strftime(to, sizeof(to), "%Y-%m-%d", localtime(&when));
+        long bytes = fileRecordCount(seg->file, 1);
+        if (bytes > 0)
+            printf("| %-28s | %-10s | %-10s | %-10ld | %-10ld |\n", seg->file, from, to, seg->records, bytes);
+        else
+            printf("| %-28s | %-10s | %-10s | %-10ld | %-10s |\n", seg->file, from, to, seg->records, "moved");
+    }
+}
+
+// Removes every segment file and the manifest
+void transactionSegmentsRemove(void) {
+    txManifestLoad();
+    for (size_t i = 0; i < tx_segment_count; i++) remove(tx_segments[i].file);
+    remove(TRANSACTIONS_MANIFEST_FILE);
+    remove(TRANSACTIONS_ARCHIVE_FILE);
+    txSegmentsClear();
+    tx_manifest_drop = 0;
+}
+
+// Decodes one varint column into values (zigzag and delta as requested)
+static int txArchiveDecodeColumn(const unsigned char *p, size_t bytes, size_t n, int zigzag, int64_t delta_base,
+                                 int delta, int64_t *values) {
+    const unsigned char *end = p + bytes;
+    int64_t prev = delta_base;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t raw;
+        if (!varintGet(&p, end, &raw)) return 0;
+        int64_t v = zigzag ? zigzagDecode(raw) : (int64_t)raw;
+        if (delta) {
+            v += prev;
+            prev = v;
+        }
+        values[i] = v;
+    }
+    return 1;
+}
+
+// Runs q over the given blocks of an open segment file
+static long txArchiveScanBlocks(FILE *fp, const struct TxBlockRef *blocks, size_t block_count,
+                                const struct TxArchiveQuery *q, int (*visit)(const struct Transaction *t, void *ctx),
+                                void *ctx) {
+    // The filters need their columns even if the caller does not
+    unsigned columns = q->columns;
+    if (q->acc_no != 0) columns |= TX_COL_ACC;
+    if (q->from != 0 || q->to != 0) columns |= TX_COL_TIME;
+
+    unsigned char *data = malloc((size_t)TX_ARCHIVE_BLOCK_RECORDS * TX_ARCHIVE_MAX_RECORD_BYTES);
+    int64_t *values = malloc(TX_ARCHIVE_BLOCK_RECORDS * sizeof(int64_t));
+    struct Transaction *rows = malloc(TX_ARCHIVE_BLOCK_RECORDS * sizeof(struct Transaction));
+    unsigned char *match = malloc(TX_ARCHIVE_BLOCK_RECORDS);
+    long visited = 0;
+    int ok = data && values && rows && match;
+    int stop = 0;
+
+    for (size_t b = 0; ok && !stop && b < block_count; b++) {
+        const struct TxArchiveBlock *block = &blocks[b].block;
+
+        // Block metadata rules out most blocks without reading them
+        if (q->acc_no != 0 && (q->acc_no < block->min_acc || q->acc_no > block->max_acc)) continue;
+        if (q->from != 0 && block->max_time < q->from) continue;
+        if (q->to != 0 && block->min_time > q->to) continue;
+
+        size_t offsets[TX_COLUMN_COUNT + 1];
+        offsets[0] = 0;
+        for (int c = 0; c < TX_COLUMN_COUNT; c++) offsets[c + 1] = offsets[c] + block->column_bytes[c];
+        long data_pos = blocks[b].offset + (long)sizeof(*block);
+
+        // Read the span from the first to the last needed column
+        int first = -1, last = -1;
+        for (int c = 0; c < TX_COLUMN_COUNT; c++) {
+            if (!(columns & (1u << c))) continue;
+            if (first < 0) first = c;
+            last = c;
+        }
+        if (first < 0) first = last = TX_COLUMN_TYPE;
+        size_t span = offsets[last + 1] - offsets[first];
+        if (fseek(fp, data_pos + (long)offsets[first], SEEK_SET) != 0 ||
+            fread(data + offsets[first], 1, span, fp) != span) {
+            ok = 0;
+            break;
+        }
+
+        size_t n = block->count;
+        memset(rows, 0, n * sizeof(struct Transaction));
+        memset(match, 1, n);
+        int any = 1;
+        for (int c = 0; ok && any && c < TX_COLUMN_COUNT; c++) {
+            if (!(columns & (1u << c))) continue;
+            const unsigned char *col = data + offsets[c];
+            size_t bytes = block->column_bytes[c];
+            if (c == TX_COLUMN_TYPE) {
+                if (bytes != n) ok = 0;
+                for (size_t i = 0; ok && i < n; i++) rows[i].type = col[i];
+                continue;
+            }
+            switch (c) {
+                case TX_COLUMN_ACC:      ok = txArchiveDecodeColumn(col, bytes, n, 1, 0, 1, values); break;
+                case TX_COLUMN_CURRENCY: ok = txArchiveDecodeColumn(col, bytes, n, 0, 0, 0, values); break;
+                case TX_COLUMN_AMOUNT:   ok = txArchiveDecodeColumn(col, bytes, n, 1, 0, 0, values); break;
+                case TX_COLUMN_TIME:     ok = txArchiveDecodeColumn(col, bytes, n, 1, block->min_time, 1, values); break;
+                default:                 ok = txArchiveDecodeColumn(col, bytes, n, 1, 0, 0, values); break;
+            }
+            if (!ok) break;
+            any = 0;
+            for (size_t i = 0; i < n; i++) {
+                switch (c) {
+                    case TX_COLUMN_ACC:
+                        rows[i].acc_no = (int32_t)values[i];
+                        if (q->acc_no != 0 && rows[i].acc_no != q->acc_no) match[i] = 0;
+                        break;
+                    case TX_COLUMN_CURRENCY: rows[i].currency = (uint16_t)values[i]; break;
+                    case TX_COLUMN_AMOUNT:   rows[i].amount = values[i]; break;
+                    case TX_COLUMN_TIME:
+                        rows[i].timestamp = values[i];
+                        if ((q->from != 0 && values[i] < q->from) || (q->to != 0 && values[i] > q->to)) match[i] = 0;
+                        break;
+                    default: rows[i].receiver_acc_no = (int32_t)values[i]; break;
+                }
+                any |= match[i];
+            }
+        }
+        if (!ok) break;
+
+        for (size_t i = 0; any && i < n; i++) {
+            if (!match[i]) continue;
+            rows[i].version = TRANSACTION_RECORD_VERSION;
+            visited++;
+            if (!visit(&rows[i], ctx)) {
+                stop = 1;
+                break;
+            }
+        }
+    }
+    free(data);
+    free(values);
+    free(rows);
+    free(match);
+    return ok ? visited : -1;
+}
+
+// Calls visit for every record of segment file path matching q, in file
+// order, with only the columns in q->columns filled in (the rest are zero).
+// Stops early when visit returns 0. Returns the number of records visited,
+// -1 on error.
+long txArchiveScan(const char *path, const struct TxArchiveQuery *q,
+                   int (*visit)(const struct Transaction *t, void *ctx), void *ctx) {
+    struct TxBlockRef *blocks;
+    size_t block_count;
+    if (!txArchiveLoadBlocks(path, &blocks, &block_count)) return -1;
+    FILE *fp = fopen(path, "rb");
+    long visited = fp ? txArchiveScanBlocks(fp, blocks, block_count, q, visit, ctx) : -1;
+    if (fp) fclose(fp);
+    free(blocks);
+    return visited;
+}
+
+// Runs q over every sealed segment whose time range overlaps it, oldest
+// first. Segment files that are missing (e.g. moved to other storage) are
+// reported and skipped. Returns the number of records visited, -1 on error.
+long transactionSegmentsScan(const struct TxArchiveQuery *q, int (*visit)(const struct Transaction *t, void *ctx),
+                             void *ctx, int *segments_read) {
+    long visited = 0;
+    int read = 0;
+    for (size_t i = 0; i < tx_segment_count; i++) {
+        struct TxSegment *seg = &tx_segments[i];
+        if (seg->pending || seg->records == 0) continue;
+        if (q->from != 0 && seg->max_time < q->from) continue;
+        if (q->to != 0 && seg->min_time > q->to) continue;
+
+        FILE *fp = fopen(seg->file, "rb");
+        if (!fp) {
+            printf(YELLOW "Log segment %s is not available; its transactions are not shown.\n" RESET, seg->file);
+            continue;
+        }
+        // Sealed segments never change, so their block headers are read once
+        if (!seg->blocks && !txArchiveLoadBlocks(seg->file, &seg->blocks, &seg->block_count)) {
+            fclose(fp);
+            return -1;
+        }
+        long n = txArchiveScanBlocks(fp, seg->blocks, seg->block_count, q, visit, ctx);
+        fclose(fp);
+        if (n < 0) return -1;
+        visited += n;
+        read++;
+    }
+    if (segments_read) *segments_read = read;
+    return visited;
+}
+
+// =========================================================================
+// LOAN INDEX
+// =========================================================================
+
+// LOANS_FILE is read once at startup and mirrored in memory, so no loan
+// action scans it:
+//   loan_book        - every record, by record number
+//   loan_by_id       - loan_id -> record number
+//   loan_by_account  - acc_no -> newest record of that account; older ones
+//                      are linked through loan_prev
+// Pending applications also form a FIFO, kept in LOAN_QUEUE_FILE as record
+// numbers in application order behind a header that holds the position of
+// the oldest undecided entry. Entries decided out of order are skipped when
+// the head reaches them, and the file is rewritten once most of it is dead.
+// A queue that does not match LOANS_FILE (missing, or a crash between the
+// two appends) is rebuilt from the pending loans in file order.
+// Loans are only handled from the menus, so none of this is locked.
+static struct Loan *loan_book = NULL;
+static long *loan_prev = NULL;
+static long loan_count = 0;
+static long loan_capacity = 0;
+static int loan_last_id = 0;
+static struct RecordIndex loan_by_id = {NULL, 0, 0};
+static struct RecordIndex loan_by_account = {NULL, 0, 0};
+
+static long *loan_queue = NULL; // record numbers; [loan_queue_head, loan_queue_len) may be pending
+static long loan_queue_len = 0;
+static long loan_queue_cap = 0;
+static long loan_queue_head = 0;
+
+static int loanIndexAdd(const struct Loan *loan) {
+    if (loan_count == loan_capacity) {
+        long capacity = loan_capacity ? loan_capacity * 2 : 256;
+        struct Loan *book = realloc(loan_book, (size_t)capacity * sizeof(struct Loan));
+        if (!book) return 0;
+        loan_book = book;
+        long *prev = realloc(loan_prev, (size_t)capacity * sizeof(long));
+        if (!prev) return 0;
+        loan_prev = prev;
+        loan_capacity = capacity;
+    }
+    long recno = loan_count;
+    // Older files may repeat a loan_id (ids were the submission second); the
+    // first record keeps it, as with the old linear scans
+    if (!recordIndexPut(&loan_by_id, loan->loan_id, recno, 0)) return 0;
+    loan_prev[recno] = recordIndexLookup(&loan_by_account, loan->acc_no);
+    if (!recordIndexPut(&loan_by_account, loan->acc_no, recno, 1)) return 0;
+    loan_book[recno] = *loan;
+    if (loan->loan_id > loan_last_id) loan_last_id = loan->loan_id;
+    loan_count++;
+    return 1;
+}
+
+static int loanQueuePushMemory(long recno) {
+    if (loan_queue_len == loan_queue_cap) {
+        long capacity = loan_queue_cap ? loan_queue_cap * 2 : 256;
+        long *queue = realloc(loan_queue, (size_t)capacity * sizeof(long));
+        if (!queue) return 0;
+        loan_queue = queue;
+        loan_queue_cap = capacity;
+    }
+    loan_queue[loan_queue_len++] = recno;
+    return 1;
+}
+
+// Writes the live part of the queue to LOAN_QUEUE_FILE (temp file + rename)
+static int loanQueueRewrite(void) {
+    const char *tmp_path = LOAN_QUEUE_FILE ".tmp";
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) return 0;
+
+    struct LoanQueueHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, LOAN_QUEUE_MAGIC, LOAN_QUEUE_MAGIC_LEN);
+    hdr.head = 0;
+    long live = loan_queue_len - loan_queue_head;
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+             (live == 0 || fwrite(loan_queue + loan_queue_head, sizeof(long), (size_t)live, fp) == (size_t)live);
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) {
+        remove(tmp_path);
+        return 0;
+    }
+    remove(LOAN_QUEUE_FILE);
+    rename(tmp_path, LOAN_QUEUE_FILE);
+
+    if (live > 0) memmove(loan_queue, loan_queue + loan_queue_head, (size_t)live * sizeof(long));
+    loan_queue_len = live;
+    loan_queue_head = 0;
+    return 1;
+}
+
+// Moves the head past decided loans and records it in the file header
+static void loanQueueAdvance(void) {
+    long head = loan_queue_head;
+    while (loan_queue_head < loan_queue_len && loan_book[loan_queue[loan_queue_head]].status != PENDING)
+        loan_queue_head++;
+    if (loan_queue_head == head) return;
+
+    if (loan_queue_head >= LOAN_QUEUE_COMPACT_MIN && loan_queue_head * 2 >= loan_queue_len) {
+        loanQueueRewrite();
+        return;
+    }
+    FILE *fp = fopen(LOAN_QUEUE_FILE, "rb+");
+    if (!fp) return;
+    struct LoanQueueHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, LOAN_QUEUE_MAGIC, LOAN_QUEUE_MAGIC_LEN);
+    hdr.head = loan_queue_head;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fclose(fp);
+}
+
+// Loads LOAN_QUEUE_FILE. Returns 0 unless it holds exactly the pending
+// loans, each once; `pending` is how many LOANS_FILE has.
+static int loanQueueLoad(long pending) {
+    FILE *fp = fopen(LOAN_QUEUE_FILE, "rb");
+    if (!fp) return 0;
+    struct LoanQueueHeader hdr;
+    int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 &&
+             memcmp(hdr.magic, LOAN_QUEUE_MAGIC, LOAN_QUEUE_MAGIC_LEN) == 0 && hdr.head >= 0;
+    long recno;
+    while (ok && fread(&recno, sizeof(recno), 1, fp) == 1) ok = loanQueuePushMemory(recno);
+    fclose(fp);
+    if (!ok || hdr.head > loan_queue_len) return 0;
+    loan_queue_head = hdr.head;
+
+    unsigned char *seen = calloc((size_t)loan_count + 1, 1);
+    if (!seen) return 0;
+    long found = 0;
+    for (long i = loan_queue_head; ok && i < loan_queue_len; i++) {
+        recno = loan_queue[i];
+        if (recno < 0 || recno >= loan_count || seen[recno]) {
+            ok = 0;
+        } else if (loan_book[recno].status == PENDING) {
+            seen[recno] = 1;
+            found++;
+        }
+    }
+    free(seen);
+    return ok && found == pending;
+}
+
+void loanIndexClose(void) {
+    free(loan_book);
+    free(loan_prev);
+    free(loan_queue);
+    loan_book = NULL;
+    loan_prev = NULL;
+    loan_queue = NULL;
+    loan_count = loan_capacity = 0;
+    loan_queue_len = loan_queue_cap = loan_queue_head = 0;
+    loan_last_id = 0;
+    recordIndexClear(&loan_by_id);
+    recordIndexClear(&loan_by_account);
+}
+
+// One sequential pass over LOANS_FILE, then the queue is loaded or rebuilt
+int loanIndexBuild(void) {
+    loanIndexClose();
+
+    long records = fileRecordCount(LOANS_FILE, sizeof(struct Loan));
+    if (!recordIndexReserve(&loan_by_id, (size_t)records) ||
+        !recordIndexReserve(&loan_by_account, (size_t)records))
+        return 0;
+
+    long pending = 0;
+    FILE *fp = fopen(LOANS_FILE, "rb");
+    if (fp) {
+        struct Loan loan;
+        while (fread(&loan, sizeof(struct Loan), 1, fp) == 1) {
+            if (!loanIndexAdd(&loan)) {
+                fclose(fp);
+                return 0;
+            }
+            if (loan.status == PENDING) pending++;
+        }
+        fclose(fp);
+    }
+
+    if (loanQueueLoad(pending)) {
+        loanQueueAdvance();
+        return 1;
+    }
+    loan_queue_len = loan_queue_head = 0;
+    for (long recno = 0; recno < loan_count; recno++)
+        if (loan_book[recno].status == PENDING && !loanQueuePushMemory(recno)) return 0;
+    return loanQueueRewrite();
+}
+
+const struct Loan *loanIndexGet(long recno) {
+    return (recno >= 0 && recno < loan_count) ? &loan_book[recno] : NULL;
+}
+
+long loanIndexFindId(int loan_id) {
+    return recordIndexLookup(&loan_by_id, loan_id);
+}
+
+// acc_no's oldest loan with the given status, or -1
+long loanIndexFindAccount(int acc_no, LoanStatus status) {
+    long found = -1;
+    for (long recno = recordIndexLookup(&loan_by_account, acc_no); recno >= 0; recno = loan_prev[recno])
+        if (loan_book[recno].status == status) found = recno;
+    return found;
+}
+
+// Appends a new application to LOANS_FILE and the pending queue. loan_id is
+// set here: the submission time, moved past the newest id so it is unique.
+// Returns the record number, or -1 if nothing could be written.
+long loanIndexAppend(struct Loan *loan) {
+    int loan_id = (int)time(NULL);
+    if (loan_id <= loan_last_id) loan_id = loan_last_id + 1;
+    loan->loan_id = loan_id;
+
+    FILE *fp = fopen(LOANS_FILE, "ab");
+    if (!fp) return -1;
+    int ok = fwrite(loan, sizeof(struct Loan), 1, fp) == 1;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok || !loanIndexAdd(loan)) return -1;
+
+    long recno = loan_count - 1;
+    if (!loanQueuePushMemory(recno)) return recno; // The next start rebuilds the queue
+    fp = fopen(LOAN_QUEUE_FILE, "ab");
+    if (fp) {
+        fwrite(&recno, sizeof(recno), 1, fp);
+        fclose(fp);
+    }
+    return recno;
+}
+
+// Mirrors a record that was just written to LOANS_FILE
+void loanIndexUpdate(long recno, const struct Loan *loan) {
+    if (recno < 0 || recno >= loan_count) return;
+    loan_book[recno] = *loan;
+    if (loan->status != PENDING) loanQueueAdvance();
+}
+
+// loanIndexUpdate for many records, with one queue update at the end
+void loanIndexUpdateBatch(const long *recnos, const struct Loan *loans, size_t n) {
+    int decided = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (recnos[i] < 0 || recnos[i] >= loan_count) continue;
+        loan_book[recnos[i]] = loans[i];
+        if (loans[i].status != PENDING) decided = 1;
+    }
+    if (decided) loanQueueAdvance();
+}
+
+// Pending loans in application order: start with *cursor = 0 and call until
+// it returns -1
+long loanQueueNext(long *cursor) {
+    if (*cursor < loan_queue_head) *cursor = loan_queue_head;
+    while (*cursor < loan_queue_len) {
+        long recno = loan_queue[(*cursor)++];
+        if (loan_book[recno].status == PENDING) return recno;
+    }
+    return -1;
+}
+
+// =========================================================================
+// LOAN AMORTIZATION
+// =========================================================================
+
+// Approved loans are repaid in equal monthly instalments (EMI) over
+// term_months at rate_bp a year. The EMI is fixed when the loan is approved;
+// the planned schedule is derived from it on demand. Interest is charged on
+// the amount still owed for the whole days since accrued_until, by the loan
+// interest run for the whole book and by loanRepayment for one loan.
+
+// Monthly instalment for each loan: principal[i] repaid over term[i] months
+// at rate_bp[i] a year, P * r / (1 - (1 + r)^-n) with r the monthly rate,
+// rounded up to the minor unit (P / n without interest; 0 without a term).
+// The power is taken by squaring so the loop makes no library calls.
+void loanEmiColumns(const Money *principal, const int32_t *rate_bp, const int32_t *term, size_t n, Money *emi) {
+    for (size_t i = 0; i < n; i++) {
+        if (term[i] <= 0) {
+            emi[i] = 0;
+            continue;
+        }
+        double r = rate_bp[i] / 120000.0;
+        double f = 1.0, base = 1.0 + r;
+        for (int32_t k = term[i]; k > 0; k >>= 1) {
+            if (k & 1) f *= base;
+            base *= base;
+        }
+        emi[i] = r > 0 ? (Money)ceil((double)principal[i] * r * f / (f - 1.0)) : (principal[i] + term[i] - 1) / term[i];
+    }
+}
+
+// Principal and accrued interest not yet repaid
+Money loanOutstanding(const struct Loan *loan) {
+    return loan->amount + loan->interest - loan->amount_paid;
+}
+
+// Fixes the instalment of a loan being approved and starts its schedule
+void loanStartSchedule(struct Loan *loan, time_t now) {
+    loanEmiColumns(&loan->amount, &loan->rate_bp, &loan->term_months, 1, &loan->emi);
+    loan->approved_at = (int64_t)now;
+    loan->accrued_until = (int64_t)now;
+}
+
+// loanStartSchedule for the APPROVED loans among n records, with the
+// instalments computed a column chunk at a time
+void loanStartSchedules(struct Loan *loans, size_t n, time_t now) {
+    Money principal[256], emi[256];
+    int32_t rate_bp[256], term[256];
+    for (size_t base = 0; base < n; base += 256) {
+        size_t count = n - base < 256 ? n - base : 256;
+        for (size_t i = 0; i < count; i++) {
+            principal[i] = loans[base + i].amount;
+            rate_bp[i] = loans[base + i].rate_bp;
+            term[i] = loans[base + i].term_months;
+        }
+        loanEmiColumns(principal, rate_bp, term, count, emi);
+        for (size_t i = 0; i < count; i++) {
+            struct Loan *loan = &loans[base + i];
+            if (loan->status != APPROVED) continue;
+            loan->emi = emi[i];
+            loan->approved_at = (int64_t)now;
+            loan->accrued_until = (int64_t)now;
+        }
+    }
+}
+
+// Charges the interest for the whole days since accrued_until, which moves
+// forward by those days (the part of a day left over is charged next time).
+// Returns the number of days charged; *interest receives the amount.
+int accrueLoan(struct Loan *loan, time_t now, Money *interest) {
+    *interest = 0;
+    if (loan->status != APPROVED || loan->rate_bp <= 0) return 0;
+    Money owed = loanOutstanding(loan);
+    double daily_rate = loan->rate_bp / 10000.0 / 365.0;
+    int days;
+    accrueInterestColumns(&owed, &loan->accrued_until, &daily_rate, 1, (int64_t)now, 0, interest, &days);
+    if (days == 0) return 0;
+    loan->interest += *interest;
+    loan->accrued_until += (int64_t)days * 60 * 60 * 24;
+    return days;
+}
+
+// Due date of instalment k (1-based): k calendar months after approval
+time_t loanDueDate(const struct Loan *loan, int k) {
+    time_t start = (time_t)loan->approved_at;
+    struct tm due = *localtime(&start);
+    due.tm_mon += k;
+    due.tm_isdst = -1;
+    return mktime(&due);
+}
+
+// Fills rows with the planned schedule: interest on the remaining principal
+// at the monthly rate, the rest of the EMI going to principal, and a last
+// instalment that clears what is left. Returns the number of instalments
+// (0 for loans without a schedule); at most max rows are written.
+int loanSchedule(const struct Loan *loan, struct LoanInstallment *rows, int max) {
+    if (loan->term_months <= 0 || loan->emi <= 0) return 0;
+    double r = loan->rate_bp / 120000.0;
+    Money balance = loan->amount;
+    for (int k = 1; k <= loan->term_months; k++) {
+        Money interest = moneyRound((double)balance * r);
+        Money principal = loan->emi - interest;
+        if (k == loan->term_months || principal > balance) principal = balance;
+        balance -= principal;
+        if (k <= max) {
+            rows[k - 1].number = k;
+            rows[k - 1].due = loanDueDate(loan, k);
+            rows[k - 1].interest = interest;
+            rows[k - 1].principal = principal;
+            rows[k - 1].payment = principal + interest;
+            rows[k - 1].balance = balance;
+        }
+    }
+    return loan->term_months;
+}
+
+// Instalments due by now and the part of them not yet paid
+int loanInstallmentsDue(const struct Loan *loan, time_t now, Money *arrears) {
+    *arrears = 0;
+    if (loan->term_months <= 0 || loan->emi <= 0) return 0;
+    int due = 0;
+    while (due < loan->term_months && loanDueDate(loan, due + 1) <= now) due++;
+    Money expected = 0;
+    if (due > 0) {
+        struct LoanInstallment *rows = malloc((size_t)due * sizeof(struct LoanInstallment));
+        if (rows) {
+            loanSchedule(loan, rows, due);
+            for (int k = 0; k < due; k++) expected += rows[k].payment;
+            free(rows);
+        } else {
+            expected = loan->emi * due;
+        }
+    }
+    if (expected > loan->amount_paid) *arrears = expected - loan->amount_paid;
+    return due;
+}
+
+// The loan interest run: charges every approved loan with a rate for the
+// whole days since it was last charged. The book is in memory (see
+// loanIndexBuild), so the run gathers a chunk of it into columns, computes
+// the chunk with accrueInterestColumns, writes back only the runs of
+// records that changed and syncs LOANS_FILE once at the end. Each record
+// carries its own accrued_until, so an interrupted run is finished by
+// running it again. Returns 0 on a write error, after reloading the index
+// from the file.
+int accrueLoanBook(time_t now, struct LoanAccrualResult *result) {
+    memset(result, 0, sizeof(*result));
+    if (loan_count == 0) return 1;
+
+    // Records are rewritten below without going through the WAL
+    if (!walCheckpoint()) return 0;
+    accountLockAll();
+
+    Money *owed = malloc(INTEREST_CHUNK_RECORDS * sizeof(Money));
+    double *daily_rate = malloc(INTEREST_CHUNK_RECORDS * sizeof(double));
+    int64_t *from = malloc(INTEREST_CHUNK_RECORDS * sizeof(int64_t));
+    Money *interest = malloc(INTEREST_CHUNK_RECORDS * sizeof(Money));
+    int *days = malloc(INTEREST_CHUNK_RECORDS * sizeof(int));
+    FILE *fp = fopen(LOANS_FILE, "rb+");
+    int ok = owed && daily_rate && from && interest && days && fp;
+
+    for (long base = 0; ok && base < loan_count; base += INTEREST_CHUNK_RECORDS) {
+        size_t n = (size_t)(loan_count - base < INTEREST_CHUNK_RECORDS ? loan_count - base : INTEREST_CHUNK_RECORDS);
+        struct Loan *chunk = loan_book + base;
+        // Loans that do not accrue get nothing owed, so the kernel skips them
+        for (size_t i = 0; i < n; i++) {
+            int accrues = chunk[i].status == APPROVED && chunk[i].rate_bp > 0;
+            owed[i] = accrues ? loanOutstanding(&chunk[i]) : 0;
+            daily_rate[i] = chunk[i].rate_bp / 10000.0 / 365.0;
+            from[i] = chunk[i].accrued_until;
+        }
+        accrueInterestColumns(owed, from, daily_rate, n, (int64_t)now, 0, interest, days);
+
+        size_t run_start = n; // first record of the current run of changed records
+        for (size_t i = 0; i <= n && ok; i++) {
+            int changed = i < n && days[i] > 0;
+            if (changed) {
+                chunk[i].interest += interest[i];
+                chunk[i].accrued_until += (int64_t)days[i] * 60 * 60 * 24;
+                result->charged++;
+                result->interest += interest[i];
+                if (run_start == n) run_start = i;
+            }
+            if (!changed && run_start < n) {
+                ok = fseek(fp, (base + (long)run_start) * (long)sizeof(struct Loan), SEEK_SET) == 0 &&
+                     fwrite(&chunk[run_start], sizeof(struct Loan), i - run_start, fp) == i - run_start;
+                run_start = n;
+            }
+        }
+        result->scanned += (long)n;
+    }
+    if (fp) {
+        if (ok) ok = syncFile(fp);
+        if (fclose(fp) != 0) ok = 0;
+    }
+    free(owed);
+    free(daily_rate);
+    free(from);
+    free(interest);
+    free(days);
+
+    // The book must match the file for the next run to finish the job
+    if (!ok) {
+        loanIndexClose();
+        loanIndexBuild();
+    }
+    accountUnlockAll();
+    return ok;
+}
+
+// Admin front end for accrueLoanBook
+void processLoanInterest() {
+    printf(BLUE "\n--- Processing Loan Interest ---\n" RESET);
+    struct LoanAccrualResult result;
+    long long started = monotonicMillis();
+    int ok = accrueLoanBook(time(NULL), &result);
+    double seconds = (double)(monotonicMillis() - started) / 1000.0;
+    if (!ok) printf(RED "Error: the loan interest run did not complete; run it again to finish.\n" RESET);
+    printf(GREEN "Charged %.2f interest on %ld loans.\n" RESET, moneyToDouble(result.interest), result.charged);
+    printf(GREEN "Scanned %ld loans in %.2f s (%.0f loans/sec).\n" RESET, result.scanned, seconds,
+           seconds > 0 ? result.scanned / seconds : (double)result.scanned);
+}
+
+// Prints the planned schedule of an approved loan with a term
+void printLoanSchedule(const struct Loan *loan) {
+    struct LoanInstallment *rows = malloc((size_t)(loan->term_months > 0 ? loan->term_months : 1) *
+                                          sizeof(struct LoanInstallment));
+    if (!rows) return;
+    int count = loanSchedule(loan, rows, loan->term_months);
+    printf(BLUE "| No. | Due Date   | Payment      | Interest     | Principal    | Balance      |\n" RESET);
+    printf(BLUE "-----------------------------------------------------------------------------------\n" RESET);
+    for (int k = 0; k < count; k++) {
+        char date[16];
+        strftime(date, sizeof(date), "%Y-%m-%d", localtime(&rows[k].due));
+        printf("| %-3d | %s | %12.2f | %12.2f | %12.2f | %12.2f |\n", rows[k].number, date,
+               moneyToDouble(rows[k].payment), moneyToDouble(rows[k].interest), moneyToDouble(rows[k].principal),
+               moneyToDouble(rows[k].balance));
+    }
+    free(rows);
+}
+
+// =========================================================================
+// WRITE-AHEAD LOG
+// =========================================================================
+
+// Balance-changing operations (deposits, withdrawals, transfers, loan
+// repayments and decisions) are written to WAL_FILE as a single entry
+// holding the after-image of every record they touch and their transaction
+// log postings, made durable with one fsync, and only then applied to
+// ACCOUNTS_FILE / LOANS_FILE without any flushing and handed to the
+// transaction log. walCheckpoint flushes the log, syncs the data files and
+// truncates the WAL. At startup walRecover redoes every complete entry,
+// including postings that had not reached the log; a torn entry at the tail
+// was never applied and is dropped, which rolls the operation back.
+static FILE *wal_fp = NULL;
+static unsigned int wal_next_seq = 1;
+static int wal_pending = 0;        // entries since the last checkpoint
+static int wal_loans_dirty = 0;
+
+// FNV-1a
+static unsigned int checksumBytes(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    unsigned int h = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static unsigned int walChecksum(const struct WalEntry *entry) {
+    return checksumBytes(entry, offsetof(struct WalEntry, checksum));
+}
+
+void walBegin(struct WalEntry *entry) {
+    memset(entry, 0, sizeof(*entry));
+    entry->magic = WAL_MAGIC;
+}
+
+int walAddAccount(struct WalEntry *entry, long pos, const struct Account *a) {
+    if (entry->count >= WAL_MAX_UPDATES) return 0;
+    struct WalUpdate *u = &entry->updates[entry->count++];
+    u->target = WAL_TARGET_ACCOUNT;
+    u->offset = pos;
+    u->image.account = *a;
+    return 1;
+}
+
+int walAddLoan(struct WalEntry *entry, long pos, const struct Loan *loan) {
+    if (entry->count >= WAL_MAX_UPDATES) return 0;
+    struct WalUpdate *u = &entry->updates[entry->count++];
+    u->target = WAL_TARGET_LOAN;
+    u->offset = pos;
+    u->image.loan = *loan;
+    return 1;
+}
+
+// Adds the transaction the operation logs; it reaches TRANSACTIONS_FILE
+// with the entry
+int walAddPosting(struct WalEntry *entry, int acc_no, TransactionType type, Money amount, int receiver_acc,
+                  const char *currency) {
+    if (entry->posting_count >= WAL_MAX_POSTINGS) return 0;
+    struct Transaction *t = &entry->postings[entry->posting_count++];
+    memset(t, 0, sizeof(*t));
+    t->acc_no = acc_no;
+    t->type = type;
+    t->amount = amount;
+    t->timestamp = time(NULL);
+    t->receiver_acc_no = receiver_acc;
+    t->currency = currencyId(currency);
+    t->version = TRANSACTION_RECORD_VERSION;
+    return 1;
+}
+
+static int walApply(const struct WalEntry *entry) {
+    int ok = 1;
+    FILE *loans_fp = NULL;
+    for (int i = 0; i < entry->count; i++) {
+        const struct WalUpdate *u = &entry->updates[i];
+        if (u->target == WAL_TARGET_ACCOUNT) {
+            if (!storeAccountRecord(u->offset, &u->image.account)) ok = 0;
+        } else {
+            if (!loans_fp && !(loans_fp = fopen(LOANS_FILE, "rb+"))) {
+                ok = 0;
+                continue;
+            }
+            if (fseek(loans_fp, u->offset, SEEK_SET) != 0 ||
+                fwrite(&u->image.loan, sizeof(struct Loan), 1, loans_fp) != 1)
+                ok = 0;
+            wal_loans_dirty = 1;
+        }
+    }
+    if (loans_fp) fclose(loans_fp);
+    return ok;
+}
+
+// One update of a batch, with its position in the batch
+struct WalApplyRef {
+    const struct WalUpdate *update;
+    size_t order;
+};
+
+static int walApplyRefCompare(const void *a, const void *b) {
+    const struct WalApplyRef *x = a, *y = b;
+    if (x->update->target != y->update->target) return x->update->target < y->update->target ? -1 : 1;
+    if (x->update->offset != y->update->offset) return x->update->offset < y->update->offset ? -1 : 1;
+    return x->order < y->order ? -1 : (x->order > y->order);
+}
+
+// Applies the updates of n entries in one pass over each data file, in
+// offset order. Several images of the same record keep their entry order,
+// so the last one wins as it would entry by entry.
+static int walApplyBatch(const struct WalEntry *entries, size_t n) {
+    if (n == 1) return walApply(entries);
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) total += (size_t)entries[i].count;
+    struct WalApplyRef *refs = malloc((total ? total : 1) * sizeof(struct WalApplyRef));
+    if (!refs) {
+        int ok = 1;
+        for (size_t i = 0; i < n; i++)
+            if (!walApply(&entries[i])) ok = 0;
+        return ok;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++)
+        for (int j = 0; j < entries[i].count; j++, k++) {
+            refs[k].update = &entries[i].updates[j];
+            refs[k].order = k;
+        }
+    qsort(refs, total, sizeof(refs[0]), walApplyRefCompare);
+
+    int ok = 1;
+    FILE *loans_fp = NULL;
+    for (k = 0; k < total; k++) {
+        const struct WalUpdate *u = refs[k].update;
+        if (u->target == WAL_TARGET_ACCOUNT) {
+            if (!storeAccountRecord(u->offset, &u->image.account)) ok = 0;
+        } else {
+            if (!loans_fp && !(loans_fp = fopen(LOANS_FILE, "rb+"))) {
+                ok = 0;
+                continue;
+            }
+            if (fseek(loans_fp, u->offset, SEEK_SET) != 0 ||
+                fwrite(&u->image.loan, sizeof(struct Loan), 1, loans_fp) != 1)
+                ok = 0;
+            wal_loans_dirty = 1;
+        }
+    }
+    if (loans_fp && fclose(loans_fp) != 0) ok = 0;
+    free(refs);
+    return ok;
+}
+
+// Logs the entry durably, then applies it. Returns 0 if the entry could not
+// be logged, in which case nothing was changed. Concurrent commits append
+// under wal_mutex but fsync and apply outside it, so their syncs can overlap.
+static int wal_in_flight = 0;       // commits between their write and apply
+static int wal_checkpointing = 0;
+static unsigned int wal_posted_seq = 0; // last entry whose postings were handed to the log
+
+// Cuts WAL_FILE back to start, removing the entries of a commit that failed
+// so that recovery cannot redo an operation reported as failed. end is where
+// those entries stop, or -1 if the caller knows nothing follows them. Called
+// with wal_mutex held. If later entries follow (another commit wrote while
+// this one was syncing) or the file cannot be cut and synced, it is unknown
+// what the log holds on disk, so the process stops and recovery settles it on
+// the next start.
+static void walDiscard(long start, long end) {
+    if (wal_fp) fclose(wal_fp); // Also drops whatever is still buffered
+    wal_fp = NULL;              // Reopened by the next commit
+    FILE *fp = fopen(WAL_FILE, "rb+");
+    int ok = fp != NULL;
+    if (ok && end >= 0) ok = fseek(fp, 0, SEEK_END) == 0 && ftell(fp) == end;
+    ok = ok && truncateFile(fp, start) && syncFile(fp);
+    if (fp) fclose(fp);
+    if (!ok) {
+        printf(RED "Fatal: a failed write-ahead log commit could not be rolled back. Stopping; "
+                   "the log is recovered on the next start.\n" RESET);
+        fflush(stdout);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int walGroupQueue(struct WalGroup *g, struct WalEntry *entry);
+
+int walCommit(struct WalEntry *entry) {
+    if (wal_group) return walGroupQueue(wal_group, entry);
+    return walCommitBatch(entry, 1);
+}
+
+// walCommit for n entries with one write and one fsync (bulk loan
+// decisions). Each entry must stand on its own: recovery after a crash
+// during the write redoes the complete entries and drops the rest. The
+// entries' postings get their log record numbers when the entries are
+// written and are handed to the log in WAL order once they are durable, so
+// a commit whose fsync finished early waits for the commits written before it.
+int walCommitBatch(struct WalEntry *entries, size_t n) {
+    if (n == 0) return 1;
+    size_t posting_total = 0;
+    for (size_t i = 0; i < n; i++) posting_total += (size_t)entries[i].posting_count;
+    struct Transaction *postings = entries[0].postings;
+    if (n > 1 && posting_total > 0) {
+        postings = malloc(posting_total * sizeof(struct Transaction));
+        if (!postings) return 0;
+        size_t k = 0;
+        for (size_t i = 0; i < n; i++)
+            for (int j = 0; j < entries[i].posting_count; j++) postings[k++] = entries[i].postings[j];
+    }
+
+    MUTEX_LOCK(&wal_mutex);
+    while (wal_checkpointing) COND_WAIT(&wal_cond, &wal_mutex);
+    long recno = 0;
+    int ok = (wal_fp || (wal_fp = fopen(WAL_FILE, "ab"))) &&
+             (posting_total == 0 || (recno = transactionLogReserve(posting_total)) >= 0);
+    int fd = -1;
+    long start = -1, end = -1;
+    unsigned int first_seq = wal_next_seq;
+    if (ok) {
+        long next = recno;
+        for (size_t i = 0; i < n; i++) {
+            if (entries[i].posting_count > 0) entries[i].log_recno = next;
+            next += entries[i].posting_count;
+            entries[i].seq = wal_next_seq++;
+            entries[i].checksum = walChecksum(&entries[i]);
+        }
+        ok = fseek(wal_fp, 0, SEEK_END) == 0 && (start = ftell(wal_fp)) >= 0 &&
+             fwrite(entries, sizeof(*entries), n, wal_fp) == n && fflush(wal_fp) == 0;
+        end = start + (long)(n * sizeof(*entries));
+        // Nothing was appended or reserved after a failed write, so it is
+        // undone right away
+        if (!ok) {
+            if (start >= 0) walDiscard(start, -1);
+            if (posting_total > 0) transactionLogRelease(posting_total);
+            wal_next_seq = first_seq;
+        }
+#ifdef _WIN32
+        if (ok) fd = _fileno(wal_fp);
+#else
+        if (ok) fd = fileno(wal_fp);
+#endif
+    }
+    if (ok) wal_in_flight++;
+    MUTEX_UNLOCK(&wal_mutex);
+    if (!ok) {
+        if (postings != entries[0].postings) free(postings);
+        return 0;
+    }
+
+    ok = syncDescriptor(fd);
+    if (ok && !walApplyBatch(entries, n))
+        printf(RED "Error applying update; it will be redone from the write-ahead log on restart.\n" RESET);
+
+    MUTEX_LOCK(&wal_mutex);
+    while (wal_posted_seq != first_seq - 1) COND_WAIT(&wal_cond, &wal_mutex);
+    wal_in_flight--;
+    if (ok) {
+        wal_pending += (int)n;
+        transactionLogPost(postings, posting_total, recno);
+    } else {
+        walDiscard(start, end); // Reported as failed, so recovery must not redo them
+        if (posting_total > 0) transactionLogRelease(posting_total);
+    }
+    wal_posted_seq = first_seq + (unsigned int)n - 1;
+    int checkpoint_due = wal_pending >= WAL_CHECKPOINT_ENTRIES;
+    COND_BROADCAST(&wal_cond);
+    MUTEX_UNLOCK(&wal_mutex);
+
+    if (postings != entries[0].postings) free(postings);
+    if (checkpoint_due) walCheckpoint();
+    return ok;
+}
+
+int walPendingEntries(void) {
+    MUTEX_LOCK(&wal_mutex);
+    int pending = wal_pending;
+    MUTEX_UNLOCK(&wal_mutex);
+    return pending;
+}
+
+int walGroupInit(struct WalGroup *g, size_t capacity) {
+    memset(g, 0, sizeof(*g));
+    g->entries = malloc(capacity * sizeof(struct WalEntry));
+    if (!g->entries) return 0;
+    g->capacity = capacity;
+    return 1;
+}
+
+void walGroupFree(struct WalGroup *g) {
+    if (wal_group == g) wal_group = NULL;
+    free(g->entries);
+    recordIndexClear(&g->images);
+    memset(g, 0, sizeof(*g));
+}
+
+// Routes walCommit, saveAccount and loadAccount through g;
+// NULL goes back to committing each operation on its own. Only one thread may
+// run operations while a group is in use, and the queued entries must be
+// committed before anything moves account records (compaction).
+void walGroupUse(struct WalGroup *g) {
+    wal_group = g;
+}
+
+static int walGroupQueue(struct WalGroup *g, struct WalEntry *entry) {
+    if (g->count == g->capacity && !walGroupCommit(g)) return 0;
+    for (int i = 0; i < entry->count; i++) {
+        const struct WalUpdate *u = &entry->updates[i];
+        if (u->target != WAL_TARGET_ACCOUNT) continue;
+        if (!recordIndexPut(&g->images, (int)(u->offset / (long)sizeof(struct Account)),
+                            (long)(g->count * WAL_MAX_UPDATES + (size_t)i), 1)) {
+            // No memory to track the image: commit the group, then this entry
+            if (!walGroupCommit(g)) return 0;
+            return walCommitBatch(entry, 1);
+        }
+    }
+    g->entries[g->count++] = *entry;
+    return 1;
+}
+
+// Commits the queued entries, postings included, with one WAL write and one
+// fsync. Returns 0 if the entries could not be logged: none of them is
+// applied.
+int walGroupCommit(struct WalGroup *g) {
+    int ok = walCommitBatch(g->entries, g->count);
+    if (ok) accountStoreCommit(0);
+    g->count = 0;
+    recordIndexClear(&g->images);
+    return ok;
+}
+
+static int walCheckpointLocked(void);
+
+// Makes the applied updates and their postings durable in the data files and
+// the transaction log, and empties the WAL. Returns 0 if that failed; the WAL
+// then keeps its entries, since it is the only durable copy of them, and the
+// next checkpoint tries again.
+int walCheckpoint(void) {
+    MUTEX_LOCK(&wal_mutex);
+    while (wal_checkpointing) COND_WAIT(&wal_cond, &wal_mutex);
+    wal_checkpointing = 1;
+    while (wal_in_flight > 0) COND_WAIT(&wal_cond, &wal_mutex);
+    int ok = walCheckpointLocked();
+    wal_checkpointing = 0;
+    COND_BROADCAST(&wal_cond);
+    MUTEX_UNLOCK(&wal_mutex);
+    return ok;
+}
+
+static int walCheckpointLocked(void) {
+    if (wal_pending == 0) return 1;
+
+    int ok = transactionLogFlush();
+    if (!accountStoreCommit(1)) ok = 0;
+    if (wal_loans_dirty) {
+        FILE *loans_fp = fopen(LOANS_FILE, "rb+");
+        int synced = loans_fp && syncFile(loans_fp);
+        if (loans_fp) fclose(loans_fp);
+        if (synced)
+            wal_loans_dirty = 0;
+        else
+            ok = 0;
+    }
+    if (!ok) {
+        printf(RED "Error syncing the data files; the write-ahead log is kept.\n" RESET);
+        return 0;
+    }
+
+    if (wal_fp) fclose(wal_fp);
+    wal_fp = fopen(WAL_FILE, "wb");
+    ok = wal_fp && syncFile(wal_fp);
+    wal_pending = 0;
+    return ok;
+}
+
+// Redoes the complete entries left by a crash and appends the postings of
+// theirs that TRANSACTIONS_FILE does not hold yet. Postings reach the log in
+// record number order, so those missing are always its tail. Needs the
+// account store open and runs before the transaction log is opened.
+int walRecover(void) {
+    FILE *fp = fopen(WAL_FILE, "rb");
+    if (!fp) return 1;
+
+    struct WalEntry entry;
+    int redone = 0;
+    long logged = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+    long restored = 0;
+    FILE *tx_fp = NULL;
+    int ok = 1;
+    while (ok && fread(&entry, sizeof(entry), 1, fp) == 1) {
+        if (entry.magic != WAL_MAGIC || entry.count < 0 || entry.count > WAL_MAX_UPDATES ||
+            entry.posting_count < 0 || entry.posting_count > WAL_MAX_POSTINGS || entry.checksum != walChecksum(&entry))
+            break; // Torn or partial entry: never applied, drop it
+        if (!walApply(&entry)) {
+            ok = 0;
+            break;
+        }
+        redone++;
+
+        long first = (long)entry.log_recno;
+        if (entry.posting_count == 0 || first + entry.posting_count <= logged) continue;
+        if (first > logged) {
+            printf(RED "The transaction log ends at record %ld, before the logged operation at record %ld.\n" RESET,
+                   logged, first);
+            ok = 0;
+            break;
+        }
+        if (!tx_fp) {
+            // Written over a torn record at the end, if there is one
+            if ((tx_fp = fopen(TRANSACTIONS_FILE, "ab")) != NULL) fclose(tx_fp);
+            tx_fp = fopen(TRANSACTIONS_FILE, "rb+");
+            ok = tx_fp && fseek(tx_fp, logged * (long)sizeof(struct Transaction), SEEK_SET) == 0;
+        }
+        size_t missing = (size_t)(first + entry.posting_count - logged);
+        ok = ok && fwrite(&entry.postings[logged - first], sizeof(struct Transaction), missing, tx_fp) == missing;
+        logged += (long)missing;
+        restored += (long)missing;
+    }
+    fclose(fp);
+    if (tx_fp) {
+        ok = ok && truncateFile(tx_fp, logged * (long)sizeof(struct Transaction)) && syncFile(tx_fp);
+        if (fclose(tx_fp) != 0) ok = 0;
+    }
+    if (!ok) return 0;
+
+    if (restored > 0)
+        printf(YELLOW "Restored %ld transaction(s) from the write-ahead log.\n" RESET, restored);
+    if (redone > 0) {
+        printf(YELLOW "Recovered %d operation(s) from the write-ahead log.\n" RESET, redone);
+        // Redone records may be tombstones or reused slots
+        if (!accountIndexBuild()) return 0;
+    }
+    wal_pending = 1; // Force the checkpoint below to sync and truncate
+    return walCheckpoint();
+}
+
+// =========================================================================
+// BACKUP
+// =========================================================================
+
+// Backups are incremental and compressed. BACKUP_MANIFEST_FILE in BACKUP_DIR
+// lists every piece written so far, oldest first, one per line:
+//
+//   <kind> <source> <piece> <offset> <size> <fingerprint> <checksum>
+//
+// A "full" piece holds a whole file, a "tail" piece the bytes an append-only
+// file gained from offset on, a "delta" piece the BACKUP_BLOCK_SIZE blocks of
+// a file updated in place that changed. The file is size bytes long once the
+// piece is applied. restoreBackup rebuilds a file from its last full piece
+// and the pieces after it, in order.
+//
+// Append-only files are checked against the fingerprint (the first and last
+// BACKUP_FINGERPRINT_BYTES before size) so that a log that was rewritten or
+// sealed gets a new full copy. Files backed up by blocks keep the hash of
+// every block, as the backup holds it, in <source>.blocks in BACKUP_DIR.
+//
+// A piece file is a stream of extents of up to BACKUP_EXTENT_SIZE bytes,
+// compressed by a pool of workers (backup_workers) and written in order,
+// then an index of BackupExtent entries (where each extent goes, where it is
+// stored, the SHA-256 of its data) and a BackupPieceTrailer. The manifest
+// line holds the SHA-256 of the index, so every byte restored is checked.
+// Sealed log segments are already compressed: they are copied by the kernel
+// (a reflink clone, else copy_file_range or sendfile) and only the index is
+// appended. Lines of earlier versions have no checksum and their pieces are
+// plain copies; restore does not accept them, so such files get a new full
+// piece on the next backup.
+
+enum BackupMode {
+    BACKUP_TAIL,   // append-only: copy what was added since the last backup
+    BACKUP_BLOCKS, // updated in place: copy the blocks that changed
+    BACKUP_SEALED  // never changes once written: copy it once
+};
+
+struct BackupEntry {
+    char kind[8];
+    char source[TX_SEGMENT_NAME_MAX];
+    char piece[BACKUP_PIECE_NAME_MAX];
+    long offset;
+    long size;
+    uint64_t fingerprint;
+    BYTE checksum[HASH_SIZE]; // SHA-256 of the piece's index
+    int legacy;               // written before pieces had an index
+};
+
+struct BackupManifest {
+    struct BackupEntry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+struct BackupBlockMapHeader {
+    char magic[4];
+    uint32_t block_size;
+    int64_t size;
+    uint64_t count;
+};
+
+// Index entry of a piece file
+struct BackupExtent {
+    int64_t target;    // offset in the restored file
+    int64_t stored_at; // offset in the piece file
+    uint32_t bytes;
+    uint32_t stored_bytes;
+    uint32_t flags;
+    uint32_t reserved;
+    BYTE sha256[HASH_SIZE]; // of the restored bytes
+};
+
+struct BackupPieceTrailer {
+    char magic[8];
+    int64_t size;     // file size once the piece is applied
+    int64_t index_at; // offset of the BackupExtent array
+    uint64_t extents;
+};
+
+int backup_workers = 0; // 0 = one per CPU core
+
+// FNV-1a, 64-bit, taking eight bytes per step. The multiply only carries
+// changes upwards, so the high half is folded back in after each step. h
+// chains a previous call (start with 0).
+static uint64_t checksumBytes64(const void *data, size_t len, uint64_t h) {
+    const unsigned char *p = (const unsigned char *)data;
+    if (h == 0) h = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        h ^= word;
+        h *= 1099511628211ULL;
+        h ^= h >> 32;
+    }
+    for (; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int backupWorkerCount(void) {
+    int workers = backup_workers;
+#ifdef _WIN32
+    workers = 1;
+#else
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (workers > BACKUP_MAX_WORKERS) workers = BACKUP_MAX_WORKERS;
+    return workers < 1 ? 1 : workers;
+}
+
+static void backupPath(char *out, size_t len, const char *name) {
+    snprintf(out, len, "%s/%s", BACKUP_DIR, name);
+}
+
+static long backupFileSize(FILE *fp) {
+    if (fseek(fp, 0, SEEK_END) != 0) return -1;
+    return ftell(fp);
+}
+
+static int backupParseChecksum(const char *hex, BYTE *out) {
+    if (strlen(hex) != 2 * HASH_SIZE) return 0;
+    for (int i = 0; i < HASH_SIZE; i++) {
+        unsigned int byte;
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) return 0;
+        out[i] = (BYTE)byte;
+    }
+    return 1;
+}
+
+static int backupManifestLoad(struct BackupManifest *m) {
+    memset(m, 0, sizeof(*m));
+    char path[BACKUP_PATH_MAX];
+    backupPath(path, sizeof(path), BACKUP_MANIFEST_FILE);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 1; // No backups yet
+
+    char line[BACKUP_PIECE_NAME_MAX + 224], magic[8] = "", checksum[2 * HASH_SIZE + 2];
+    int ok = fgets(line, sizeof(line), fp) && sscanf(line, "%7s", magic) == 1 &&
+             (strcmp(magic, BACKUP_MANIFEST_MAGIC) == 0 || strcmp(magic, BACKUP_MANIFEST_MAGIC_V1) == 0);
+    while (ok && fgets(line, sizeof(line), fp)) {
+        struct BackupEntry e;
+        unsigned long long fingerprint;
+        memset(&e, 0, sizeof(e));
+        int fields = sscanf(line, "%7s %63s %127s %ld %ld %llx %65s", e.kind, e.source, e.piece, &e.offset,
+                            &e.size, &fingerprint, checksum);
+        if (fields == 7) {
+            ok = backupParseChecksum(checksum, e.checksum);
+        } else {
+            ok = fields == 6;
+            e.legacy = 1;
+        }
+        if (!ok) break;
+        e.fingerprint = (uint64_t)fingerprint;
+        if (m->count == m->capacity) {
+            size_t capacity = m->capacity ? m->capacity * 2 : 32;
+            struct BackupEntry *grown = realloc(m->entries, capacity * sizeof(struct BackupEntry));
+            if (!grown) {
+                ok = 0;
+                break;
+            }
+            m->entries = grown;
+            m->capacity = capacity;
+        }
+        m->entries[m->count++] = e;
+    }
+    fclose(fp);
+    if (!ok) printf(RED "Error: %s is damaged.\n" RESET, path);
+    return ok;
+}
+
+// Appends e to the manifest file once its piece is on disk
+static int backupManifestAppend(struct BackupManifest *m, const struct BackupEntry *e) {
+    char path[BACKUP_PATH_MAX];
+    backupPath(path, sizeof(path), BACKUP_MANIFEST_FILE);
+    FILE *fp = fopen(path, "a");
+    if (!fp) return 0;
+    int ok = 1;
+    if (ftell(fp) == 0) ok = fprintf(fp, "%s\n", BACKUP_MANIFEST_MAGIC) > 0;
+    ok = ok && fprintf(fp, "%s %s %s %ld %ld %llx ", e->kind, e->source, e->piece, e->offset, e->size,
+                       (unsigned long long)e->fingerprint) > 0;
+    for (int i = 0; ok && i < HASH_SIZE; i++) ok = fprintf(fp, "%02x", e->checksum[i]) > 0;
+    ok = ok && fputc('\n', fp) != EOF;
+    ok = syncFile(fp) && ok;
+    if (fclose(fp) != 0) ok = 0;
+    if (ok && m->count < m->capacity) m->entries[m->count++] = *e;
+    return ok;
+}
+
+// Position of the last full entry for source, or -1. *legacy is set if it
+// or any later entry for source has no checksum.
+static long backupChainStart(const struct BackupManifest *m, const char *source, int *legacy) {
+    *legacy = 0;
+    for (size_t i = m->count; i-- > 0; ) {
+        const struct BackupEntry *e = &m->entries[i];
+        if (strcmp(e->source, source) != 0) continue;
+        if (e->legacy) *legacy = 1;
+        if (strcmp(e->kind, "full") == 0) return (long)i;
+    }
+    return -1;
+}
+
+// Newest entry for source, and how many entries it has since its last full one
+static const struct BackupEntry *backupLastEntry(const struct BackupManifest *m, const char *source,
+                                                 int *since_full) {
+    const struct BackupEntry *last = NULL;
+    *since_full = 0;
+    for (size_t i = m->count; i-- > 0; ) {
+        const struct BackupEntry *e = &m->entries[i];
+        if (strcmp(e->source, source) != 0) continue;
+        if (!last) last = e;
+        if (strcmp(e->kind, "full") == 0) return last;
+        (*since_full)++;
+    }
+    return last;
+}
+
+// Name for a new piece of source; a second backup within the same second
+// gets a numbered name
+static void backupPieceName(char *out, size_t len, const char *source, const char *timestamp, const char *ext) {
+    char path[BACKUP_PATH_MAX];
+    snprintf(out, len, "%s_%s%s", source, timestamp, ext);
+    for (int n = 2; ; n++) {
+        backupPath(path, sizeof(path), out);
+        FILE *probe = fopen(path, "rb");
+        if (!probe) return;
+        fclose(probe);
+        snprintf(out, len, "%s_%s-%d%s", source, timestamp, n, ext);
+    }
+}
+
+// Hash of the first and last BACKUP_FINGERPRINT_BYTES of fp before end
+static int backupFingerprint(FILE *fp, long end, uint64_t *out) {
+    unsigned char buf[BACKUP_FINGERPRINT_BYTES];
+    size_t head = end < BACKUP_FINGERPRINT_BYTES ? (size_t)end : BACKUP_FINGERPRINT_BYTES;
+    long tail_start = end - (long)head;
+    if (fseek(fp, 0, SEEK_SET) != 0 || fread(buf, 1, head, fp) != head) return 0;
+    uint64_t h = checksumBytes64(buf, head, 0);
+    if (fseek(fp, tail_start, SEEK_SET) != 0 || fread(buf, 1, head, fp) != head) return 0;
+    *out = checksumBytes64(buf, head, h);
+    return 1;
+}
+
+// Copies len bytes at in_off of src to out_off of dst. The kernel copies them
+// directly when it can; otherwise they go through a buffer.
+static int backupCopyRange(FILE *src, long in_off, FILE *dst, long out_off, long len) {
+    if (fflush(dst) != 0) return 0;
+#ifdef __linux__
+    int in_fd = fileno(src), out_fd = fileno(dst);
+    long done = 0;
+#ifdef SYS_copy_file_range
+    long long in_pos = in_off, out_pos = out_off;
+    while (done < len) {
+        long n = syscall(SYS_copy_file_range, in_fd, &in_pos, out_fd, &out_pos, (size_t)(len - done), 0U);
+        if (n <= 0) break; // Not supported here (e.g. across filesystems), or EOF
+        done += n;
+    }
+#endif
+    // sendfile writes at the file position of out_fd
+    if (done < len && lseek(out_fd, out_off + done, SEEK_SET) >= 0) {
+        off_t in_pos2 = in_off + done;
+        while (done < len) {
+            ssize_t n = sendfile(out_fd, in_fd, &in_pos2, (size_t)(len - done));
+            if (n <= 0) break;
+            done += n;
+        }
+    }
+    in_off += done;
+    out_off += done;
+    len -= done;
+    if (len == 0) return 1;
+#endif
+    if (fseek(src, in_off, SEEK_SET) != 0 || fseek(dst, out_off, SEEK_SET) != 0) return 0;
+    char *buffer = malloc(BACKUP_COPY_BUFFER);
+    int ok = buffer != NULL;
+    while (ok && len > 0) {
+        size_t n = len < BACKUP_COPY_BUFFER ? (size_t)len : BACKUP_COPY_BUFFER;
+        ok = fread(buffer, 1, n, src) == n && fwrite(buffer, 1, n, dst) == n;
+        len -= (long)n;
+    }
+    free(buffer);
+    return ok && fflush(dst) == 0;
+}
+
+// Copies the first size bytes of src into the empty file dst. Returns 2 for
+// a reflink clone, 1 for a copy, 0 on failure.
+static int backupCopyFile(FILE *src, FILE *dst, long size) {
+#ifdef __linux__
+    if (ioctl(fileno(dst), FICLONE, fileno(src)) == 0) {
+        // The clone covers anything appended since size was taken
+        if (ftruncate(fileno(dst), size) == 0) return 2;
+        if (ftruncate(fileno(dst), 0) != 0) return 0;
+    }
+#endif
+    return backupCopyRange(src, 0, dst, 0, size);
+}
+
+static void backupBlockMapPath(char *out, size_t len, const char *source) {
+    char name[TX_SEGMENT_NAME_MAX + 16];
+    snprintf(name, sizeof(name), "%s%s", source, BACKUP_BLOCKMAP_SUFFIX);
+    backupPath(out, len, name);
+}
+
+// Block hashes of the backed-up copy of source. Returns 0 if there are none
+// (or they were written with another block size).
+static int backupBlockMapLoad(const char *source, long *size, uint64_t **hashes, size_t *count) {
+    char path[BACKUP_PATH_MAX];
+    backupBlockMapPath(path, sizeof(path), source);
+    *hashes = NULL;
+    *count = 0;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    struct BackupBlockMapHeader hdr;
+    int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1 && memcmp(hdr.magic, BACKUP_BLOCKMAP_MAGIC, 4) == 0 &&
+             hdr.block_size == BACKUP_BLOCK_SIZE && hdr.size >= 0 &&
+             hdr.count == (uint64_t)((hdr.size + BACKUP_BLOCK_SIZE - 1) / BACKUP_BLOCK_SIZE);
+    if (ok && hdr.count > 0) {
+        *hashes = malloc((size_t)hdr.count * sizeof(uint64_t));
+        ok = *hashes && fread(*hashes, sizeof(uint64_t), (size_t)hdr.count, fp) == (size_t)hdr.count;
+    }
+    fclose(fp);
+    if (!ok) {
+        free(*hashes);
+        *hashes = NULL;
+        return 0;
+    }
+    *size = (long)hdr.size;
+    *count = (size_t)hdr.count;
+    return 1;
+}
+
+static int backupBlockMapSave(const char *source, long size, const uint64_t *hashes, size_t count) {
+    char path[BACKUP_PATH_MAX], tmp_path[BACKUP_PATH_MAX + 8];
+    backupBlockMapPath(path, sizeof(path), source);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) return 0;
+    struct BackupBlockMapHeader hdr;
+    memcpy(hdr.magic, BACKUP_BLOCKMAP_MAGIC, 4);
+    hdr.block_size = BACKUP_BLOCK_SIZE;
+    hdr.size = size;
+    hdr.count = count;
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(hashes, sizeof(uint64_t), count, fp) == count;
+    ok = syncFile(fp) && ok;
+    if (fclose(fp) != 0) ok = 0;
+    remove(path);
+    return ok && rename(tmp_path, path) == 0;
+}
+
+static uint64_t backupBlockHash(const unsigned char *block, size_t n) {
+    return checksumBytes64(block, n, 0) ^ (uint64_t)n;
+}
+
+// LZ77 compression in the style of LZ4. A sequence is a token byte (literal
+// count in the high four bits, match length - BACKUP_LZ_MIN_MATCH in the low
+// four; 15 means more length bytes follow, 255 at a time), the literals and
+// a two-byte little-endian match offset. The last sequence has literals only.
+static uint32_t backupLzRead32(const BYTE *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static BYTE *backupLzPutLength(BYTE *op, const BYTE *end, size_t len) {
+    for (; len >= 255; len -= 255) {
+        if (op >= end) return NULL;
+        *op++ = 255;
+    }
+    if (op >= end) return NULL;
+    *op++ = (BYTE)len;
+    return op;
+}
+
+// match_len 0 writes the final, literals-only sequence
+static BYTE *backupLzPutSequence(BYTE *op, const BYTE *end, const BYTE *literals, size_t literal_len,
+                                 size_t offset, size_t match_len) {
+    if (op >= end) return NULL;
+    size_t extra = match_len ? match_len - BACKUP_LZ_MIN_MATCH : 0;
+    BYTE *token = op++;
+    *token = (BYTE)(((literal_len < 15 ? literal_len : 15) << 4) | (extra < 15 ? extra : 15));
+    if (literal_len >= 15 && !(op = backupLzPutLength(op, end, literal_len - 15))) return NULL;
+    if ((size_t)(end - op) < literal_len) return NULL;
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (!match_len) return op;
+    if (end - op < 2) return NULL;
+    *op++ = (BYTE)offset;
+    *op++ = (BYTE)(offset >> 8);
+    if (extra >= 15 && !(op = backupLzPutLength(op, end, extra - 15))) return NULL;
+    return op;
+}
+
+// Compresses n bytes into out (n bytes of room). Returns the compressed size,
+// or 0 if it would not be smaller. table has 1 << BACKUP_LZ_HASH_BITS entries.
+static size_t backupCompress(const BYTE *in, size_t n, BYTE *out, uint32_t *table) {
+    if (n < 16) return 0;
+    memset(table, 0, sizeof(uint32_t) << BACKUP_LZ_HASH_BITS);
+    const BYTE *end = out + n - 1;
+    BYTE *op = out;
+    size_t anchor = 0, i = 0;
+    while (i + BACKUP_LZ_MIN_MATCH <= n) {
+        uint32_t v = backupLzRead32(in + i);
+        uint32_t h = (v * 2654435761U) >> (32 - BACKUP_LZ_HASH_BITS);
+        size_t candidate = table[h]; // position + 1, 0 = empty
+        table[h] = (uint32_t)(i + 1);
+        if (candidate && i - (candidate - 1) <= 0xFFFF && backupLzRead32(in + candidate - 1) == v) {
+            size_t from = candidate - 1, len = BACKUP_LZ_MIN_MATCH;
+            while (i + len < n && in[from + len] == in[i + len]) len++;
+            if (!(op = backupLzPutSequence(op, end, in + anchor, i - anchor, i - from, len))) return 0;
+            i += len;
+            anchor = i;
+        } else {
+            i += 1 + ((i - anchor) >> 6); // Move faster through data that does not compress
+        }
+    }
+    if (!(op = backupLzPutSequence(op, end, in + anchor, n - anchor, 0, 0))) return 0;
+    return (size_t)(op - out);
+}
+
+static int backupLzGetLength(const BYTE **ip, const BYTE *end, size_t *len) {
+    BYTE b;
+    do {
+        if (*ip >= end) return 0;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+// Decompresses n bytes into exactly out_len bytes; returns 0 on malformed input
+static int backupDecompress(const BYTE *in, size_t n, BYTE *out, size_t out_len) {
+    const BYTE *ip = in, *end = in + n;
+    size_t op = 0;
+    while (ip < end) {
+        unsigned int token = *ip++;
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !backupLzGetLength(&ip, end, &literal_len)) return 0;
+        if ((size_t)(end - ip) < literal_len || out_len - op < literal_len) return 0;
+        memcpy(out + op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == end) break; // Last sequence
+
+        if (end - ip < 2) return 0;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !backupLzGetLength(&ip, end, &len)) return 0;
+        len += BACKUP_LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || out_len - op < len) return 0;
+        if (offset >= len) {
+            memcpy(out + op, out + op - offset, len);
+            op += len;
+        } else {
+            for (size_t k = 0; k < len; k++, op++) out[op] = out[op - offset]; // Overlap repeats the pattern
+        }
+    }
+    return op == out_len;
+}
+
+// One extent on its way into a piece file
+struct BackupJob {
+    long target;
+    size_t bytes;
+    BYTE *data;
+    BYTE *packed;
+    size_t packed_bytes; // 0 = store data as is
+    BYTE sha256[HASH_SIZE];
+};
+
+// Writes one piece file. Extents are collected into a batch of jobs; the
+// workers compress and checksum a full batch, then it is written in order.
+struct BackupWriter {
+    FILE *fp;
+    long pos;      // end of the extent data in fp
+    int copy_only; // the data is already in fp at its target offsets
+    uint64_t *block_hashes; // if set, filled with backupBlockHash of every block
+    int workers;
+    struct BackupJob *jobs;
+    size_t job_count, job_slots;
+    uint32_t *tables; // one compression hash table per worker
+    struct BackupExtent *index;
+    size_t extents, index_capacity;
+    long long bytes, stored_bytes;
+    int ok;
+};
+
+struct BackupWorkerArg {
+    struct BackupWriter *w;
+    int first;
+};
+
+static void *backupWorkerRun(void *arg) {
+    struct BackupWorkerArg *a = arg;
+    struct BackupWriter *w = a->w;
+    uint32_t *table = w->tables + ((size_t)a->first << BACKUP_LZ_HASH_BITS);
+    for (size_t j = (size_t)a->first; j < w->job_count; j += (size_t)w->workers) {
+        struct BackupJob *job = &w->jobs[j];
+        sha256(job->data, job->bytes, job->sha256);
+        job->packed_bytes = w->copy_only ? 0 : backupCompress(job->data, job->bytes, job->packed, table);
+        if (w->block_hashes) {
+            size_t first_block = (size_t)(job->target / BACKUP_BLOCK_SIZE);
+            for (size_t off = 0; off < job->bytes; off += BACKUP_BLOCK_SIZE) {
+                size_t n = job->bytes - off < BACKUP_BLOCK_SIZE ? job->bytes - off : BACKUP_BLOCK_SIZE;
+                w->block_hashes[first_block + off / BACKUP_BLOCK_SIZE] = backupBlockHash(job->data + off, n);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int backupWriterInit(struct BackupWriter *w, FILE *fp, int copy_only) {
+    memset(w, 0, sizeof(*w));
+    w->fp = fp;
+    w->copy_only = copy_only;
+    w->workers = backupWorkerCount();
+    w->job_slots = (size_t)w->workers * BACKUP_JOBS_PER_WORKER;
+    w->jobs = calloc(w->job_slots, sizeof(struct BackupJob));
+    w->tables = malloc(((size_t)w->workers << BACKUP_LZ_HASH_BITS) * sizeof(uint32_t));
+    w->ok = w->jobs && w->tables;
+    for (size_t j = 0; w->ok && j < w->job_slots; j++) {
+        w->jobs[j].data = malloc(BACKUP_EXTENT_SIZE);
+        w->jobs[j].packed = malloc(BACKUP_EXTENT_SIZE);
+        w->ok = w->jobs[j].data && w->jobs[j].packed;
+    }
+    return w->ok;
+}
+
+static void backupWriterFree(struct BackupWriter *w) {
+    for (size_t j = 0; w->jobs && j < w->job_slots; j++) {
+        free(w->jobs[j].data);
+        free(w->jobs[j].packed);
+    }
+    free(w->jobs);
+    free(w->tables);
+    free(w->index);
+}
+
+// Compresses the batch on all workers and appends it to the piece
+static int backupWriterFlush(struct BackupWriter *w) {
+    if (!w->ok || w->job_count == 0) return w->ok;
+    int workers = w->workers;
+    if ((size_t)workers > w->job_count) workers = (int)w->job_count;
+    struct BackupWorkerArg args[BACKUP_MAX_WORKERS];
+    for (int i = 0; i < workers; i++) {
+        args[i].w = w;
+        args[i].first = i;
+    }
+    int saved = w->workers;
+    w->workers = workers; // the stride; workers beyond the batch have nothing to do
+#ifndef _WIN32
+    pthread_t threads[BACKUP_MAX_WORKERS];
+    int started[BACKUP_MAX_WORKERS];
+    for (int i = 1; i < workers; i++)
+        started[i] = pthread_create(&threads[i], NULL, backupWorkerRun, &args[i]) == 0;
+    backupWorkerRun(&args[0]);
+    for (int i = 1; i < workers; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            backupWorkerRun(&args[i]);
+    }
+#else
+    backupWorkerRun(&args[0]);
+#endif
+    w->workers = saved;
+
+    if (w->extents + w->job_count > w->index_capacity) {
+        size_t capacity = w->index_capacity ? w->index_capacity * 2 : 256;
+        while (capacity < w->extents + w->job_count) capacity *= 2;
+        struct BackupExtent *grown = realloc(w->index, capacity * sizeof(struct BackupExtent));
+        if (!grown) return w->ok = 0;
+        w->index = grown;
+        w->index_capacity = capacity;
+    }
+    for (size_t j = 0; w->ok && j < w->job_count; j++) {
+        const struct BackupJob *job = &w->jobs[j];
+        struct BackupExtent *x = &w->index[w->extents++];
+        memset(x, 0, sizeof(*x));
+        x->target = job->target;
+        x->bytes = (uint32_t)job->bytes;
+        x->stored_bytes = (uint32_t)(job->packed_bytes ? job->packed_bytes : job->bytes);
+        x->flags = job->packed_bytes ? 0 : BACKUP_EXTENT_RAW;
+        memcpy(x->sha256, job->sha256, HASH_SIZE);
+        if (w->copy_only) {
+            x->stored_at = job->target;
+        } else {
+            x->stored_at = w->pos;
+            const BYTE *stored = job->packed_bytes ? job->packed : job->data;
+            w->ok = fwrite(stored, 1, x->stored_bytes, w->fp) == x->stored_bytes;
+            w->pos += (long)x->stored_bytes;
+        }
+        w->bytes += (long long)x->bytes;
+        w->stored_bytes += (long long)x->stored_bytes;
+    }
+    w->job_count = 0;
+    return w->ok;
+}
+
+// Next job with room for more bytes at target, flushing a full batch first
+static struct BackupJob *backupWriterJob(struct BackupWriter *w, long target) {
+    if (w->job_count > 0) {
+        struct BackupJob *last = &w->jobs[w->job_count - 1];
+        if (last->target + (long)last->bytes == target && last->bytes < BACKUP_EXTENT_SIZE) return last;
+    }
+    if (w->job_count == w->job_slots && !backupWriterFlush(w)) return NULL;
+    struct BackupJob *job = &w->jobs[w->job_count++];
+    job->target = target;
+    job->bytes = 0;
+    return job;
+}
+
+// Adds n bytes that belong at target in the restored file
+static int backupWriterAdd(struct BackupWriter *w, long target, const BYTE *data, size_t n) {
+    while (w->ok && n > 0) {
+        struct BackupJob *job = backupWriterJob(w, target);
+        if (!job) break;
+        size_t take = BACKUP_EXTENT_SIZE - job->bytes < n ? BACKUP_EXTENT_SIZE - job->bytes : n;
+        memcpy(job->data + job->bytes, data, take);
+        job->bytes += take;
+        target += (long)take;
+        data += take;
+        n -= take;
+    }
+    return w->ok;
+}
+
+// Adds len bytes of src starting at from, read straight into the jobs
+static int backupWriterAddRange(struct BackupWriter *w, FILE *src, long from, long len) {
+    if (fseek(src, from, SEEK_SET) != 0) return w->ok = 0;
+    while (w->ok && len > 0) {
+        struct BackupJob *job = backupWriterJob(w, from);
+        if (!job) break;
+        size_t take = BACKUP_EXTENT_SIZE - job->bytes;
+        if ((long)take > len) take = (size_t)len;
+        w->ok = fread(job->data + job->bytes, 1, take, src) == take;
+        job->bytes += take;
+        from += (long)take;
+        len -= (long)take;
+    }
+    return w->ok;
+}
+
+// SHA-256 of a piece's extent index. A piece with no extents (a file that
+// did not change) has no index array, so the hash of no bytes is taken from
+// a placeholder rather than a null pointer.
+static void backupIndexChecksum(const struct BackupExtent *index, size_t extents, BYTE *checksum) {
+    static const BYTE no_index[1];
+    sha256(extents > 0 ? (const BYTE *)index : no_index, extents * sizeof(struct BackupExtent), checksum);
+}
+
+// Writes the index and trailer; checksum receives the SHA-256 of the index
+static int backupWriterFinish(struct BackupWriter *w, long size, BYTE *checksum) {
+    if (!backupWriterFlush(w)) return 0;
+    struct BackupPieceTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    memcpy(trailer.magic, BACKUP_PIECE_MAGIC, BACKUP_PIECE_MAGIC_LEN);
+    trailer.size = size;
+    trailer.index_at = w->pos;
+    trailer.extents = w->extents;
+    backupIndexChecksum(w->index, w->extents, checksum);
+    return fseek(w->fp, w->pos, SEEK_SET) == 0 &&
+           (w->extents == 0 || fwrite(w->index, sizeof(struct BackupExtent), w->extents, w->fp) == w->extents) &&
+           fwrite(&trailer, sizeof(trailer), 1, w->fp) == 1 && syncFile(w->fp);
+}
+
+// Adds the blocks of src (size bytes) whose hash differs from hashes[] and
+// updates hashes[] (which holds *count entries on entry and the new count on
+// return). Returns the number of blocks added, -1 on error.
+static long backupAddChangedBlocks(FILE *src, long size, struct BackupWriter *w, uint64_t **hashes, size_t *count) {
+    size_t new_count = (size_t)((size + BACKUP_BLOCK_SIZE - 1) / BACKUP_BLOCK_SIZE);
+    if (new_count > *count) {
+        uint64_t *grown = realloc(*hashes, new_count * sizeof(uint64_t));
+        if (!grown) return -1;
+        *hashes = grown;
+    }
+    BYTE *chunk = malloc(BACKUP_COPY_BUFFER);
+    long added = 0;
+    int ok = chunk != NULL && fseek(src, 0, SEEK_SET) == 0;
+    for (long base = 0; ok && base < size; base += BACKUP_COPY_BUFFER) {
+        size_t chunk_bytes = size - base < BACKUP_COPY_BUFFER ? (size_t)(size - base) : BACKUP_COPY_BUFFER;
+        ok = fread(chunk, 1, chunk_bytes, src) == chunk_bytes;
+        for (size_t off = 0; ok && off < chunk_bytes; off += BACKUP_BLOCK_SIZE) {
+            size_t i = (size_t)((base + (long)off) / BACKUP_BLOCK_SIZE);
+            size_t n = chunk_bytes - off < BACKUP_BLOCK_SIZE ? chunk_bytes - off : BACKUP_BLOCK_SIZE;
+            uint64_t h = backupBlockHash(chunk + off, n);
+            if (i < *count && (*hashes)[i] == h) continue;
+            ok = backupWriterAdd(w, base + (long)off, chunk + off, n);
+            (*hashes)[i] = h;
+            added++;
+        }
+    }
+    free(chunk);
+    *count = new_count;
+    return ok ? added : -1;
+}
+
+// Backs up one file into a new piece. Returns 1 if a piece was written, 0 if
+// nothing changed or the file does not exist, -1 on error.
+static int backupSource(struct BackupManifest *m, const char *source, enum BackupMode mode,
+                        const char *timestamp) {
+    FILE *src = fopen(source, "rb");
+    if (!src) {
+        printf(YELLOW "Warning: File not found, skipping backup for %s\n" RESET, source);
+        return 0;
+    }
+    long size = backupFileSize(src);
+    int since_full, legacy;
+    const struct BackupEntry *last = backupLastEntry(m, source, &since_full);
+    backupChainStart(m, source, &legacy);
+    int full = !last || legacy || since_full >= BACKUP_MAX_INCREMENTS || size < 0;
+    uint64_t fingerprint = 0;
+    uint64_t *hashes = NULL;
+    size_t hash_count = 0;
+    long mapped_size = 0;
+
+    if (!full && mode == BACKUP_SEALED) {
+        full = last->size != size;
+    } else if (!full && mode == BACKUP_TAIL) {
+        full = size < last->size || !backupFingerprint(src, last->size, &fingerprint) ||
+               fingerprint != last->fingerprint;
+    } else if (!full && mode == BACKUP_BLOCKS) {
+        full = !backupBlockMapLoad(source, &mapped_size, &hashes, &hash_count) || mapped_size != last->size;
+    }
+    if (!full && (mode == BACKUP_SEALED || (mode == BACKUP_TAIL && size == last->size))) {
+        fclose(src);
+        printf("%s: unchanged\n", source);
+        return 0;
+    }
+
+    struct BackupEntry e;
+    memset(&e, 0, sizeof(e));
+    snprintf(e.source, sizeof(e.source), "%s", source);
+    snprintf(e.kind, sizeof(e.kind), "%s", full ? "full" : mode == BACKUP_TAIL ? "tail" : "delta");
+    backupPieceName(e.piece, sizeof(e.piece), source, timestamp,
+                    full ? ".full" : mode == BACKUP_TAIL ? ".tail" : ".delta");
+    e.offset = full || mode != BACKUP_TAIL ? 0 : last->size;
+    e.size = size;
+
+    char piece_path[BACKUP_PATH_MAX];
+    backupPath(piece_path, sizeof(piece_path), e.piece);
+    FILE *dst = fopen(piece_path, "wb+");
+    struct BackupWriter w;
+    memset(&w, 0, sizeof(w));
+    int ok = dst != NULL && size >= 0;
+    if (ok) ok = backupWriterInit(&w, dst, mode == BACKUP_SEALED);
+    int cloned = 0;
+    long blocks = 0;
+    if (ok && mode == BACKUP_SEALED) {
+        int copied = backupCopyFile(src, dst, size);
+        cloned = copied == 2;
+        w.pos = size;
+        ok = copied && backupWriterAddRange(&w, src, 0, size);
+    } else if (ok && full) {
+        if (mode == BACKUP_BLOCKS) {
+            // The block hashes are taken from the bytes that go into the piece
+            free(hashes);
+            hash_count = (size_t)((size + BACKUP_BLOCK_SIZE - 1) / BACKUP_BLOCK_SIZE);
+            hashes = malloc((hash_count ? hash_count : 1) * sizeof(uint64_t));
+            w.block_hashes = hashes;
+            ok = hashes != NULL;
+        }
+        ok = ok && backupWriterAddRange(&w, src, 0, size);
+    } else if (ok && mode == BACKUP_TAIL) {
+        ok = backupWriterAddRange(&w, src, last->size, size - last->size);
+    } else if (ok) {
+        blocks = backupAddChangedBlocks(src, size, &w, &hashes, &hash_count);
+        ok = blocks >= 0;
+    }
+    // The log only grows, so the bytes before size are the ones backed up
+    if (ok && mode == BACKUP_TAIL) ok = backupFingerprint(src, size, &e.fingerprint);
+    ok = ok && backupWriterFinish(&w, size, e.checksum);
+    long long stored = w.stored_bytes;
+    backupWriterFree(&w);
+    if (dst && fclose(dst) != 0) ok = 0;
+    fclose(src);
+
+    if (ok && !full && mode == BACKUP_BLOCKS && blocks == 0 && size == mapped_size) {
+        remove(piece_path);
+        free(hashes);
+        printf("%s: unchanged\n", source);
+        return 0;
+    }
+    // The manifest lists the piece before the block map moves on, so a crash
+    // in between only makes the next backup copy some blocks again
+    ok = ok && backupManifestAppend(m, &e);
+    if (ok && mode == BACKUP_BLOCKS) ok = backupBlockMapSave(source, size, hashes, hash_count);
+    free(hashes);
+    if (!ok) {
+        remove(piece_path);
+        printf(RED "Error: Could not back up %s.\n" RESET, source);
+        return -1;
+    }
+
+    if (mode == BACKUP_SEALED)
+        printf(GREEN "%s: copied, %ld bytes%s -> %s\n" RESET, source, size, cloned ? " (reflink)" : "", e.piece);
+    else if (full)
+        printf(GREEN "%s: full copy, %ld bytes stored in %lld -> %s\n" RESET, source, size, stored, e.piece);
+    else if (mode == BACKUP_TAIL)
+        printf(GREEN "%s: %ld new bytes stored in %lld -> %s\n" RESET, source, size - e.offset, stored, e.piece);
+    else
+        printf(GREEN "%s: %ld changed block(s) stored in %lld bytes -> %s\n" RESET, source, blocks, stored, e.piece);
+    return 1;
+}
+
+struct RestoreWorker {
+    const char *piece_path;
+    const char *target_path;
+    const struct BackupExtent *index;
+    size_t extents;
+    int first, stride;
+    int ok;
+    int damaged; // an extent did not match its checksum
+};
+
+// Decompresses, checks and writes every stride-th extent of a piece
+static void *restoreWorkerRun(void *arg) {
+    struct RestoreWorker *r = arg;
+    FILE *in = fopen(r->piece_path, "rb");
+    FILE *out = fopen(r->target_path, "rb+");
+    BYTE *stored = malloc(BACKUP_EXTENT_SIZE);
+    BYTE *data = malloc(BACKUP_EXTENT_SIZE);
+    r->ok = in && out && stored && data;
+    for (size_t i = (size_t)r->first; r->ok && i < r->extents; i += (size_t)r->stride) {
+        const struct BackupExtent *x = &r->index[i];
+        int raw = (x->flags & BACKUP_EXTENT_RAW) != 0;
+        BYTE sum[HASH_SIZE];
+        r->ok = x->bytes <= BACKUP_EXTENT_SIZE && x->stored_bytes <= BACKUP_EXTENT_SIZE && x->target >= 0 &&
+                x->stored_at >= 0 && (!raw || x->stored_bytes == x->bytes) &&
+                fseek(in, (long)x->stored_at, SEEK_SET) == 0 &&
+                fread(raw ? data : stored, 1, x->stored_bytes, in) == x->stored_bytes &&
+                (raw || backupDecompress(stored, x->stored_bytes, data, x->bytes));
+        if (r->ok) {
+            sha256(data, x->bytes, sum);
+            r->ok = memcmp(sum, x->sha256, HASH_SIZE) == 0;
+        }
+        if (!r->ok) {
+            r->damaged = 1;
+            break;
+        }
+        r->ok = fseek(out, (long)x->target, SEEK_SET) == 0 && fwrite(data, 1, x->bytes, out) == x->bytes;
+    }
+    free(stored);
+    free(data);
+    if (in) fclose(in);
+    if (out && fclose(out) != 0) r->ok = 0;
+    return NULL;
+}
+
+// Applies one piece to target_path, checking it against the manifest entry
+static int restorePiece(const struct BackupEntry *e, const char *target_path) {
+    char piece_path[BACKUP_PATH_MAX];
+    backupPath(piece_path, sizeof(piece_path), e->piece);
+    FILE *fp = fopen(piece_path, "rb");
+    if (!fp) {
+        printf(RED "Error: Backup piece %s is missing.\n" RESET, e->piece);
+        return 0;
+    }
+    struct BackupPieceTrailer trailer;
+    long file_size = backupFileSize(fp);
+    int ok = file_size >= (long)sizeof(trailer) && fseek(fp, file_size - (long)sizeof(trailer), SEEK_SET) == 0 &&
+             fread(&trailer, sizeof(trailer), 1, fp) == 1 &&
+             memcmp(trailer.magic, BACKUP_PIECE_MAGIC, BACKUP_PIECE_MAGIC_LEN) == 0 && trailer.size == e->size &&
+             trailer.index_at >= 0 &&
+             trailer.extents == (uint64_t)(file_size - (long)sizeof(trailer) - trailer.index_at) / sizeof(struct BackupExtent);
+    struct BackupExtent *index = NULL;
+    if (ok && trailer.extents > 0) {
+        index = malloc((size_t)trailer.extents * sizeof(struct BackupExtent));
+        ok = index && fseek(fp, (long)trailer.index_at, SEEK_SET) == 0 &&
+             fread(index, sizeof(struct BackupExtent), (size_t)trailer.extents, fp) == (size_t)trailer.extents;
+    }
+    fclose(fp);
+    if (ok) {
+        BYTE sum[HASH_SIZE];
+        backupIndexChecksum(index, (size_t)trailer.extents, sum);
+        ok = memcmp(sum, e->checksum, HASH_SIZE) == 0;
+    }
+    if (!ok) {
+        free(index);
+        printf(RED "Error: Backup piece %s is damaged.\n" RESET, e->piece);
+        return 0;
+    }
+
+    int workers = backupWorkerCount();
+    if ((uint64_t)workers > trailer.extents) workers = trailer.extents > 0 ? (int)trailer.extents : 1;
+    struct RestoreWorker r[BACKUP_MAX_WORKERS];
+    for (int i = 0; i < workers; i++) {
+        r[i].piece_path = piece_path;
+        r[i].target_path = target_path;
+        r[i].index = index;
+        r[i].extents = (size_t)trailer.extents;
+        r[i].first = i;
+        r[i].stride = workers;
+        r[i].ok = 0;
+        r[i].damaged = 0;
+    }
+#ifndef _WIN32
+    pthread_t threads[BACKUP_MAX_WORKERS];
+    int started[BACKUP_MAX_WORKERS];
+    for (int i = 1; i < workers; i++)
+        started[i] = pthread_create(&threads[i], NULL, restoreWorkerRun, &r[i]) == 0;
+    restoreWorkerRun(&r[0]);
+    for (int i = 1; i < workers; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            restoreWorkerRun(&r[i]);
+    }
+#else
+    restoreWorkerRun(&r[0]);
+#endif
+    free(index);
+
+    int damaged = 0;
+    for (int i = 0; i < workers; i++) {
+        if (!r[i].ok) ok = 0;
+        if (r[i].damaged) damaged = 1;
+    }
+    if (damaged) {
+        printf(RED "Error: Backup piece %s is damaged.\n" RESET, e->piece);
+        return 0;
+    }
+    FILE *out = ok ? fopen(target_path, "rb+") : NULL;
+    ok = out && truncateFile(out, e->size);
+    if (out && fclose(out) != 0) ok = 0;
+    if (!ok) printf(RED "Error: Could not write %s.\n" RESET, target_path);
+    return ok;
+}
+
+// Rebuilds every file in the backup manifest inside dir from its last full
+// piece and the pieces after it, checking every extent against its
+// checksum. dir must not be the live data directory. Returns 1 if all files
+// were restored.
+int restoreBackup(const char *dir) {
+    if (strcmp(dir, ".") == 0 || strcmp(dir, "./") == 0) {
+        printf(RED "Error: Restore into an empty directory, not over the live data files.\n" RESET);
+        return 0;
+    }
+    struct BackupManifest m;
+    if (!backupManifestLoad(&m)) return 0;
+    if (m.count == 0) {
+        printf(YELLOW "No backups found in '%s'.\n" RESET, BACKUP_DIR);
+        return 0;
+    }
+    if (MKDIR(dir) == -1 && errno != EEXIST) {
+        printf(RED "Error: Could not create directory %s.\n" RESET, dir);
+        free(m.entries);
+        return 0;
+    }
+
+    long long started = monotonicMillis();
+    int restored = 0, failed = 0;
+    for (size_t i = 0; i < m.count; i++) {
+        const char *source = m.entries[i].source;
+        int seen = 0;
+        for (size_t k = 0; k < i && !seen; k++) seen = strcmp(m.entries[k].source, source) == 0;
+        if (seen) continue; // Each file once, in the order it was first backed up
+
+        int legacy;
+        long start = backupChainStart(&m, source, &legacy);
+        if (start < 0 || legacy) {
+            printf(RED "Error: %s has no backup this version can restore.\n" RESET, source);
+            failed++;
+            continue;
+        }
+        char target_path[BACKUP_PATH_MAX + TX_SEGMENT_NAME_MAX];
+        snprintf(target_path, sizeof(target_path), "%s/%s", dir, source);
+        FILE *out = fopen(target_path, "wb");
+        int ok = out != NULL;
+        if (out && fclose(out) != 0) ok = 0;
+
+        int pieces = 0;
+        for (size_t k = (size_t)start; ok && k < m.count; k++) {
+            if (strcmp(m.entries[k].source, source) != 0) continue;
+            ok = restorePiece(&m.entries[k], target_path);
+            pieces++;
+        }
+        out = ok ? fopen(target_path, "rb+") : NULL;
+        ok = out && syncFile(out);
+        if (out && fclose(out) != 0) ok = 0;
+        if (ok) {
+            printf(GREEN "Restored %s from %d piece(s), checksums verified.\n" RESET, source, pieces);
+            restored++;
+        } else {
+            remove(target_path);
+            failed++;
+        }
+    }
+    free(m.entries);
+
+    printf("%d file(s) restored into %s in %lld ms", restored, dir, monotonicMillis() - started);
+    if (failed > 0) printf(RED ", %d failed" RESET, failed);
+    printf(".\n");
+    return failed == 0;
+}
+
+// Removes every backup piece, block map and the manifest (used by --bench
+// before it generates fresh data)
+void backupReset(void) {
+    struct BackupManifest m;
+    if (!backupManifestLoad(&m)) return;
+    char path[BACKUP_PATH_MAX];
+    for (size_t i = 0; i < m.count; i++) {
+        backupPath(path, sizeof(path), m.entries[i].piece);
+        remove(path);
+        backupBlockMapPath(path, sizeof(path), m.entries[i].source);
+        remove(path);
+    }
+    backupPath(path, sizeof(path), BACKUP_MANIFEST_FILE);
+    remove(path);
+    free(m.entries);
+}
+
+// =========================================================================
+// DATA FORMAT MIGRATION
+// =========================================================================
+
+// Version 1 files stored amounts as float; version 2 transaction records held
+// the currency code and used platform-sized fields. migrateDataFiles converts
+// older files to the current layout once, before anything else opens them:
+//   1. a version 1 WAL is redone onto the version 1 files and removed,
+//   2. every file is converted into <name>.migrate,
+//   3. DATA_FORMAT_FILE is written,
+//   4. the .migrate files replace the originals.
+// A crash before step 3 restarts the migration; after it, step 4 is finished
+// on the next start.
+
+static int readDataFormatVersion(void) {
+    int version = 0;
+    FILE *fp = fopen(DATA_FORMAT_FILE, "r");
+    if (!fp) return 0;
+    if (fscanf(fp, "%d", &version) != 1) version = 0;
+    fclose(fp);
+    return version;
+}
+
+int writeDataFormatVersion(void) {
+    FILE *fp = fopen(DATA_FORMAT_FILE, "w");
+    if (!fp) return 0;
+    fprintf(fp, "%d\n", DATA_FORMAT_VERSION);
+    int ok = syncFile(fp);
+    return fclose(fp) == 0 && ok;
+}
+
+static void migrateAccountV1(const void *old_record, void *new_record) {
+    const struct AccountV1 *o = old_record;
+    struct Account *a = new_record;
+    a->acc_no = o->acc_no;
+    memcpy(a->name, o->name, sizeof(a->name));
+    a->balance = moneyRound((double)o->balance * MONEY_SCALE);
+    memcpy(a->currency, o->currency, sizeof(a->currency));
+    a->currency[sizeof(a->currency) - 1] = '\0';
+    if (a->currency[0] == '\0') strcpy(a->currency, "INR");
+    memcpy(a->pin_hash, o->pin_hash, HASH_SIZE);
+    memcpy(a->salt, o->salt, SALT_SIZE);
+    a->failed_attempts = o->failed_attempts;
+    a->locked = o->locked;
+    a->last_interest_date = o->last_interest_date;
+}
+
+// Older files may hold lower-case codes; anything that is still not a
+// currency code is stored as CURRENCY_ID_NONE
+static uint16_t migrateCurrency(const char old_code[4]) {
+    char code[4];
+    for (int i = 0; i < 3; i++) code[i] = (char)toupper((unsigned char)old_code[i]);
+    code[3] = '\0';
+    return currencyId(code);
+}
+
+static void migrateTransactionV1(const void *old_record, void *new_record) {
+    const struct TransactionV1 *o = old_record;
+    struct Transaction *t = new_record;
+    t->acc_no = o->acc_no;
+    t->type = (uint8_t)o->type;
+    t->amount = moneyRound((double)o->amount * MONEY_SCALE);
+    t->timestamp = o->timestamp;
+    t->receiver_acc_no = o->receiver_acc_no;
+    t->currency = migrateCurrency(o->currency);
+    t->version = TRANSACTION_RECORD_VERSION;
+}
+
+static void migrateTransactionV2(const void *old_record, void *new_record) {
+    const struct TransactionV2 *o = old_record;
+    struct Transaction *t = new_record;
+    t->acc_no = o->acc_no;
+    t->type = (uint8_t)o->type;
+    t->amount = o->amount;
+    t->timestamp = o->timestamp;
+    t->receiver_acc_no = o->receiver_acc_no;
+    t->currency = migrateCurrency(o->currency);
+    t->version = TRANSACTION_RECORD_VERSION;
+}
+
+static void migrateLoanV1(const void *old_record, void *new_record) {
+    const struct LoanV1 *o = old_record;
+    struct Loan *l = new_record;
+    l->loan_id = o->loan_id;
+    l->acc_no = o->acc_no;
+    l->amount = moneyRound((double)o->amount * MONEY_SCALE);
+    l->timestamp = o->timestamp;
+    l->status = o->status;
+    l->amount_paid = moneyRound((double)o->amount_paid * MONEY_SCALE);
+}
+
+// The amortization fields stay 0: existing loans keep their interest-free terms
+static void migrateLoanV3(const void *old_record, void *new_record) {
+    const struct LoanV3 *o = old_record;
+    struct Loan *l = new_record;
+    l->loan_id = o->loan_id;
+    l->acc_no = o->acc_no;
+    l->amount = o->amount;
+    l->timestamp = o->timestamp;
+    l->status = o->status;
+    l->amount_paid = o->amount_paid;
+}
+
+// Converts path into path.migrate record by record. A missing file is fine.
+static int migrateFile(const char *path, size_t old_size, size_t new_size,
+                       void (*convert)(const void *, void *)) {
+    char tmp_path[64];
+    snprintf(tmp_path, sizeof(tmp_path), "%s%s", path, DATA_MIGRATE_SUFFIX);
+
+    FILE *in = fopen(path, "rb");
+    if (!in) return 1;
+    FILE *out = fopen(tmp_path, "wb");
+    unsigned char *old_record = malloc(old_size);
+    unsigned char *new_record = malloc(new_size);
+    int ok = out && old_record && new_record;
+
+    while (ok && fread(old_record, old_size, 1, in) == 1) {
+        memset(new_record, 0, new_size);
+        convert(old_record, new_record);
+        ok = fwrite(new_record, new_size, 1, out) == 1;
+    }
+    if (out) {
+        if (ok) ok = syncFile(out);
+        if (fclose(out) != 0) ok = 0;
+    }
+    fclose(in);
+    free(old_record);
+    free(new_record);
+    return ok;
+}
+
+// Redoes the complete entries of a version 1 WAL onto the version 1 files
+static int migrateWalV1(void) {
+    FILE *fp = fopen(WAL_FILE, "rb");
+    if (!fp) return 1;
+
+    struct WalEntryV1 entry;
+    int ok = 1;
+    while (ok && fread(&entry, sizeof(entry), 1, fp) == 1) {
+        if (entry.magic != WAL_MAGIC || entry.count < 0 || entry.count > WAL_MAX_UPDATES ||
+            entry.checksum != checksumBytes(&entry, offsetof(struct WalEntryV1, checksum)))
+            break;
+        for (int i = 0; ok && i < entry.count; i++) {
+            const struct WalUpdateV1 *u = &entry.updates[i];
+            int is_account = u->target == WAL_TARGET_ACCOUNT;
+            FILE *data_fp = fopen(is_account ? ACCOUNTS_FILE : LOANS_FILE, "rb+");
+            if (!data_fp) {
+                ok = 0;
+                break;
+            }
+            ok = fseek(data_fp, u->offset, SEEK_SET) == 0 &&
+                 fwrite(&u->image, is_account ? sizeof(struct AccountV1) : sizeof(struct LoanV1), 1, data_fp) == 1 &&
+                 syncFile(data_fp);
+            fclose(data_fp);
+        }
+    }
+    fclose(fp);
+    if (ok) remove(WAL_FILE);
+    return ok;
+}
+
+// Redoes the complete entries of a version 2 or 3 WAL, whose loan images
+// have the version 3 size, onto the files before they are converted
+static int migrateWalV3(void) {
+    FILE *fp = fopen(WAL_FILE, "rb");
+    if (!fp) return 1;
+
+    struct WalEntryV3 entry;
+    int ok = 1;
+    while (ok && fread(&entry, sizeof(entry), 1, fp) == 1) {
+        if (entry.magic != WAL_MAGIC || entry.count < 0 || entry.count > WAL_MAX_UPDATES ||
+            entry.checksum != checksumBytes(&entry, offsetof(struct WalEntryV3, checksum)))
+            break;
+        for (int i = 0; ok && i < entry.count; i++) {
+            const struct WalUpdateV3 *u = &entry.updates[i];
+            int is_account = u->target == WAL_TARGET_ACCOUNT;
+            FILE *data_fp = fopen(is_account ? ACCOUNTS_FILE : LOANS_FILE, "rb+");
+            if (!data_fp) {
+                ok = 0;
+                break;
+            }
+            ok = fseek(data_fp, u->offset, SEEK_SET) == 0 &&
+                 fwrite(&u->image, is_account ? sizeof(struct Account) : sizeof(struct LoanV3), 1, data_fp) == 1 &&
+                 syncFile(data_fp);
+            fclose(data_fp);
+        }
+    }
+    fclose(fp);
+    if (ok) remove(WAL_FILE);
+    return ok;
+}
+
+// Redoes the complete entries of a version 4 WAL, which carried no postings;
+// those operations logged their transactions themselves
+static int migrateWalV4(void) {
+    FILE *fp = fopen(WAL_FILE, "rb");
+    if (!fp) return 1;
+
+    struct WalEntryV4 entry;
+    int ok = 1;
+    while (ok && fread(&entry, sizeof(entry), 1, fp) == 1) {
+        if (entry.magic != WAL_MAGIC || entry.count < 0 || entry.count > WAL_MAX_UPDATES ||
+            entry.checksum != checksumBytes(&entry, offsetof(struct WalEntryV4, checksum)))
+            break;
+        for (int i = 0; ok && i < entry.count; i++) {
+            const struct WalUpdate *u = &entry.updates[i];
+            int is_account = u->target == WAL_TARGET_ACCOUNT;
+            FILE *data_fp = fopen(is_account ? ACCOUNTS_FILE : LOANS_FILE, "rb+");
+            if (!data_fp) {
+                ok = 0;
+                break;
+            }
+            ok = fseek(data_fp, u->offset, SEEK_SET) == 0 &&
+                 fwrite(&u->image, is_account ? sizeof(struct Account) : sizeof(struct Loan), 1, data_fp) == 1 &&
+                 syncFile(data_fp);
+            fclose(data_fp);
+        }
+    }
+    fclose(fp);
+    if (ok) remove(WAL_FILE);
+    return ok;
+}
+
+int migrateDataFiles(void) {
+    const char *files[] = {ACCOUNTS_FILE, TRANSACTIONS_FILE, LOANS_FILE};
+    const int file_count = sizeof(files) / sizeof(files[0]);
+    char tmp_path[64];
+    FILE *probe;
+
+    int version = readDataFormatVersion();
+    if (version > DATA_FORMAT_VERSION) {
+        printf(RED "Data files use format version %d; this program supports up to %d.\n" RESET,
+               version, DATA_FORMAT_VERSION);
+        return 0;
+    }
+
+    if (version < DATA_FORMAT_VERSION) {
+        int has_data = 0;
+        for (int i = 0; i < file_count; i++) {
+            if ((probe = fopen(files[i], "rb")) != NULL) {
+                has_data = 1;
+                fclose(probe);
+            }
+        }
+        if (has_data && version < 2) {
+            printf(YELLOW "Migrating data files to integer minor-unit amounts...\n" RESET);
+            if (!migrateWalV1() ||
+                !migrateFile(ACCOUNTS_FILE, sizeof(struct AccountV1), sizeof(struct Account), migrateAccountV1) ||
+                !migrateFile(TRANSACTIONS_FILE, sizeof(struct TransactionV1), sizeof(struct Transaction),
+                             migrateTransactionV1) ||
+                !migrateFile(LOANS_FILE, sizeof(struct LoanV1), sizeof(struct Loan), migrateLoanV1)) {
+                printf(RED "Data migration failed; the original files are unchanged.\n" RESET);
+                return 0;
+            }
+        } else if (has_data) {
+            // Accounts are unchanged since version 2
+            int ok = 1;
+            if (version < 3) {
+                printf(YELLOW "Migrating transaction records to the packed format...\n" RESET);
+                ok = migrateFile(TRANSACTIONS_FILE, sizeof(struct TransactionV2), sizeof(struct Transaction),
+                                 migrateTransactionV2);
+            }
+            if (ok && version < 4) {
+                printf(YELLOW "Migrating loan records to add amortization terms...\n" RESET);
+                ok = migrateWalV3() && migrateFile(LOANS_FILE, sizeof(struct LoanV3), sizeof(struct Loan), migrateLoanV3);
+            } else if (ok) {
+                ok = migrateWalV4(); // Only the WAL entry layout changed
+            }
+            if (!ok) {
+                printf(RED "Data migration failed; the original files are unchanged.\n" RESET);
+                return 0;
+            }
+        }
+        if (!writeDataFormatVersion()) return 0;
+    }
+
+    // Put converted files in place (also finishes an interrupted migration)
+    int migrated = 0;
+    for (int i = 0; i < file_count; i++) {
+        snprintf(tmp_path, sizeof(tmp_path), "%s%s", files[i], DATA_MIGRATE_SUFFIX);
+        if ((probe = fopen(tmp_path, "rb")) == NULL) continue;
+        fclose(probe);
+        remove(files[i]);
+        if (rename(tmp_path, files[i]) != 0) return 0;
+        migrated++;
+    }
+    if (migrated > 0) printf(GREEN "Data migration complete.\n" RESET);
+    return 1;
+}
+
+// Startup order: the account index and store come first so that WAL recovery
+// can redo account updates before anything else writes.
+int openDataFiles(void) {
+    if (!acquireDataLock()) {
+        printf(RED "The data files are in use by another instance of the program.\n" RESET);
+        return 0;
+    }
+    if (!migrateDataFiles()) {
+        printf(RED "Failed to migrate data files.\n" RESET);
+        return 0;
+    }
+    remove(ACCOUNTS_COMPACT_FILE); // Left by a compaction interrupted before its rename
+    // Build the acc_no -> record index used by all account lookups
+    if (!accountIndexBuild()) {
+        printf(RED "Failed to build account index.\n" RESET);
+        return 0;
+    }
+    if (!accountStoreOpen()) {
+        printf(RED "Failed to open account store.\n" RESET);
+        return 0;
+    }
+    // Finish operations interrupted by a crash before anything else writes
+    if (!walRecover()) {
+        printf(RED "Failed to recover from the write-ahead log.\n" RESET);
+        return 0;
+    }
+    if (!loanIndexBuild()) {
+        printf(RED "Failed to build loan index.\n" RESET);
+        return 0;
+    }
+    // Settles an interest run cut short, before the log is indexed
+    if (!interestRecover()) {
+        printf(RED "Failed to recover the interrupted interest run.\n" RESET);
+        return 0;
+    }
+
+    // Initialize last interest dates for existing accounts
+    initializeLastInterestDate();
+    if (!txArchiveRecover()) {
+        printf(RED "Failed to recover the transaction archive.\n" RESET);
+        return 0;
+    }
+    if (!transactionIndexOpen() || !transactionLogOpen()) {
+        printf(RED "Failed to open transaction log.\n" RESET);
+        return 0;
+    }
+    transactionLogRollPoll();
+    return 1;
+}
+
+// Shutdown order: the WAL checkpoint writes account records, so it runs
+// before the store is closed; the log is flushed before its index checkpoint.
+void closeDataFiles(void) {
+    compactionPoll(1);
+    walCheckpoint();
+    accountStoreClose();
+    transactionLogClose();
+    transactionIndexCheckpoint();
+    exchangeRatesClose();
+    loanIndexClose();
+    releaseDataLock();
+}
+
+// =========================================================================
+// EXISTING FUNCTION IMPLEMENTATIONS
+// =========================================================================
+
+static const WORD sha256_k[64] = {
+    0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,
+    0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+    0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,
+    0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+    0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,
+    0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+    0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,
+    0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+    0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,
+    0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+    0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,
+    0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+    0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,
+    0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+    0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,
+    0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+static const WORD sha256_iv[8] = {
+    0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,
+    0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
+};
+
+static void sha256BlocksScalar(WORD state[8], const BYTE *data, size_t blocks)
+{
+    WORD a,b,c,d,e,f,g,h,i,j,t1,t2,m[64];
+
+    for (; blocks > 0; blocks--, data += 64) {
+        for (i=0,j=0; i < 16; ++i, j += 4)
+            m[i] = ((WORD)data[j] << 24) | (data[j+1] << 16) | (data[j+2] << 8) | (data[j+3]);
+        for ( ; i < 64; ++i)
+            m[i] = SIG1(m[i-2]) + m[i-7] + SIG0(m[i-15]) + m[i-16];
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
+
+        for (i=0; i < 64; ++i) {
+            t1 = h + EP1(e) + CH(e,f,g) + sha256_k[i] + m[i];
+            t2 = EP0(a) + MAJ(a,b,c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+// One block for each of up to SHA256_MAX_LANES independent messages. Word j
+// of lane l lives at state[j][l] and w[j][l], so a vector load of row j
+// picks up that word for every lane at once.
+typedef void (*Sha256LanesFn)(WORD state[8][SHA256_MAX_LANES], const WORD w[16][SHA256_MAX_LANES]);
+
+#if SHA256_X86_DISPATCH
+// SHA-NI: the ABEF/CDGH state layout and two rounds per sha256rnds2 follow
+// Intel's reference code. The message schedule is kept as a rolling window
+// of four 4-word vectors.
+__attribute__((target("sha,sse4.1")))
+static void sha256BlocksShaNi(WORD state[8], const BYTE *data, size_t blocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1); // CDAB
+    __m128i s1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);  // EFGH
+    __m128i s0 = _mm_alignr_epi8(tmp, s1, 8);                                          // ABEF
+    s1 = _mm_blend_epi16(s1, tmp, 0xF0);                                               // CDGH
+
+    for (; blocks > 0; blocks--, data += 64) {
+        __m128i save0 = s0, save1 = s1, w[4];
+        for (int i = 0; i < 16; i++) {
+            __m128i *cur = &w[i & 3];
+            if (i < 4) {
+                *cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), bswap);
+            } else {
+                __m128i prev = w[(i - 1) & 3];
+                __m128i x = _mm_sha256msg1_epu32(*cur, w[(i + 1) & 3]);
+                x = _mm_add_epi32(x, _mm_alignr_epi8(prev, w[(i - 2) & 3], 4));
+                *cur = _mm_sha256msg2_epu32(x, prev);
+            }
+            __m128i msg = _mm_add_epi32(*cur, _mm_loadu_si128((const __m128i *)&sha256_k[4 * i]));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+        s0 = _mm_add_epi32(s0, save0);
+        s1 = _mm_add_epi32(s1, save1);
+    }
+
+    tmp = _mm_shuffle_epi32(s0, 0x1B);        // FEBA
+    s1 = _mm_shuffle_epi32(s1, 0xB1);         // DCHG
+    s0 = _mm_blend_epi16(tmp, s1, 0xF0);      // DCBA
+    s1 = _mm_alignr_epi8(s1, tmp, 8);         // HGFE
+    _mm_storeu_si128((__m128i *)&state[0], s0);
+    _mm_storeu_si128((__m128i *)&state[4], s1);
+}
+
+// The lane kernels are the scalar rounds with every WORD widened to a vector
+#define SHA256_LANES_KERNEL(name, target_isa, vec, load, store, add, xor_, and_, andnot, or_, srli, slli, set1) \
+__attribute__((target(target_isa)))                                                                   \
+static void name(WORD state[8][SHA256_MAX_LANES], const WORD w[16][SHA256_MAX_LANES])                 \
+{                                                                                                     \
+    vec s[8], m[16];                                                                                  \
+    for (int j = 0; j < 8; j++) s[j] = load((const vec *)state[j]);                                   \
+    for (int j = 0; j < 16; j++) m[j] = load((const vec *)w[j]);                                      \
+    vec a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];               \
+    for (int i = 0; i < 64; i++) {                                                                    \
+        if (i >= 16) {                                                                                \
+            vec x = m[(i - 15) & 15], y = m[(i - 2) & 15];                                            \
+            vec s0 = xor_(xor_(or_(srli(x, 7), slli(x, 25)), or_(srli(x, 18), slli(x, 14))), srli(x, 3)); \
+            vec s1 = xor_(xor_(or_(srli(y, 17), slli(y, 15)), or_(srli(y, 19), slli(y, 13))), srli(y, 10)); \
+            m[i & 15] = add(add(m[i & 15], s0), add(m[(i - 7) & 15], s1));                             \
+        }                                                                                             \
+        vec ep1 = xor_(xor_(or_(srli(e, 6), slli(e, 26)), or_(srli(e, 11), slli(e, 21))),             \
+                       or_(srli(e, 25), slli(e, 7)));                                                 \
+        vec ch = xor_(and_(e, f), andnot(e, g));                                                      \
+        vec t1 = add(add(add(h, ep1), add(ch, set1((int)sha256_k[i]))), m[i & 15]);                   \
+        vec ep0 = xor_(xor_(or_(srli(a, 2), slli(a, 30)), or_(srli(a, 13), slli(a, 19))),             \
+                       or_(srli(a, 22), slli(a, 10)));                                                \
+        vec maj = or_(and_(a, b), and_(c, or_(a, b)));                                                \
+        h = g;                                                                                        \
+        g = f;                                                                                        \
+        f = e;                                                                                        \
+        e = add(d, t1);                                                                               \
+        d = c;                                                                                        \
+        c = b;                                                                                        \
+        b = a;                                                                                        \
+        a = add(t1, add(ep0, maj));                                                                   \
+    }                                                                                                 \
+    store((vec *)state[0], add(s[0], a));                                                             \
+    store((vec *)state[1], add(s[1], b));                                                             \
+    store((vec *)state[2], add(s[2], c));                                                             \
+    store((vec *)state[3], add(s[3], d));                                                             \
+    store((vec *)state[4], add(s[4], e));                                                             \
+    store((vec *)state[5], add(s[5], f));                                                             \
+    store((vec *)state[6], add(s[6], g));                                                             \
+    store((vec *)state[7], add(s[7], h));                                                             \
+}
+
+SHA256_LANES_KERNEL(sha256LanesSse2, "sse2", __m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi32,
+                    _mm_xor_si128, _mm_and_si128, _mm_andnot_si128, _mm_or_si128, _mm_srli_epi32,
+                    _mm_slli_epi32, _mm_set1_epi32)
+SHA256_LANES_KERNEL(sha256LanesAvx2, "avx2", __m256i, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi32,
+                    _mm256_xor_si256, _mm256_and_si256, _mm256_andnot_si256, _mm256_or_si256, _mm256_srli_epi32,
+                    _mm256_slli_epi32, _mm256_set1_epi32)
+#endif
+
+static int sha256EngineSupported(int engine)
+{
+    switch (engine) {
+    case SHA256_ENGINE_SCALAR:
+        return 1;
+#if SHA256_X86_DISPATCH
+    case SHA256_ENGINE_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SHA256_ENGINE_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case SHA256_ENGINE_SHANI: {
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & (1u << 29))) return 0;
+        return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+// Engine in use: sha256_engine if this CPU has it, otherwise the fastest
+// one it does have. Resolved once; the race on first use is benign since
+// every thread computes the same answer.
+static int sha256ActiveEngine(void)
+{
+    static int active = SHA256_ENGINE_AUTO;
+    int engine = ATOMIC_LOAD_ACQUIRE(&active);
+    if (engine != SHA256_ENGINE_AUTO) return engine;
+
+    const int preference[] = {SHA256_ENGINE_SHANI, SHA256_ENGINE_AVX2, SHA256_ENGINE_SSE2, SHA256_ENGINE_SCALAR};
+    engine = sha256_engine;
+    for (size_t i = 0; !sha256EngineSupported(engine) && i < sizeof(preference) / sizeof(preference[0]); i++)
+        engine = preference[i];
+    ATOMIC_STORE_RELEASE(&active, engine);
+    return engine;
+}
+
+int sha256EngineFromName(const char *name)
+{
+    const char *names[] = {"auto", "scalar", "sse2", "avx2", "shani"};
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++)
+        if (strcmp(name, names[i]) == 0) return i;
+    return -1;
+}
+
+// Single-message compression: SHA-NI when that is the active engine. The
+// lane engines only pay off across several messages, so they hash a single
+// stream with the scalar rounds.
+static void sha256Blocks(WORD state[8], const BYTE *data, size_t blocks)
+{
+#if SHA256_X86_DISPATCH
+    if (sha256ActiveEngine() == SHA256_ENGINE_SHANI) {
+        sha256BlocksShaNi(state, data, blocks);
+        return;
+    }
+#endif
+    sha256BlocksScalar(state, data, blocks);
+}
+
+void sha256_transform(SHA256_CTX *ctx, const BYTE data[])
+{
+    sha256Blocks(ctx->state, data, 1);
+}
+
+void sha256_init(SHA256_CTX *ctx)
+{
+    ctx->datalen = 0;
+    ctx->bitlen = 0;
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+}
+
+// Whole blocks are compressed straight from data; only a partial block at
+// either end goes through ctx->data.
+void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len)
+{
+    if (ctx->datalen > 0) {
+        size_t take = 64 - ctx->datalen;
+        if (take > len) take = len;
+        memcpy(ctx->data + ctx->datalen, data, take);
+        ctx->datalen += (WORD)take;
+        data += take;
+        len -= take;
+        if (ctx->datalen < 64) return;
+        sha256_transform(ctx, ctx->data);
+        ctx->bitlen += 512;
+        ctx->datalen = 0;
+    }
+
+    size_t blocks = len / 64;
+    if (blocks > 0) {
+        sha256Blocks(ctx->state, data, blocks);
+        ctx->bitlen += 512ULL * blocks;
+        data += blocks * 64;
+        len -= blocks * 64;
+    }
+    memcpy(ctx->data, data, len);
+    ctx->datalen = (WORD)len;
+}
+
+void sha256_final(SHA256_CTX *ctx, BYTE hash[])
+{
+    WORD i;
+
+    i = ctx->datalen;
+
+    if (ctx->datalen < 56) {
+        ctx->data[i++] = 0x80;
+        while (i < 56)
+            ctx->data[i++] = 0x00;
+    }
+    else {
+        ctx->data[i++] = 0x80;
+        while (i < 64)
+            ctx->data[i++] = 0x00;
+        sha256_transform(ctx, ctx->data);
+        memset(ctx->data, 0, 56);
+    }
+
+    ctx->bitlen += ctx->datalen * 8;
+    ctx->data[63] = ctx->bitlen;
+    ctx->data[62] = ctx->bitlen >> 8;
+    ctx->data[61] = ctx->bitlen >> 16;
+    ctx->data[60] = ctx->bitlen >> 24;
+    ctx->data[59] = ctx->bitlen >> 32;
+    ctx->data[58] = ctx->bitlen >> 40;
+    ctx->data[57] = ctx->bitlen >> 48;
+    ctx->data[56] = ctx->bitlen >> 56;
+    sha256_transform(ctx, ctx->data);
+
+    for (i=0; i < 4; ++i) {
+        hash[i]      = (ctx->state[0] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 4]  = (ctx->state[1] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 8]  = (ctx->state[2] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 12] = (ctx->state[3] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 16] = (ctx->state[4] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 20] = (ctx->state[5] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 24] = (ctx->state[6] >> (24 - i * 8)) & 0x000000ff;
+        hash[i + 28] = (ctx->state[7] >> (24 - i * 8)) & 0x000000ff;
+    }
+}
+
+void sha256(const BYTE *data, size_t len, BYTE *out_hash)
+{
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, out_hash);
+}
+
+// Block `block` of the padded message: data bytes, then 0x80, zeros and, in
+// the last block, the bit length
+static void sha256PaddedBlock(const BYTE *data, size_t len, size_t block, BYTE out[64])
+{
+    size_t off = block * 64;
+    size_t n = off < len ? len - off : 0;
+    if (n > 64) n = 64;
+    memcpy(out, data + off, n);
+    memset(out + n, 0, 64 - n);
+    if (len >= off && len - off < 64) out[len - off] = 0x80;
+    if (block == (len + 8) / 64) {
+        unsigned long long bits = (unsigned long long)len * 8;
+        for (int i = 0; i < 8; i++) out[63 - i] = (BYTE)(bits >> (8 * i));
+    }
+}
+
+// Runs up to `lanes` messages through the kernel side by side. A lane that
+// finishes its message is refilled with the next one, so messages of
+// different lengths keep every lane busy until the batch runs dry.
+static void sha256MultiLanes(const BYTE *const data[], const size_t len[], size_t count, BYTE *const out[],
+                             int lanes, Sha256LanesFn kernel)
+{
+    WORD state[8][SHA256_MAX_LANES], w[16][SHA256_MAX_LANES];
+    size_t msg[SHA256_MAX_LANES], block[SHA256_MAX_LANES];
+    BYTE buf[64];
+    size_t next = 0;
+    int active = 0;
+
+    memset(w, 0, sizeof(w));
+    for (int l = 0; l < lanes; l++) {
+        msg[l] = next < count ? next++ : count;
+        block[l] = 0;
+        for (int j = 0; j < 8; j++) state[j][l] = sha256_iv[j];
+        if (msg[l] < count) active++;
+    }
+
+    while (active > 0) {
+        for (int l = 0; l < lanes; l++) {
+            if (msg[l] == count) continue; // idle lanes hash stale words
+            sha256PaddedBlock(data[msg[l]], len[msg[l]], block[l], buf);
+            for (int j = 0; j < 16; j++)
+                w[j][l] = ((WORD)buf[4 * j] << 24) | (buf[4 * j + 1] << 16) | (buf[4 * j + 2] << 8) | buf[4 * j + 3];
+        }
+        kernel(state, w);
+        for (int l = 0; l < lanes; l++) {
+            if (msg[l] == count || ++block[l] < (len[msg[l]] + 8) / 64 + 1) continue;
+            BYTE *hash = out[msg[l]];
+            for (int j = 0; j < 8; j++) {
+                hash[4 * j] = (BYTE)(state[j][l] >> 24);
+                hash[4 * j + 1] = (BYTE)(state[j][l] >> 16);
+                hash[4 * j + 2] = (BYTE)(state[j][l] >> 8);
+                hash[4 * j + 3] = (BYTE)state[j][l];
+                state[j][l] = sha256_iv[j];
+            }
+            block[l] = 0;
+            if (next < count) {
+                msg[l] = next++;
+            } else {
+                msg[l] = count;
+                active--;
+            }
+        }
+    }
+}
+
+// Hashes count independent messages: out[i] = SHA-256(data[i][0..len[i])).
+// With the SSE2 or AVX2 engine 4 or 8 messages share each pass through the
+// rounds; SHA-NI and the scalar engine hash them one after another.
+void sha256_multi(const BYTE *const data[], const size_t len[], size_t count, BYTE *const out[])
+{
+#if SHA256_X86_DISPATCH
+    int engine = sha256ActiveEngine();
+    if (count > 1 && engine == SHA256_ENGINE_AVX2) {
+        sha256MultiLanes(data, len, count, out, 8, sha256LanesAvx2);
+        return;
+    }
+    if (count > 1 && engine == SHA256_ENGINE_SSE2) {
+        sha256MultiLanes(data, len, count, out, 4, sha256LanesSse2);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) sha256(data[i], len[i], out[i]);
+}
+
+void flush_stdin(void)
+{
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF);
+}
+
+void getMaskedInput(char *buffer, size_t size)
+{
+    if (size == 0) return;
+    size_t idx = 0;
+#ifdef _WIN32
+    int ch;
+    while ((ch = _getch()) != '\r' && ch != EOF) {
+        if (ch == '\b' || ch == 127) {
+            if (idx > 0) {
+                idx--;
+                printf("\b \b");
+            }
+        } else if (ch >= ' ' && ch <= '~' && idx + 1 < size) {
+            buffer[idx++] = (char)ch;
+            printf("*");
+        }
+    }
+    buffer[idx] = '\0';
+    printf("\n");
+#else
+    struct termios oldt, newt;
+    tcgetattr(STDIN_FILENO, &oldt);
+    newt = oldt;
+    newt.c_lflag &= ~(ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+
+    int ch;
+    while ((ch = getchar()) != '\n' && ch != EOF) {
+        if (ch == 127 || ch == '\b') {
+            if (idx > 0) {
+                idx--;
+                printf("\b \b");
+            }
+        } else if (ch >= ' ' && ch <= '~' && idx + 1 < size) {
+            buffer[idx++] = (char)ch;
+            printf("*");
+        }
+    }
+    buffer[idx] = '\0';
+    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    printf("\n");
+#endif
+}
+
+void printHex(const unsigned char *data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+        printf("%02x", data[i]);
+    printf("\n");
+}
+
+void generateSalt(unsigned char *salt, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        salt[i] = (unsigned char)(rand() % 256);
+    }
+}
+
+void hashPin(const char *pin, const unsigned char *salt, size_t salt_len, unsigned char *out_hash) {
+    SHA256_CTX ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, salt, salt_len);
+    sha256_update(&ctx, (const BYTE *)pin, strlen(pin));
+    sha256_final(&ctx, out_hash);
+}
+
+// hashPin for many PINs at once (bulk onboarding, rehashing stored hashes).
+// salt||pin messages are staged in groups for sha256_multi; the rare
+// oversized one is hashed on its own.
+void hashPinBatch(const struct PinHashJob *jobs, size_t count, size_t salt_len) {
+    enum { GROUP = 64, MAX_MESSAGE = 128 };
+    BYTE buf[GROUP][MAX_MESSAGE];
+    const BYTE *msgs[GROUP];
+    size_t lens[GROUP];
+    BYTE *outs[GROUP];
+
+    for (size_t i = 0; i < count; ) {
+        size_t n = 0;
+        for (; n < GROUP && i < count; i++) {
+            size_t pin_len = strlen(jobs[i].pin);
+            if (salt_len + pin_len > MAX_MESSAGE) {
+                hashPin(jobs[i].pin, jobs[i].salt, salt_len, jobs[i].hash);
+                continue;
+            }
+            memcpy(buf[n], jobs[i].salt, salt_len);
+            memcpy(buf[n] + salt_len, jobs[i].pin, pin_len);
+            msgs[n] = buf[n];
+            lens[n] = salt_len + pin_len;
+            outs[n] = jobs[i].hash;
+            n++;
+        }
+        sha256_multi(msgs, lens, n, outs);
+    }
+}
+
+int loadAdminCredentials(unsigned char *salt, unsigned char *hash) {
+    FILE *fp = fopen(ADMIN_FILE, "rb");
+    if (!fp) return 0;
+    AdminRecord rec;
+    size_t r = fread(&rec, sizeof(AdminRecord), 1, fp);
+    fclose(fp);
+    if (r != 1) return 0;
+    if (memcmp(rec.magic, ADMIN_MAGIC, ADMIN_MAGIC_LEN) != 0) return 0;
+    memcpy(salt, rec.salt, SALT_SIZE);
+    memcpy(hash, rec.pin_hash, HASH_SIZE);
+    return 1;
+}
+
+int saveAdminCredentials(const unsigned char *salt, const unsigned char *hash) {
+    FILE *fp = fopen(ADMIN_FILE, "wb");
+    if (!fp) return 0;
+    AdminRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.magic, ADMIN_MAGIC, ADMIN_MAGIC_LEN);
+    memcpy(rec.salt, salt, SALT_SIZE);
+    memcpy(rec.pin_hash, hash, HASH_SIZE);
+    size_t w = fwrite(&rec, sizeof(AdminRecord), 1, fp);
+    fclose(fp);
+#ifndef _WIN32
+    chmod(ADMIN_FILE, S_IRUSR | S_IWUSR);
+#endif
+    return w == 1;
+}
+
+int setAdminPinInteractive(void) {
+    char pin1[64], pin2[64];
+
+    while (1) {
+        printf(YELLOW "\nNo admin PIN configured.\n" RESET);
+        printf(GREEN "Set admin PIN (4-12 digits): " RESET);
+        getMaskedInput(pin1, sizeof(pin1));
+        size_t n = strlen(pin1);
+        if (n < 4 || n > 12 || strspn(pin1, "0123456789") != n) {
+            printf(RED "Invalid PIN. Must be 4-12 digits.\n" RESET);
+            continue;
+        }
+
+        printf(GREEN "Confirm admin PIN: " RESET);
+        getMaskedInput(pin2, sizeof(pin2));
+        if (strcmp(pin1, pin2) != 0) {
+            printf(RED "PINs do not match. Try again.\n" RESET);
+            continue;
+        }
+
+        unsigned char salt[SALT_SIZE];
+        unsigned char hash[HASH_SIZE];
+        generateSalt(salt, SALT_SIZE);
+        hashPin(pin1, salt, SALT_SIZE, hash);
+
+        memset(pin1, 0, sizeof(pin1));
+        memset(pin2, 0, sizeof(pin2));
+
+        if (!saveAdminCredentials(salt, hash)) {
+            printf(RED "Failed to save admin PIN. Please try again.\n" RESET);
+            return 0;
+        }
+
+        printf(GREEN "Admin PIN set successfully.\n" RESET);
+        return 1;
+    }
+}
+
+int adminInitIfNeeded(void) {
+    unsigned char salt[SALT_SIZE], hash[HASH_SIZE];
+    if (loadAdminCredentials(salt, hash)) return 1;
+    return setAdminPinInteractive();
+}
+
+int authenticateAdmin(const char *pin_input) {
+    unsigned char salt[SALT_SIZE], stored_hash[HASH_SIZE], input_hash[HASH_SIZE];
+    if (!loadAdminCredentials(salt, stored_hash)) {
+        return 0;
+    }
+    hashPin(pin_input, salt, SALT_SIZE, input_hash);
+    return memcmp(input_hash, stored_hash, HASH_SIZE) == 0;
+}
+
+int accountExists(int acc_no)
+{
+    storeLockRead();
+    int exists = accountIndexLookup(acc_no) >= 0;
+    storeUnlock();
+    return exists;
+}
+
+int authenticate(int acc_no, const char *pin_input) {
+    struct Account a;
+    long pos = 0;
+
+    if (!loadAccount(acc_no, &a, &pos)) {
+        return 0;
+    }
+
+    if (a.locked) {
+        return 0;
+    }
+
+    unsigned char input_hash[HASH_SIZE];
+    hashPin(pin_input, a.salt, SALT_SIZE, input_hash);
+
+    if (memcmp(input_hash, a.pin_hash, HASH_SIZE) == 0) {
+        // The record only changes if earlier attempts failed
+        if (a.failed_attempts != 0) {
+            a.failed_attempts = 0;
+            saveAccount(pos, &a);
+            accountStoreCommit(0);
+        }
+        return 1;
+    } else {
+        a.failed_attempts++;
+        if (a.failed_attempts >= 3) {
+            a.locked = 1;
+            printf(RED "\nToo many failed attempts. Account has been locked.\n" RESET);
+        }
+        saveAccount(pos, &a);
+        accountStoreCommit(0);
+        return 0;
+    }
+}
+
+// =========================================================================
+// CUSTOMER SESSIONS
+// =========================================================================
+
+// A session stands for one successful authenticate. Tokens are random and
+// expire SESSION_TTL_SECONDS after login; a token of 0 is never issued.
+struct Session {
+    unsigned long long token;
+    int acc_no;
+    time_t expires;
+};
+
+static struct Session sessions[SESSION_MAX];
+static unsigned long long customer_session; // the user menu's current login
+
+static unsigned long long sessionNewToken(void) {
+    unsigned long long token = 0;
+    FILE *fp = fopen("/dev/urandom", "rb");
+    if (fp) {
+        if (fread(&token, sizeof(token), 1, fp) != 1) token = 0;
+        fclose(fp);
+    }
+    if (token == 0) // no /dev/urandom (Windows): same source as generateSalt
+        token = ((unsigned long long)rand() << 40) ^ ((unsigned long long)rand() << 20) ^ (unsigned long long)rand();
+    return token ? token : 1;
+}
+
+// Records a session for acc_no, which must just have passed authenticate.
+// Expired entries are reused first, then the one closest to expiry.
+unsigned long long sessionOpen(int acc_no) {
+    unsigned long long token = sessionNewToken();
+    time_t now = time(NULL);
+    MUTEX_LOCK(&session_mutex);
+    struct Session *slot = &sessions[0];
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (sessions[i].token == 0 || sessions[i].expires <= now) {
+            slot = &sessions[i];
+            break;
+        }
+        if (sessions[i].expires < slot->expires) slot = &sessions[i];
+    }
+    slot->token = token;
+    slot->acc_no = acc_no;
+    slot->expires = now + SESSION_TTL_SECONDS;
+    MUTEX_UNLOCK(&session_mutex);
+    return token;
+}
+
+// 1 if token is a live session for acc_no. The account must also still exist
+// and be unlocked, which costs an index lookup but no hash and no write.
+int sessionCheck(unsigned long long token, int acc_no) {
+    int valid = 0;
+    if (token == 0) return 0;
+    time_t now = time(NULL);
+    MUTEX_LOCK(&session_mutex);
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (sessions[i].token != token) continue;
+        if (sessions[i].expires <= now) {
+            sessions[i].token = 0;
+        } else {
+            valid = sessions[i].acc_no == acc_no;
+        }
+        break;
+    }
+    MUTEX_UNLOCK(&session_mutex);
+
+    struct Account a;
+    return valid && loadAccount(acc_no, &a, NULL) && !a.locked;
+}
+
+void sessionClose(unsigned long long token) {
+    if (token == 0) return;
+    MUTEX_LOCK(&session_mutex);
+    for (int i = 0; i < SESSION_MAX; i++)
+        if (sessions[i].token == token) sessions[i].token = 0;
+    MUTEX_UNLOCK(&session_mutex);
+}
+
+// Authentication for the user menu actions, called right after the account
+// number has been read. A live session for acc_no skips the PIN; otherwise
+// the PIN is read after prompt and a successful check starts a new session.
+int authenticateCustomer(int acc_no, const char *prompt) {
+    char pin_str[32];
+
+    flush_stdin();
+    if (sessionCheck(customer_session, acc_no)) {
+        printf(GREEN "Using your active session for account %d.\n" RESET, acc_no);
+        return 1;
+    }
+    printf("%s", prompt);
+    getMaskedInput(pin_str, sizeof(pin_str));
+    if (!authenticate(acc_no, pin_str)) return 0;
+
+    sessionClose(customer_session);
+    customer_session = sessionOpen(acc_no);
+    return 1;
+}
+
+// =========================================================================
+// USER MENU FUNCTIONS
+// =========================================================================
+
+void logTransaction(int acc_no, TransactionType type, Money amount, int receiver_acc, const char* currency) {
+    struct Transaction t;
+    memset(&t, 0, sizeof(t));
+    t.acc_no = acc_no;
+    t.type = type;
+    t.amount = amount;
+    t.timestamp = time(NULL);
+    t.receiver_acc_no = receiver_acc;
+    t.currency = currencyId(currency);
+    t.version = TRANSACTION_RECORD_VERSION;
+    if (!transactionLogAppend(&t)) {
+        printf(RED "Error: Could not log transaction.\n" RESET);
+    }
+}
+
+// =========================================================================
+// ACCOUNT OPERATIONS
+// =========================================================================
+
+// Prompt-free versions of the core operations. The menus collect input and
+// authenticate before calling them; batch mode calls them directly.
+
+const char *opStatusMessage(OpStatus status) {
+    switch (status) {
+        case OP_OK:                 return "OK";
+        case OP_NOT_FOUND:          return "Account not found.";
+        case OP_RECEIVER_NOT_FOUND: return "Receiver account not found.";
+        case OP_EXISTS:             return "Account number already exists.";
+        case OP_INVALID_AMOUNT:     return "Amount must be positive.";
+        case OP_INVALID_PIN:        return "Invalid PIN. Must be exactly 4 digits.";
+        case OP_INVALID_NAME:       return "Name cannot be empty.";
+        case OP_SAME_ACCOUNT:       return "Cannot transfer money to the same account.";
+        case OP_INSUFFICIENT_FUNDS: return "Insufficient balance.";
+        case OP_INVALID_CURRENCY:   return "Invalid currency. Must be a three-letter code such as INR.";
+        case OP_IO_ERROR:           return "Error writing account data.";
+    }
+    return "Unknown error.";
+}
+
+OpStatus openAccount(int acc_no, const char *name, const char *pin, Money balance, const char *currency) {
+    if (accountExists(acc_no)) return OP_EXISTS;
+    if (name[0] == '\0') return OP_INVALID_NAME;
+    if (strlen(pin) != 4 || strspn(pin, "0123456789") != 4) return OP_INVALID_PIN;
+    if (balance < 0) return OP_INVALID_AMOUNT;
+
+    char code[4] = "";
+    if (strlen(currency) != 3) return OP_INVALID_CURRENCY;
+    for (int i = 0; i < 3; i++) code[i] = (char)toupper((unsigned char)currency[i]);
+    if (currencyId(code) == CURRENCY_ID_NONE) return OP_INVALID_CURRENCY;
+
+    struct Account a;
+    memset(&a, 0, sizeof(a));
+    a.acc_no = acc_no;
+    snprintf(a.name, sizeof(a.name), "%s", name);
+    generateSalt(a.salt, SALT_SIZE);
+    hashPin(pin, a.salt, SALT_SIZE, a.pin_hash);
+    a.balance = balance;
+    memcpy(a.currency, code, sizeof(a.currency));
+    a.failed_attempts = 0;
+    a.locked = 0;
+    a.last_interest_date = time(NULL); // Initialize to current date
+
+    if (!appendAccount(&a)) return OP_IO_ERROR;
+    accountStoreCommit(0);
+    return OP_OK;
+}
+
+OpStatus depositFunds(int acc_no, Money amount, struct Account *result) {
+    if (amount <= 0) return OP_INVALID_AMOUNT;
+
+    struct Account a;
+    long pos;
+    if (!loadAccount(acc_no, &a, &pos)) return OP_NOT_FOUND;
+    a.balance += amount;
+
+    struct WalEntry entry;
+    walBegin(&entry);
+    walAddAccount(&entry, pos, &a);
+    walAddPosting(&entry, acc_no, DEPOSIT, amount, 0, a.currency);
+    if (!walCommit(&entry)) return OP_IO_ERROR;
+    accountStoreCommit(0);
+
+    if (result) *result = a;
+    return OP_OK;
+}
+
+OpStatus withdrawFunds(int acc_no, Money amount, struct Account *result) {
+    if (amount <= 0) return OP_INVALID_AMOUNT;
+
+    struct Account a;
+    long pos;
+    if (!loadAccount(acc_no, &a, &pos)) return OP_NOT_FOUND;
+    if (a.balance < amount) return OP_INSUFFICIENT_FUNDS;
+    a.balance -= amount;
+
+    struct WalEntry entry;
+    walBegin(&entry);
+    walAddAccount(&entry, pos, &a);
+    walAddPosting(&entry, acc_no, WITHDRAWAL, amount, 0, a.currency);
+    if (!walCommit(&entry)) return OP_IO_ERROR;
+    accountStoreCommit(0);
+
+    if (result) *result = a;
+    return OP_OK;
+}
+
+// Overwrites the record with a tombstone and frees its slot for the next new
+// account; *result (if given) receives the record as it was.
+OpStatus removeAccount(int acc_no, struct Account *result) {
+    struct Account a;
+    long pos;
+    if (!loadAccount(acc_no, &a, &pos)) return OP_NOT_FOUND;
+
+    struct Account tombstone;
+    memset(&tombstone, 0, sizeof(tombstone));
+    tombstone.acc_no = acc_no;
+    tombstone.locked = ACCOUNT_TOMBSTONE;
+    if (!saveAccount(pos, &tombstone)) return OP_IO_ERROR;
+    accountStoreCommit(0);
+
+    storeLockWrite();
+    accountIndexRemove(acc_no);
+    accountFreeSlotPush(pos / (long)sizeof(struct Account));
+    storeUnlock();
+    compactionMaybeStart();
+
+    if (result) *result = a;
+    return OP_OK;
+}
+
+// Moves amount (in the sender's currency) to the receiver, converting it to
+// the receiver's currency. Both balances and both postings go into one
+// write-ahead log entry.
+OpStatus transferFunds(int from_acc, int to_acc, Money amount, struct Account *sender_result,
+                       struct Account *receiver_result, Money *converted_amount) {
+    struct Account sender, receiver;
+    long senderPos, receiverPos;
+
+    if (from_acc == to_acc) return OP_SAME_ACCOUNT;
+    if (amount <= 0) return OP_INVALID_AMOUNT;
+    if (!loadAccount(from_acc, &sender, &senderPos)) return OP_NOT_FOUND;
+    if (!loadAccount(to_acc, &receiver, &receiverPos)) return OP_RECEIVER_NOT_FOUND;
+    if (sender.balance < amount) return OP_INSUFFICIENT_FUNDS;
+
+    // Convert amount to receiver's currency
+    float exchangeRate = getExchangeRate(sender.currency, receiver.currency);
+    Money convertedAmount = moneyRound((double)amount * exchangeRate);
+
+    sender.balance -= amount;
+    receiver.balance += convertedAmount;
+
+    struct WalEntry entry;
+    walBegin(&entry);
+    walAddAccount(&entry, senderPos, &sender);
+    walAddAccount(&entry, receiverPos, &receiver);
+    walAddPosting(&entry, from_acc, TRANSFER_OUT, amount, to_acc, sender.currency);
+    walAddPosting(&entry, to_acc, TRANSFER_IN, convertedAmount, from_acc, receiver.currency);
+    if (!walCommit(&entry)) return OP_IO_ERROR;
+    accountStoreCommit(0);
+
+    if (sender_result) *sender_result = sender;
+    if (receiver_result) *receiver_result = receiver;
+    if (converted_amount) *converted_amount = convertedAmount;
+    return OP_OK;
+}
+
+void createAccount()
+{
+    struct Account a;
+    char pin_str[32];
+    int ch;
+
+    printf(GREEN "Enter account number: " RESET);
+    if (scanf("%d", &a.acc_no) != 1) {
+        printf(RED "Invalid account number input.\n" RESET);
+        while ((ch = getchar()) != '\n' && ch != EOF);
+        return;
+    }
+    if (accountExists(a.acc_no)) {
+        printf(RED "Account number already exists. Choose another.\n" RESET);
+        return;
+    }
+    printf(GREEN "Enter account holder name: " RESET);
+
+    while ((ch = getchar()) != '\n' && ch != EOF);
+    if (!fgets(a.name, sizeof(a.name), stdin)) {
+        printf(RED "Invalid name input.\n" RESET);
+        return;
+    }
+    size_t len = strlen(a.name);
+    if (len > 0 && a.name[len - 1] == '\n')
+        a.name[len - 1] = '\0';
+    if (strlen(a.name) == 0) {
+        printf(RED "Name cannot be empty.\n" RESET);
+        return;
+    }
+
+    printf(GREEN "Set a 4-digit PIN: " RESET);
+    getMaskedInput(pin_str, sizeof(pin_str));
+    if (strlen(pin_str) != 4 || strspn(pin_str, "0123456789") != 4)
+    {
+        printf(RED "Invalid PIN. Must be exactly 4 digits.\n" RESET);
+        return;
+    }
+
+    printf(GREEN "Enter initial balance: " RESET);
+    if (!readMoney(&a.balance)) {
+        printf(RED "Invalid balance input.\n" RESET);
+        while ((ch = getchar()) != '\n' && ch != EOF);
+        return;
+    }
+    if (a.balance < 0) {
+        printf(RED "Initial balance cannot be negative.\n" RESET);
+        return;
+    }
+
+    printf(GREEN "Enter currency (e.g., INR, USD): " RESET);
+    scanf("%3s", a.currency);
+    while ((ch = getchar()) != '\n' && ch != EOF);
+
+    OpStatus status = openAccount(a.acc_no, a.name, pin_str, a.balance, a.currency);
+    memset(pin_str, 0, sizeof(pin_str));
+    if (status != OP_OK) {
+        printf(RED "%s\n" RESET, opStatusMessage(status));
+        return;
+    }
+
+    printf(GREEN "Account Created: %d, Name: %s, Balance: %.2f %s\n" RESET, a.acc_no, a.name, moneyToDouble(a.balance), a.currency);
+}
+
+void deposit()
+{
+    int acc_no;
+    Money amount;
+    int ch;
+
+    printf(GREEN "Enter account number: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid input format.\n" RESET);
+        while ((ch = getchar()) != '\n' && ch != EOF);
+        return;
+    }
+    if (!authenticateCustomer(acc_no, GREEN "Enter your PIN: " RESET))
+    {
+        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
+        return;
+    }
+    printf(GREEN "Enter amount to deposit: " RESET);
+    if (!readMoney(&amount)) {
+        printf(RED "Invalid input format.\n" RESET);
+        while ((ch = getchar()) != '\n' && ch != EOF);
+        return;
+    }
+
+    struct Account a;
+    OpStatus status = depositFunds(acc_no, amount, &a);
+    if (status == OP_OK) {
+        printf(GREEN "Deposit successful. New balance: %.2f %s\n" RESET, moneyToDouble(a.balance), a.currency);
+    } else {
+        printf(RED "%s\n" RESET, opStatusMessage(status));
+    }
+}
+
+void withdraw()
+{
+    int acc_no;
+    Money amount;
+    int ch;
+
+    printf(GREEN "Enter account number: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid input format.\n" RESET);
+        while ((ch = getchar()) != '\n' && ch != EOF);
+        return;
+    }
+    if (!authenticateCustomer(acc_no, GREEN "Enter your PIN: " RESET))
+    {
+        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
+        return;
+    }
+    printf(GREEN "Enter amount to withdraw: " RESET);
+    if (!readMoney(&amount)) {
+        printf(RED "Invalid input format.\n" RESET);
+        while ((ch = getchar()) != '\n' && ch != EOF);
+        return;
+    }
+
+    struct Account a;
+    OpStatus status = withdrawFunds(acc_no, amount, &a);
+    if (status == OP_OK) {
+        printf(GREEN "Withdraw successful. New balance: %.2f %s\n" RESET, moneyToDouble(a.balance), a.currency);
+    } else {
+        printf(RED "%s\n" RESET, opStatusMessage(status));
+    }
+}
+
+void transferMoney() {
+    struct Account sender, receiver;
+    int senderAcc, receiverAcc;
+    Money amount;
+
+    printf(GREEN "\n--- Money Transfer ---\n" RESET);
+    printf("Enter Sender Account Number: " RESET);
+    if (scanf("%d", &senderAcc) != 1) {
+        printf(RED "Invalid input format.\n" RESET);
+        flush_stdin();
+        return;
+    }
+    if (!authenticateCustomer(senderAcc, "Enter Sender PIN: " RESET)) {
+        printf(RED "Authentication failed. Sender account not found or invalid PIN.\n" RESET);
+        return;
+    }
+
+    if (!loadAccount(senderAcc, &sender, NULL)) {
+        printf(RED "Sender account not found.\n" RESET);
+        return;
+    }
+
+    printf("Enter Receiver Account Number: " RESET);
+    if (scanf("%d", &receiverAcc) != 1) {
+        printf(RED "Invalid input format.\n" RESET);
+        flush_stdin();
+        return;
+    }
+    if (senderAcc == receiverAcc) {
+        printf(RED "Cannot transfer money to the same account.\n" RESET);
+        return;
+    }
+
+    if (!accountExists(receiverAcc)) {
+        printf(RED "Receiver account not found.\n" RESET);
+        return;
+    }
+
+    printf("Enter amount to transfer (%s): " RESET, sender.currency);
+    if (!readMoney(&amount)) {
+        printf(RED "Invalid input format.\n" RESET);
+        flush_stdin();
+        return;
+    }
+
+    Money convertedAmount;
+    OpStatus status = transferFunds(senderAcc, receiverAcc, amount, &sender, &receiver, &convertedAmount);
+    if (status == OP_INSUFFICIENT_FUNDS) {
+        printf(RED "Insufficient balance in sender's account.\n" RESET);
+        return;
+    } else if (status != OP_OK) {
+        printf(RED "%s\n" RESET, opStatusMessage(status));
+        return;
+    }
+
+    printf(GREEN "Rs. %.2f %s successfully transferred from %s to %s\n" RESET, moneyToDouble(amount), sender.currency, sender.name, receiver.name);
+    printf(GREEN "Amount received: %.2f %s\n" RESET, moneyToDouble(convertedAmount), receiver.currency);
+}
+
+void viewTransactionHistory() {
+    int acc_no;
+    
+    printf(GREEN "Enter account number to view history: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid account number input.\n" RESET);
+        flush_stdin();
+        return;
+    }
+    if (!authenticateCustomer(acc_no, GREEN "Enter your PIN: " RESET)) {
+        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
+        return;
+    }
+
+    printTransactionHistory(acc_no);
+}
+
+// One row of the history table
+static void printTransactionRow(const struct Transaction *t) {
+    char time_str[30], currency[4];
+    time_t when = (time_t)t->timestamp;
+    struct tm *local_time = localtime(&when);
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", local_time);
+    currencyCode(t->currency, currency);
+
+    printf("| %s | ", time_str);
+    switch (t->type) {
+        case DEPOSIT:
+            printf(GREEN "DEPOSIT      " RESET);
+            printf("| %-11.2f | %-8s\n", moneyToDouble(t->amount), currency);
+            break;
+        case WITHDRAWAL:
+            printf(RED "WITHDRAWAL   " RESET);
+            printf("| %-11.2f | %-8s\n", moneyToDouble(t->amount), currency);
+            break;
+        case TRANSFER_OUT:
+            printf(YELLOW "TRANSFER OUT " RESET);
+            printf("| %-11.2f | %-8s\n", moneyToDouble(t->amount), currency);
+            break;
+        case TRANSFER_IN:
+            printf(GREEN "TRANSFER IN  " RESET);
+            printf("| %-11.2f | %-8s\n", moneyToDouble(t->amount), currency);
+            break;
+        case LOAN_REPAYMENT:
+            printf(BLUE "LOAN REPAYMENT" RESET);
+            printf("| %-11.2f | %-8s\n", moneyToDouble(t->amount), currency);
+            break;
+        case LOAN_APPROVED:
+            printf(GREEN "LOAN APPROVED" RESET);
+            printf("| %-11.2f | %-8s\n", moneyToDouble(t->amount), currency);
+            break;
+        case LOAN_REJECTED:
+            printf(RED "LOAN REJECTED" RESET);
+            printf("| %-11.2f | %-8s\n", moneyToDouble(t->amount), currency);
+            break;
+        case INTEREST_CREDIT:
+            printf(GREEN "INTEREST     " RESET);
+            printf("| %-11.2f | Credit\n", moneyToDouble(t->amount));
+            break;
+    }
+}
+
+static int printArchivedTransaction(const struct Transaction *t, void *found) {
+    *(int *)found = 1;
+    printTransactionRow(t);
+    return 1;
+}
+
+// Prints the history table for acc_no; the caller has authenticated
+void printTransactionHistory(int acc_no) {
+    transactionLogFlush();
+    FILE *fp = fopen(TRANSACTIONS_FILE, "rb");
+    if (!fp) {
+        printf(YELLOW "No transaction history found for any account.\n" RESET);
+        return;
+    }
+    
+    struct Transaction t;
+    int found = 0;
+    
+    printf(BLUE "\n===================================================================\n" RESET);
+    printf(BLUE "         Transaction History for Account %d\n" RESET, acc_no);
+    printf(BLUE "===================================================================\n" RESET);
+    printf(BLUE "| Date & Time             | Type         | Amount      | Currency\n" RESET);
+    printf(BLUE "-------------------------------------------------------------------\n" RESET);
+
+    // Sealed segments come first; the segment reader skips blocks without
+    // this account and leaves the receiver column unread
+    struct TxArchiveQuery q = {acc_no, 0, 0, TX_COL_ACC | TX_COL_TYPE | TX_COL_CURRENCY | TX_COL_AMOUNT | TX_COL_TIME};
+    if (transactionSegmentsScan(&q, printArchivedTransaction, &found, NULL) < 0)
+        printf(RED "Error: Could not read the transaction log segments.\n" RESET);
+
+    // Then this account's records in the log, located through the transaction index
+    size_t count = 0;
+    long *chain = transactionIndexChain(acc_no, &count);
+    for (size_t i = 0; i < count; i++) {
+        if (fseek(fp, chain[i] * (long)sizeof(struct Transaction), SEEK_SET) != 0 ||
+            fread(&t, sizeof(struct Transaction), 1, fp) != 1)
+            break;
+        if (t.acc_no == acc_no) {
+            found = 1;
+            printTransactionRow(&t);
+        }
+    }
+    free(chain);
+
+    if (!found) {
+        printf(YELLOW "\n  No transactions found for this account.\n" RESET);
+    }
+
+    printf(BLUE "===================================================================\n" RESET);
+    fclose(fp);
+}
+
+void applyForLoan() {
+    int acc_no;
+    Money loanAmount;
+    struct Account currentAccount;
+
+    printf(GREEN "\n--- Loan Application ---\n" RESET);
+    printf("Enter your account number: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid input format.\n" RESET);
+        flush_stdin();
+        return;
+    }
+    if (!authenticateCustomer(acc_no, "Enter your PIN: " RESET)) {
+        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
+        return;
+    }
+
+    if (isLoanPending(acc_no)) {
+        printf(YELLOW "You already have a pending loan application. Please wait for a response.\n" RESET);
+        return;
+    }
+
+    if (!loadAccount(acc_no, &currentAccount, NULL)) {
+        printf(RED "Error reading account data.\n" RESET);
+        return;
+    }
+    
+    if (currentAccount.balance <= 0) {
+        printf(RED "You are not eligible for a loan with a non-positive balance. Your balance must be greater than 0.\n" RESET);
+        return;
+    }
+
+    printf("Enter desired loan amount: " RESET);
+    if (!readMoney(&loanAmount)) {
+        printf(RED "Invalid input format.\n" RESET);
+        flush_stdin();
+        return;
+    }
+
+    if (loanAmount <= 0) {
+        printf(RED "Loan amount must be positive.\n" RESET);
+        return;
+    }
+
+    int term;
+    printf("Enter repayment term in months (1-%d): " RESET, LOAN_MAX_TERM_MONTHS);
+    if (scanf("%d", &term) != 1 || term < 1 || term > LOAN_MAX_TERM_MONTHS) {
+        printf(RED "Invalid term.\n" RESET);
+        flush_stdin();
+        return;
+    }
+
+    struct Loan newLoan;
+    memset(&newLoan, 0, sizeof(newLoan));
+    newLoan.acc_no = acc_no;
+    newLoan.amount = loanAmount;
+    newLoan.timestamp = time(NULL);
+    newLoan.status = PENDING;
+    newLoan.amount_paid = 0;
+    newLoan.rate_bp = LOAN_ANNUAL_RATE_BP;
+    newLoan.term_months = term;
+    Money emi;
+    loanEmiColumns(&newLoan.amount, &newLoan.rate_bp, &newLoan.term_months, 1, &emi);
+
+    if (loanIndexAppend(&newLoan) < 0) {
+        printf(RED "Error creating or opening loans file.\n" RESET);
+        return;
+    }
+
+    printf(GREEN "Loan application for Rs. %.2f submitted successfully.\n" RESET, moneyToDouble(loanAmount));
+    printf(YELLOW "If approved: %d monthly instalments of Rs. %.2f at %.2f%% a year.\n" RESET, term,
+           moneyToDouble(emi), newLoan.rate_bp / 100.0);
+    printf(YELLOW "Please wait for an administrator to review your application.\n" RESET);
+}
+
+int isLoanPending(int acc_no) {
+    return loanIndexFindAccount(acc_no, PENDING) >= 0;
+}
+
+void loanRepayment() {
+    int acc_no;
+    Money repaymentAmount;
+
+    printf(GREEN "\n--- Loan Repayment ---\n" RESET);
+    printf("Enter your account number: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid input format.\n" RESET);
+        flush_stdin();
+        return;
+    }
+
+    if (!authenticateCustomer(acc_no, "Enter your PIN: " RESET)) {
+        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
+        return;
+    }
+
+    long loanRecno = loanIndexFindAccount(acc_no, APPROVED);
+    if (loanRecno < 0) {
+        printf(YELLOW "You have no approved loans to repay.\n" RESET);
+        return;
+    }
+    struct Loan loan = *loanIndexGet(loanRecno);
+    long loanPos = loanRecno * (long)sizeof(struct Loan);
+
+    // Interest up to today is owed before the loan can be cleared; it is
+    // saved with the repayment
+    time_t now = time(NULL);
+    Money charged;
+    accrueLoan(&loan, now, &charged);
+
+    Money outstandingBalance = loanOutstanding(&loan);
+    printf(YELLOW "Outstanding loan balance: Rs. %.2f (interest accrued: Rs. %.2f)\n" RESET,
+           moneyToDouble(outstandingBalance), moneyToDouble(loan.interest));
+    if (loan.term_months > 0) {
+        Money arrears;
+        int due = loanInstallmentsDue(&loan, now, &arrears);
+        printf(YELLOW "Monthly instalment: Rs. %.2f; %d of %d instalments due so far, Rs. %.2f unpaid.\n" RESET,
+               moneyToDouble(loan.emi), due, loan.term_months, moneyToDouble(arrears));
+    }
+    printf("Enter amount to repay: " RESET);
+    if (!readMoney(&repaymentAmount)) {
+        printf(RED "Invalid input format.\n" RESET);
+        flush_stdin();
+        return;
+    }
+
+    if (repaymentAmount <= 0 || repaymentAmount > outstandingBalance) {
+        printf(RED "Invalid repayment amount. Must be positive and not exceed outstanding balance.\n" RESET);
+        return;
+    }
+
+    struct Account a;
+    long accountPos = 0;
+    if (!loadAccount(acc_no, &a, &accountPos)) {
+        printf(RED "Account not found.\n" RESET);
+        return;
+    }
+
+    if (a.balance < repaymentAmount) {
+        printf(RED "Insufficient balance to make this repayment.\n" RESET);
+        return;
+    }
+
+    a.balance -= repaymentAmount;
+    loan.amount_paid += repaymentAmount;
+    if (loanOutstanding(&loan) <= 0) {
+        loan.status = REPAID;
+    }
+
+    // The loan and the account are updated together through the WAL
+    struct WalEntry entry;
+    walBegin(&entry);
+    walAddLoan(&entry, loanPos, &loan);
+    walAddAccount(&entry, accountPos, &a);
+    walAddPosting(&entry, acc_no, LOAN_REPAYMENT, repaymentAmount, 0, "N/A"); // Currency not needed here
+    if (!walCommit(&entry)) {
+        printf(RED "Error writing to the write-ahead log. Repayment aborted.\n" RESET);
+        return;
+    }
+    accountStoreCommit(0);
+    loanIndexUpdate(loanRecno, &loan);
+
+    if (loan.status == REPAID) {
+        printf(GREEN "Loan successfully repaid in full!\n" RESET);
+    } else {
+        printf(GREEN "Repayment successful. Remaining balance: %.2f\n" RESET, moneyToDouble(loanOutstanding(&loan)));
+    }
+}
+
+void viewLoanSchedule() {
+    int acc_no;
+
+    printf(GREEN "\n--- Loan Schedule ---\n" RESET);
+    printf("Enter your account number: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid input format.\n" RESET);
+        flush_stdin();
+        return;
     }
 
-    if (!found) {
-        fclose(fp);
-        return 0;
+    if (!authenticateCustomer(acc_no, "Enter your PIN: " RESET)) {
+        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
+        return;
     }
 
-    if (a.locked) {
-        fclose(fp);
-        return 0;
+    long loanRecno = loanIndexFindAccount(acc_no, APPROVED);
+    if (loanRecno < 0) {
+        printf(YELLOW "You have no approved loans.\n" RESET);
+        return;
+    }
+    // Shows interest up to today without saving it
+    struct Loan loan = *loanIndexGet(loanRecno);
+    time_t now = time(NULL);
+    Money charged;
+    accrueLoan(&loan, now, &charged);
+
+    printf(YELLOW "Loan ID %d: Rs. %.2f, repaid Rs. %.2f, interest accrued Rs. %.2f, outstanding Rs. %.2f\n" RESET,
+           loan.loan_id, moneyToDouble(loan.amount), moneyToDouble(loan.amount_paid), moneyToDouble(loan.interest),
+           moneyToDouble(loanOutstanding(&loan)));
+    if (loan.term_months <= 0) {
+        printf(YELLOW "This loan has no instalment schedule.\n" RESET);
+        return;
     }
+    Money arrears;
+    int due = loanInstallmentsDue(&loan, now, &arrears);
+    printf(YELLOW "%d monthly instalments of Rs. %.2f at %.2f%% a year; %d due so far, Rs. %.2f unpaid.\n\n" RESET,
+           loan.term_months, moneyToDouble(loan.emi), loan.rate_bp / 100.0, due, moneyToDouble(arrears));
+    printLoanSchedule(&loan);
+}
 
-    unsigned char input_hash[HASH_SIZE];
-    hashPin(pin_input, a.salt, SALT_SIZE, input_hash);
+void viewBankTotals() {
+    struct BankTotals totals;
+    if (!computeBankTotals(&totals)) {
+        printf(RED "Error reading accounts file.\n" RESET);
+        return;
+    }
+    if (totals.accounts == 0) {
+        printf(YELLOW "No accounts found.\n" RESET);
+        return;
+    }
 
-    if (memcmp(input_hash, a.pin_hash, HASH_SIZE) == 0) {
-        a.failed_attempts = 0;
-        fseek(fp, pos, SEEK_SET);
-        fwrite(&a, sizeof(struct Account), 1, fp);
-        fflush(fp);
-        fclose(fp);
-        return 1;
-    } else {
-        a.failed_attempts++;
-        if (a.failed_attempts >= 3) {
-            a.locked = 1;
-            printf(RED "\nToo many failed attempts. Account has been locked.\n" RESET);
-        }
-        fseek(fp, pos, SEEK_SET);
-        fwrite(&a, sizeof(struct Account), 1, fp);
-        fflush(fp);
-        fclose(fp);
-        return 0;
+    // Customer balances are the bank's liabilities; the grand total is
+    // expressed in INR using the exchange rate table
+    Money total_inr = 0;
+    printf(BLUE "\n--- Bank Totals (%ld accounts) ---\n" RESET, totals.accounts);
+    printf(BLUE "| Currency | Total Balance                |\n" RESET);
+    for (int k = 0; k < totals.currency_count; k++) {
+        printf("| %-8s | %-28.2f |\n", totals.currency[k], moneyToDouble(totals.balance[k]));
+        total_inr += moneyRound((double)totals.balance[k] * getExchangeRate(totals.currency[k], "INR"));
+    }
+    if (totals.other_accounts > 0) {
+        printf("| %-8s | %-28.2f |\n", "Other", moneyToDouble(totals.other_balance));
+        printf(YELLOW "%ld account(s) in further or unrecognised currencies are totalled as Other and left out of "
+                      "the total below.\n" RESET, totals.other_accounts);
     }
+    printf(GREEN "Total liabilities: Rs. %.2f\n" RESET, moneyToDouble(total_inr));
 }
 
-// =========================================================================
-// USER MENU FUNCTIONS
-// =========================================================================
-
-void logTransaction(int acc_no, TransactionType type, float amount, int receiver_acc, const char* currency) {
-    FILE *fp = fopen(TRANSACTIONS_FILE, "ab");
+void viewAccounts()
+{
+    FILE *fp = fopen(ACCOUNTS_FILE, "rb");
     if (!fp) {
-        printf(RED "Error: Could not open transactions file for logging.\n" RESET);
+        printf(YELLOW "No accounts found.\n" RESET);
         return;
     }
-    struct Transaction t;
-    t.acc_no = acc_no;
-    t.type = type;
-    t.amount = amount;
-    t.timestamp = time(NULL);
-    t.receiver_acc_no = receiver_acc;
-    strcpy(t.currency, currency);
-    fwrite(&t, sizeof(struct Transaction), 1, fp);
+    struct Account a;
+    printf(BLUE "\n+-------------+---------------------------+------------------------------+----------+\n" RESET);
+    printf(BLUE "| Account No  | Name                      | Balance                      | Currency |\n" RESET);
+    printf(BLUE "+-------------+---------------------------+------------------------------+----------+\n" RESET);
+    while (fread(&a, sizeof(struct Account), 1, fp)) {
+        if (accountIsTombstone(&a)) continue;
+        printf("| %-11d | %-25s | %-28.2f | %-8s |\n", a.acc_no, a.name, moneyToDouble(a.balance), a.currency);
+    }
+    printf(BLUE "+-------------+---------------------------+------------------------------+----------+\n" RESET);
     fclose(fp);
 }
 
-void createAccount()
+void searchAccount(int show_pin)
 {
-    struct Account a;
-    char pin_str[32];
-    char currency[10];
+    int acc_no;
     int ch;
-
-    printf(GREEN "Enter account number: " RESET);
-    if (scanf("%d", &a.acc_no) != 1) {
+    
+    printf(GREEN "Enter account number to search: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
         printf(RED "Invalid account number input.\n" RESET);
         while ((ch = getchar()) != '\n' && ch != EOF);
         return;
     }
-    if (accountExists(a.acc_no)) {
-        printf(RED "Account number already exists. Choose another.\n" RESET);
+    
+    struct Account a;
+    int found = 0;
+    if (loadAccount(acc_no, &a, NULL))
+    {
+        found = 1;
+        printf(BLUE "\nAccount Details:\n" RESET);
+        printf(YELLOW "Account No: %d\n" RESET, a.acc_no);
+        printf(YELLOW "Name: %s\n" RESET, a.name);
+        printf(YELLOW "Balance: %.2f %s\n" RESET, moneyToDouble(a.balance), a.currency);
+        if (show_pin) {
+             printf(YELLOW "Pin Hash: " RESET);
+             printHex(a.pin_hash, HASH_SIZE);
+        }
+    }
+    if (!found) {
+        printf(RED "Account not found.\n" RESET);
+    }
+}
+
+void updateAccountName()
+{
+    int acc_no;
+    char newName[100];
+    int found = 0;
+    int ch;
+
+    printf(GREEN "Enter account number to update: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid account number input.\n" RESET);
+        while ((ch = getchar()) != '\n' && ch != EOF);
         return;
     }
-    printf(GREEN "Enter account holder name: " RESET);
 
+    printf(GREEN "Enter new account holder name: " RESET);
     while ((ch = getchar()) != '\n' && ch != EOF);
-    if (!fgets(a.name, sizeof(a.name), stdin)) {
+    if (!fgets(newName, sizeof(newName), stdin))
+    {
         printf(RED "Invalid name input.\n" RESET);
         return;
     }
-    size_t len = strlen(a.name);
-    if (len > 0 && a.name[len - 1] == '\n')
-        a.name[len - 1] = '\0';
-    if (strlen(a.name) == 0) {
+    size_t len = strlen(newName);
+    if (len > 0 && newName[len - 1] == '\n')
+        newName[len - 1] = '\0';
+    if (strlen(newName) == 0) {
         printf(RED "Name cannot be empty.\n" RESET);
         return;
     }
 
-    printf(GREEN "Set a 4-digit PIN: " RESET);
-    getMaskedInput(pin_str, sizeof(pin_str));
-    if (strlen(pin_str) != 4 || strspn(pin_str, "0123456789") != 4)
+    struct Account a;
+    long pos;
+    if (loadAccount(acc_no, &a, &pos))
     {
-        printf(RED "Invalid PIN. Must be exactly 4 digits.\n" RESET);
-        return;
+        found = 1;
+        strcpy(a.name, newName);
+        saveAccount(pos, &a);
+        accountStoreCommit(0);
+        printf(GREEN "Account holder's name updated successfully.\n" RESET);
+        printf(YELLOW "Account %d name changed to: %s\n" RESET, acc_no, newName);
+    }
+    
+    if (!found) {
+        printf(RED "Account not found.\n" RESET);
     }
+}
 
-    generateSalt(a.salt, SALT_SIZE);
-    hashPin(pin_str, a.salt, SALT_SIZE, a.pin_hash);
+void deleteAccount()
+{
+    int acc_no;
+    int ch;
 
-    printf(GREEN "Enter initial balance: " RESET);
-    if (scanf("%f", &a.balance) != 1) {
-        printf(RED "Invalid balance input.\n" RESET);
+    printf(GREEN "Enter account number to delete: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid account number input.\n" RESET);
         while ((ch = getchar()) != '\n' && ch != EOF);
         return;
     }
-    if (a.balance < 0.0f) {
-        printf(RED "Initial balance cannot be negative.\n" RESET);
+
+    struct Account a;
+    OpStatus status = removeAccount(acc_no, &a);
+    if (status != OP_OK) {
+        printf(RED "%s\n" RESET, opStatusMessage(status));
         return;
     }
+    printf(YELLOW "Deleting account: %d, Name: %s, Balance: %.2f\n" RESET,
+           a.acc_no, a.name, moneyToDouble(a.balance));
+    printf(GREEN "Account %d deleted successfully.\n" RESET, acc_no);
+}
 
-    printf(GREEN "Enter currency (e.g., INR, USD): " RESET);
-    scanf("%s", a.currency);
-    while ((ch = getchar()) != '\n' && ch != EOF);
+// =========================================================================
+// ACCOUNT STATEMENTS
+// =========================================================================
 
-    a.failed_attempts = 0;
-    a.locked = 0;
-    a.last_interest_date = time(NULL); // Initialize to current date
+// A statement is written in one pass over the account's records from the
+// start of the period to now, holding a single block of them in memory:
+//   - sealed segments overlapping the period, oldest first (block scan)
+//   - the current log, newest first through the account's index chain,
+//     stopping at the first record older than the period
+// Records inside the period are spooled to temporary files as they are met.
+// Every record from the period start on is also netted, so the opening
+// balance is the current balance minus that net. The spools are then
+// replayed oldest first (the current log spool from its end) with a
+// running balance.
+
+// Signed effect of a transaction on its account's balance. Loan decisions
+// (manageLoanApplications, decideLoans) credit the borrower by the amount
+// posted with LOAN_APPROVED; a rejection changes no balance.
+Money transactionEffect(const struct Transaction *t) {
+    switch (t->type) {
+        case DEPOSIT:
+        case TRANSFER_IN:
+        case LOAN_APPROVED:
+        case INTEREST_CREDIT:
+            return t->amount;
+        case WITHDRAWAL:
+        case TRANSFER_OUT:
+        case LOAN_REPAYMENT:
+            return -t->amount;
+        case LOAN_REJECTED:
+        default:
+            return 0;
+    }
+}
 
-    FILE *fp = fopen(ACCOUNTS_FILE, "ab");
-    if (!fp) {
-        printf(RED "Error opening accounts file.\n" RESET);
-        return;
+static const char *statementTypeLabel(const struct Transaction *t) {
+    switch (t->type) {
+        case DEPOSIT:         return "Deposit";
+        case WITHDRAWAL:      return "Withdrawal";
+        case TRANSFER_OUT:    return "Transfer out";
+        case TRANSFER_IN:     return "Transfer in";
+        case LOAN_REPAYMENT:  return "Loan repayment";
+        case LOAN_APPROVED:   return "Loan credit";
+        case LOAN_REJECTED:   return "Loan rejected";
+        case INTEREST_CREDIT: return "Interest";
+        default:              return "Other";
     }
-    fwrite(&a, sizeof(struct Account), 1, fp);
-    fclose(fp);
+}
+
+struct StatementScan {
+    FILE *spool;
+    long to;
+    Money net;   // every record visited, including those after the period
+    long count;  // records spooled
+    int ok;
+};
 
-    printf(GREEN "Account Created: %d, Name: %s, Balance: %.2f %s\n" RESET, a.acc_no, a.name, a.balance, a.currency);
+static int statementSpoolSegmentRecord(const struct Transaction *t, void *ctx) {
+    struct StatementScan *scan = ctx;
+    scan->net += transactionEffect(t);
+    if (scan->to != 0 && t->timestamp > scan->to) return 1;
+    scan->ok = fwrite(t, sizeof(*t), 1, scan->spool) == 1;
+    scan->count += scan->ok;
+    return scan->ok;
 }
 
-void deposit()
-{
-    int acc_no;
-    char pin_str[32];
-    float amount;
-    int found = 0;
-    int ch;
+// localtime() returns a shared buffer, and month-end workers format dates
+// concurrently
+static struct tm *statementLocalTime(long t, struct tm *buf) {
+    time_t when = (time_t)t;
+#ifdef _WIN32
+    *buf = *localtime(&when);
+#else
+    localtime_r(&when, buf);
+#endif
+    return buf;
+}
 
-    printf(GREEN "Enter account number: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        while ((ch = getchar()) != '\n' && ch != EOF);
-        return;
+static void statementWriteHeader(FILE *out, int acc_no, const char *name, const char *currency, long from, long to,
+                                 Money opening) {
+    char from_str[16] = "first entry", to_str[16] = "today";
+    struct tm tm;
+    if (from != 0) strftime(from_str, sizeof(from_str), "%Y-%m-%d", statementLocalTime(from, &tm));
+    if (to != 0) strftime(to_str, sizeof(to_str), "%Y-%m-%d", statementLocalTime(to, &tm));
+    fprintf(out, "==========================================================================================================\n");
+    fprintf(out, "                                         BANK ACCOUNT STATEMENT\n");
+    fprintf(out, "==========================================================================================================\n");
+    fprintf(out, "Account Number:  %d\n", acc_no);
+    fprintf(out, "Account Holder:  %s\n", name);
+    fprintf(out, "Currency:        %s\n", currency);
+    fprintf(out, "Period:          %s to %s\n", from_str, to_str);
+    fprintf(out, "Opening Balance: %.2f\n", moneyToDouble(opening));
+    fprintf(out, "----------------------------------------------------------------------------------------------------------\n");
+    fprintf(out, "| Date & Time         | Type           |          Debit |         Credit |          Balance | Reference    |\n");
+    fprintf(out, "----------------------------------------------------------------------------------------------------------\n");
+}
+
+static void statementWriteFooter(FILE *out, const struct StatementTotals *totals, int ok) {
+    fprintf(out, "----------------------------------------------------------------------------------------------------------\n");
+    fprintf(out, "Transactions:    %ld\n", totals->count);
+    fprintf(out, "Total Debits:    %.2f\n", moneyToDouble(totals->debits));
+    fprintf(out, "Total Credits:   %.2f\n", moneyToDouble(totals->credits));
+    fprintf(out, "Closing Balance: %.2f\n", moneyToDouble(totals->closing));
+    if (!ok) fprintf(out, "*** The transaction log could not be read completely; this statement is incomplete. ***\n");
+    fprintf(out, "==========================================================================================================\n");
+}
+
+static void statementWriteRow(FILE *out, const struct Transaction *t, Money balance, struct StatementTotals *totals) {
+    char time_str[30], debit[24] = "", credit[24] = "", reference[24] = "";
+    struct tm tm;
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", statementLocalTime((long)t->timestamp, &tm));
+    Money effect = transactionEffect(t);
+    if (effect < 0) {
+        snprintf(debit, sizeof(debit), "%.2f", moneyToDouble(-effect));
+        totals->debits -= effect;
+    } else if (effect > 0) {
+        snprintf(credit, sizeof(credit), "%.2f", moneyToDouble(effect));
+        totals->credits += effect;
     }
-    printf(GREEN "Enter your PIN: " RESET);
+    if (t->type == TRANSFER_OUT) snprintf(reference, sizeof(reference), "to %d", t->receiver_acc_no);
+    if (t->type == TRANSFER_IN) snprintf(reference, sizeof(reference), "from %d", t->receiver_acc_no);
+    fprintf(out, "| %s | %-14s | %14s | %14s | %16.2f | %-12s |\n", time_str, statementTypeLabel(t), debit, credit,
+            moneyToDouble(balance), reference);
+    totals->count++;
+}
 
-    while ((ch = getchar()) != '\n' && ch != EOF);
-    getMaskedInput(pin_str, sizeof(pin_str));
+// Writes the statement of acc_no for [from, to] (0 = no limit) to out and
+// fills *totals. Returns 0 if the account does not exist or the log could not
+// be read; what was written so far is then incomplete.
+int writeAccountStatement(FILE *out, int acc_no, long from, long to, struct StatementTotals *totals) {
+    memset(totals, 0, sizeof(*totals));
 
-    if (!authenticate(acc_no, pin_str))
-    {
-        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
-        return;
+    // The balance and the end of the log are taken together, so records
+    // logged while the statement is written are left out of both
+    struct Account a;
+    accountLock(acc_no);
+    transactionLogFlush();
+    int found = loadAccount(acc_no, &a, NULL);
+    long log_records = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+    long cur = transactionIndexHead(acc_no);
+    accountUnlock(acc_no);
+    if (!found) return 0;
+
+    struct StatementScan seg = {tmpfile(), to, 0, 0, 1};
+    struct StatementScan log = {tmpfile(), to, 0, 0, 1};
+    int ok = seg.spool && log.spool;
+
+    struct TxArchiveQuery q = {acc_no, from, 0, TX_COL_ALL};
+    if (ok && transactionSegmentsScan(&q, statementSpoolSegmentRecord, &seg, &totals->segments_read) < 0) ok = 0;
+    ok = ok && seg.ok;
+
+    FILE *tx_fp = ok ? fopen(TRANSACTIONS_FILE, "rb") : NULL;
+    FILE *idx_fp = tx_fp ? fopen(TRANSACTIONS_INDEX_FILE, "rb") : NULL;
+    if (ok && cur >= 0 && !idx_fp) ok = 0;
+    struct Transaction t;
+    while (ok && cur >= 0) {
+        if (cur < log_records) {
+            if (fseek(tx_fp, cur * (long)sizeof(t), SEEK_SET) != 0 || fread(&t, sizeof(t), 1, tx_fp) != 1 ||
+                t.acc_no != acc_no) {
+                ok = 0;
+                break;
+            }
+            if (from != 0 && t.timestamp < from) break; // The rest is older still
+            log.net += transactionEffect(&t);
+            if (to == 0 || t.timestamp <= to) {
+                ok = fwrite(&t, sizeof(t), 1, log.spool) == 1;
+                log.count++;
+            }
+        }
+        cur = transactionIndexPrev(idx_fp, cur);
     }
-    printf(GREEN "Enter amount to deposit: " RESET);
-    if (scanf("%f", &amount) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        while ((ch = getchar()) != '\n' && ch != EOF);
-        return;
+    if (tx_fp) fclose(tx_fp);
+    if (idx_fp) fclose(idx_fp);
+
+    totals->opening = a.balance - seg.net - log.net;
+    Money balance = totals->opening;
+    statementWriteHeader(out, a.acc_no, a.name, a.currency, from, to, totals->opening);
+
+    // Replay: segment records in the order spooled, then the current log
+    // spool read backwards a block at a time
+    struct Transaction *block = ok ? malloc(STATEMENT_SPOOL_RECORDS * sizeof(struct Transaction)) : NULL;
+    if (!block) ok = 0;
+    if (ok) {
+        rewind(seg.spool);
+        size_t n;
+        while ((n = fread(block, sizeof(struct Transaction), STATEMENT_SPOOL_RECORDS, seg.spool)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                balance += transactionEffect(&block[i]);
+                statementWriteRow(out, &block[i], balance, totals);
+            }
+        }
+        for (long end = log.count; ok && end > 0; ) {
+            long start = end > STATEMENT_SPOOL_RECORDS ? end - STATEMENT_SPOOL_RECORDS : 0;
+            size_t m = (size_t)(end - start);
+            if (fseek(log.spool, start * (long)sizeof(struct Transaction), SEEK_SET) != 0 ||
+                fread(block, sizeof(struct Transaction), m, log.spool) != m) {
+                ok = 0;
+                break;
+            }
+            for (size_t i = m; i-- > 0; ) {
+                balance += transactionEffect(&block[i]);
+                statementWriteRow(out, &block[i], balance, totals);
+            }
+            end = start;
+        }
     }
-    if (amount <= 0.0f) {
-        printf(RED "Amount must be positive.\n" RESET);
-        return;
+    free(block);
+    if (seg.spool) fclose(seg.spool);
+    if (log.spool) fclose(log.spool);
+
+    totals->closing = balance;
+    statementWriteFooter(out, totals, ok);
+    return ok;
+}
+
+// Month-end run: the statements of every account for one period, with one
+// pass over the log rather than one per account.
+//   1. Under accountLockAll the log is flushed and every live account is
+//      copied to the spill file of its partition (a hash of acc_no), so the
+//      balances and the end of the log agree.
+//   2. The segments overlapping the period and then TRANSACTIONS_FILE are
+//      read once, oldest first, and every record from the period start on
+//      is appended to its account's partition. An account's records thus
+//      stay in time order within the partition.
+//   3. Worker threads claim partitions one at a time. Each partition is
+//      small enough to load: its records are grouped by account with a
+//      counting sort, and each account's statement file is written with the
+//      opening balance derived as in writeAccountStatement.
+
+int statement_workers = 0; // 0 = one per CPU core
+
+// Account fields a month-end statement needs, as copied in step 1
+struct StatementRunAccount {
+    int acc_no;
+    char name[100];
+    char currency[4];
+    Money balance;
+};
+
+struct StatementRun {
+    const char *dir;
+    long from;
+    long to;
+    int partitions;
+    FILE **accounts;      // per partition: StatementRunAccount records
+    FILE **records;       // per partition: Transaction records
+    long *account_counts; // per partition
+    int next;             // next partition to claim
+    int ok;               // cleared when a spill write fails
+};
+
+struct StatementRunWorker {
+    struct StatementRun *run;
+    long written;
+    long transactions;
+    long failed;
+};
+
+static int statementRunWorkerCount(void) {
+    int workers = statement_workers;
+#ifdef _WIN32
+    workers = 1;
+#else
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (workers > STATEMENT_RUN_MAX_WORKERS) workers = STATEMENT_RUN_MAX_WORKERS;
+    return workers < 1 ? 1 : workers;
+}
+
+static int statementRunPartition(const struct StatementRun *run, int acc_no) {
+    return (int)(recordIndexHash(acc_no) % (size_t)run->partitions);
+}
+
+static int statementRunSpillRecord(const struct Transaction *t, void *ctx) {
+    struct StatementRun *run = ctx;
+    run->ok = fwrite(t, sizeof(*t), 1, run->records[statementRunPartition(run, t->acc_no)]) == 1;
+    return run->ok;
+}
+
+// Reads a whole spill file back into memory
+static void *statementRunLoad(FILE *fp, size_t record_size, size_t *count) {
+    *count = 0;
+    if (fflush(fp) != 0 || fseek(fp, 0, SEEK_END) != 0) return NULL;
+    long bytes = ftell(fp);
+    if (bytes < 0 || fseek(fp, 0, SEEK_SET) != 0) return NULL;
+    size_t n = (size_t)bytes / record_size;
+    void *data = malloc(n > 0 ? n * record_size : 1);
+    if (data && fread(data, record_size, n, fp) != n) {
+        free(data);
+        return NULL;
     }
+    if (data) *count = n;
+    return data;
+}
 
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb+");
-    if (!fp) {
-        printf(YELLOW "No accounts found.\n" RESET);
-        return;
+// Writes the statements of partition p. Returns 0 if the partition could not
+// be loaded, in which case none of them were written.
+static int statementRunWritePartition(struct StatementRunWorker *w, int p) {
+    struct StatementRun *run = w->run;
+    size_t account_count = 0, record_count = 0;
+    struct StatementRunAccount *accounts = statementRunLoad(run->accounts[p], sizeof(*accounts), &account_count);
+    struct Transaction *records = accounts ? statementRunLoad(run->records[p], sizeof(*records), &record_count) : NULL;
+    struct Transaction *grouped = malloc((record_count > 0 ? record_count : 1) * sizeof(struct Transaction));
+    long *owner = malloc((record_count > 0 ? record_count : 1) * sizeof(long));
+    long *start = calloc(account_count + 1, sizeof(long));
+    long *next = malloc((account_count + 1) * sizeof(long));
+    Money *net = calloc(account_count + 1, sizeof(Money));
+    struct RecordIndex ix = {NULL, 0, 0};
+    int ok = accounts && records && grouped && owner && start && next && net &&
+             recordIndexReserve(&ix, account_count);
+    for (size_t k = 0; ok && k < account_count; k++) ok = recordIndexPut(&ix, accounts[k].acc_no, (long)k, 1);
+
+    if (ok) {
+        // Counting sort by account; records of accounts deleted since are dropped
+        for (size_t r = 0; r < record_count; r++) {
+            long k = recordIndexLookup(&ix, records[r].acc_no);
+            owner[r] = k;
+            if (k < 0) continue;
+            start[k + 1]++;
+            net[k] += transactionEffect(&records[r]);
+        }
+        for (size_t k = 0; k < account_count; k++) start[k + 1] += start[k];
+        memcpy(next, start, (account_count + 1) * sizeof(long));
+        for (size_t r = 0; r < record_count; r++)
+            if (owner[r] >= 0) grouped[next[owner[r]]++] = records[r];
+
+        for (size_t k = 0; k < account_count; k++) {
+            const struct StatementRunAccount *a = &accounts[k];
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%d.txt", run->dir, a->acc_no);
+            FILE *out = fopen(path, "w");
+            if (!out) {
+                w->failed++;
+                continue;
+            }
+            struct StatementTotals totals;
+            memset(&totals, 0, sizeof(totals));
+            totals.opening = a->balance - net[k];
+            Money balance = totals.opening;
+            statementWriteHeader(out, a->acc_no, a->name, a->currency, run->from, run->to, totals.opening);
+            for (long i = start[k]; i < start[k + 1]; i++) {
+                if (run->to != 0 && grouped[i].timestamp > run->to) continue; // Only netted
+                balance += transactionEffect(&grouped[i]);
+                statementWriteRow(out, &grouped[i], balance, &totals);
+            }
+            totals.closing = balance;
+            statementWriteFooter(out, &totals, 1);
+            if (fclose(out) != 0) {
+                w->failed++;
+                continue;
+            }
+            w->written++;
+            w->transactions += totals.count;
+        }
     }
+    recordIndexClear(&ix);
+    free(accounts);
+    free(records);
+    free(grouped);
+    free(owner);
+    free(start);
+    free(next);
+    free(net);
+    return ok;
+}
 
-    struct Account a;
-    while (fread(&a, sizeof(struct Account), 1, fp)) {
-        if (a.acc_no == acc_no) {
-            found = 1;
-            a.balance += amount;
-            fseek(fp, -sizeof(struct Account), SEEK_CUR);
-            fwrite(&a, sizeof(struct Account), 1, fp);
-            logTransaction(acc_no, DEPOSIT, amount, 0, a.currency);
-            printf(GREEN "Deposit successful. New balance: %.2f %s\n" RESET, a.balance, a.currency);
+static void *statementRunWorker(void *arg) {
+    struct StatementRunWorker *w = arg;
+    struct StatementRun *run = w->run;
+    for (;;) {
+        int p = ATOMIC_INC(&run->next) - 1;
+        if (p >= run->partitions) break;
+        if (!statementRunWritePartition(w, p)) w->failed += run->account_counts[p];
+    }
+    return NULL;
+}
+
+// Writes the statement of every account for [from, to] (0 = no limit) to
+// dir/<acc_no>.txt and fills *result. Returns 0 if the log could not be read
+// or any statement could not be written (result->failed).
+int runMonthEndStatements(const char *dir, long from, long to, struct StatementRunResult *result) {
+    memset(result, 0, sizeof(*result));
+    if (MKDIR(dir) == -1 && errno != EEXIST) return 0;
+
+    struct StatementRun run;
+    memset(&run, 0, sizeof(run));
+    run.dir = dir;
+    run.from = from;
+    run.to = to;
+    run.ok = 1;
+    int workers = statementRunWorkerCount();
+
+    // Step 1: the same lock order as the interest run
+    walCheckpoint();
+    accountLockAll();
+    transactionLogFlush();
+    long log_records = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+    long account_records = fileRecordCount(ACCOUNTS_FILE, sizeof(struct Account));
+    long spilled = log_records;
+    for (size_t i = 0; i < tx_segment_count; i++)
+        if (!tx_segments[i].pending && (from == 0 || tx_segments[i].max_time >= from))
+            spilled += tx_segments[i].records;
+    double bytes = (double)spilled * sizeof(struct Transaction) +
+                   (double)account_records * sizeof(struct StatementRunAccount);
+    long partitions = (long)(bytes / STATEMENT_RUN_PARTITION_BYTES) + 1;
+    if (partitions < 2L * workers) partitions = 2L * workers; // Room to even out uneven partitions
+    if (partitions > STATEMENT_RUN_MAX_PARTITIONS) partitions = STATEMENT_RUN_MAX_PARTITIONS;
+    run.partitions = (int)partitions;
+
+    run.accounts = calloc((size_t)run.partitions, sizeof(FILE *));
+    run.records = calloc((size_t)run.partitions, sizeof(FILE *));
+    run.account_counts = calloc((size_t)run.partitions, sizeof(long));
+    struct Transaction *block = malloc(STATEMENT_SPOOL_RECORDS * sizeof(struct Transaction));
+    struct Account *chunk = malloc(STATEMENT_SPOOL_RECORDS * sizeof(struct Account));
+    int ok = run.accounts && run.records && run.account_counts && block && chunk;
+    for (int p = 0; ok && p < run.partitions; p++) {
+        run.accounts[p] = tmpfile();
+        run.records[p] = tmpfile();
+        ok = run.accounts[p] && run.records[p];
+        if (ok) {
+            setvbuf(run.accounts[p], NULL, _IOFBF, STATEMENT_RUN_SPILL_BUFFER);
+            setvbuf(run.records[p], NULL, _IOFBF, STATEMENT_RUN_SPILL_BUFFER);
+        }
+    }
+
+    FILE *fp = ok && account_records > 0 ? fopen(ACCOUNTS_FILE, "rb") : NULL;
+    if (ok && account_records > 0 && !fp) ok = 0;
+    size_t n;
+    while (ok && fp && (n = fread(chunk, sizeof(struct Account), STATEMENT_SPOOL_RECORDS, fp)) > 0) {
+        for (size_t i = 0; ok && i < n; i++) {
+            if (accountIsTombstone(&chunk[i])) continue;
+            struct StatementRunAccount a;
+            a.acc_no = chunk[i].acc_no;
+            memcpy(a.name, chunk[i].name, sizeof(a.name));
+            memcpy(a.currency, chunk[i].currency, sizeof(a.currency));
+            a.balance = chunk[i].balance;
+            int p = statementRunPartition(&run, a.acc_no);
+            ok = fwrite(&a, sizeof(a), 1, run.accounts[p]) == 1;
+            run.account_counts[p]++;
+        }
+    }
+    if (fp) fclose(fp);
+    accountUnlockAll();
+
+    // Step 2: segments, then the log up to where it ended in step 1
+    struct TxArchiveQuery q = {0, from, 0, TX_COL_ALL};
+    if (ok && transactionSegmentsScan(&q, statementRunSpillRecord, &run, &result->segments_read) < 0) ok = 0;
+    ok = ok && run.ok;
+    FILE *tx_fp = ok && log_records > 0 ? fopen(TRANSACTIONS_FILE, "rb") : NULL;
+    if (ok && log_records > 0 && !tx_fp) ok = 0;
+    for (long done = 0; ok && done < log_records; ) {
+        size_t want = log_records - done < STATEMENT_SPOOL_RECORDS ? (size_t)(log_records - done)
+                                                                   : STATEMENT_SPOOL_RECORDS;
+        if (fread(block, sizeof(struct Transaction), want, tx_fp) != want) {
+            ok = 0;
             break;
         }
+        for (size_t i = 0; ok && i < want; i++) {
+            if (from != 0 && block[i].timestamp < from) continue;
+            ok = statementRunSpillRecord(&block[i], &run);
+        }
+        done += (long)want;
     }
-    fclose(fp);
+    if (tx_fp) fclose(tx_fp);
+    free(block);
+    free(chunk);
+
+    // Step 3
+    struct StatementRunWorker *w = ok ? calloc((size_t)workers, sizeof(struct StatementRunWorker)) : NULL;
+    if (!w) ok = 0;
+    if (ok) {
+        for (int i = 0; i < workers; i++) w[i].run = &run;
+#ifndef _WIN32
+        pthread_t threads[STATEMENT_RUN_MAX_WORKERS];
+        int started[STATEMENT_RUN_MAX_WORKERS];
+        for (int i = 1; i < workers; i++)
+            started[i] = pthread_create(&threads[i], NULL, statementRunWorker, &w[i]) == 0;
+        statementRunWorker(&w[0]);
+        for (int i = 1; i < workers; i++)
+            if (started[i]) pthread_join(threads[i], NULL);
+#else
+        statementRunWorker(&w[0]);
+#endif
+        for (int i = 0; i < workers; i++) {
+            result->accounts += w[i].written;
+            result->transactions += w[i].transactions;
+            result->failed += w[i].failed;
+        }
+    }
+    free(w);
+    for (int p = 0; run.accounts && p < run.partitions; p++) {
+        if (run.accounts[p]) fclose(run.accounts[p]);
+        if (run.records[p]) fclose(run.records[p]);
+    }
+    free(run.accounts);
+    free(run.records);
+    free(run.account_counts);
 
-    if (!found) {
-        printf(RED "Account not found.\n" RESET);
+    result->partitions = run.partitions;
+    result->workers = workers;
+    return ok && result->failed == 0;
+}
+
+// "YYYY-MM-DD" -> start of that day (or its last second), local time.
+// Blank input gives 0 (no limit).
+static int parseStatementDate(const char *text, int end_of_day, long *out) {
+    int year, month, day;
+    char extra;
+    *out = 0;
+    while (*text == ' ') text++;
+    if (*text == '\0') return 1;
+    if (sscanf(text, "%d-%d-%d %c", &year, &month, &day, &extra) != 3 || month < 1 || month > 12 || day < 1 ||
+        day > 31)
+        return 0;
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_isdst = -1;
+    if (end_of_day) {
+        tm.tm_hour = 23;
+        tm.tm_min = 59;
+        tm.tm_sec = 59;
     }
+    *out = (long)mktime(&tm);
+    return *out != -1;
 }
 
-void withdraw()
-{
-    int acc_no;
-    char pin_str[32];
-    float amount;
-    int found = 0;
+void generateAccountStatement() {
+    int acc_no;
+    char date_str[32], path[256];
     int ch;
-
-    printf(GREEN "Enter account number: " RESET);
+    
+    printf(GREEN "Enter account number for statement: " RESET);
     if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
+        printf(RED "Invalid account number input.\n" RESET);
         while ((ch = getchar()) != '\n' && ch != EOF);
         return;
     }
-    printf(GREEN "Enter your PIN: " RESET);
-
-    while ((ch = getchar()) != '\n' && ch != EOF);
-    getMaskedInput(pin_str, sizeof(pin_str));
+    
+    if (!authenticateCustomer(acc_no, GREEN "Enter PIN for authentication: " RESET)) {
+        printf(RED "Authentication failed. Account not found or PIN incorrect.\n" RESET);
+        return;
+    }
 
-    if (!authenticate(acc_no, pin_str))
-    {
-        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
+    long from, to;
+    printf(GREEN "From date (YYYY-MM-DD, blank for the first transaction): " RESET);
+    if (!fgets(date_str, sizeof(date_str), stdin)) return;
+    date_str[strcspn(date_str, "\r\n")] = '\0';
+    if (!parseStatementDate(date_str, 0, &from)) {
+        printf(RED "Invalid date.\n" RESET);
         return;
     }
-    printf(GREEN "Enter amount to withdraw: " RESET);
-    if (scanf("%f", &amount) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        while ((ch = getchar()) != '\n' && ch != EOF);
+    printf(GREEN "To date (YYYY-MM-DD, blank for today): " RESET);
+    if (!fgets(date_str, sizeof(date_str), stdin)) return;
+    date_str[strcspn(date_str, "\r\n")] = '\0';
+    if (!parseStatementDate(date_str, 1, &to)) {
+        printf(RED "Invalid date.\n" RESET);
         return;
     }
-    if (amount <= 0.0f) {
-        printf(RED "Amount must be positive.\n" RESET);
+    if (to != 0 && to < from) {
+        printf(RED "The end date is before the start date.\n" RESET);
         return;
     }
+    printf(GREEN "Save to file (blank to show it here): " RESET);
+    if (!fgets(path, sizeof(path), stdin)) return;
+    path[strcspn(path, "\r\n")] = '\0';
 
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb+");
-    if (!fp) {
-        printf(YELLOW "No accounts found.\n" RESET);
+    FILE *out = stdout;
+    if (path[0] != '\0' && (out = fopen(path, "w")) == NULL) {
+        printf(RED "Cannot create %s.\n" RESET, path);
         return;
     }
+    if (out == stdout) printf("\n");
+    struct StatementTotals totals;
+    int ok = writeAccountStatement(out, acc_no, from, to, &totals);
+    if (out != stdout && fclose(out) != 0) ok = 0;
+
+    if (!ok) printf(RED "Error: the statement could not be completed.\n" RESET);
+    if (out != stdout)
+        printf(GREEN "Statement with %ld transaction(s) written to %s.\n" RESET, totals.count, path);
+    printf(YELLOW "%d log segment(s) read.\n" RESET, totals.segments_read);
+}
 
-    struct Account a;
-    while (fread(&a, sizeof(struct Account), 1, fp)) {
-        if (a.acc_no == acc_no) {
-            found = 1;
-            if (a.balance >= amount) {
-                a.balance -= amount;
-                fseek(fp, -sizeof(struct Account), SEEK_CUR);
-                fwrite(&a, sizeof(struct Account), 1, fp);
-                logTransaction(acc_no, WITHDRAWAL, amount, 0, a.currency);
-                printf(GREEN "Withdraw successful. New balance: %.2f %s\n" RESET, a.balance, a.currency);
-            } else {
-                printf(RED "Insufficient balance.\n" RESET);
-            }
-            break;
-        }
+// "YYYY-MM" -> first and last second of that month, local time. Blank input
+// gives the month before the current one.
+static int parseStatementMonth(const char *text, long *from, long *to) {
+    int year, month;
+    char extra;
+    long start, end;
+    while (*text == ' ') text++;
+    if (*text == '\0') {
+        txMonthBounds((long)time(NULL), &start, &end);
+        txMonthBounds(start - 1, &start, &end);
+    } else {
+        if (sscanf(text, "%d-%d %c", &year, &month, &extra) != 2 || month < 1 || month > 12) return 0;
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = 1;
+        tm.tm_isdst = -1;
+        time_t first = mktime(&tm);
+        if (first == (time_t)-1) return 0;
+        txMonthBounds((long)first, &start, &end);
     }
-    fclose(fp);
+    *from = start;
+    *to = end - 1;
+    return 1;
+}
 
-    if (!found) {
-        printf(RED "Account not found.\n" RESET);
+// Writes every account's statement for month ("YYYY-MM", blank for last
+// month) into STATEMENTS_DIR/YYYY-MM. Returns 1 if all of them were written.
+int monthEndStatements(const char *month) {
+    long from, to;
+    if (!parseStatementMonth(month, &from, &to)) {
+        printf(RED "Invalid month.\n" RESET);
+        return 0;
+    }
+    char dir[64];
+    struct tm tm;
+    int len = snprintf(dir, sizeof(dir), "%s/", STATEMENTS_DIR);
+    strftime(dir + len, sizeof(dir) - (size_t)len, "%Y-%m", statementLocalTime(from, &tm));
+    if (MKDIR(STATEMENTS_DIR) == -1 && errno != EEXIST) {
+        printf(RED "Cannot create %s.\n" RESET, STATEMENTS_DIR);
+        return 0;
     }
-}
 
-void transferMoney() {
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb+");
-    struct Account sender, receiver;
-    int senderAcc, receiverAcc;
-    char senderPin_str[32];
-    float amount;
-    int foundSender = 0, foundReceiver = 0;
-    long senderPos, receiverPos;
+    printf(BLUE "\n--- Month-End Statements for %s ---\n" RESET, dir + len);
+    long long started = monotonicMillis();
+    struct StatementRunResult result;
+    int ok = runMonthEndStatements(dir, from, to, &result);
+    double seconds = (double)(monotonicMillis() - started) / 1000.0;
+
+    if (result.failed > 0)
+        printf(RED "Error: %ld statement(s) could not be written.\n" RESET, result.failed);
+    else if (!ok)
+        printf(RED "Error: the transaction log could not be read; no statements were written.\n" RESET);
+    printf(GREEN "%ld statement(s) with %ld transaction(s) written to %s in %.2f s.\n" RESET, result.accounts,
+           result.transactions, dir, seconds);
+    printf(YELLOW "%d log segment(s) read, %d partition(s), %d worker(s).\n" RESET, result.segments_read,
+           result.partitions, result.workers);
+    return ok;
+}
 
-    printf(GREEN "\n--- Money Transfer ---\n" RESET);
-    printf("Enter Sender Account Number: " RESET);
-    if (scanf("%d", &senderAcc) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        flush_stdin();
-        return;
-    }
-    printf("Enter Sender PIN: " RESET);
+void monthEndStatementsMenu(void) {
+    char month[32];
+    printf(GREEN "Month (YYYY-MM, blank for last month): " RESET);
     flush_stdin();
-    getMaskedInput(senderPin_str, sizeof(senderPin_str));
+    if (!fgets(month, sizeof(month), stdin)) return;
+    month[strcspn(month, "\r\n")] = '\0';
+    monthEndStatements(month);
+}
 
-    if (!authenticate(senderAcc, senderPin_str)) {
-        printf(RED "Authentication failed. Sender account not found or invalid PIN.\n" RESET);
+void archiveTransactionsMenu(void) {
+    printf(BLUE "\n--- Archiving Transaction Log ---\n" RESET);
+    long archived = archiveTransactionLog();
+    if (archived < 0) {
+        printf(RED "Archiving failed; the transaction log is unchanged.\n" RESET);
         return;
     }
+    if (archived == 0)
+        printf(YELLOW "The transaction log holds no transactions from before this month.\n" RESET);
+    else
+        printf(GREEN "Sealed %ld transaction(s) (%ld bytes in the log) into log segments.\n" RESET, archived,
+               archived * (long)sizeof(struct Transaction));
+    printTransactionSegments();
+}
 
-    if (!fp) {
-        printf(YELLOW "No accounts found.\n" RESET);
+void unlockAccount() {
+    int acc_no;
+    int found = 0;
+    int ch;
+
+    printf(GREEN "Enter account number to unlock: " RESET);
+    if (scanf("%d", &acc_no) != 1) {
+        printf(RED "Invalid input format.\n" RESET);
+        while ((ch = getchar()) != '\n' && ch != EOF);
         return;
     }
 
-    rewind(fp);
-    while (fread(&sender, sizeof(struct Account), 1, fp) == 1) {
-        if (sender.acc_no == senderAcc) {
-            foundSender = 1;
-            senderPos = ftell(fp) - sizeof(struct Account);
-            break;
+    struct Account a;
+    long pos;
+    if (loadAccount(acc_no, &a, &pos)) {
+        found = 1;
+        if (a.locked) {
+            a.locked = 0;
+            a.failed_attempts = 0;
+            saveAccount(pos, &a);
+            accountStoreCommit(0);
+            printf(GREEN "Account %d has been unlocked successfully.\n" RESET, acc_no);
+        } else {
+            printf(YELLOW "Account %d was not locked.\n" RESET, acc_no);
         }
     }
 
-    printf("Enter Receiver Account Number: " RESET);
-    if (scanf("%d", &receiverAcc) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        flush_stdin();
-        goto cleanup;
+    if (!found) {
+        printf(RED "Account not found.\n" RESET);
     }
-    if (senderAcc == receiverAcc) {
-        printf(RED "Cannot transfer money to the same account.\n" RESET);
-        goto cleanup;
+}
+
+// Each run writes only what changed since the previous one; see BACKUP.
+// Returns 1 unless a file could not be backed up.
+int createAutomatedBackup() {
+    printf(BLUE "\n--- Creating Automated Backup ---\n" RESET);
+    transactionLogFlush();
+    accountStoreCommit(1);
+
+    if (MKDIR(BACKUP_DIR) == -1 && errno != EEXIST) {
+        printf(RED "Error: Could not create backup directory.\n" RESET);
+        return 0;
     }
 
-    rewind(fp);
-    while (fread(&receiver, sizeof(struct Account), 1, fp) == 1) {
-        if (receiver.acc_no == receiverAcc) {
-            foundReceiver = 1;
-            receiverPos = ftell(fp) - sizeof(struct Account);
-            break;
+    char timestamp[100];
+    time_t now = time(NULL);
+    struct tm *t = localtime(&now);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d_%H-%M-%S", t);
+
+    struct BackupManifest manifest;
+    if (!backupManifestLoad(&manifest)) return 0;
+    // Room for this run's entries, so appending never reallocates
+    size_t needed = manifest.count + 8 + tx_segment_count;
+    if (needed > manifest.capacity) {
+        struct BackupEntry *grown = realloc(manifest.entries, needed * sizeof(struct BackupEntry));
+        if (!grown) {
+            free(manifest.entries);
+            printf(RED "Error: Out of memory.\n" RESET);
+            return 0;
         }
-    }
-    if (!foundReceiver) {
-        printf(RED "Receiver account not found.\n" RESET);
-        goto cleanup;
+        manifest.entries = grown;
+        manifest.capacity = needed;
     }
 
-    printf("Enter amount to transfer (%s): " RESET, sender.currency);
-    if (scanf("%f", &amount) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        flush_stdin();
-        goto cleanup;
-    }
+    const char* filesToBackup[] = {ACCOUNTS_FILE, TRANSACTIONS_FILE, LOANS_FILE, INTEREST_LOG_FILE};
+    const enum BackupMode modes[] = {BACKUP_BLOCKS, BACKUP_TAIL, BACKUP_BLOCKS, BACKUP_TAIL};
+    int numFiles = sizeof(filesToBackup) / sizeof(filesToBackup[0]);
+    int successCount = 0, failCount = 0;
 
-    if (amount <= 0) {
-        printf(RED "Invalid amount.\n" RESET);
-        goto cleanup;
+    for (int i = 0; i < numFiles; ++i) {
+        int r = backupSource(&manifest, filesToBackup[i], modes[i], timestamp);
+        if (r > 0) successCount++;
+        if (r < 0) failCount++;
+    }
+    // Sealed log segments and the manifest that lists them
+    if (tx_segment_count > 0) {
+        int r = backupSource(&manifest, TRANSACTIONS_MANIFEST_FILE, BACKUP_BLOCKS, timestamp);
+        if (r > 0) successCount++;
+        if (r < 0) failCount++;
+        for (size_t i = 0; i < tx_segment_count; i++) {
+            if (tx_segments[i].pending) continue;
+            r = backupSource(&manifest, tx_segments[i].file, BACKUP_SEALED, timestamp);
+            if (r > 0) successCount++;
+            if (r < 0) failCount++;
+        }
     }
+    free(manifest.entries);
 
-    if (sender.balance < amount) {
-        printf(RED "Insufficient balance in sender's account.\n" RESET);
-        goto cleanup;
+    if (failCount > 0) {
+        printf(RED "\nBackup incomplete: %d file(s) could not be backed up.\n" RESET, failCount);
+    } else if (successCount > 0) {
+        printf(GREEN "\nAutomated backup completed successfully. Files saved in the '%s' directory.\n" RESET, BACKUP_DIR);
+    } else {
+        printf(YELLOW "\nNothing changed since the last backup.\n" RESET);
     }
+    return failCount == 0;
+}
 
-    // Convert amount to receiver's currency
-    float exchangeRate = getExchangeRate(sender.currency, receiver.currency);
-    float convertedAmount = amount * exchangeRate;
+void manageLoanApplications() {
+    int loan_id;
+    char action;
 
-    sender.balance -= amount;
-    fseek(fp, senderPos, SEEK_SET);
-    if (fwrite(&sender, sizeof(struct Account), 1, fp) != 1) {
-        printf(RED "Error writing to sender's account file. Transaction aborted.\n" RESET);
-        goto cleanup;
+    printf(BLUE "\n--- Manage Loan Applications ---\n" RESET);
+    printf(BLUE "\nPending Loan Applications:\n" RESET);
+    printf(BLUE "--------------------------------------------------------\n" RESET);
+    printf(BLUE "| ID       | Account  | Amount    | Date\n" RESET);
+    printf(BLUE "--------------------------------------------------------\n" RESET);
+
+    // The pending queue lists applications oldest first without reading LOANS_FILE
+    int foundPending = 0;
+    long cursor = 0, recno;
+    while ((recno = loanQueueNext(&cursor)) >= 0) {
+        const struct Loan *pending = loanIndexGet(recno);
+        foundPending = 1;
+        char time_str[30];
+        time_t when = (time_t)pending->timestamp;
+        struct tm *local_time = localtime(&when);
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d", local_time);
+        printf("| %-8d | %-8d | %-9.2f | %s\n", pending->loan_id, pending->acc_no, moneyToDouble(pending->amount), time_str);
     }
-    fflush(fp);
-    logTransaction(senderAcc, TRANSFER_OUT, amount, receiverAcc, sender.currency);
+    printf(BLUE "--------------------------------------------------------\n" RESET);
 
-    receiver.balance += convertedAmount;
-    fseek(fp, receiverPos, SEEK_SET);
-    if (fwrite(&receiver, sizeof(struct Account), 1, fp) != 1) {
-        printf(RED "Error writing to receiver's account file. Transaction aborted.\n" RESET);
-        sender.balance += amount;
-        fseek(fp, senderPos, SEEK_SET);
-        fwrite(&sender, sizeof(struct Account), 1, fp);
-        fflush(fp);
-        goto cleanup;
-    }
-    fflush(fp);
-    logTransaction(receiverAcc, TRANSFER_IN, convertedAmount, senderAcc, receiver.currency);
-
-    printf(GREEN "Rs. %.2f %s successfully transferred from %s to %s\n" RESET, amount, sender.currency, sender.name, receiver.name);
-    printf(GREEN "Amount received: %.2f %s\n" RESET, convertedAmount, receiver.currency);
-
-cleanup:
-    if (fp) fclose(fp);
-}
+    if (!foundPending) {
+        printf(YELLOW "No pending loan applications found.\n" RESET);
+        return;
+    }
 
-void viewTransactionHistory() {
-    int acc_no;
-    char pin_str[32];
-    int ch;
-    
-    printf(GREEN "Enter account number to view history: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid account number input.\n" RESET);
+    printf(GREEN "\nEnter Loan ID to approve/reject: " RESET);
+    if (scanf("%d", &loan_id) != 1) {
+        printf(RED "Invalid input.\n" RESET);
         flush_stdin();
         return;
     }
-    printf(GREEN "Enter your PIN: " RESET);
+    
+    printf(GREEN "Approve or Reject? (A/R): " RESET);
     flush_stdin();
-    getMaskedInput(pin_str, sizeof(pin_str));
+    action = getchar();
+    if (action == '\n') action = getchar();
+    action = toupper(action);
 
-    if (!authenticate(acc_no, pin_str)) {
-        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
+    recno = loanIndexFindId(loan_id);
+    if (recno < 0 || loanIndexGet(recno)->status != PENDING) {
+        printf(RED "Loan ID %d not found or is not pending.\n" RESET, loan_id);
         return;
     }
-    
-    FILE *fp = fopen(TRANSACTIONS_FILE, "rb");
-    if (!fp) {
-        printf(YELLOW "No transaction history found for any account.\n" RESET);
+    struct Loan loan = *loanIndexGet(recno);
+    long loanPos = recno * (long)sizeof(struct Loan);
+
+    struct WalEntry entry;
+    walBegin(&entry);
+    if (action == 'A') {
+        loan.status = APPROVED;
+        loanStartSchedule(&loan, time(NULL));
+        struct Account acc;
+        long accountPos = 0;
+        if (loadAccount(loan.acc_no, &acc, &accountPos)) {
+            acc.balance += loan.amount;
+            walAddAccount(&entry, accountPos, &acc);
+        }
+        walAddPosting(&entry, loan.acc_no, LOAN_APPROVED, loan.amount, 0, "N/A");
+    } else if (action == 'R') {
+        loan.status = REJECTED;
+        walAddPosting(&entry, loan.acc_no, LOAN_REJECTED, 0, 0, "N/A");
+    } else {
+        printf(RED "Invalid action. Loan status remains unchanged.\n" RESET);
         return;
     }
-    
-    struct Transaction t;
-    int found = 0;
-    
-    printf(BLUE "\n===================================================================\n" RESET);
-    printf(BLUE "         Transaction History for Account %d\n" RESET, acc_no);
-    printf(BLUE "===================================================================\n" RESET);
-    printf(BLUE "| Date & Time             | Type         | Amount      | Currency\n" RESET);
-    printf(BLUE "-------------------------------------------------------------------\n" RESET);
 
-    while (fread(&t, sizeof(struct Transaction), 1, fp)) {
-        if (t.acc_no == acc_no) {
-            found = 1;
-            char time_str[30];
-            struct tm *local_time = localtime(&t.timestamp);
-            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", local_time);
-
-            printf("| %s | ", time_str);
-            switch (t.type) {
-                case DEPOSIT:
-                    printf(GREEN "DEPOSIT      " RESET);
-                    printf("| %-11.2f | %-8s\n", t.amount, t.currency);
-                    break;
-                case WITHDRAWAL:
-                    printf(RED "WITHDRAWAL   " RESET);
-                    printf("| %-11.2f | %-8s\n", t.amount, t.currency);
-                    break;
-                case TRANSFER_OUT:
-                    printf(YELLOW "TRANSFER OUT " RESET);
-                    printf("| %-11.2f | %-8s\n", t.amount, t.currency);
-                    break;
-                case TRANSFER_IN:
-                    printf(GREEN "TRANSFER IN  " RESET);
-                    printf("| %-11.2f | %-8s\n", t.amount, t.currency);
-                    break;
-                case LOAN_REPAYMENT:
-                    printf(BLUE "LOAN REPAYMENT" RESET);
-                    printf("| %-11.2f | %-8s\n", t.amount, t.currency);
-                    break;
-                case LOAN_APPROVED:
-                    printf(GREEN "LOAN APPROVED" RESET);
-                    printf("| %-11.2f | %-8s\n", t.amount, t.currency);
-                    break;
-                case LOAN_REJECTED:
-                    printf(RED "LOAN REJECTED" RESET);
-                    printf("| %-11.2f | %-8s\n", t.amount, t.currency);
-                    break;
-                case INTEREST_CREDIT:
-                    printf(GREEN "INTEREST     " RESET);
-                    printf("| %-11.2f | Credit\n", t.amount);
-                    break;
+    // The loan status, the borrower's balance and the posting change together
+    walAddLoan(&entry, loanPos, &loan);
+    if (!walCommit(&entry)) {
+        printf(RED "Error writing to the write-ahead log. Loan status remains unchanged.\n" RESET);
+        return;
+    }
+    accountStoreCommit(0);
+    loanIndexUpdate(recno, &loan);
+
+    if (action == 'A') {
+        printf(GREEN "Loan ID %d for account %d has been approved. Amount credited to account.\n" RESET, loan_id, loan.acc_no);
+        if (loan.term_months > 0)
+            printf(GREEN "Repayable in %d monthly instalments of Rs. %.2f.\n" RESET, loan.term_months,
+                   moneyToDouble(loan.emi));
+    } else {
+        printf(YELLOW "Loan ID %d for account %d has been rejected.\n" RESET, loan_id, loan.acc_no);
+    }
+}
+
+// One decision of a bulk run, as validated against the loan index
+struct LoanBatchItem {
+    long loan_recno;
+    long acc_recno; // borrower's record in ACCOUNTS_FILE (approvals only)
+    size_t order;   // position in the decision list
+    char action;
+    struct Loan loan;
+};
+
+static int loanBatchByLoan(const void *a, const void *b) {
+    const struct LoanBatchItem *x = a, *y = b;
+    if (x->loan_recno != y->loan_recno) return x->loan_recno < y->loan_recno ? -1 : 1;
+    return x->order < y->order ? -1 : (x->order > y->order);
+}
+
+// Rejections first, then approvals grouped by borrower in file order
+static int loanBatchByAccount(const void *a, const void *b) {
+    const struct LoanBatchItem *x = a, *y = b;
+    if (x->acc_recno != y->acc_recno) return x->acc_recno < y->acc_recno ? -1 : 1;
+    return x->loan_recno < y->loan_recno ? -1 : (x->loan_recno > y->loan_recno);
+}
+
+// Applies many loan decisions as one unit of work. The decisions are either
+// the list given (loan_id, 'A' or 'R') or, when rule is set, an approval for
+// every pending loan of at most rule->max_amount whose borrower's balance is
+// at least rule->min_balance. Each borrower's record is read once, in file
+// order, however many of their loans are approved; the loan and account
+// images are logged, each with its LOAN_APPROVED / LOAN_REJECTED posting,
+// with one WAL write and fsync and written back in one pass over LOANS_FILE
+// and ACCOUNTS_FILE, and the postings reach the transaction log together.
+// The instalments of the approved loans are computed in one batch (see
+// loanStartSchedules). Unknown or already decided loans, repeated IDs,
+// invalid actions and approvals whose borrower no longer exists (or fails
+// the rule) are counted as skipped. Returns 0 if the batch could not be
+// committed; since the postings are part of the WAL entries, that always
+// means no loan, balance or posting was changed, and only result->skipped is
+// kept. Once the entries are durable the whole batch counts as applied: a
+// failed write to the data files is redone from the WAL on restart and a
+// failed write to the transaction log stops the process (see
+// transactionLogLost), so there is no partly applied outcome to report.
+int decideLoans(const struct LoanDecision *decisions, size_t n, const struct LoanRule *rule,
+                struct LoanBatchResult *result) {
+    memset(result, 0, sizeof(*result));
+    size_t capacity = rule ? (size_t)(loan_queue_len - loan_queue_head) : n;
+    if (capacity == 0) return 1;
+    struct LoanBatchItem *items = malloc(capacity * sizeof(struct LoanBatchItem));
+    if (!items) return 0;
+
+    size_t count = 0;
+    if (rule) {
+        long cursor = 0, recno;
+        while ((recno = loanQueueNext(&cursor)) >= 0) {
+            if (loanIndexGet(recno)->amount > rule->max_amount) continue;
+            items[count].loan_recno = recno;
+            items[count].order = count;
+            items[count].action = 'A';
+            count++;
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            long recno = loanIndexFindId(decisions[i].loan_id);
+            char action = (char)toupper((unsigned char)decisions[i].action);
+            if (recno < 0 || loanIndexGet(recno)->status != PENDING || (action != 'A' && action != 'R')) {
+                result->skipped++;
+                continue;
             }
+            items[count].loan_recno = recno;
+            items[count].order = i;
+            items[count].action = action;
+            count++;
         }
     }
 
-    if (!found) {
-        printf(YELLOW "\n  No transactions found for this account.\n" RESET);
+    // The first decision for a loan counts
+    qsort(items, count, sizeof(items[0]), loanBatchByLoan);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (kept > 0 && items[kept - 1].loan_recno == items[i].loan_recno) {
+            result->skipped++;
+            continue;
+        }
+        items[kept] = items[i];
+        items[kept].loan = *loanIndexGet(items[i].loan_recno);
+        items[kept].acc_recno = items[i].action == 'A' ? accountIndexLookup(items[kept].loan.acc_no) : -1;
+        if (items[i].action == 'A' && items[kept].acc_recno < 0) {
+            result->skipped++;
+            continue;
+        }
+        kept++;
     }
+    count = kept;
+    qsort(items, count, sizeof(items[0]), loanBatchByAccount);
+
+    // Per decision: its WAL entry (with its posting) and index update
+    size_t slots = count ? count : 1;
+    struct WalEntry *entries = malloc(slots * sizeof(struct WalEntry));
+    long *recnos = malloc(slots * sizeof(long));
+    struct Loan *loans = malloc(slots * sizeof(struct Loan));
+    if (!entries || !recnos || !loans) {
+        free(entries);
+        free(recnos);
+        free(loans);
+        free(items);
+        return 0;
+    }
+    time_t now = time(NULL);
 
-    printf(BLUE "===================================================================\n" RESET);
-    fclose(fp);
-}
-
-void applyForLoan() {
-    int acc_no;
-    char pin_str[32];
-    float loanAmount;
-    int ch;
-    struct Account currentAccount;
+    accountLockAll();
+    size_t entry_count = 0;
+    for (size_t i = 0; i < count; ) {
+        struct LoanBatchItem *it = &items[i];
+        if (it->action == 'R') {
+            it->loan.status = REJECTED;
+            walBegin(&entries[entry_count]);
+            walAddPosting(&entries[entry_count], it->loan.acc_no, LOAN_REJECTED, 0, 0, "N/A");
+            recnos[entry_count] = it->loan_recno;
+            loans[entry_count++] = it->loan;
+            result->rejected++;
+            i++;
+            continue;
+        }
 
-    printf(GREEN "\n--- Loan Application ---\n" RESET);
-    printf("Enter your account number: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        flush_stdin();
-        return;
+        // All approvals for this borrower; the rule sees the balance from
+        // before the batch
+        size_t end = i + 1;
+        while (end < count && items[end].acc_recno == it->acc_recno) end++;
+        struct Account a;
+        long pos = 0;
+        int eligible = loadAccount(it->loan.acc_no, &a, &pos) && (!rule || a.balance >= rule->min_balance);
+        for (size_t j = i; j < end; j++) {
+            if (!eligible) {
+                result->skipped++;
+                continue;
+            }
+            items[j].loan.status = APPROVED;
+            a.balance += items[j].loan.amount;
+            walBegin(&entries[entry_count]);
+            walAddAccount(&entries[entry_count], pos, &a);
+            walAddPosting(&entries[entry_count], items[j].loan.acc_no, LOAN_APPROVED, items[j].loan.amount, 0, "N/A");
+            recnos[entry_count] = items[j].loan_recno;
+            loans[entry_count++] = items[j].loan;
+            result->approved++;
+            result->credited += items[j].loan.amount;
+        }
+        i = end;
     }
-    printf("Enter your PIN: " RESET);
-    flush_stdin();
-    getMaskedInput(pin_str, sizeof(pin_str));
 
-    if (!authenticate(acc_no, pin_str)) {
-        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
-        return;
+    // Schedules of all the approved loans, then their after-images
+    loanStartSchedules(loans, entry_count, now);
+    for (size_t k = 0; k < entry_count; k++)
+        walAddLoan(&entries[k], recnos[k] * (long)sizeof(struct Loan), &loans[k]);
+
+    int ok = walCommitBatch(entries, entry_count);
+    if (ok) {
+        accountStoreCommit(0);
+        loanIndexUpdateBatch(recnos, loans, entry_count);
+    } else {
+        result->approved = result->rejected = 0;
+        result->credited = 0;
     }
+    accountUnlockAll();
+    free(entries);
+    free(recnos);
+    free(loans);
+    free(items);
+    return ok;
+}
 
-    if (isLoanPending(acc_no)) {
-        printf(YELLOW "You already have a pending loan application. Please wait for a response.\n" RESET);
+// Admin menu front end for decideLoans
+void bulkLoanDecisions() {
+    int mode;
+    printf(BLUE "\n--- Bulk Loan Decisions ---\n" RESET);
+    printf(YELLOW "1. Apply a decision file (one \"<loan_id> A|R\" per line)\n" RESET);
+    printf(YELLOW "2. Approve by rule (amount at most X for balances of at least Y)\n" RESET);
+    printf(GREEN "Enter your choice: " RESET);
+    if (scanf("%d", &mode) != 1 || (mode != 1 && mode != 2)) {
+        printf(RED "Invalid choice.\n" RESET);
+        flush_stdin();
         return;
     }
 
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb");
-    if (fp) {
-        while (fread(&currentAccount, sizeof(struct Account), 1, fp)) {
-            if (currentAccount.acc_no == acc_no) {
-                break;
+    struct LoanDecision *decisions = NULL;
+    size_t n = 0;
+    struct LoanRule rule;
+    if (mode == 1) {
+        char path[256];
+        printf(GREEN "Decision file: " RESET);
+        if (scanf("%255s", path) != 1) {
+            flush_stdin();
+            return;
+        }
+        FILE *fp = fopen(path, "r");
+        if (!fp) {
+            printf(RED "Cannot open %s.\n" RESET, path);
+            return;
+        }
+        size_t capacity = 0;
+        char line[128];
+        int line_no = 0;
+        while (fgets(line, sizeof(line), fp)) {
+            line_no++;
+            char *p = line;
+            while (isspace((unsigned char)*p)) p++;
+            if (*p == '\0' || *p == '#') continue;
+            struct LoanDecision d;
+            if (sscanf(p, "%d %c", &d.loan_id, &d.action) != 2) {
+                printf(YELLOW "Line %d ignored: %s" RESET, line_no, line);
+                continue;
+            }
+            if (n == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                struct LoanDecision *grown = realloc(decisions, capacity * sizeof(struct LoanDecision));
+                if (!grown) break;
+                decisions = grown;
             }
+            decisions[n++] = d;
         }
         fclose(fp);
     } else {
-        printf(RED "Error reading account data.\n" RESET);
-        return;
-    }
-    
-    if (currentAccount.balance <= 0) {
-        printf(RED "You are not eligible for a loan with a non-positive balance. Your balance must be greater than 0.\n" RESET);
-        return;
+        printf(GREEN "Approve pending loans of at most: " RESET);
+        if (!readMoney(&rule.max_amount)) {
+            printf(RED "Invalid amount.\n" RESET);
+            flush_stdin();
+            return;
+        }
+        printf(GREEN "for borrowers with a balance of at least: " RESET);
+        if (!readMoney(&rule.min_balance)) {
+            printf(RED "Invalid amount.\n" RESET);
+            flush_stdin();
+            return;
+        }
     }
 
-    printf("Enter desired loan amount: " RESET);
-    if (scanf("%f", &loanAmount) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        flush_stdin();
+    struct LoanBatchResult result;
+    long long started = monotonicMillis();
+    int ok = decideLoans(decisions, n, mode == 2 ? &rule : NULL, &result);
+    double seconds = (double)(monotonicMillis() - started) / 1000.0;
+    free(decisions);
+
+    if (!ok) {
+        printf(RED "Error: the decisions could not be written; no loan was changed (%.2f s).\n" RESET, seconds);
         return;
     }
+    printf(GREEN "Approved %ld loan(s), %.2f credited; rejected %ld; skipped %ld (%.2f s).\n" RESET,
+           result.approved, moneyToDouble(result.credited), result.rejected, result.skipped, seconds);
+}
+
+// =========================================================================
+// BATCH MODE
+// =========================================================================
+
+// Runs a command file without prompts. The admin PIN is checked once for the
+// whole batch; each line then goes through the same validation as the menus.
+// Deposits, withdrawals and transfers are committed BATCH_GROUP_LINES at a
+// time through a WAL group: one WAL write and fsync, then one transaction log
+// append. Creating and deleting an account also changes the account index,
+// so those lines commit the group first and run on their own. A line counts
+// as succeeded only once its group is committed.
+// Line formats ('#' starts a comment, blank lines are skipped):
+//   C <acc_no> <pin> <balance> <currency> <name...>   create account
+//   D <acc_no> <amount>                                deposit
+//   W <acc_no> <amount>                                withdraw
+//   T <from_acc> <to_acc> <amount>                     transfer
+//   X <acc_no>                                         delete account
+
+typedef struct {
+    long line;
+    char message[96];
+} BatchError;
 
-    if (loanAmount <= 0) {
-        printf(RED "Loan amount must be positive.\n" RESET);
-        return;
-    }
+static int batchErrorCompare(const void *a, const void *b) {
+    const BatchError *x = a, *y = b;
+    return x->line < y->line ? -1 : (x->line > y->line);
+}
 
-    FILE *loans_fp = fopen(LOANS_FILE, "ab");
-    if (!loans_fp) {
-        printf(RED "Error creating or opening loans file.\n" RESET);
-        return;
+// Appends an error to the list; the line still counts as failed if there is
+// no memory to list it
+static void batchErrorAdd(BatchError **errors, size_t *count, size_t *capacity, long line, const char *message) {
+    if (*count == *capacity) {
+        size_t grown_capacity = *capacity ? *capacity * 2 : 16;
+        BatchError *grown = realloc(*errors, grown_capacity * sizeof(BatchError));
+        if (!grown) return;
+        *errors = grown;
+        *capacity = grown_capacity;
     }
+    (*errors)[*count].line = line;
+    snprintf((*errors)[*count].message, sizeof((*errors)[*count].message), "%s", message);
+    (*count)++;
+}
 
-    struct Loan newLoan;
-    newLoan.loan_id = (int)time(NULL);
-    newLoan.acc_no = acc_no;
-    newLoan.amount = loanAmount;
-    newLoan.timestamp = time(NULL);
-    newLoan.status = PENDING;
-    newLoan.amount_paid = 0.0f;
+// Commits a batch's WAL group; if that fails, the lines that queued writes in
+// it are listed as failed. Returns the number of such lines.
+static long batchGroupCommit(struct WalGroup *g, const long *lines, size_t line_count, BatchError **errors,
+                             size_t *count, size_t *capacity) {
+    if (walGroupCommit(g)) return 0;
+    for (size_t i = 0; i < line_count; i++)
+        batchErrorAdd(errors, count, capacity, lines[i], opStatusMessage(OP_IO_ERROR));
+    return (long)line_count;
+}
 
-    fwrite(&newLoan, sizeof(struct Loan), 1, loans_fp);
-    fclose(loans_fp);
+// Parses one command line (also used by server mode). Returns 0 if the line
+// is malformed.
+int parseCommand(char *line, struct Command *cmd) {
+    char op[4], amount_str[32];
+    int consumed = 0;
+
+    memset(cmd, 0, sizeof(*cmd));
+    if (sscanf(line, "%3s", op) != 1 || op[1] != '\0') return 0;
+    cmd->op = op[0];
+
+    switch (cmd->op) {
+        case 'C':
+            if (sscanf(line, "%*s %d %31s %31s %9s %n", &cmd->acc_no, cmd->pin, amount_str, cmd->currency,
+                       &consumed) != 4 || consumed == 0)
+                return 0;
+            cmd->name = line + consumed;
+            return parseMoney(amount_str, &cmd->amount);
+        case 'D':
+        case 'W':
+            if (sscanf(line, "%*s %d %31s %n", &cmd->acc_no, amount_str, &consumed) != 2 ||
+                line[consumed] != '\0')
+                return 0;
+            return parseMoney(amount_str, &cmd->amount);
+        case 'T':
+            if (sscanf(line, "%*s %d %d %31s %n", &cmd->acc_no, &cmd->to_acc, amount_str, &consumed) != 3 ||
+                line[consumed] != '\0')
+                return 0;
+            return parseMoney(amount_str, &cmd->amount);
+        case 'X':
+            return sscanf(line, "%*s %d %n", &cmd->acc_no, &consumed) == 1 && line[consumed] == '\0';
+    }
+    return 0;
+}
 
-    printf(GREEN "Loan application for Rs. %.2f submitted successfully.\n" RESET, loanAmount);
-    printf(YELLOW "Please wait for an administrator to review your application.\n" RESET);
+// Runs a parsed command. *result (if given) receives the account it was
+// applied to; for a transfer, the sender.
+OpStatus executeCommand(const struct Command *cmd, struct Account *result) {
+    OpStatus status = OP_NOT_FOUND;
+    switch (cmd->op) {
+        case 'C':
+            status = openAccount(cmd->acc_no, cmd->name, cmd->pin, cmd->amount, cmd->currency);
+            if (status == OP_OK && result) loadAccount(cmd->acc_no, result, NULL);
+            break;
+        case 'D':
+            status = depositFunds(cmd->acc_no, cmd->amount, result);
+            break;
+        case 'W':
+            status = withdrawFunds(cmd->acc_no, cmd->amount, result);
+            break;
+        case 'T':
+            status = transferFunds(cmd->acc_no, cmd->to_acc, cmd->amount, result, NULL, NULL);
+            break;
+        case 'X':
+            status = removeAccount(cmd->acc_no, result);
+            break;
+    }
+    return status;
 }
 
-int isLoanPending(int acc_no) {
-    FILE *fp = fopen(LOANS_FILE, "rb");
+int runBatch(const char *path) {
+    FILE *fp = fopen(path, "r");
     if (!fp) {
+        printf(RED "Cannot open batch file %s.\n" RESET, path);
         return 0;
     }
-    struct Loan loan;
-    while (fread(&loan, sizeof(struct Loan), 1, fp)) {
-        if (loan.acc_no == acc_no && loan.status == PENDING) {
-            fclose(fp);
-            return 1;
+
+    unsigned char salt[SALT_SIZE], hash[HASH_SIZE];
+    if (!loadAdminCredentials(salt, hash)) {
+        printf(RED "No admin PIN configured. Run the program interactively once to set it.\n" RESET);
+        fclose(fp);
+        return 0;
+    }
+
+    // BANK_ADMIN_PIN allows fully unattended runs
+    char admin_pin[32];
+    const char *env_pin = getenv("BANK_ADMIN_PIN");
+    if (env_pin) {
+        snprintf(admin_pin, sizeof(admin_pin), "%s", env_pin);
+    } else {
+        printf(GREEN "Enter Admin PIN: " RESET);
+        getMaskedInput(admin_pin, sizeof(admin_pin));
+    }
+    int authorized = authenticateAdmin(admin_pin);
+    memset(admin_pin, 0, sizeof(admin_pin));
+    if (!authorized) {
+        printf(RED "Incorrect passcode. Batch not run.\n" RESET);
+        fclose(fp);
+        return 0;
+    }
+
+    BatchError *errors = NULL;
+    size_t error_count = 0, error_capacity = 0;
+    long line_no = 0, executed = 0, succeeded = 0;
+    char line[512];
+    long long started = monotonicMillis();
+
+    // Lines whose writes wait in the group; without memory for the group
+    // every line commits on its own
+    struct WalGroup group;
+    long *group_lines = malloc(BATCH_GROUP_LINES * sizeof(long));
+    int grouped = group_lines && walGroupInit(&group, BATCH_GROUP_LINES);
+    size_t group_line_count = 0;
+    if (grouped) walGroupUse(&group);
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char *cmd = line;
+        while (*cmd == ' ' || *cmd == '\t') cmd++;
+        if (*cmd == '\0' || *cmd == '#') continue;
+
+        struct Command command;
+        int syntax_error = !parseCommand(cmd, &command);
+        int alone = grouped && !syntax_error && (command.op == 'C' || command.op == 'X');
+        if (alone) {
+            succeeded -= batchGroupCommit(&group, group_lines, group_line_count, &errors, &error_count, &error_capacity);
+            group_line_count = 0;
+            walGroupUse(NULL);
+        }
+        size_t queued = grouped ? group.count : 0;
+        OpStatus status = syntax_error ? OP_OK : executeCommand(&command, NULL);
+        if (alone) walGroupUse(&group);
+        executed++;
+        if (grouped && group.count > queued) group_lines[group_line_count++] = line_no;
+        if (grouped && group_line_count == BATCH_GROUP_LINES) {
+            succeeded -= batchGroupCommit(&group, group_lines, group_line_count, &errors, &error_count, &error_capacity);
+            group_line_count = 0;
+        }
+        if (!grouped || group.count == 0) {
+            // Compaction moves records, so it is installed only between groups
+            compactionPoll(0);
+            transactionLogRollPoll();
+        }
+        if (!syntax_error && status == OP_OK) {
+            succeeded++;
+            continue;
         }
+        batchErrorAdd(&errors, &error_count, &error_capacity, line_no,
+                      syntax_error ? "Malformed command." : opStatusMessage(status));
     }
     fclose(fp);
-    return 0;
+    if (grouped) {
+        succeeded -= batchGroupCommit(&group, group_lines, group_line_count, &errors, &error_count, &error_capacity);
+        walGroupFree(&group);
+    }
+    free(group_lines);
+    transactionLogFlush();
+    if (error_count > 1) qsort(errors, error_count, sizeof(BatchError), batchErrorCompare); // Group failures come late
+
+    double seconds = (monotonicMillis() - started) / 1000.0;
+    printf(BLUE "\n=== Batch Summary ===\n" RESET);
+    printf("Commands executed: %ld\n", executed);
+    printf(GREEN "Succeeded: %ld\n" RESET, succeeded);
+    printf(executed - succeeded ? RED "Failed: %ld\n" RESET : "Failed: %ld\n", executed - succeeded);
+    printf("Elapsed: %.3f s", seconds);
+    if (seconds > 0) printf(" (%.0f ops/sec)", executed / seconds);
+    printf("\n");
+    for (size_t i = 0; i < error_count; i++) {
+        printf(RED "Line %ld: %s\n" RESET, errors[i].line, errors[i].message);
+    }
+
+    free(errors);
+    return executed == succeeded;
 }
 
-void loanRepayment() {
-    int acc_no;
-    char pin_str[32];
-    float repaymentAmount;
-    int ch;
+// =========================================================================
+// SERVER MODE
+// =========================================================================
 
-    printf(GREEN "\n--- Loan Repayment ---\n" RESET);
-    printf("Enter your account number: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        flush_stdin();
-        return;
+// --server accepts line-based connections on 127.0.0.1 and runs deposit,
+// withdraw, transfer and create commands from several clients at once. Each
+// worker thread of the pool accepts a connection and serves it until it
+// closes. A connection must start with "AUTH <admin PIN>"; after that every
+// line is a batch-mode command, answered with "OK <acc_no> <balance>
+// <currency>" or "ERR <reason>". "QUIT" closes the connection.
+//
+// Operations on the same account are serialized by the striped account
+// locks; everything else runs in parallel. SIGINT/SIGTERM stop the server.
+
+#ifndef _WIN32
+static int server_fd = -1;
+static int server_stop = 0; // set by the signal handler, polled by every thread
+
+static void serverSignal(int sig) {
+    (void)sig;
+    __atomic_store_n(&server_stop, 1, __ATOMIC_RELAXED);
+}
+
+static int serverStopping(void) {
+    return __atomic_load_n(&server_stop, __ATOMIC_RELAXED);
+}
+
+static void serverReply(int fd, const char *text) {
+    size_t len = strlen(text);
+    while (len > 0) {
+        ssize_t n = send(fd, text, len, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        text += n;
+        len -= (size_t)n;
     }
+}
 
-    printf("Enter your PIN: " RESET);
-    flush_stdin();
-    getMaskedInput(pin_str, sizeof(pin_str));
+// Handles one request line. Returns 0 when the connection should close.
+static int serverHandleLine(char *line, int *authenticated, char *reply, size_t reply_len) {
+    if (strncmp(line, "AUTH ", 5) == 0) {
+        *authenticated = authenticateAdmin(line + 5);
+        memset(line, 0, strlen(line));
+        snprintf(reply, reply_len, *authenticated ? "OK\n" : "ERR Incorrect passcode.\n");
+        return *authenticated;
+    }
+    if (strcmp(line, "QUIT") == 0) {
+        snprintf(reply, reply_len, "OK\n");
+        return 0;
+    }
+    if (!*authenticated) {
+        snprintf(reply, reply_len, "ERR Not authenticated.\n");
+        return 0;
+    }
 
-    if (!authenticate(acc_no, pin_str)) {
-        printf(RED "Authentication failed. Wrong account or PIN.\n" RESET);
-        return;
+    struct Command cmd;
+    if (!parseCommand(line, &cmd)) {
+        snprintf(reply, reply_len, "ERR Malformed command.\n");
+        return 1;
     }
 
-    FILE *loans_fp = fopen(LOANS_FILE, "rb+");
-    if (!loans_fp) {
-        printf(YELLOW "No loans found.\n" RESET);
-        return;
+    struct Account result;
+    OpStatus status;
+    if (cmd.op == 'T') {
+        accountLockPair(cmd.acc_no, cmd.to_acc);
+        status = executeCommand(&cmd, &result);
+        accountUnlockPair(cmd.acc_no, cmd.to_acc);
+    } else {
+        accountLock(cmd.acc_no);
+        status = executeCommand(&cmd, &result);
+        accountUnlock(cmd.acc_no);
     }
 
-    struct Loan loan;
-    int foundLoan = 0;
-    long loanPos = 0;
+    if (status == OP_OK)
+        snprintf(reply, reply_len, "OK %d %.2f %s\n", result.acc_no, moneyToDouble(result.balance), result.currency);
+    else
+        snprintf(reply, reply_len, "ERR %s\n", opStatusMessage(status));
+    return 1;
+}
 
-    while (fread(&loan, sizeof(struct Loan), 1, loans_fp)) {
-        if (loan.acc_no == acc_no && loan.status == APPROVED) {
-            foundLoan = 1;
-            loanPos = ftell(loans_fp) - sizeof(struct Loan);
-            break;
+// Serves one connection; returns the number of commands handled
+static long serverHandleClient(int fd) {
+    char buf[SERVER_LINE_MAX];
+    char reply[160];
+    size_t len = 0;
+    int authenticated = 0;
+    long handled = 0;
+
+    // Wake up once a second to notice a shutdown
+    struct timeval tv = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    while (!serverStopping()) {
+        char *nl = memchr(buf, '\n', len);
+        if (!nl) {
+            if (len == sizeof(buf)) {
+                serverReply(fd, "ERR Line too long.\n");
+                break;
+            }
+            ssize_t n = recv(fd, buf + len, sizeof(buf) - len, 0);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+            if (n <= 0) break;
+            len += (size_t)n;
+            continue;
         }
-    }
 
-    if (!foundLoan) {
-        printf(YELLOW "You have no approved loans to repay.\n" RESET);
-        fclose(loans_fp);
-        return;
+        *nl = '\0';
+        if (nl > buf && nl[-1] == '\r') nl[-1] = '\0';
+        int keep_open = 1;
+        if (buf[0] != '\0') {
+            keep_open = serverHandleLine(buf, &authenticated, reply, sizeof(reply));
+            serverReply(fd, reply);
+            handled++;
+        }
+        size_t consumed = (size_t)(nl + 1 - buf);
+        memmove(buf, nl + 1, len - consumed);
+        len -= consumed;
+        if (!keep_open) break;
     }
+    close(fd);
+    return handled;
+}
 
-    float outstandingBalance = loan.amount - loan.amount_paid;
-    printf(YELLOW "Outstanding loan balance: Rs. %.2f\n" RESET, outstandingBalance);
-    printf("Enter amount to repay: " RESET);
-    if (scanf("%f", &repaymentAmount) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        flush_stdin();
-        fclose(loans_fp);
-        return;
+static void *serverWorker(void *arg) {
+    long *handled = arg;
+    while (!serverStopping()) {
+        struct pollfd pfd = {server_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) <= 0) continue;
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd < 0) continue; // Another worker took it, or interrupted
+
+        // The listening socket is non-blocking; the connection should not be
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        *handled += serverHandleClient(fd);
     }
+    return NULL;
+}
 
-    if (repaymentAmount <= 0 || repaymentAmount > outstandingBalance) {
-        printf(RED "Invalid repayment amount. Must be positive and not exceed outstanding balance.\n" RESET);
-        fclose(loans_fp);
-        return;
+int runServer(int port, int workers) {
+    unsigned char salt[SALT_SIZE], hash[HASH_SIZE];
+    if (!loadAdminCredentials(salt, hash)) {
+        printf(RED "No admin PIN configured. Run the program interactively once to set it.\n" RESET);
+        return 0;
     }
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1) workers = 1;
+    if (workers > SERVER_MAX_WORKERS) workers = SERVER_MAX_WORKERS;
 
-    FILE *accounts_fp = fopen(ACCOUNTS_FILE, "rb+");
-    if (!accounts_fp) {
-        printf(RED "Error opening accounts file.\n" RESET);
-        fclose(loans_fp);
-        return;
+    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        printf(RED "Cannot create server socket.\n" RESET);
+        return 0;
     }
-
-    struct Account a;
-    long accountPos = 0;
-    while (fread(&a, sizeof(struct Account), 1, accounts_fp)) {
-        if (a.acc_no == acc_no) {
-            accountPos = ftell(accounts_fp) - sizeof(struct Account);
-            break;
-        }
+    int one = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server_fd, 64) != 0) {
+        printf(RED "Cannot listen on port %d.\n" RESET, port);
+        close(server_fd);
+        server_fd = -1;
+        return 0;
     }
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
 
-    if (a.balance < repaymentAmount) {
-        printf(RED "Insufficient balance to make this repayment.\n" RESET);
-        fclose(accounts_fp);
-        fclose(loans_fp);
-        return;
-    }
+    signal(SIGINT, serverSignal);
+    signal(SIGTERM, serverSignal);
+    signal(SIGPIPE, SIG_IGN);
 
-    a.balance -= repaymentAmount;
-    loan.amount_paid += repaymentAmount;
+    pthread_t threads[SERVER_MAX_WORKERS];
+    long handled[SERVER_MAX_WORKERS] = {0};
+    int started = 0;
+    for (; started < workers; started++) {
+        if (pthread_create(&threads[started], NULL, serverWorker, &handled[started]) != 0) break;
+    }
+    if (started == 0) {
+        printf(RED "Cannot start worker threads.\n" RESET);
+        close(server_fd);
+        server_fd = -1;
+        return 0;
+    }
+    printf(GREEN "Listening on 127.0.0.1:%d with %d worker(s). Press Ctrl+C to stop.\n" RESET, port, started);
+    fflush(stdout);
+
+    // Idle-time commit of the transaction log group
+    while (!serverStopping()) {
+        struct timespec nap = {0, 50 * 1000000L};
+        nanosleep(&nap, NULL);
+        transactionLogFlushExpired();
+        compactionPoll(0);
+        transactionLogRollPoll();
+    }
 
-    if (loan.amount_paid >= loan.amount) {
-        loan.status = REPAID;
-        printf(GREEN "Loan successfully repaid in full!\n" RESET);
-    } else {
-        printf(GREEN "Repayment successful. Remaining balance: %.2f\n" RESET, loan.amount - loan.amount_paid);
+    long total = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        total += handled[i];
     }
+    close(server_fd);
+    server_fd = -1;
+    transactionLogFlush();
+    printf(GREEN "\nServer stopped after %ld request(s).\n" RESET, total);
+    return 1;
+}
+#else
+int runServer(int port, int workers) {
+    (void)port;
+    (void)workers;
+    printf(RED "Server mode is not available on this platform.\n" RESET);
+    return 0;
+}
+#endif
 
-    fseek(loans_fp, loanPos, SEEK_SET);
-    fwrite(&loan, sizeof(struct Loan), 1, loans_fp);
-    fflush(loans_fp);
-    fclose(loans_fp);
+// =========================================================================
+// BENCHMARK
+// =========================================================================
 
-    fseek(accounts_fp, accountPos, SEEK_SET);
-    fwrite(&a, sizeof(struct Account), 1, accounts_fp);
-    fflush(accounts_fp);
-    fclose(accounts_fp);
+// --bench generates a synthetic data set per scale in its own directory under
+// the scratch directory, opens it like a normal start would and times the
+// core operations. Results go to stdout as CSV, one row per operation:
+//   accounts,transactions,operation,calls,total_ms,calls_per_sec,us_per_call
+// Everything the operations print themselves is discarded while they run.
 
-    logTransaction(acc_no, LOAN_REPAYMENT, repaymentAmount, 0, "N/A"); // Currency not needed here
+static double benchSeconds(void) {
+#ifdef _WIN32
+    return (double)clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
 }
 
-void viewAccounts()
-{
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb");
-    if (!fp) {
-        printf(YELLOW "No accounts found.\n" RESET);
-        return;
+static int bench_saved_stdout = -1;
+
+// Points stdout at the null device (quiet = 1) or back at the terminal
+static void benchQuiet(int quiet) {
+    fflush(stdout);
+#ifdef _WIN32
+    if (quiet && bench_saved_stdout < 0) {
+        int null_fd = _open(NULL_DEVICE, _O_WRONLY);
+        if (null_fd < 0) return;
+        bench_saved_stdout = _dup(_fileno(stdout));
+        _dup2(null_fd, _fileno(stdout));
+        _close(null_fd);
+    } else if (!quiet && bench_saved_stdout >= 0) {
+        _dup2(bench_saved_stdout, _fileno(stdout));
+        _close(bench_saved_stdout);
+        bench_saved_stdout = -1;
     }
-    struct Account a;
-    printf(BLUE "\n+-------------+---------------------------+------------------------------+----------+\n" RESET);
-    printf(BLUE "| Account No  | Name                      | Balance                      | Currency |\n" RESET);
-    printf(BLUE "+-------------+---------------------------+------------------------------+----------+\n" RESET);
-    while (fread(&a, sizeof(struct Account), 1, fp))
-        printf("| %-11d | %-25s | %-28.2f | %-8s |\n", a.acc_no, a.name, a.balance, a.currency);
-    printf(BLUE "+-------------+---------------------------+------------------------------+----------+\n" RESET);
-    fclose(fp);
+#else
+    if (quiet && bench_saved_stdout < 0) {
+        int null_fd = open(NULL_DEVICE, O_WRONLY);
+        if (null_fd < 0) return;
+        bench_saved_stdout = dup(fileno(stdout));
+        dup2(null_fd, fileno(stdout));
+        close(null_fd);
+    } else if (!quiet && bench_saved_stdout >= 0) {
+        dup2(bench_saved_stdout, fileno(stdout));
+        close(bench_saved_stdout);
+        bench_saved_stdout = -1;
+    }
+#endif
 }
 
-void searchAccount(int show_pin)
-{
-    int acc_no;
-    int ch;
-    
-    printf(GREEN "Enter account number to search: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid account number input.\n" RESET);
-        while ((ch = getchar()) != '\n' && ch != EOF);
-        return;
+static void benchReport(long accounts, long transactions, const char *operation, long calls, double seconds) {
+    benchQuiet(0);
+    double ms = seconds * 1000.0;
+    printf("%ld,%ld,%s,%ld,%.3f,%.1f,%.3f\n", accounts, transactions, operation, calls, ms,
+           seconds > 0 ? calls / seconds : 0.0, calls > 0 ? ms * 1000.0 / calls : 0.0);
+    fflush(stdout);
+    benchQuiet(1);
+}
+
+// Synthetic PINs are derived from the account number so that authenticate
+// can be called with the right one
+static void benchPin(int acc_no, char *pin, size_t len) {
+    snprintf(pin, len, "%04d", acc_no % 10000);
+}
+
+static int benchAccountNo(long accounts) {
+    return 1 + (int)(((long)rand() * (RAND_MAX + 1L) + rand()) % accounts);
+}
+
+// Writes accounts.dat and transactions.dat directly, in large sequential
+// chunks. Accounts are numbered 1..accounts with salted PIN hashes and an
+// interest date 30 days back; transactions are spread over those 30 days.
+static int benchGenerate(long accounts, long transactions) {
+    const char *stale[] = {ACCOUNTS_FILE, TRANSACTIONS_FILE, TRANSACTIONS_INDEX_FILE, TRANSACTIONS_HEADS_FILE,
+                           WAL_FILE, LOANS_FILE, LOAN_QUEUE_FILE, INTEREST_LOG_FILE, INTEREST_RUN_FILE};
+    for (size_t i = 0; i < sizeof(stale) / sizeof(stale[0]); i++) remove(stale[i]);
+    transactionSegmentsRemove();
+    backupReset();
+    if (!writeDataFormatVersion()) return 0;
+
+    enum { CHUNK = 4096 };
+    time_t now = time(NULL);
+    long start = (long)now - 30L * 24 * 60 * 60;
+
+    FILE *fp = fopen(ACCOUNTS_FILE, "wb");
+    struct Account *acc_chunk = calloc(CHUNK, sizeof(struct Account));
+    char (*pins)[8] = calloc(CHUNK, sizeof(*pins));
+    struct PinHashJob *jobs = calloc(CHUNK, sizeof(struct PinHashJob));
+    if (!fp || !acc_chunk || !pins || !jobs) {
+        if (fp) fclose(fp);
+        free(acc_chunk);
+        free(pins);
+        free(jobs);
+        return 0;
     }
-    
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb");
-    if (!fp) {
-        printf(YELLOW "No accounts found.\n" RESET);
-        return;
+    int ok = 1;
+    for (long done = 0; ok && done < accounts; ) {
+        size_t n = 0;
+        for (; n < CHUNK && done < accounts; n++, done++) {
+            struct Account *a = &acc_chunk[n];
+            a->acc_no = (int)(done + 1);
+            snprintf(a->name, sizeof(a->name), "Bench Account %ld", done + 1);
+            a->balance = (1000 + rand() % 100000) * (Money)MONEY_SCALE;
+            strcpy(a->currency, "INR");
+            benchPin(a->acc_no, pins[n], sizeof(pins[n]));
+            generateSalt(a->salt, SALT_SIZE);
+            jobs[n].pin = pins[n];
+            jobs[n].salt = a->salt;
+            jobs[n].hash = a->pin_hash;
+            a->last_interest_date = start;
+        }
+        hashPinBatch(jobs, n, SALT_SIZE);
+        ok = fwrite(acc_chunk, sizeof(struct Account), n, fp) == n;
     }
-    struct Account a;
-    int found = 0;
-    while (fread(&a, sizeof(struct Account), 1, fp))
-    {
-        if (a.acc_no == acc_no)
-        {
-            found = 1;
-            printf(BLUE "\nAccount Details:\n" RESET);
-            printf(YELLOW "Account No: %d\n" RESET, a.acc_no);
-            printf(YELLOW "Name: %s\n" RESET, a.name);
-            printf(YELLOW "Balance: %.2f %s\n" RESET, a.balance, a.currency);
-            if (show_pin) {
-                 printf(YELLOW "Pin Hash: " RESET);
-                 printHex(a.pin_hash, HASH_SIZE);
-            }
-            break;
+    free(acc_chunk);
+    free(pins);
+    free(jobs);
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) return 0;
+
+    fp = fopen(TRANSACTIONS_FILE, "wb");
+    struct Transaction *tx_chunk = calloc(CHUNK, sizeof(struct Transaction));
+    if (!fp || !tx_chunk) {
+        if (fp) fclose(fp);
+        free(tx_chunk);
+        return 0;
+    }
+    long span = (long)now - start;
+    for (long done = 0; ok && done < transactions; ) {
+        size_t n = 0;
+        for (; n < CHUNK && done < transactions; n++, done++) {
+            struct Transaction *t = &tx_chunk[n];
+            t->acc_no = benchAccountNo(accounts);
+            t->type = (rand() % 2) ? DEPOSIT : WITHDRAWAL;
+            t->amount = (1 + rand() % 500) * (Money)MONEY_SCALE;
+            t->timestamp = start + (long)((double)done / transactions * span);
+            t->currency = currencyId("INR");
+            t->version = TRANSACTION_RECORD_VERSION;
         }
+        ok = fwrite(tx_chunk, sizeof(struct Transaction), n, fp) == n;
     }
-    fclose(fp);
-    if (!found) {
-        printf(RED "Account not found.\n" RESET);
+    free(tx_chunk);
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) return 0;
+
+    // One loan per BENCH_ACCOUNTS_PER_LOAN accounts, a quarter of them pending
+    // and the rest approved when applied for; the pending queue is rebuilt
+    // from these when the data set is opened
+    fp = fopen(LOANS_FILE, "wb");
+    if (!fp) return 0;
+    for (long i = 0; ok && i < accounts / BENCH_ACCOUNTS_PER_LOAN; i++) {
+        struct Loan loan;
+        memset(&loan, 0, sizeof(loan));
+        loan.loan_id = (int)(i + 1);
+        loan.acc_no = benchAccountNo(accounts);
+        loan.amount = (1000 + rand() % 100000) * (Money)MONEY_SCALE;
+        loan.timestamp = start + (long)((double)i / (accounts / BENCH_ACCOUNTS_PER_LOAN) * span);
+        loan.status = (i % 4 == 0) ? PENDING : APPROVED;
+        loan.rate_bp = LOAN_ANNUAL_RATE_BP;
+        loan.term_months = 12 * (1 + rand() % 5);
+        if (loan.status == APPROVED) loanStartSchedule(&loan, (time_t)loan.timestamp);
+        ok = fwrite(&loan, sizeof(loan), 1, fp) == 1;
     }
+    if (fclose(fp) != 0) ok = 0;
+    return ok;
 }
 
-void updateAccountName()
-{
-    int acc_no;
-    char newName[100];
-    int found = 0;
-    int ch;
+static int benchScale(long accounts, long transactions, int ops) {
+    char pin[8];
+    double t0;
+    long calls;
 
-    printf(GREEN "Enter account number to update: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid account number input.\n" RESET);
-        while ((ch = getchar()) != '\n' && ch != EOF);
-        return;
+    fprintf(stderr, "Generating %ld accounts and %ld transactions...\n", accounts, transactions);
+    t0 = benchSeconds();
+    if (!benchGenerate(accounts, transactions)) {
+        fprintf(stderr, "Failed to generate benchmark data.\n");
+        return 0;
     }
+    benchReport(accounts, transactions, "generate", accounts + transactions, benchSeconds() - t0);
 
-    printf(GREEN "Enter new account holder name: " RESET);
-    while ((ch = getchar()) != '\n' && ch != EOF);
-    if (!fgets(newName, sizeof(newName), stdin))
-    {
-        printf(RED "Invalid name input.\n" RESET);
-        return;
+    // Startup cost: account index build, WAL recovery, transaction index rebuild
+    t0 = benchSeconds();
+    if (!openDataFiles()) {
+        benchQuiet(0);
+        fprintf(stderr, "Failed to open benchmark data.\n");
+        return 0;
     }
-    size_t len = strlen(newName);
-    if (len > 0 && newName[len - 1] == '\n')
-        newName[len - 1] = '\0';
-    if (strlen(newName) == 0) {
-        printf(RED "Name cannot be empty.\n" RESET);
-        return;
+    benchReport(accounts, transactions, "open", 1, benchSeconds() - t0);
+
+    fprintf(stderr, "Timing operations...\n");
+    calls = (long)ops * BENCH_LOOKUPS_PER_OP;
+    volatile int hits = 0; // keeps the lookups from being optimized away
+    t0 = benchSeconds();
+    for (long i = 0; i < calls; i++) hits += accountExists(benchAccountNo(accounts * 2)); // about half miss
+    benchReport(accounts, transactions, "accountExists", calls, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    for (long i = 0; i < calls; i++) hits += isLoanPending(benchAccountNo(accounts));
+    benchReport(accounts, transactions, "isLoanPending", calls, benchSeconds() - t0);
+
+    // PIN hashing alone, one at a time and batched, on the salts just generated
+    struct Account sample[BENCH_LOOKUPS_PER_OP];
+    struct PinHashJob jobs[BENCH_LOOKUPS_PER_OP];
+    unsigned char hash[HASH_SIZE];
+    for (int i = 0; i < BENCH_LOOKUPS_PER_OP; i++) {
+        if (!loadAccount(benchAccountNo(accounts), &sample[i], NULL)) memset(&sample[i], 0, sizeof(sample[i]));
+        jobs[i].pin = "1234";
+        jobs[i].salt = sample[i].salt;
+        jobs[i].hash = hash;
+    }
+    t0 = benchSeconds();
+    for (long i = 0; i < calls; i++) hashPin("1234", sample[i % BENCH_LOOKUPS_PER_OP].salt, SALT_SIZE, hash);
+    benchReport(accounts, transactions, "hashPin", calls, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    for (long i = 0; i < ops; i++) hashPinBatch(jobs, BENCH_LOOKUPS_PER_OP, SALT_SIZE);
+    benchReport(accounts, transactions, "hashPinBatch", calls, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    for (long i = 0; i < ops; i++) {
+        int acc_no = benchAccountNo(accounts);
+        benchPin(acc_no, pin, sizeof(pin));
+        authenticate(acc_no, pin);
+    }
+    benchReport(accounts, transactions, "authenticate", ops, benchSeconds() - t0);
+
+    // Later operations in the same session: no hash, no write
+    unsigned long long token = sessionOpen(1);
+    t0 = benchSeconds();
+    for (long i = 0; i < ops; i++) hits += sessionCheck(token, 1);
+    benchReport(accounts, transactions, "sessionCheck", ops, benchSeconds() - t0);
+    sessionClose(token);
+
+    t0 = benchSeconds();
+    for (long i = 0; i < ops; i++) depositFunds(benchAccountNo(accounts), 10 * MONEY_SCALE, NULL);
+    transactionLogFlush();
+    benchReport(accounts, transactions, "deposit", ops, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    for (long i = 0; i < ops; i++) withdrawFunds(benchAccountNo(accounts), 10 * MONEY_SCALE, NULL);
+    transactionLogFlush();
+    benchReport(accounts, transactions, "withdraw", ops, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    for (long i = 0; i < ops; i++) {
+        int from = benchAccountNo(accounts);
+        int to = benchAccountNo(accounts);
+        if (to == from) to = from % (int)accounts + 1;
+        transferFunds(from, to, 10 * MONEY_SCALE, NULL, NULL, NULL);
+    }
+    transactionLogFlush();
+    benchReport(accounts, transactions, "transfer", ops, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    for (long i = 0; i < ops; i++) printTransactionHistory(benchAccountNo(accounts));
+    benchReport(accounts, transactions, "viewTransactionHistory", ops, benchSeconds() - t0);
+
+    struct StatementTotals statement;
+    t0 = benchSeconds();
+    for (long i = 0; i < ops; i++) writeAccountStatement(stdout, benchAccountNo(accounts), 0, 0, &statement);
+    benchReport(accounts, transactions, "writeAccountStatement", ops, benchSeconds() - t0);
+
+    if (accounts <= BENCH_MAX_STATEMENT_ACCOUNTS) {
+        struct StatementRunResult run;
+        t0 = benchSeconds();
+        runMonthEndStatements(BENCH_STATEMENTS_DIR, 0, 0, &run);
+        benchReport(accounts, transactions, "runMonthEndStatements", run.accounts > 0 ? run.accounts : 1,
+                    benchSeconds() - t0);
     }
 
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb+");
-    if (!fp) {
-        printf(RED "No accounts found.\n" RESET);
-        return;
+    struct BankTotals totals;
+    t0 = benchSeconds();
+    computeBankTotals(&totals);
+    benchReport(accounts, transactions, "computeBankTotals", 1, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    processScheduledInterest();
+    transactionLogFlush();
+    benchReport(accounts, transactions, "processScheduledInterest", 1, benchSeconds() - t0);
+
+    struct LoanAccrualResult accrued;
+    t0 = benchSeconds();
+    accrueLoanBook(time(NULL), &accrued);
+    benchReport(accounts, transactions, "accrueLoanBook", accrued.scanned > 0 ? accrued.scanned : 1, benchSeconds() - t0);
+
+    // Every pending loan approved in one batch
+    struct LoanRule rule = {INT64_MAX, 0};
+    struct LoanBatchResult decided;
+    t0 = benchSeconds();
+    decideLoans(NULL, 0, &rule, &decided);
+    benchReport(accounts, transactions, "decideLoans", decided.approved > 0 ? decided.approved : 1, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    createAutomatedBackup();
+    benchReport(accounts, transactions, "createAutomatedBackup", 1, benchSeconds() - t0);
+
+    // A second backup after a few more operations only copies what they changed
+    for (long i = 0; i < ops; i++) depositFunds(benchAccountNo(accounts), 1 * MONEY_SCALE, NULL);
+    transactionLogFlush();
+    t0 = benchSeconds();
+    createAutomatedBackup();
+    benchReport(accounts, transactions, "incrementalBackup", 1, benchSeconds() - t0);
+
+    t0 = benchSeconds();
+    restoreBackup(BENCH_RESTORE_DIR);
+    benchReport(accounts, transactions, "restoreBackup", 1, benchSeconds() - t0);
+
+    closeDataFiles();
+    benchQuiet(0);
+    return 1;
+}
+
+// scales: comma-separated "accounts[:transactions]" entries; transactions
+// default to the number of accounts
+int runBenchmark(const char *scales, int ops, const char *dir) {
+    if (ops < 1) ops = 1;
+    if ((MKDIR(dir) == -1 && errno != EEXIST) || CHDIR(dir) != 0) {
+        printf(RED "Cannot use benchmark directory %s.\n" RESET, dir);
+        return 0;
     }
-    
-    struct Account a;
-    while (fread(&a, sizeof(struct Account), 1, fp))
-    {
-        if (a.acc_no == acc_no)
-        {
-            found = 1;
-            strcpy(a.name, newName);
-            fseek(fp, -sizeof(struct Account), SEEK_CUR);
-            fwrite(&a, sizeof(struct Account), 1, fp);
-            printf(GREEN "Account holder's name updated successfully.\n" RESET);
-            printf(YELLOW "Account %d name changed to: %s\n" RESET, acc_no, newName);
+
+    printf("accounts,transactions,operation,calls,total_ms,calls_per_sec,us_per_call\n");
+    int ok = 1;
+    const char *p = scales;
+    while (ok && *p) {
+        char *end;
+        long accounts = strtol(p, &end, 10);
+        long transactions = accounts;
+        if (*end == ':') transactions = strtol(end + 1, &end, 10);
+        if (accounts < 1 || accounts > 2000000000L || transactions < 0 || (*end != ',' && *end != '\0')) {
+            printf(RED "Invalid benchmark scale list: %s\n" RESET, scales);
+            ok = 0;
             break;
         }
+        p = (*end == ',') ? end + 1 : end;
+
+        char scale_dir[64];
+        snprintf(scale_dir, sizeof(scale_dir), "%ldx%ld", accounts, transactions);
+        if ((MKDIR(scale_dir) == -1 && errno != EEXIST) || CHDIR(scale_dir) != 0) {
+            printf(RED "Cannot use benchmark directory %s/%s.\n" RESET, dir, scale_dir);
+            ok = 0;
+            break;
+        }
+        benchQuiet(1);
+        ok = benchScale(accounts, transactions, ops);
+        benchQuiet(0);
+        if (CHDIR("..") != 0) ok = 0;
+    }
+    return ok;
+}
+
+// =========================================================================
+// SELF-TEST
+// =========================================================================
+
+// --self-test checks results that must not change between builds and CPUs
+// against known answers, and the crash recovery of the data files. Every
+// check prints PASS or FAIL; the exit status is non-zero if any failed.
+// Checks that need data files run in a directory of their own under DIR.
+
+static int self_test_failures = 0;
+
+static void selfTestCheck(int ok, const char *name, const char *detail) {
+    if (ok) {
+        printf(GREEN "PASS" RESET " %s\n", name);
+    } else {
+        printf(RED "FAIL" RESET " %s: %s\n", name, detail);
+        self_test_failures++;
+    }
+}
+
+static void selfTestHex(const BYTE hash[32], char hex[65]) {
+    for (int i = 0; i < 32; i++) snprintf(hex + 2 * i, 3, "%02x", hash[i]);
+}
+
+// FIPS 180-2 examples, plus one message per padding case: length 55 (padding
+// fits the block), 56 (it does not) and 64 (a whole block of data)
+struct Sha256Kat {
+    const char *name;
+    const char *message; // NULL: one million 'a'
+    const char *digest;
+};
+
+static const struct Sha256Kat sha256_kats[] = {
+    {"empty", "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc", "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"448-bit", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {"896-bit",
+     "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+     "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+    {"55 bytes", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+     "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318"},
+    {"56 bytes", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+     "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a"},
+    {"64 bytes", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+     "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb"},
+    {"million a", NULL, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+};
+
+#define SHA256_KAT_COUNT (sizeof(sha256_kats) / sizeof(sha256_kats[0]))
+
+// Digest through one block function: whole blocks straight from data, then
+// the padded tail
+static void selfTestSha256Blocks(void (*blocks)(WORD state[8], const BYTE *data, size_t blocks), const BYTE *data,
+                                 size_t len, BYTE out[32]) {
+    WORD state[8];
+    BYTE buf[64];
+    memcpy(state, sha256_iv, sizeof(state));
+    size_t full = len / 64;
+    if (full > 0) blocks(state, data, full);
+    for (size_t b = full; b <= (len + 8) / 64; b++) {
+        sha256PaddedBlock(data, len, b, buf);
+        blocks(state, buf, 1);
     }
-    fclose(fp);
-    
-    if (!found) {
-        printf(RED "Account not found.\n" RESET);
+    for (int j = 0; j < 8; j++) {
+        out[4 * j] = (BYTE)(state[j] >> 24);
+        out[4 * j + 1] = (BYTE)(state[j] >> 16);
+        out[4 * j + 2] = (BYTE)(state[j] >> 8);
+        out[4 * j + 3] = (BYTE)state[j];
     }
 }
 
-void deleteAccount()
-{
-    int acc_no;
-    int found = 0;
-    int ch;
+static int selfTestSha256Digest(const char *engine, int kat, const BYTE hash[32]) {
+    char hex[65], name[96], detail[160];
+    selfTestHex(hash, hex);
+    int ok = strcmp(hex, sha256_kats[kat].digest) == 0;
+    snprintf(name, sizeof(name), "sha256 %s: %s", engine, sha256_kats[kat].name);
+    snprintf(detail, sizeof(detail), "got %s", hex);
+    selfTestCheck(ok, name, detail);
+    return ok;
+}
 
-    printf(GREEN "Enter account number to delete: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid account number input.\n" RESET);
-        while ((ch = getchar()) != '\n' && ch != EOF);
+// Every engine this CPU has, through its own entry point, then the public
+// functions with the engine in use
+static void selfTestSha256(void) {
+    const BYTE *data[SHA256_KAT_COUNT];
+    size_t len[SHA256_KAT_COUNT];
+    BYTE *million = malloc(1000000);
+    if (!million) {
+        selfTestCheck(0, "sha256", "not enough memory");
         return;
     }
+    memset(million, 'a', 1000000);
+    for (size_t k = 0; k < SHA256_KAT_COUNT; k++) {
+        data[k] = sha256_kats[k].message ? (const BYTE *)sha256_kats[k].message : million;
+        len[k] = sha256_kats[k].message ? strlen(sha256_kats[k].message) : 1000000;
+    }
+    BYTE hash[32];
 
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb");
-    if (!fp) {
-        printf(RED "No accounts found.\n" RESET);
-        return;
+    for (size_t k = 0; k < SHA256_KAT_COUNT; k++) {
+        selfTestSha256Blocks(sha256BlocksScalar, data[k], len[k], hash);
+        selfTestSha256Digest("scalar", (int)k, hash);
     }
-    
-    FILE *temp = fopen("temp.dat", "wb");
-    if (!temp)
-    {
-        fclose(fp);
-        printf(RED "Error creating temporary file.\n" RESET);
-        return;
+#if SHA256_X86_DISPATCH
+    if (sha256EngineSupported(SHA256_ENGINE_SHANI)) {
+        for (size_t k = 0; k < SHA256_KAT_COUNT; k++) {
+            selfTestSha256Blocks(sha256BlocksShaNi, data[k], len[k], hash);
+            selfTestSha256Digest("shani", (int)k, hash);
+        }
     }
-    
-    struct Account a;
-    while (fread(&a, sizeof(struct Account), 1, fp))
-    {
-        if (a.acc_no == acc_no)
-        {
-            found = 1;
-            printf(YELLOW "Deleting account: %d, Name: %s, Balance: %.2f\n" RESET, 
-                       a.acc_no, a.name, a.balance);
-            continue;
+    // Lane engines: more messages than lanes, so lanes are refilled mid-batch
+    const struct {
+        const char *name;
+        int engine, lanes;
+        Sha256LanesFn kernel;
+    } lane_engines[] = {{"sse2", SHA256_ENGINE_SSE2, 4, sha256LanesSse2}, {"avx2", SHA256_ENGINE_AVX2, 8, sha256LanesAvx2}};
+    for (size_t e = 0; e < sizeof(lane_engines) / sizeof(lane_engines[0]); e++) {
+        if (!sha256EngineSupported(lane_engines[e].engine)) continue;
+        enum { MESSAGES = 2 * SHA256_KAT_COUNT + 1 };
+        const BYTE *batch[MESSAGES];
+        size_t batch_len[MESSAGES];
+        BYTE out[MESSAGES][32];
+        BYTE *outp[MESSAGES];
+        for (size_t m = 0; m < MESSAGES; m++) {
+            batch[m] = data[m % SHA256_KAT_COUNT];
+            batch_len[m] = len[m % SHA256_KAT_COUNT];
+            outp[m] = out[m];
         }
-        else
-        {
-            fwrite(&a, sizeof(struct Account), 1, temp);
+        sha256MultiLanes(batch, batch_len, MESSAGES, outp, lane_engines[e].lanes, lane_engines[e].kernel);
+        for (size_t m = 0; m < MESSAGES; m++) selfTestSha256Digest(lane_engines[e].name, (int)(m % SHA256_KAT_COUNT), out[m]);
+    }
+#endif
+
+    // sha256_update fed in pieces that straddle block boundaries
+    const size_t pieces[] = {1, 3, 63, 64, 65, 127, 1000};
+    for (size_t k = 0; k < SHA256_KAT_COUNT; k++) {
+        SHA256_CTX ctx;
+        sha256_init(&ctx);
+        for (size_t at = 0, p = 0; at < len[k]; p++) {
+            size_t n = pieces[p % (sizeof(pieces) / sizeof(pieces[0]))];
+            if (n > len[k] - at) n = len[k] - at;
+            sha256_update(&ctx, data[k] + at, n);
+            at += n;
         }
+        sha256_final(&ctx, hash);
+        selfTestSha256Digest("sha256_update", (int)k, hash);
     }
-    fclose(fp);
-    if (temp) fclose(temp);
 
-    if (found)
-    {
-        remove(ACCOUNTS_FILE);
-        rename("temp.dat", ACCOUNTS_FILE);
-        printf(GREEN "Account %d deleted successfully.\n" RESET, acc_no);
+    BYTE out[SHA256_KAT_COUNT][32];
+    BYTE *outp[SHA256_KAT_COUNT];
+    for (size_t k = 0; k < SHA256_KAT_COUNT; k++) outp[k] = out[k];
+    sha256_multi(data, len, SHA256_KAT_COUNT, outp);
+    for (size_t k = 0; k < SHA256_KAT_COUNT; k++) selfTestSha256Digest("sha256_multi", (int)k, out[k]);
+    free(million);
+
+    // hashPinBatch must store the same hashes as hashPin
+    enum { PINS = 37 };
+    char pins[PINS][8];
+    unsigned char salts[PINS][SALT_SIZE], one[HASH_SIZE], many[PINS][HASH_SIZE];
+    struct PinHashJob jobs[PINS];
+    for (int i = 0; i < PINS; i++) {
+        snprintf(pins[i], sizeof(pins[i]), "%04d", (i * 7919) % 10000);
+        for (int j = 0; j < SALT_SIZE; j++) salts[i][j] = (unsigned char)(i * 31 + j);
+        jobs[i].pin = pins[i];
+        jobs[i].salt = salts[i];
+        jobs[i].hash = many[i];
     }
-    else
-    {
-        remove("temp.dat");
-        printf(RED "Account not found.\n" RESET);
+    hashPinBatch(jobs, PINS, SALT_SIZE);
+    int same = 1;
+    for (int i = 0; i < PINS; i++) {
+        hashPin(pins[i], salts[i], SALT_SIZE, one);
+        if (memcmp(one, many[i], HASH_SIZE) != 0) same = 0;
     }
+    selfTestCheck(same, "hashPinBatch matches hashPin", "a batch hash differs");
 }
 
-void generateAccountStatement() {
-    int acc_no;
-    char pin_str[32];
-    int found = 0;
-    int ch;
-    
-    printf(GREEN "Enter account number for statement: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid account number input.\n" RESET);
-        while ((ch = getchar()) != '\n' && ch != EOF);
-        return;
-    }
-    
-    printf(GREEN "Enter PIN for authentication: " RESET);
-    while ((ch = getchar()) != '\n' && ch != EOF);
-    getMaskedInput(pin_str, sizeof(pin_str));
-    
-    if (!authenticate(acc_no, pin_str)) {
-        printf(RED "Authentication failed. Account not found or PIN incorrect.\n" RESET);
-        return;
+// Varint, zigzag and archive block encodings. The byte strings are the
+// on-disk format: a change here makes existing segments unreadable.
+struct SelfTestVarint {
+    uint64_t value;
+    const char *bytes; // hex
+};
+
+static const struct SelfTestVarint self_test_varints[] = {
+    {0, "00"}, {1, "01"}, {127, "7f"}, {128, "8001"}, {300, "ac02"}, {16383, "ff7f"}, {16384, "808001"},
+    {UINT64_C(0xFFFFFFFF), "ffffffff0f"}, {UINT64_MAX, "ffffffffffffffffff01"},
+};
+
+struct SelfTestZigzag {
+    int64_t value;
+    uint64_t encoded;
+};
+
+static const struct SelfTestZigzag self_test_zigzags[] = {
+    {0, 0}, {-1, 1}, {1, 2}, {-2, 3}, {2, 4}, {INT32_MAX, UINT64_C(0xFFFFFFFE)}, {INT32_MIN, UINT64_C(0xFFFFFFFF)},
+    {INT64_MAX, UINT64_MAX - 1}, {INT64_MIN, UINT64_MAX},
+};
+
+static void selfTestHexBytes(const unsigned char *p, size_t n, char *hex, size_t size) {
+    hex[0] = '\0';
+    for (size_t i = 0; i < n && 2 * i + 3 <= size; i++) snprintf(hex + 2 * i, 3, "%02x", p[i]);
+}
+
+struct SelfTestRows {
+    struct Transaction *rows;
+    size_t count, capacity;
+};
+
+static int selfTestCollect(const struct Transaction *t, void *ctx) {
+    struct SelfTestRows *r = ctx;
+    if (r->count == r->capacity) return 0;
+    r->rows[r->count++] = *t;
+    return 1;
+}
+
+// Writes the records as one block to a temporary file and scans it back with q
+static int selfTestBlockScan(const struct Transaction *t, size_t n, const struct TxArchiveQuery *q,
+                             struct SelfTestRows *out, unsigned char **encoded, size_t *encoded_len) {
+    FILE *fp = tmpfile();
+    unsigned char *buf = malloc(n * TX_ARCHIVE_MAX_RECORD_BYTES);
+    struct TxBlockRef ref;
+    int ok = fp && buf && txArchiveWriteBlock(fp, t, n, buf) && fflush(fp) == 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+             fread(&ref.block, sizeof(ref.block), 1, fp) == 1;
+    ref.offset = 0;
+    if (ok && encoded) {
+        // Column bytes as written, for the known-answer check
+        size_t bytes = 0;
+        for (int c = 0; c < TX_COLUMN_COUNT; c++) bytes += ref.block.column_bytes[c];
+        *encoded = malloc(bytes ? bytes : 1);
+        ok = *encoded && fread(*encoded, 1, bytes, fp) == bytes;
+        *encoded_len = bytes;
     }
-    
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb");
-    if (!fp) {
-        printf(YELLOW "No accounts found.\n" RESET);
-        return;
+    out->count = 0;
+    if (ok) ok = txArchiveScanBlocks(fp, &ref, 1, q, selfTestCollect, out) >= 0;
+    if (fp) fclose(fp);
+    free(buf);
+    return ok;
+}
+
+static int selfTestSameRecord(const struct Transaction *a, const struct Transaction *b) {
+    return a->acc_no == b->acc_no && a->type == b->type && a->currency == b->currency && a->amount == b->amount &&
+           a->timestamp == b->timestamp && a->receiver_acc_no == b->receiver_acc_no;
+}
+
+static void selfTestCodec(void) {
+    char name[96], detail[160], hex[64];
+    unsigned char buf[16];
+
+    int varints_ok = 1;
+    for (size_t i = 0; i < sizeof(self_test_varints) / sizeof(self_test_varints[0]); i++) {
+        size_t n = varintPut(buf, self_test_varints[i].value);
+        selfTestHexBytes(buf, n, hex, sizeof(hex));
+        const unsigned char *p = buf;
+        uint64_t back = 0;
+        int ok = strcmp(hex, self_test_varints[i].bytes) == 0 && varintGet(&p, buf + n, &back) &&
+                 back == self_test_varints[i].value && p == buf + n;
+        if (!ok) {
+            snprintf(name, sizeof(name), "varint %llu", (unsigned long long)self_test_varints[i].value);
+            snprintf(detail, sizeof(detail), "encoded as %s, decoded as %llu", hex, (unsigned long long)back);
+            selfTestCheck(0, name, detail);
+            varints_ok = 0;
+        }
     }
-    
-    struct Account a;
-    while (fread(&a, sizeof(struct Account), 1, fp)) {
-        if (a.acc_no == acc_no) {
-            found = 1;
-            printf(BLUE "\n============================================\n" RESET);
-            printf(BLUE "         BANK ACCOUNT STATEMENT             \n" RESET);
-            printf(BLUE "============================================\n" RESET);
-            printf(YELLOW "Account Number:  %d\n" RESET, a.acc_no);
-            printf(YELLOW "Account Holder:  %s\n" RESET, a.name);
-            printf(YELLOW "Current Balance: %.2f %s\n" RESET, a.balance, a.currency);
-            printf(BLUE "============================================\n" RESET);
-            break;
+    if (varints_ok) selfTestCheck(1, "varint known answers", "");
+
+    // A varint cut short, and one longer than 64 bits, are rejected
+    const unsigned char truncated[] = {0x80, 0x80};
+    unsigned char overlong[11];
+    memset(overlong, 0x80, sizeof(overlong));
+    const unsigned char *p = truncated;
+    uint64_t v;
+    int rejects = !varintGet(&p, truncated + sizeof(truncated), &v);
+    p = overlong;
+    rejects = rejects && !varintGet(&p, overlong + sizeof(overlong), &v);
+    selfTestCheck(rejects, "varint rejects truncated and overlong input", "a bad varint was accepted");
+
+    int zigzags_ok = 1;
+    for (size_t i = 0; i < sizeof(self_test_zigzags) / sizeof(self_test_zigzags[0]); i++) {
+        uint64_t encoded = zigzagEncode(self_test_zigzags[i].value);
+        if (encoded != self_test_zigzags[i].encoded || zigzagDecode(encoded) != self_test_zigzags[i].value) {
+            snprintf(name, sizeof(name), "zigzag %lld", (long long)self_test_zigzags[i].value);
+            snprintf(detail, sizeof(detail), "encoded as %llu", (unsigned long long)encoded);
+            selfTestCheck(0, name, detail);
+            zigzags_ok = 0;
         }
     }
-    fclose(fp);
-    
-    if (!found) {
-        printf(RED "Account not found or PIN incorrect.\n" RESET);
+    if (zigzags_ok) selfTestCheck(1, "zigzag known answers", "");
+
+    // Known block: acc_no deltas 5, 0, -2; time deltas from min_time 0, 3, -2
+    struct Transaction known[3];
+    memset(known, 0, sizeof(known));
+    const int32_t acc[3] = {5, 5, 3}, receiver[3] = {0, 7, 0};
+    const uint8_t type[3] = {DEPOSIT, WITHDRAWAL, TRANSFER_IN};
+    const Money amount[3] = {100, -50, 300};
+    const int64_t when[3] = {1000, 1003, 1001};
+    for (int i = 0; i < 3; i++) {
+        known[i].acc_no = acc[i];
+        known[i].type = type[i];
+        known[i].currency = (uint16_t)(i == 2 ? 2 : 1);
+        known[i].amount = amount[i];
+        known[i].timestamp = when[i];
+        known[i].receiver_acc_no = receiver[i];
     }
+    const char *known_columns = "0a0003" "000103" "010102" "c80163d804" "000603" "000e00";
+    struct Transaction rows[3];
+    struct SelfTestRows got = {rows, 0, 3};
+    struct TxArchiveQuery all = {0, 0, 0, TX_COL_ALL};
+    unsigned char *encoded = NULL;
+    size_t encoded_len = 0;
+    char columns_hex[64] = "";
+    int ok = selfTestBlockScan(known, 3, &all, &got, &encoded, &encoded_len);
+    if (ok) selfTestHexBytes(encoded, encoded_len, columns_hex, sizeof(columns_hex));
+    ok = ok && strcmp(columns_hex, known_columns) == 0;
+    free(encoded);
+    snprintf(detail, sizeof(detail), "columns encoded as %s", columns_hex);
+    selfTestCheck(ok, "archive block known answer", detail);
+    ok = got.count == 3;
+    for (size_t i = 0; ok && i < 3; i++) ok = selfTestSameRecord(&rows[i], &known[i]);
+    selfTestCheck(ok, "archive block decodes the known records", "decoded records differ");
+
+    // Round trip of a full block of edge values, then the block filters
+    // against a plain scan
+    size_t n = TX_ARCHIVE_BLOCK_RECORDS;
+    struct Transaction *t = calloc(n, sizeof(struct Transaction));
+    struct SelfTestRows back = {malloc(n * sizeof(struct Transaction)), 0, n};
+    if (!t || !back.rows) {
+        selfTestCheck(0, "archive block round trip", "not enough memory");
+        free(t);
+        free(back.rows);
+        return;
+    }
+    const Money amounts[] = {0, 1, -1, INT64_MAX, INT64_MIN, 123456789, -987654321};
+    const int32_t accs[] = {1, INT32_MAX, INT32_MIN, 0, -1, 42};
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        t[i].acc_no = i % 5 ? (int32_t)(seed % 1000) : accs[i / 5 % (sizeof(accs) / sizeof(accs[0]))];
+        t[i].type = (uint8_t)(seed >> 8) % (LOAN_REJECTED + 1);
+        t[i].currency = (uint16_t)((seed >> 12) % CURRENCY_ID_LIMIT);
+        t[i].amount = i % 3 ? (Money)(int32_t)seed * 1000 : amounts[i / 3 % (sizeof(amounts) / sizeof(amounts[0]))];
+        t[i].timestamp = (int64_t)(seed % 2000000001u) - 1000000000 + (i % 7 == 0 ? ((int64_t)1 << 40) : 0);
+        t[i].receiver_acc_no = i % 4 ? 0 : accs[i / 4 % (sizeof(accs) / sizeof(accs[0]))];
+    }
+    ok = selfTestBlockScan(t, n, &all, &back, NULL, NULL) && back.count == n;
+    for (size_t i = 0; ok && i < n; i++) ok = selfTestSameRecord(&back.rows[i], &t[i]);
+    selfTestCheck(ok, "archive block round trip", "decoded records differ");
+
+    struct TxArchiveQuery filtered = {42, -500000000, 500000000, TX_COL_AMOUNT};
+    size_t expected = 0;
+    for (size_t i = 0; i < n; i++)
+        if (t[i].acc_no == filtered.acc_no && t[i].timestamp >= filtered.from && t[i].timestamp <= filtered.to)
+            expected++;
+    ok = selfTestBlockScan(t, n, &filtered, &back, NULL, NULL) && back.count == expected && expected > 0;
+    for (size_t i = 0; ok && i < back.count; i++) ok = back.rows[i].acc_no == 42;
+    snprintf(detail, sizeof(detail), "%zu records matched, expected %zu", back.count, expected);
+    selfTestCheck(ok, "archive block account and time filter", detail);
+    free(t);
+    free(back.rows);
 }
 
-void unlockAccount() {
-    int acc_no;
-    int found = 0;
-    int ch;
+// Interest kernel rows with their known answers when an unset date counts as
+// one day. The vector paths must agree with the scalar loop on all of them:
+// the unset date, amounts just inside and outside +-2^51 (the vector paths
+// hand those lanes to the scalar loop), results of 2^51 and more, products on
+// and next to .5, and dates less than a day back or in the future.
+#define SELF_TEST_DAY INT64_C(86400)
+#define SELF_TEST_NOW INT64_C(1700000000)
+#define SELF_TEST_FAR_NOW ((INT64_C(1) << 51) + 3 * SELF_TEST_DAY)
+
+struct SelfTestAccrual {
+    Money amount;
+    int64_t from;
+    double daily_rate;
+    Money interest;
+    int days;
+};
 
-    printf(GREEN "Enter account number to unlock: " RESET);
-    if (scanf("%d", &acc_no) != 1) {
-        printf(RED "Invalid input format.\n" RESET);
-        while ((ch = getchar()) != '\n' && ch != EOF);
-        return;
-    }
+static const struct SelfTestAccrual self_test_accruals[] = {
+    {100000, 0, 0.0001, 10, 1},
+    {-1000, 0, 0.5, 0, 0},
+    {1, SELF_TEST_NOW - SELF_TEST_DAY, 0.5, 1, 1},
+    {1, SELF_TEST_NOW - SELF_TEST_DAY, 0x1.fffffffffffffp-2, 0, 1},
+    {1, SELF_TEST_NOW - SELF_TEST_DAY, 0x1.0000000000001p-1, 1, 1},
+    {5, SELF_TEST_NOW - SELF_TEST_DAY, 0.5, 3, 1},
+    {3, SELF_TEST_NOW - 3 * SELF_TEST_DAY, 0.5, 5, 3},
+    {(INT64_C(1) << 51) - 1, SELF_TEST_NOW - SELF_TEST_DAY, 0.0, 0, 1},
+    {INT64_C(1) << 51, SELF_TEST_NOW - SELF_TEST_DAY, 0.0, 0, 1},
+    {(INT64_C(1) << 51) + 1, SELF_TEST_NOW - SELF_TEST_DAY, 0.25, INT64_C(1) << 49, 1},
+    {-(INT64_C(1) << 51), SELF_TEST_NOW - SELF_TEST_DAY, 0.5, 0, 0},
+    {-(INT64_C(1) << 51) - 1, SELF_TEST_NOW - SELF_TEST_DAY, 0.5, 0, 0},
+    {INT64_C(1) << 50, SELF_TEST_NOW - SELF_TEST_DAY, 1.5, INT64_C(1688849860263936), 1},
+    {INT64_C(1) << 50, SELF_TEST_NOW - SELF_TEST_DAY, 2.0, INT64_C(1) << 51, 1},
+    {INT64_C(1) << 50, SELF_TEST_NOW - SELF_TEST_DAY, 4.0, INT64_C(1) << 52, 1},
+    {0, SELF_TEST_NOW - SELF_TEST_DAY, 0.5, 0, 0},
+    {1000, SELF_TEST_NOW + SELF_TEST_DAY, 0.5, 0, 0},
+    {1000, SELF_TEST_NOW - SELF_TEST_DAY + 1, 0.5, 0, 0},
+    {1000, SELF_TEST_NOW - 2 * SELF_TEST_DAY + 1, 0.5, 500, 1},
+};
 
-    FILE *fp = fopen(ACCOUNTS_FILE, "rb+");
-    if (!fp) {
-        printf(RED "No accounts found.\n" RESET);
-        return;
-    }
+// Dates just inside and outside +-2^51, against a clock past 2^51
+static const struct SelfTestAccrual self_test_far_accruals[] = {
+    {1000, INT64_C(1) << 51, 0.5, 1500, 3},
+    {1000, (INT64_C(1) << 51) - 1, 0.5, 1500, 3},
+    {1000, (INT64_C(1) << 51) + SELF_TEST_DAY, 0.5, 1000, 2},
+    {1001, (INT64_C(1) << 51) + 2 * SELF_TEST_DAY, 0.5, 501, 1},
+    {1000, (INT64_C(1) << 51) - SELF_TEST_DAY, 0.5, 2000, 4},
+};
 
-    struct Account a;
-    while (fread(&a, sizeof(struct Account), 1, fp)) {
-        if (a.acc_no == acc_no) {
-            found = 1;
-            if (a.locked) {
-                a.locked = 0;
-                a.failed_attempts = 0;
-                fseek(fp, -sizeof(struct Account), SEEK_CUR);
-                fwrite(&a, sizeof(struct Account), 1, fp);
-                printf(GREEN "Account %d has been unlocked successfully.\n" RESET, acc_no);
-            } else {
-                printf(YELLOW "Account %d was not locked.\n" RESET, acc_no);
-            }
-            break;
-        }
-    }
-    fclose(fp);
+struct SelfTestColumns {
+    Money *amount;
+    int64_t *from;
+    double *daily_rate;
+    Money *interest, *expected;
+    int *days, *expected_days;
+};
 
-    if (!found) {
-        printf(RED "Account not found.\n" RESET);
+static int selfTestColumnsAlloc(struct SelfTestColumns *c, size_t n) {
+    c->amount = malloc(n * sizeof(Money));
+    c->from = malloc(n * sizeof(int64_t));
+    c->daily_rate = malloc(n * sizeof(double));
+    c->interest = malloc(n * sizeof(Money));
+    c->expected = malloc(n * sizeof(Money));
+    c->days = malloc(n * sizeof(int));
+    c->expected_days = malloc(n * sizeof(int));
+    return c->amount && c->from && c->daily_rate && c->interest && c->expected && c->days && c->expected_days;
+}
+
+static void selfTestColumnsFree(struct SelfTestColumns *c) {
+    free(c->amount);
+    free(c->from);
+    free(c->daily_rate);
+    free(c->interest);
+    free(c->expected);
+    free(c->days);
+    free(c->expected_days);
+}
+
+// Runs accrueInterestColumns and the scalar loop on rows [start, start + n)
+// and describes the first row where they differ
+static int selfTestAccrualMatch(struct SelfTestColumns *c, size_t start, size_t n, int64_t now, int unset_is_one_day,
+                                char *detail, size_t size) {
+    accrueInterestColumns(c->amount + start, c->from + start, c->daily_rate + start, n, now, unset_is_one_day,
+                          c->interest, c->days);
+    accrueInterestScalar(c->amount + start, c->from + start, c->daily_rate + start, n, now, unset_is_one_day,
+                         c->expected, c->expected_days);
+    for (size_t i = 0; i < n; i++) {
+        if (c->interest[i] != c->expected[i] || c->days[i] != c->expected_days[i]) {
+            size_t row = start + i;
+            snprintf(detail, size, "row %zu of %zu..%zu (amount %lld, from %lld, rate %a): %lld for %d day(s), "
+                     "expected %lld for %d", row, start, start + n, (long long)c->amount[row],
+                     (long long)c->from[row], c->daily_rate[row], (long long)c->interest[i], c->days[i],
+                     (long long)c->expected[i], c->expected_days[i]);
+            return 0;
+        }
     }
+    return 1;
 }
 
-void createAutomatedBackup() {
-    printf(BLUE "\n--- Creating Automated Backup ---\n" RESET);
+// Known answers, then every window of up to 20 rows at every start, so each
+// edge row sits in every lane of a vector and in the scalar tail, with both
+// meanings of an unset date
+static void selfTestAccrualTable(const struct SelfTestAccrual *rows, size_t count, int64_t now, const char *what,
+                                 const char *path) {
+    char name[96], detail[256] = "";
+    struct SelfTestColumns c;
+    size_t n = 3 * count + 24;
+    int ok = selfTestColumnsAlloc(&c, n);
+    uint32_t seed = 777;
+    for (size_t i = 0; ok && i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        c.amount[i] = (Money)(seed % 2000000) - 1000;
+        c.daily_rate[i] = i % 5 ? (seed >> 12) % 1000 * 1e-6 : 0.5;
+        c.from[i] = now - (int64_t)(seed >> 8) % (4000 * SELF_TEST_DAY);
+    }
+    for (size_t i = 0; ok && i < count; i++) {
+        // The rows twice, once shifted by one lane
+        for (size_t copy = 0; copy < 2; copy++) {
+            size_t at = i + copy * (count + 1);
+            c.amount[at] = rows[i].amount;
+            c.from[at] = rows[i].from;
+            c.daily_rate[at] = rows[i].daily_rate;
+        }
+    }
 
-    if (MKDIR(BACKUP_DIR) == -1 && errno != EEXIST) {
-        printf(RED "Error: Could not create backup directory.\n" RESET);
+    if (ok) {
+        accrueInterestColumns(c.amount, c.from, c.daily_rate, count, now, 1, c.interest, c.days);
+        for (size_t i = 0; i < count && ok; i++) {
+            if (c.interest[i] != rows[i].interest || c.days[i] != rows[i].days) {
+                snprintf(detail, sizeof(detail),
+                         "row %zu (amount %lld, rate %a): %lld for %d day(s), expected %lld for %d", i,
+                         (long long)rows[i].amount, rows[i].daily_rate, (long long)c.interest[i], c.days[i],
+                         (long long)rows[i].interest, rows[i].days);
+                ok = 0;
+            }
+        }
+    } else {
+        snprintf(detail, sizeof(detail), "out of memory");
+    }
+    snprintf(name, sizeof(name), "interest kernel known answers, %s (%s)", what, path);
+    selfTestCheck(ok, name, detail);
+    if (!ok) {
+        selfTestColumnsFree(&c);
         return;
     }
 
-    char timestamp[100];
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d_%H-%M-%S", t);
-
-    char backupFilePath[256];
-    char sourceFilePath[256];
-    
-    const char* filesToBackup[] = {ACCOUNTS_FILE, TRANSACTIONS_FILE, LOANS_FILE};
-    int numFiles = sizeof(filesToBackup) / sizeof(filesToBackup[0]);
-    int successCount = 0;
+    for (int unset = 0; unset <= 1 && ok; unset++)
+        for (size_t start = 0; start + 20 <= n && ok; start++)
+            for (size_t len = 0; len <= 20 && ok; len++)
+                ok = selfTestAccrualMatch(&c, start, len, now, unset, detail, sizeof(detail));
+    if (ok) ok = selfTestAccrualMatch(&c, 0, n, now, 1, detail, sizeof(detail));
+    snprintf(name, sizeof(name), "interest kernel matches scalar loop, %s (%s)", what, path);
+    selfTestCheck(ok, name, detail);
+    selfTestColumnsFree(&c);
+}
 
-    for (int i = 0; i < numFiles; ++i) {
-        snprintf(sourceFilePath, sizeof(sourceFilePath), "%s", filesToBackup[i]);
-        snprintf(backupFilePath, sizeof(backupFilePath), "%s/%s_%s.dat", BACKUP_DIR, filesToBackup[i], timestamp);
+static void selfTestInterestKernel(void) {
+#if defined(__AVX2__)
+    const char *path = "AVX2";
+#elif defined(__SSE4_1__)
+    const char *path = "SSE4.1";
+#else
+    const char *path = "scalar build";
+#endif
+    selfTestAccrualTable(self_test_accruals, sizeof(self_test_accruals) / sizeof(self_test_accruals[0]), SELF_TEST_NOW,
+                         "edge values", path);
+    selfTestAccrualTable(self_test_far_accruals, sizeof(self_test_far_accruals) / sizeof(self_test_far_accruals[0]),
+                         SELF_TEST_FAR_NOW, "dates near 2^51", path);
+}
 
-        FILE* source_fp = fopen(sourceFilePath, "rb");
-        if (source_fp == NULL) {
-            printf(YELLOW "Warning: File not found, skipping backup for %s\n" RESET, sourceFilePath);
-            continue;
-        }
+// Writes the entries to WAL_FILE as a crash after the fsync, before they were
+// applied, would leave them. The last entry is cut to keep_last bytes.
+static int selfTestWalWrite(struct WalEntry *entries, size_t n, size_t keep_last) {
+    FILE *fp = fopen(WAL_FILE, "wb");
+    if (!fp) return 0;
+    int ok = 1;
+    for (size_t i = 0; i < n; i++) {
+        entries[i].seq = (unsigned int)(i + 1);
+        entries[i].checksum = walChecksum(&entries[i]);
+        size_t bytes = i + 1 == n ? keep_last : sizeof(entries[i]);
+        if (fwrite(&entries[i], 1, bytes, fp) != bytes) ok = 0;
+    }
+    if (fclose(fp) != 0) ok = 0;
+    return ok;
+}
 
-        FILE* dest_fp = fopen(backupFilePath, "wb");
-        if (dest_fp == NULL) {
-            printf(RED "Error: Could not create backup file for %s.\n" RESET, sourceFilePath);
-            fclose(source_fp);
-            continue;
+static int selfTestBalances(const int *acc_no, const Money *expected, size_t n, char *detail, size_t size) {
+    for (size_t i = 0; i < n; i++) {
+        struct Account a;
+        long pos;
+        if (!loadAccount(acc_no[i], &a, &pos)) {
+            snprintf(detail, size, "account %d not found", acc_no[i]);
+            return 0;
         }
-
-        char buffer[1024];
-        size_t bytesRead;
-        while ((bytesRead = fread(buffer, 1, sizeof(buffer), source_fp)) > 0) {
-            fwrite(buffer, 1, bytesRead, dest_fp);
+        if (a.balance != expected[i]) {
+            snprintf(detail, size, "account %d has balance %lld, expected %lld", acc_no[i], (long long)a.balance,
+                     (long long)expected[i]);
+            return 0;
         }
+    }
+    return 1;
+}
 
-        fclose(source_fp);
-        fclose(dest_fp);
-        printf(GREEN "Backup of %s created successfully.\n" RESET, sourceFilePath);
-        successCount++;
+// A crash after the WAL fsync and before the records were written: the
+// complete entries are redone, a torn or corrupt entry at the tail is dropped
+// and the WAL is empty afterwards.
+static void selfTestWalRecovery(void) {
+    char detail[160] = "";
+    const int acc_no[3] = {1, 2, 3};
+    struct Account before[3];
+    long pos[3];
+
+    benchQuiet(1);
+    int ok = benchGenerate(8, 0) && openDataFiles();
+    for (int i = 0; ok && i < 3; i++) ok = loadAccount(acc_no[i], &before[i], &pos[i]);
+    if (ok) closeDataFiles();
+    benchQuiet(0);
+    if (!ok) {
+        selfTestCheck(0, "wal recovery", "cannot create the test data set");
+        return;
     }
 
-    if (successCount > 0) {
-        printf(GREEN "\nAutomated backup completed successfully. Files saved in the '%s' directory.\n" RESET, BACKUP_DIR);
+    // A transfer from account 1 to 2, a deposit to 3, then a torn entry
+    // that would have emptied account 1
+    struct WalEntry entries[3];
+    struct Account image;
+    walBegin(&entries[0]);
+    image = before[0];
+    image.balance -= 250 * (Money)MONEY_SCALE;
+    walAddAccount(&entries[0], pos[0], &image);
+    image = before[1];
+    image.balance += 250 * (Money)MONEY_SCALE;
+    walAddAccount(&entries[0], pos[1], &image);
+    walBegin(&entries[1]);
+    image = before[2];
+    image.balance += 75 * (Money)MONEY_SCALE;
+    walAddAccount(&entries[1], pos[2], &image);
+    walBegin(&entries[2]);
+    image = before[0];
+    image.balance = 0;
+    walAddAccount(&entries[2], pos[0], &image);
+    Money redone[3] = {before[0].balance - 250 * (Money)MONEY_SCALE, before[1].balance + 250 * (Money)MONEY_SCALE,
+                       before[2].balance + 75 * (Money)MONEY_SCALE};
+
+    benchQuiet(1);
+    ok = selfTestWalWrite(entries, 3, sizeof(entries[2]) / 2) && openDataFiles();
+    benchQuiet(0);
+    if (ok) {
+        ok = selfTestBalances(acc_no, redone, 3, detail, sizeof(detail));
+        benchQuiet(1);
+        closeDataFiles();
+        benchQuiet(0);
+    } else {
+        snprintf(detail, sizeof(detail), "the data files did not open");
+    }
+    selfTestCheck(ok, "wal redoes complete entries and drops a torn tail", detail);
+
+    // The redone balances were synced: they are there without the WAL
+    struct stat st;
+    ok = stat(WAL_FILE, &st) != 0 || st.st_size == 0;
+    selfTestCheck(ok, "wal is empty after recovery", "entries were left in the WAL");
+
+    // A whole entry whose bytes changed after the checksum is dropped too
+    walBegin(&entries[0]);
+    image = before[1];
+    image.balance = 1;
+    walAddAccount(&entries[0], pos[1], &image);
+    benchQuiet(1);
+    ok = selfTestWalWrite(entries, 1, sizeof(entries[0]));
+    FILE *fp = ok ? fopen(WAL_FILE, "rb+") : NULL;
+    long at = (long)offsetof(struct WalEntry, updates) + (long)offsetof(struct WalUpdate, image);
+    unsigned char byte = 0;
+    ok = fp && fseek(fp, at, SEEK_SET) == 0 && fread(&byte, 1, 1, fp) == 1 && fseek(fp, at, SEEK_SET) == 0;
+    byte ^= 0x01;
+    if (ok) ok = fwrite(&byte, 1, 1, fp) == 1;
+    if (fp && fclose(fp) != 0) ok = 0;
+    ok = ok && openDataFiles();
+    benchQuiet(0);
+    if (ok) {
+        ok = selfTestBalances(acc_no, redone, 3, detail, sizeof(detail));
+        benchQuiet(1);
+        closeDataFiles();
+        benchQuiet(0);
     } else {
-        printf(YELLOW "\nNo files were backed up. Please check if the data files exist.\n" RESET);
+        snprintf(detail, sizeof(detail), "the data files did not open");
     }
+    selfTestCheck(ok, "wal drops an entry with a bad checksum", detail);
 }
 
-void manageLoanApplications() {
-    int loan_id;
-    char action;
-    int ch;
+#define SELF_TEST_ARCHIVE_RECORDS 3000
 
-    printf(BLUE "\n--- Manage Loan Applications ---\n" RESET);
-    FILE* loans_fp = fopen(LOANS_FILE, "rb+");
-    if (!loans_fp) {
-        printf(YELLOW "No loan applications file found.\n" RESET);
+// Records seen by a segment scan, by amount (each test record has its own)
+struct SelfTestSeen {
+    const struct Transaction *log;
+    unsigned char *seen;
+    long wrong;
+};
+
+static int selfTestSeenVisit(const struct Transaction *t, void *ctx) {
+    struct SelfTestSeen *s = ctx;
+    long i = (long)t->amount - 1;
+    if (i < 0 || i >= SELF_TEST_ARCHIVE_RECORDS || s->seen[i] || !selfTestSameRecord(t, &s->log[i]))
+        s->wrong++;
+    else
+        s->seen[i] = 1;
+    return 1;
+}
+
+// Runs an archive of the log up to the point where the manifest lists the
+// new segments as pending, as a crash right after txManifestSave leaves it.
+// With renamed, the first segment was also moved into place.
+static int selfTestArchiveCrash(int renamed) {
+    long start, mid, end;
+    txMonthBounds((long)time(NULL) - 70L * 24 * 60 * 60, &start, &mid);
+    txMonthBounds(mid, &mid, &end);
+    long months[2] = {start, mid};
+    struct TxSegment segs[2];
+    memset(segs, 0, sizeof(segs));
+    if (!txManifestLoad()) return 0;
+    for (int m = 0; m < 2; m++) {
+        txSegmentName(months[m], segs[m].file, sizeof(segs[m].file));
+        segs[m].pending = 1;
+    }
+    FILE *in = fopen(TRANSACTIONS_FILE, "rb");
+    int ok = in && txArchiveWriteSegments(in, SELF_TEST_ARCHIVE_RECORDS, months, 2, segs);
+    if (in) fclose(in);
+    for (int m = 0; ok && m < 2; m++) ok = txSegmentAdd(&segs[m]);
+    tx_manifest_drop = SELF_TEST_ARCHIVE_RECORDS;
+    ok = ok && txManifestSave();
+    if (ok && renamed) {
+        char tmp_path[TX_SEGMENT_NAME_MAX + 8];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", segs[0].file);
+        ok = rename(tmp_path, segs[0].file) == 0;
+    }
+    // The process is gone: only the files remain
+    txSegmentsClear();
+    tx_manifest_drop = 0;
+    return ok;
+}
+
+// An archive interrupted once its manifest was saved is finished on the next
+// start: the log is emptied and every record is in exactly one segment.
+static void selfTestArchiveRecovery(void) {
+    struct Transaction *log = calloc(SELF_TEST_ARCHIVE_RECORDS, sizeof(struct Transaction));
+    unsigned char *seen = malloc(SELF_TEST_ARCHIVE_RECORDS);
+    if (!log || !seen) {
+        selfTestCheck(0, "archive recovery", "not enough memory");
+        free(log);
+        free(seen);
         return;
     }
+    long start, mid, end;
+    txMonthBounds((long)time(NULL) - 70L * 24 * 60 * 60, &start, &mid);
+    txMonthBounds(mid, &mid, &end);
+    for (long i = 0; i < SELF_TEST_ARCHIVE_RECORDS; i++) {
+        struct Transaction *t = &log[i];
+        t->acc_no = 1 + (int)(i * 7 % 16);
+        t->type = i % 2 ? DEPOSIT : WITHDRAWAL;
+        t->amount = (Money)(i + 1);
+        t->timestamp = start + (long)((double)i / SELF_TEST_ARCHIVE_RECORDS * (end - start));
+        t->currency = currencyId("INR");
+        t->version = TRANSACTION_RECORD_VERSION;
+    }
 
-    struct Loan loan;
-    printf(BLUE "\nPending Loan Applications:\n" RESET);
-    printf(BLUE "--------------------------------------------------------\n" RESET);
-    printf(BLUE "| ID       | Account  | Amount    | Date\n" RESET);
-    printf(BLUE "--------------------------------------------------------\n" RESET);
+    for (int renamed = 0; renamed < 2; renamed++) {
+        const char *name = renamed ? "archive recovery after one segment was renamed"
+                                   : "archive recovery from a pending manifest";
+        char detail[160] = "";
+        benchQuiet(1);
+        int ok = benchGenerate(16, 0);
+        FILE *fp = ok ? fopen(TRANSACTIONS_FILE, "wb") : NULL;
+        ok = fp && fwrite(log, sizeof(struct Transaction), SELF_TEST_ARCHIVE_RECORDS, fp) == SELF_TEST_ARCHIVE_RECORDS;
+        if (fp && fclose(fp) != 0) ok = 0;
+        ok = ok && selfTestArchiveCrash(renamed) && openDataFiles();
+        benchQuiet(0);
+        if (!ok) {
+            selfTestCheck(0, name, "cannot set up or reopen the data set");
+            continue;
+        }
 
-    int foundPending = 0;
-    while(fread(&loan, sizeof(struct Loan), 1, loans_fp)) {
-        if (loan.status == PENDING) {
-            foundPending = 1;
-            char time_str[30];
-            struct tm *local_time = localtime(&loan.timestamp);
-            strftime(time_str, sizeof(time_str), "%Y-%m-%d", local_time);
-            printf("| %-8d | %-8d | %-9.2f | %s\n", loan.loan_id, loan.acc_no, loan.amount, time_str);
+        long left = fileRecordCount(TRANSACTIONS_FILE, sizeof(struct Transaction));
+        int pending = 0;
+        for (size_t i = 0; i < tx_segment_count; i++) {
+            char tmp_path[TX_SEGMENT_NAME_MAX + 8];
+            snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", tx_segments[i].file);
+            FILE *tmp = fopen(tmp_path, "rb");
+            if (tx_segments[i].pending || tmp) pending = 1;
+            if (tmp) fclose(tmp);
         }
+        memset(seen, 0, SELF_TEST_ARCHIVE_RECORDS);
+        struct SelfTestSeen s = {log, seen, 0};
+        struct TxArchiveQuery all = {0, 0, 0, TX_COL_ALL};
+        int segments_read = 0;
+        long scanned = transactionSegmentsScan(&all, selfTestSeenVisit, &s, &segments_read);
+        long missing = 0;
+        for (long i = 0; i < SELF_TEST_ARCHIVE_RECORDS; i++) missing += !seen[i];
+        benchQuiet(1);
+        closeDataFiles();
+        benchQuiet(0);
+
+        ok = left == 0 && !pending && tx_segment_count == 2 && scanned == SELF_TEST_ARCHIVE_RECORDS && s.wrong == 0 &&
+             missing == 0;
+        snprintf(detail, sizeof(detail), "%ld left in the log, %zu segment(s)%s, %ld missing, %ld extra or changed",
+                 left, tx_segment_count, pending ? " still pending" : "", missing, s.wrong);
+        selfTestCheck(ok, name, detail);
     }
-    printf(BLUE "--------------------------------------------------------\n" RESET);
+    free(log);
+    free(seen);
+}
 
-    if (!foundPending) {
-        printf(YELLOW "No pending loan applications found.\n" RESET);
-        fclose(loans_fp);
-        return;
+#define SELF_TEST_BACKUP_DIR "restored"
+
+// 1 if the two files hold the same bytes
+static int selfTestSameFile(const char *a, const char *b) {
+    FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+    unsigned char ba[4096], bb[4096];
+    int same = fa && fb;
+    while (same) {
+        size_t na = fread(ba, 1, sizeof(ba), fa), nb = fread(bb, 1, sizeof(bb), fb);
+        same = na == nb && memcmp(ba, bb, na) == 0;
+        if (na < sizeof(ba)) break;
     }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return same;
+}
 
-    printf(GREEN "\nEnter Loan ID to approve/reject: " RESET);
-    if (scanf("%d", &loan_id) != 1) {
-        printf(RED "Invalid input.\n" RESET);
-        flush_stdin();
-        fclose(loans_fp);
-        return;
+// Restores the backup into dir and compares every file in it with the live
+// one. *files receives how many were compared.
+static int selfTestRestoreMatches(const char *dir, int *files, char *detail, size_t size) {
+    struct BackupManifest m;
+    benchQuiet(1);
+    int ok = restoreBackup(dir) && backupManifestLoad(&m);
+    benchQuiet(0);
+    *files = 0;
+    if (!ok) {
+        snprintf(detail, size, "the restore failed");
+        return 0;
     }
-    
-    printf(GREEN "Approve or Reject? (A/R): " RESET);
-    flush_stdin();
-    action = getchar();
-    if (action == '\n') action = getchar();
-    action = toupper(action);
+    for (size_t i = 0; ok && i < m.count; i++) {
+        int seen = 0;
+        for (size_t k = 0; k < i && !seen; k++) seen = strcmp(m.entries[k].source, m.entries[i].source) == 0;
+        if (seen) continue;
+        char path[BACKUP_PATH_MAX + TX_SEGMENT_NAME_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, m.entries[i].source);
+        ok = selfTestSameFile(m.entries[i].source, path);
+        if (!ok) snprintf(detail, size, "restored %s differs from the live file", m.entries[i].source);
+        (*files)++;
+    }
+    free(m.entries);
+    return ok;
+}
 
-    rewind(loans_fp);
-    foundPending = 0;
-    while(fread(&loan, sizeof(struct Loan), 1, loans_fp)) {
-        if (loan.loan_id == loan_id && loan.status == PENDING) {
-            foundPending = 1;
-            long loanPos = ftell(loans_fp) - sizeof(struct Loan);
-
-            if (action == 'A') {
-                loan.status = APPROVED;
-                FILE* accounts_fp = fopen(ACCOUNTS_FILE, "rb+");
-                if (accounts_fp) {
-                    struct Account acc;
-                    long accountPos = 0;
-                    while (fread(&acc, sizeof(struct Account), 1, accounts_fp)) {
-                        if (acc.acc_no == loan.acc_no) {
-                            accountPos = ftell(accounts_fp) - sizeof(struct Account);
-                            acc.balance += loan.amount;
-                            fseek(accounts_fp, accountPos, SEEK_SET);
-                            fwrite(&acc, sizeof(struct Account), 1, accounts_fp);
-                            fflush(accounts_fp);
-                            break;
-                        }
-                    }
-                    fclose(accounts_fp);
-                }
-                logTransaction(loan.acc_no, LOAN_APPROVED, loan.amount, 0, "N/A");
-                printf(GREEN "Loan ID %d for account %d has been approved. Amount credited to account.\n" RESET, loan_id, loan.acc_no);
+// Flips one byte of a backup piece in place (twice puts it back)
+static int selfTestFlipByte(const char *piece, long at) {
+    char path[BACKUP_PATH_MAX];
+    backupPath(path, sizeof(path), piece);
+    FILE *fp = fopen(path, "rb+");
+    unsigned char byte = 0;
+    int ok = fp && fseek(fp, at, SEEK_SET) == 0 && fread(&byte, 1, 1, fp) == 1 && fseek(fp, at, SEEK_SET) == 0;
+    byte ^= 0x40;
+    if (ok) ok = fwrite(&byte, 1, 1, fp) == 1;
+    if (fp && fclose(fp) != 0) ok = 0;
+    return ok;
+}
 
-            } else if (action == 'R') {
-                loan.status = REJECTED;
-                logTransaction(loan.acc_no, LOAN_REJECTED, 0, 0, "N/A");
-                printf(YELLOW "Loan ID %d for account %d has been rejected.\n" RESET, loan_id, loan.acc_no);
-            } else {
-                printf(RED "Invalid action. Loan status remains unchanged.\n" RESET);
-                break;
-            }
-            
-            fseek(loans_fp, loanPos, SEEK_SET);
-            fwrite(&loan, sizeof(struct Loan), 1, loans_fp);
-            fflush(loans_fp);
-            break;
-        }
+// A full backup, deposits, then an incremental one (changed blocks of the
+// accounts, new log records) must restore to the live bytes. A flipped byte
+// in a piece's data, or in its index, must make the restore fail for that
+// file instead of writing it.
+static void selfTestBackupRoundTrip(void) {
+    char detail[160] = "";
+    benchQuiet(1);
+    int opened = benchGenerate(3000, 20000) && openDataFiles();
+    int ok = opened && createAutomatedBackup();
+    for (int i = 0; ok && i < 40; i++) ok = depositFunds(1 + i * 73, (Money)(i + 1) * MONEY_SCALE, NULL) == OP_OK;
+    ok = ok && createAutomatedBackup();
+    benchQuiet(0);
+    if (!ok) {
+        benchQuiet(1);
+        if (opened) closeDataFiles();
+        benchQuiet(0);
+        selfTestCheck(0, "backup round trip", "cannot create the data set or its backups");
+        return;
     }
 
-    if (!foundPending) {
-        printf(RED "Loan ID %d not found or is not pending.\n" RESET, loan_id);
+    // The second run must have been incremental for the check to mean anything
+    struct BackupManifest m;
+    const struct BackupEntry *full = NULL, *tail = NULL;
+    int delta = 0;
+    ok = backupManifestLoad(&m);
+    for (size_t i = 0; ok && i < m.count; i++) {
+        const struct BackupEntry *e = &m.entries[i];
+        if (strcmp(e->source, ACCOUNTS_FILE) == 0 && strcmp(e->kind, "full") == 0) full = e;
+        if (strcmp(e->source, ACCOUNTS_FILE) == 0 && strcmp(e->kind, "delta") == 0) delta = 1;
+        if (strcmp(e->source, TRANSACTIONS_FILE) == 0 && strcmp(e->kind, "tail") == 0) tail = e;
     }
-    
-    fclose(loans_fp);
+    int files = 0;
+    ok = ok && full && delta && tail;
+    if (ok)
+        ok = selfTestRestoreMatches(SELF_TEST_BACKUP_DIR, &files, detail, sizeof(detail));
+    else
+        snprintf(detail, sizeof(detail), "the second backup wrote no delta of %s or tail of %s", ACCOUNTS_FILE,
+                 TRANSACTIONS_FILE);
+    selfTestCheck(ok, "backup full, delta and tail pieces restore to the live bytes", detail);
+
+    // Extent data of the tail piece, then the index of the full piece
+    for (int where = 0; ok && where < 2; where++) {
+        const struct BackupEntry *e = where == 0 ? tail : full;
+        char path[BACKUP_PATH_MAX];
+        backupPath(path, sizeof(path), e->piece);
+        FILE *fp = fopen(path, "rb");
+        long at = fp ? backupFileSize(fp) : -1;
+        if (fp) fclose(fp);
+        at = where == 0 ? 0 : at - (long)sizeof(struct BackupPieceTrailer) - 1;
+        char target[BACKUP_PATH_MAX + TX_SEGMENT_NAME_MAX];
+        snprintf(target, sizeof(target), "%s/%s", SELF_TEST_BACKUP_DIR, e->source);
+        remove(target);
+        int flipped = at >= 0 && selfTestFlipByte(e->piece, at);
+        int restored = 0;
+        benchQuiet(1);
+        if (flipped) restored = restoreBackup(SELF_TEST_BACKUP_DIR);
+        benchQuiet(0);
+        FILE *written = fopen(target, "rb");
+        int detected = flipped && !restored && !written;
+        if (written) fclose(written);
+        if (flipped && !selfTestFlipByte(e->piece, at)) detected = 0;
+        snprintf(detail, sizeof(detail), "%s", !flipped ? "cannot change the piece"
+                                              : restored ? "the restore succeeded"
+                                                         : "the damaged file was left in the restore directory");
+        selfTestCheck(detected, where == 0 ? "backup restore detects a damaged extent"
+                                           : "backup restore detects a damaged index", detail);
+    }
+    free(m.entries);
+    benchQuiet(1);
+    closeDataFiles();
+    benchQuiet(0);
+}
+
+int runSelfTests(const char *dir) {
+    if ((MKDIR(dir) == -1 && errno != EEXIST) || CHDIR(dir) != 0) {
+        printf(RED "Cannot use self-test directory %s.\n" RESET, dir);
+        return 0;
+    }
+    self_test_failures = 0;
+    selfTestSha256();
+    selfTestCodec();
+    selfTestInterestKernel();
+    selfTestWalRecovery();
+    selfTestArchiveRecovery();
+    selfTestBackupRoundTrip();
+
+    if (self_test_failures)
+        printf(RED "\n%d check(s) failed.\n" RESET, self_test_failures);
+    else
+        printf(GREEN "\nAll checks passed.\n" RESET);
+    return self_test_failures == 0;
 }
 
 // =========================================================================
@@ -1779,7 +10779,9 @@ void userMenu() {
         printf(YELLOW "5. View Transaction History\n" RESET);
         printf(YELLOW "6. Apply for Loan\n" RESET);
         printf(YELLOW "7. Loan Repayment\n" RESET);
-        printf(YELLOW "8. Exit to Main Menu\n" RESET);
+        printf(YELLOW "8. Account Statement\n" RESET);
+        printf(YELLOW "9. View Loan Schedule\n" RESET);
+        printf(YELLOW "10. Exit to Main Menu\n" RESET);
         printf(GREEN "Enter your choice: " RESET);
 
         if (scanf("%d", &choice) != 1) {
@@ -1811,17 +10813,28 @@ void userMenu() {
                 loanRepayment();
                 break;
             case 8:
+                generateAccountStatement();
+                break;
+            case 9:
+                viewLoanSchedule();
+                break;
+            case 10:
+                sessionClose(customer_session);
+                customer_session = 0;
                 printf(GREEN "Exiting user menu...\n" RESET);
                 break;
             default:
                 printf(RED "Invalid choice!\n" RESET);
         }
-        if (choice != 8) {
+        transactionLogFlush();
+        compactionPoll(0);
+        transactionLogRollPoll();
+        if (choice != 10) {
             printf(YELLOW "\nPress Enter to continue..." RESET);
             flush_stdin();
             getchar();
         }
-    } while (choice != 8);
+    } while (choice != 10);
 }
 
 void adminMenu() {
@@ -1837,8 +10850,13 @@ void adminMenu() {
 
         printf(YELLOW "6. Process Scheduled Interest\n" RESET);
         printf(YELLOW "7. View Interest Log\n" RESET);
+        printf(YELLOW "8. View Bank Totals\n" RESET);
+        printf(YELLOW "9. Archive Transaction Log\n" RESET);
+        printf(YELLOW "10. Manage Loan Applications\n" RESET);
+        printf(YELLOW "11. Bulk Loan Decisions\n" RESET);
+        printf(YELLOW "12. Month-End Statements\n" RESET);
 
-        printf(YELLOW "8. Exit to Main Menu\n" RESET);
+        printf(YELLOW "13. Exit to Main Menu\n" RESET);
         printf(GREEN "Enter your choice: " RESET);
 
         if (scanf("%d", &choice) != 1) {
@@ -1866,33 +10884,163 @@ void adminMenu() {
             case 6:
 
                 processScheduledInterest();
+                processLoanInterest();
                 break;
             case 7:
                 viewInterestLog();
 
                 break;
             case 8:
+                viewBankTotals();
+                break;
+            case 9:
+                archiveTransactionsMenu();
+                break;
+            case 10:
+                manageLoanApplications();
+                break;
+            case 11:
+                bulkLoanDecisions();
+                break;
+            case 12:
+                monthEndStatementsMenu();
+                break;
+            case 13:
                 printf(GREEN "Exiting admin menu...\n" RESET);
                 break;
             default:
                 printf(RED "Invalid choice!\n" RESET);
         }
-        if (choice != 8) {
+        transactionLogFlush();
+        compactionPoll(0);
+        transactionLogRollPoll();
+        if (choice != 13) {
             printf(YELLOW "\nPress Enter to continue..." RESET);
             flush_stdin();
             getchar();
         }
-    } while (choice != 8);
+    } while (choice != 13);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     srand((unsigned int)time(NULL));
+    const char *batch_file = NULL;
+    int run_server = 0;
+    int server_port = SERVER_DEFAULT_PORT;
+    int server_workers = 0;
+    int run_bench = 0;
+    const char *bench_scales = BENCH_DEFAULT_SCALES;
+    int bench_ops = BENCH_DEFAULT_OPS;
+    const char *bench_dir = BENCH_DEFAULT_DIR;
+    int run_self_test = 0;
+    const char *self_test_dir = SELF_TEST_DEFAULT_DIR;
+    int run_backup = 0;
+    const char *restore_dir = NULL;
+    int run_statements = 0;
+    const char *statement_month = "";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mmap") == 0) {
+            account_store_use_mmap = 1;
+        } else if (strcmp(argv[i], "--sync-every") == 0 && i + 1 < argc) {
+            account_store_sync_every = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-group") == 0 && i + 1 < argc) {
+            transaction_log_group_records = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log-group-ms") == 0 && i + 1 < argc) {
+            transaction_log_group_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--interest-workers") == 0 && i + 1 < argc) {
+            interest_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--compact-ratio") == 0 && i + 1 < argc) {
+            compaction_dead_ratio = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_file = argv[++i];
+        } else if (strcmp(argv[i], "--server") == 0) {
+            run_server = 1;
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            server_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            server_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--backup") == 0) {
+            run_backup = 1;
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_dir = argv[++i];
+        } else if (strcmp(argv[i], "--backup-workers") == 0 && i + 1 < argc) {
+            backup_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--statements") == 0) {
+            run_statements = 1;
+        } else if (strcmp(argv[i], "--statement-month") == 0 && i + 1 < argc) {
+            statement_month = argv[++i];
+        } else if (strcmp(argv[i], "--statement-workers") == 0 && i + 1 < argc) {
+            statement_workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sha256-engine") == 0 && i + 1 < argc) {
+            sha256_engine = sha256EngineFromName(argv[++i]);
+            if (sha256_engine < 0) {
+                printf(RED "Unknown SHA-256 engine: %s (auto, scalar, sse2, avx2, shani)\n" RESET, argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            run_bench = 1;
+        } else if (strcmp(argv[i], "--bench-scales") == 0 && i + 1 < argc) {
+            bench_scales = argv[++i];
+        } else if (strcmp(argv[i], "--bench-ops") == 0 && i + 1 < argc) {
+            bench_ops = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-dir") == 0 && i + 1 < argc) {
+            bench_dir = argv[++i];
+        } else if (strcmp(argv[i], "--self-test") == 0) {
+            run_self_test = 1;
+        } else if (strcmp(argv[i], "--self-test-dir") == 0 && i + 1 < argc) {
+            self_test_dir = argv[++i];
+        } else {
+            printf(RED "Unknown option: %s\n" RESET, argv[i]);
+            printf("Usage: %s [--mmap] [--sync-every N] [--log-group N] [--log-group-ms T] [--compact-ratio R]\n"
+                   "          [--interest-workers N] [--sha256-engine E] [--batch FILE]\n"
+                   "       %s --server [--port N] [--workers N]\n"
+                   "       %s --backup | --restore DIR [--backup-workers N]\n"
+                   "       %s --statements [--statement-month YYYY-MM] [--statement-workers N]\n"
+                   "       %s --bench [--bench-scales N[:M],...] [--bench-ops K] [--bench-dir DIR]\n"
+                   "       %s --self-test [--self-test-dir DIR]\n",
+                   argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
 
-    
-    // Initialize last interest dates for existing accounts
-    initializeLastInterestDate();
+    if (run_bench) {
+        return runBenchmark(bench_scales, bench_ops, bench_dir) ? 0 : 1;
+    }
+    if (run_self_test) {
+        return runSelfTests(self_test_dir) ? 0 : 1;
+    }
+    // Restoring only reads BACKUP_DIR, so it does not open the data files
+    if (restore_dir) {
+        return restoreBackup(restore_dir) ? 0 : 1;
+    }
+
+    if (!openDataFiles()) {
+        printf(RED "Exiting.\n" RESET);
+        return 1;
+    }
 
+    if (run_backup) {
+        int ok = createAutomatedBackup();
+        closeDataFiles();
+        return ok ? 0 : 1;
+    }
+    if (run_statements) {
+        int ok = monthEndStatements(statement_month);
+        closeDataFiles();
+        return ok ? 0 : 1;
+    }
+    if (batch_file) {
+        int ok = runBatch(batch_file);
+        closeDataFiles();
+        return ok ? 0 : 1;
+    }
+    if (run_server) {
+        int ok = runServer(server_port, server_workers);
+        closeDataFiles();
+        return ok ? 0 : 1;
+    }
 
     if (!adminInitIfNeeded()) {
         printf(RED "Failed to initialize admin credentials. Exiting.\n" RESET);
@@ -1945,5 +11093,6 @@ int main()
         }
     } while (choice != 3);
 
+    closeDataFiles();
     return 0;
 }